@@ -2,6 +2,7 @@
 """
 setup.py file for pylibmmal
 """
+import os
 import glob
 import platform
 from setuptools import setup, Extension
@@ -18,20 +19,34 @@ else:
     raise Exception('Unable to find _VERSION_ in {}'.format(VER_FILE))
 
 
-if not platform.machine().startswith('arm'):
-    raise Exception('{} only support raspberry'.format(NAME))
+# PYLIBMMAL_STUB=1 builds against tests/stub instead of /opt/vc, so it runs on any linux box
+STUB = os.environ.get('PYLIBMMAL_STUB', '0') not in ('', '0')
+
+# PYLIBMMAL_TRACE=0 compiles the MMAL/VCHI call tracer out, pylibmmal.trace_enable() then raises
+MACROS = [] if os.environ.get('PYLIBMMAL_TRACE', '1') not in ('', '0') else [('PYLIBMMAL_NO_TRACE', None)]
+
+
+if not STUB and not platform.machine().startswith('arm'):
+    raise Exception('{} only support raspberry, set PYLIBMMAL_STUB=1 to build the stub backend'.format(NAME))
 
 
 if platform.system().lower() != 'linux':
     raise Exception('{} only support linux'.format(NAME))
 
 
-pylibmmal_module = Extension(NAME,
-                             sources=glob.glob('src/*.c'),
-                             library_dirs=['/opt/vc/lib'],
-                             libraries=['bcm_host', 'mmal', 'mmal_util', 'mmal_core'],
-                             include_dirs=['/opt/vc/include', '/opt/vc/include/interface/mmal'])
-
+if STUB:
+    pylibmmal_module = Extension(NAME,
+                                 sources=glob.glob('src/*.c') + glob.glob('tests/stub/*.c'),
+                                 libraries=['pthread'],
+                                 define_macros=MACROS,
+                                 include_dirs=['tests/stub', 'tests/stub/include', 'tests/stub/include/interface/mmal'])
+else:
+    pylibmmal_module = Extension(NAME,
+                                 sources=glob.glob('src/*.c'),
+                                 library_dirs=['/opt/vc/lib'],
+                                 libraries=['bcm_host', 'mmal', 'mmal_util', 'mmal_core', 'pthread'],
+                                 define_macros=MACROS,
+                                 include_dirs=['/opt/vc/include', '/opt/vc/include/interface/mmal'])
 
 setup(
     name=NAME,
@@ -44,7 +59,6 @@ setup(
     ext_modules=[pylibmmal_module],
     classifiers=[
         'Programming Language :: Python',
-        'Programming Language :: Python :: 2',
         'Programming Language :: Python :: 3',
     ],
 )
@@ -15,4 +15,18 @@ void define_constants(PyObject *module) {
 
 	PyObject *dmt = Py_BuildValue("s", HDMI_DMT);
 	PyModule_AddObject(module, "DMT", dmt);
+
+	PyModule_AddStringConstant(module, "EVENT_EOS", EVENT_EOS);
+	PyModule_AddStringConstant(module, "EVENT_ERROR", EVENT_ERROR);
+	PyModule_AddStringConstant(module, "EVENT_FORMAT_CHANGED", EVENT_FORMAT_CHANGED);
+	PyModule_AddStringConstant(module, "EVENT_PARAMETER_CHANGED", EVENT_PARAMETER_CHANGED);
+	PyModule_AddStringConstant(module, "TV_EVENT_UNPLUGGED", TV_EVENT_UNPLUGGED);
+	PyModule_AddStringConstant(module, "TV_EVENT_ATTACHED", TV_EVENT_ATTACHED);
+	PyModule_AddStringConstant(module, "TV_EVENT_DVI", TV_EVENT_DVI);
+	PyModule_AddStringConstant(module, "TV_EVENT_HDMI", TV_EVENT_HDMI);
+	PyModule_AddStringConstant(module, "TV_EVENT_CHANGING_MODE", TV_EVENT_CHANGING_MODE);
+	PyModule_AddStringConstant(module, "TV_EVENT_HDCP_AUTH", TV_EVENT_HDCP_AUTH);
+	PyModule_AddStringConstant(module, "TV_EVENT_HDCP_UNAUTH", TV_EVENT_HDCP_UNAUTH);
+	PyModule_AddStringConstant(module, "TV_EVENT_SDTV_UNPLUGGED", TV_EVENT_SDTV_UNPLUGGED);
+	PyModule_AddStringConstant(module, "TV_EVENT_SDTV_ATTACHED", TV_EVENT_SDTV_ATTACHED);
 }
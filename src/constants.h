@@ -4,6 +4,19 @@
 #define HDMI 5
 #define HDMI_CEA "CEA"
 #define HDMI_DMT "DMT"
+#define EVENT_EOS "eos"
+#define EVENT_ERROR "error"
+#define EVENT_FORMAT_CHANGED "format_changed"
+#define EVENT_PARAMETER_CHANGED "parameter_changed"
+#define TV_EVENT_UNPLUGGED "unplugged"
+#define TV_EVENT_ATTACHED "attached"
+#define TV_EVENT_DVI "dvi"
+#define TV_EVENT_HDMI "hdmi"
+#define TV_EVENT_CHANGING_MODE "changing_mode"
+#define TV_EVENT_HDCP_AUTH "hdcp_auth"
+#define TV_EVENT_HDCP_UNAUTH "hdcp_unauth"
+#define TV_EVENT_SDTV_UNPLUGGED "sdtv_unplugged"
+#define TV_EVENT_SDTV_ATTACHED "sdtv_attached"
 
 
 void define_constants(PyObject *module);
@@ -0,0 +1,150 @@
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "event_queue.h"
+
+
+/* Monotonic clock in microseconds, comparable with Python time.monotonic() */
+static uint64_t monotonic_us(void) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+
+int event_queue_init(EventQueue *queue) {
+
+	uint32_t i;
+
+	memset(queue, 0, sizeof(EventQueue));
+
+	for (i = 0; i < EVENT_QUEUE_SIZE; i++) {
+
+		queue->slots[i].seq = i;
+	}
+
+	if ((queue->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void event_queue_destroy(EventQueue *queue) {
+
+	if (queue->fd >= 0) {
+
+		close(queue->fd);
+		queue->fd = -1;
+	}
+}
+
+
+/* Push an event and signal fd, never blocks, returns -1 and counts a drop when full */
+int event_queue_push(EventQueue *queue, uint32_t type, uint32_t param1, uint32_t param2, const char *source) {
+
+	int32_t diff;
+	QueueSlot *slot;
+	uint64_t one = 1;
+	uint32_t seq, pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+	for (;;) {
+
+		slot = &queue->slots[pos % EVENT_QUEUE_SIZE];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (int32_t)(seq - pos);
+
+		if (diff == 0) {
+
+			if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+
+				break;
+			}
+		}
+		else if (diff < 0) {
+
+			__atomic_add_fetch(&queue->dropped, 1, __ATOMIC_RELAXED);
+			return -1;
+		}
+		else {
+
+			pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->event.type = type;
+	slot->event.param1 = param1;
+	slot->event.param2 = param2;
+	slot->event.timestamp = monotonic_us();
+	strncpy(slot->event.source, source ? source : "", EVENT_SOURCE_LEN - 1);
+	slot->event.source[EVENT_SOURCE_LEN - 1] = 0;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	/* Wake up readers, a full counter still leaves fd readable */
+	if (write(queue->fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Pop an event, returns -1 when queue is empty */
+int event_queue_pop(EventQueue *queue, QueueEvent *event) {
+
+	int32_t diff;
+	QueueSlot *slot;
+	uint32_t seq, pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+
+	for (;;) {
+
+		slot = &queue->slots[pos % EVENT_QUEUE_SIZE];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (int32_t)(seq - (pos + 1));
+
+		if (diff == 0) {
+
+			if (__atomic_compare_exchange_n(&queue->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+
+				break;
+			}
+		}
+		else if (diff < 0) {
+
+			return -1;
+		}
+		else {
+
+			pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	*event = slot->event;
+	__atomic_store_n(&slot->seq, pos + EVENT_QUEUE_SIZE, __ATOMIC_RELEASE);
+	return 0;
+}
+
+
+/* Reset fd readiness, call before draining so no wakeup is lost */
+void event_queue_clear_fd(EventQueue *queue) {
+
+	uint64_t count;
+
+	if (read(queue->fd, &count, sizeof(count)) < 0) {
+
+		return;
+	}
+}
+
+
+double event_queue_seconds(uint64_t timestamp) {
+
+	return timestamp / 1000000.0;
+}
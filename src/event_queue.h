@@ -0,0 +1,37 @@
+#ifndef _EVENT_QUEUE_H_
+#define _EVENT_QUEUE_H_
+
+#include <stdint.h>
+
+#define EVENT_QUEUE_SIZE 64
+#define EVENT_SOURCE_LEN 48
+
+typedef struct {
+	uint32_t type;
+	uint32_t param1;
+	uint32_t param2;
+	uint64_t timestamp;
+	char source[EVENT_SOURCE_LEN];
+} QueueEvent;
+
+typedef struct {
+	uint32_t seq;
+	QueueEvent event;
+} QueueSlot;
+
+/* Bounded lock-free queue, producers may run on any thread, readers wait on fd */
+typedef struct {
+	int fd;
+	uint32_t dropped;
+	uint32_t head, tail;
+	QueueSlot slots[EVENT_QUEUE_SIZE];
+} EventQueue;
+
+int event_queue_init(EventQueue *queue);
+void event_queue_destroy(EventQueue *queue);
+int event_queue_push(EventQueue *queue, uint32_t type, uint32_t param1, uint32_t param2, const char *source);
+int event_queue_pop(EventQueue *queue, QueueEvent *event);
+void event_queue_clear_fd(EventQueue *queue);
+double event_queue_seconds(uint64_t timestamp);
+
+#endif
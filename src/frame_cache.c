@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "frame_cache.h"
+
+
+void frame_cache_init(FrameCache *cache, size_t budget) {
+
+	memset(cache, 0, sizeof(FrameCache));
+	cache->budget = budget;
+}
+
+
+void frame_cache_entry_free(FrameCacheEntry *entry) {
+
+	if (entry) {
+
+		free(entry->uri);
+		free(entry->data);
+		free(entry);
+	}
+}
+
+
+static void frame_cache_unlink(FrameCache *cache, FrameCacheEntry *entry) {
+
+	if (entry->prev) {
+
+		entry->prev->next = entry->next;
+	}
+	else {
+
+		cache->head = entry->next;
+	}
+
+	if (entry->next) {
+
+		entry->next->prev = entry->prev;
+	}
+	else {
+
+		cache->tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+}
+
+
+static void frame_cache_push_front(FrameCache *cache, FrameCacheEntry *entry) {
+
+	entry->prev = NULL;
+	entry->next = cache->head;
+
+	if (cache->head) {
+
+		cache->head->prev = entry;
+	}
+	else {
+
+		cache->tail = entry;
+	}
+
+	cache->head = entry;
+}
+
+
+static void frame_cache_remove(FrameCache *cache, FrameCacheEntry *entry) {
+
+	frame_cache_unlink(cache, entry);
+	cache->used -= entry->length;
+	cache->count--;
+	frame_cache_entry_free(entry);
+}
+
+
+/* Drop every entry, counters are kept */
+void frame_cache_clear(FrameCache *cache) {
+
+	while (cache->head) {
+
+		frame_cache_remove(cache, cache->head);
+	}
+}
+
+
+/* Only regular files can be cached, anything else (network streams, devices) returns -1 */
+int frame_cache_key(const char *uri, FrameCacheKey *key) {
+
+	struct stat st;
+
+	if (stat(uri, &st) != 0 || !S_ISREG(st.st_mode)) {
+
+		return -1;
+	}
+
+	key->size = st.st_size;
+	key->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	return 0;
+}
+
+
+/* Entry for uri as it is now, a changed file drops the stale entry. Counts a hit or a miss */
+FrameCacheEntry *frame_cache_lookup(FrameCache *cache, const char *uri, const FrameCacheKey *key) {
+
+	FrameCacheEntry *entry;
+
+	for (entry = cache->head; entry && strcmp(entry->uri, uri) != 0; entry = entry->next);
+
+	if (entry && (entry->key.size != key->size || entry->key.mtime_ns != key->mtime_ns)) {
+
+		frame_cache_remove(cache, entry);
+		entry = NULL;
+	}
+
+	if (entry == NULL) {
+
+		cache->misses++;
+		return NULL;
+	}
+
+	frame_cache_unlink(cache, entry);
+	frame_cache_push_front(cache, entry);
+	cache->hits++;
+	return entry;
+}
+
+
+/* Take ownership of entry, least recently used entries are evicted until it fits.
+   An entry larger than the whole budget is freed and -1 returned */
+int frame_cache_insert(FrameCache *cache, FrameCacheEntry *entry) {
+
+	FrameCacheEntry *old;
+
+	if (entry->length > cache->budget) {
+
+		frame_cache_entry_free(entry);
+		return -1;
+	}
+
+	for (old = cache->head; old && strcmp(old->uri, entry->uri) != 0; old = old->next);
+
+	if (old) {
+
+		frame_cache_remove(cache, old);
+	}
+
+	while (cache->used + entry->length > cache->budget && cache->tail) {
+
+		frame_cache_remove(cache, cache->tail);
+		cache->evictions++;
+	}
+
+	frame_cache_push_front(cache, entry);
+	cache->used += entry->length;
+	cache->count++;
+	return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef _FRAME_CACHE_H_
+#define _FRAME_CACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mmal.h>
+
+/* A file is identified by its uri and the size and modification time it had when it was decoded */
+typedef struct {
+	int64_t size;
+	int64_t mtime_ns;
+} FrameCacheKey;
+
+/* Decoded picture in host memory, format is what the decoder (or resizer) output port had */
+typedef struct FrameCacheEntry {
+	struct FrameCacheEntry *prev, *next;
+	char *uri;
+	FrameCacheKey key;
+	uint32_t encoding;
+	MMAL_VIDEO_FORMAT_T video;
+	uint8_t *data;
+	uint32_t length;
+} FrameCacheEntry;
+
+/* LRU list, head is the most recently used entry. Not locked, the owner serialises access */
+typedef struct {
+	size_t budget, used;
+	uint32_t count;
+	uint64_t hits, misses, evictions;
+	FrameCacheEntry *head, *tail;
+} FrameCache;
+
+void frame_cache_init(FrameCache *cache, size_t budget);
+void frame_cache_clear(FrameCache *cache);
+int frame_cache_key(const char *uri, FrameCacheKey *key);
+FrameCacheEntry *frame_cache_lookup(FrameCache *cache, const char *uri, const FrameCacheKey *key);
+int frame_cache_insert(FrameCache *cache, FrameCacheEntry *entry);
+void frame_cache_entry_free(FrameCacheEntry *entry);
+
+#endif
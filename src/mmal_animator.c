@@ -0,0 +1,276 @@
+#include <time.h>
+#include <string.h>
+#include <interface/vcos/vcos.h>
+#include "mmal_animator.h"
+#include "vc_connection.h"
+#include "trace.h"
+
+/* Step anyway when a display produces no vsync, e.g. while it is powered off */
+#define ANIMATOR_VSYNC_TIMEOUT_MS 100
+
+
+static void animator_deadline(struct timespec *deadline, uint32_t timeout_ms) {
+
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_sec += timeout_ms / 1000;
+	deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+
+	if (deadline->tv_nsec >= 1000000000L) {
+
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+
+void animator_init(RegionAnimator *animator) {
+
+	memset(animator, 0, sizeof(RegionAnimator));
+	pthread_mutex_init(&animator->lock, NULL);
+	pthread_cond_init(&animator->vsync, NULL);
+	pthread_cond_init(&animator->done, NULL);
+}
+
+
+void animator_destroy(RegionAnimator *animator) {
+
+	animator_stop(animator);
+	pthread_cond_destroy(&animator->done);
+	pthread_cond_destroy(&animator->vsync);
+	pthread_mutex_destroy(&animator->lock);
+}
+
+
+/* Runs on the dispmanx callback thread, only wakes the animator */
+static void animator_vsync_cb(void *data) {
+
+	RegionAnimator *animator = data;
+
+	pthread_mutex_lock(&animator->lock);
+	animator->vsyncs++;
+	pthread_cond_signal(&animator->vsync);
+	pthread_mutex_unlock(&animator->lock);
+}
+
+
+static int32_t animator_lerp(int32_t from, int32_t to, double t) {
+
+	return from + (int32_t)((to - from) * t + (to >= from ? 0.5 : -0.5));
+}
+
+
+/* Apply the state at progress t, 0 <= t <= 1 */
+static void animator_step(RegionAnimator *animator, double t) {
+
+	uint32_t i;
+	GraphError err;
+	MMAL_DISPLAYREGION_T step;
+	MmalPipeline *pipeline = animator->pipeline;
+
+	if (animator->set & MMAL_DISPLAY_SET_ALPHA) {
+
+		memset(&step, 0, sizeof(step));
+		step.set = MMAL_DISPLAY_SET_ALPHA;
+		step.alpha = animator_lerp(animator->from_alpha, animator->to_alpha, t);
+		pipeline_set_region(pipeline, -1, &step, &err);
+	}
+
+	if (animator->set & MMAL_DISPLAY_SET_DEST_RECT) {
+
+		for (i = 0; i < pipeline->output_count; i++) {
+
+			if (animator->output >= 0 && (uint32_t)animator->output != i) {
+
+				continue;
+			}
+
+			memset(&step, 0, sizeof(step));
+			step.set = MMAL_DISPLAY_SET_DEST_RECT | MMAL_DISPLAY_SET_FULLSCREEN;
+			step.fullscreen = MMAL_FALSE;
+			step.dest_rect.x = animator_lerp(animator->from_rect[i].x, animator->to_rect.x, t);
+			step.dest_rect.y = animator_lerp(animator->from_rect[i].y, animator->to_rect.y, t);
+			step.dest_rect.width = animator_lerp(animator->from_rect[i].width, animator->to_rect.width, t);
+			step.dest_rect.height = animator_lerp(animator->from_rect[i].height, animator->to_rect.height, t);
+			pipeline_set_region(pipeline, i, &step, &err);
+		}
+	}
+}
+
+
+static void *animator_thread(void *arg) {
+
+	double t = 0.0;
+	uint32_t seen = 0;
+	struct timespec deadline;
+	RegionAnimator *animator = arg;
+
+	pthread_mutex_lock(&animator->lock);
+
+	while (!animator->stop && t < 1.0) {
+
+		animator_deadline(&deadline, ANIMATOR_VSYNC_TIMEOUT_MS);
+
+		while (!animator->stop && animator->vsyncs == seen) {
+
+			if (pthread_cond_timedwait(&animator->vsync, &animator->lock, &deadline) != 0) {
+
+				break;
+			}
+		}
+
+		seen = animator->vsyncs;
+
+		if (animator->stop) {
+
+			break;
+		}
+
+		pthread_mutex_unlock(&animator->lock);
+
+		t = animator->duration_us ? (double)(vcos_getmicrosecs64() - animator->start_us) / animator->duration_us : 1.0;
+		animator_step(animator, t > 1.0 ? 1.0 : t);
+
+		pthread_mutex_lock(&animator->lock);
+	}
+
+	animator->running = 0;
+	pthread_cond_broadcast(&animator->done);
+	pthread_mutex_unlock(&animator->lock);
+
+	vc_vsync_remove_listener(animator_vsync_cb, animator);
+	return NULL;
+}
+
+
+/* Current dest_rect of output, the full display when the renderer is fullscreen */
+static void animator_current_rect(MMAL_DISPLAYREGION_T *region, MMAL_RECT_T *rect) {
+
+	DISPMANX_MODEINFO_T info;
+	DISPMANX_DISPLAY_HANDLE_T display;
+
+	if ((region->set & MMAL_DISPLAY_SET_DEST_RECT) && !((region->set & MMAL_DISPLAY_SET_FULLSCREEN) && region->fullscreen)) {
+
+		*rect = region->dest_rect;
+		return;
+	}
+
+	memset(rect, 0, sizeof(MMAL_RECT_T));
+
+	if ((display = vc_dispmanx_display_open(region->display_num)) != DISPMANX_NO_HANDLE) {
+
+		if (vc_dispmanx_display_get_info(display, &info) == 0) {
+
+			rect->width = info.width;
+			rect->height = info.height;
+		}
+
+		vc_dispmanx_display_close(display);
+	}
+}
+
+
+/* Animate alpha and/or dest_rect of output (-1 every output) from their current values to target over duration_ms.
+   Called with the owner's lock held, a running animation is stopped first */
+int animator_start(RegionAnimator *animator, MmalPipeline *pipeline, int output, const MMAL_DISPLAYREGION_T *target,
+                   uint32_t duration_ms, GraphError *err) {
+
+	uint32_t i;
+
+	animator_stop(animator);
+
+	if (pipeline->graph == NULL) {
+
+		err->type = PyExc_RuntimeError;
+		err->msg = "graph is not open";
+		return -1;
+	}
+
+	animator->pipeline = pipeline;
+	animator->output = output;
+	animator->set = target->set & (MMAL_DISPLAY_SET_ALPHA | MMAL_DISPLAY_SET_DEST_RECT);
+	animator->from_alpha = pipeline->alpha;
+	animator->to_alpha = target->alpha;
+	animator->to_rect = target->dest_rect;
+	animator->duration_us = (uint64_t)duration_ms * 1000;
+
+	for (i = 0; i < pipeline->output_count; i++) {
+
+		animator_current_rect(&pipeline->outputs[i].region, &animator->from_rect[i]);
+	}
+
+	animator->stop = 0;
+	animator->vsyncs = 0;
+	animator->running = 1;
+	animator->start_us = vcos_getmicrosecs64();
+
+	/* Vsync of the first display paces every output */
+	if (vc_vsync_add_listener(pipeline->outputs[0].region.display_num, animator_vsync_cb, animator) != 0) {
+
+		animator->running = 0;
+		err->type = PyExc_RuntimeError;
+		err->msg = "failed to open display for vsync";
+		return -1;
+	}
+
+	if (pthread_create(&animator->thread, NULL, animator_thread, animator) != 0) {
+
+		vc_vsync_remove_listener(animator_vsync_cb, animator);
+		animator->running = 0;
+		err->type = PyExc_RuntimeError;
+		err->msg = "failed to start animation thread";
+		return -1;
+	}
+
+	animator->joinable = 1;
+	return 0;
+}
+
+
+/* Stop a running animation where it is and release its thread */
+void animator_stop(RegionAnimator *animator) {
+
+	if (!animator->joinable) {
+
+		return;
+	}
+
+	pthread_mutex_lock(&animator->lock);
+	animator->stop = 1;
+	pthread_cond_signal(&animator->vsync);
+	pthread_mutex_unlock(&animator->lock);
+
+	pthread_join(animator->thread, NULL);
+	animator->joinable = 0;
+}
+
+
+/* Wait for the animation to finish, returns 0 when done and -1 on timeout */
+int animator_wait(RegionAnimator *animator, uint32_t timeout_ms) {
+
+	int ret = 0;
+	struct timespec deadline;
+
+	animator_deadline(&deadline, timeout_ms);
+	pthread_mutex_lock(&animator->lock);
+
+	/* Any error ends the wait, a bad deadline would otherwise spin */
+	while (animator->running && ret == 0) {
+
+		ret = pthread_cond_timedwait(&animator->done, &animator->lock, &deadline);
+	}
+
+	ret = animator->running ? -1 : 0;
+	pthread_mutex_unlock(&animator->lock);
+	return ret;
+}
+
+
+int animator_running(RegionAnimator *animator) {
+
+	int running;
+
+	pthread_mutex_lock(&animator->lock);
+	running = animator->running;
+	pthread_mutex_unlock(&animator->lock);
+	return running;
+}
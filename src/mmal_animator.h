@@ -0,0 +1,31 @@
+#ifndef _MMAL_ANIMATOR_H_
+#define _MMAL_ANIMATOR_H_
+
+#include <pthread.h>
+#include <bcm_host.h>
+#include "mmal_pipeline.h"
+
+/* Steps alpha and dest_rect of a pipeline once per vsync on its own thread */
+typedef struct {
+	int running, stop, joinable;
+	int output;
+	uint32_t set;
+	uint32_t vsyncs;
+	uint64_t start_us, duration_us;
+	uint32_t from_alpha, to_alpha;
+	MMAL_RECT_T from_rect[PIPELINE_OUTPUTS], to_rect;
+	MmalPipeline *pipeline;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t vsync, done;
+} RegionAnimator;
+
+void animator_init(RegionAnimator *animator);
+void animator_destroy(RegionAnimator *animator);
+int animator_start(RegionAnimator *animator, MmalPipeline *pipeline, int output, const MMAL_DISPLAYREGION_T *target,
+                   uint32_t duration_ms, GraphError *err);
+void animator_stop(RegionAnimator *animator);
+int animator_wait(RegionAnimator *animator, uint32_t timeout_ms);
+int animator_running(RegionAnimator *animator);
+
+#endif
@@ -0,0 +1,968 @@
+#include <Python.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <mmal.h>
+#include <bcm_host.h>
+#include <interface/vcos/vcos.h>
+#include <util/mmal_util.h>
+#include <util/mmal_connection.h>
+#include <util/mmal_util_params.h>
+#include <util/mmal_default_components.h>
+#include "mmal_batch.h"
+#include "mmal_pipeline.h"
+#include "vc_connection.h"
+#include "module_state.h"
+#include "trace.h"
+
+#define BATCH_LANES 8
+#define BATCH_TIMEOUT 5000
+#define CHECK_STATUS(status, message) if (status != MMAL_SUCCESS) { error = message; goto error; }
+
+
+PyDoc_STRVAR(MmalBatchObject_type_doc,
+             "MmalBatch(paths, size, format='jpeg', outputs=None, quality=85, lanes=2)\n"
+             "-> Iterator resizing every image of paths to fit size=(width, height) and encoding it to format (jpeg, png, bmp).\n"
+             "Yields the encoded bytes in input order, or the output path when outputs lists where to write them.\n"
+             "Each lane is a decoder -> resizer -> encoder chain on its own thread, so reading, decoding and encoding\n"
+             "of several images overlap. A failed image raises IOError from next() and the iteration can go on.\n");
+
+/* Encoded image waiting for next(), error is set instead of data when it failed */
+typedef struct {
+	int ready;
+	uint8_t *data;
+	size_t size, capacity;
+	const char *error;
+} BatchResult;
+
+struct MmalBatchObject;
+
+/* decoder -> resizer -> encoder, tunnelled between components and fed from the lane thread */
+typedef struct {
+	struct MmalBatchObject *batch;
+	int thread_started;
+	pthread_t thread;
+	MMAL_COMPONENT_T *decoder, *resizer, *encoder;
+	MMAL_CONNECTION_T *decoder_conn, *resizer_conn;
+	MMAL_POOL_T *input_pool, *output_pool;
+	MMAL_QUEUE_T *output_ready;
+} BatchLane;
+
+typedef struct MmalBatchObject {
+	PyObject_HEAD;
+	char **paths, **outputs;
+	Py_ssize_t count, next_job, next_result;
+	uint32_t width, height, encoding, quality;
+	uint32_t lane_count, depth, running;
+	int stop;
+	uint64_t start_time, last_time;
+	BatchLane lanes[BATCH_LANES];
+	BatchResult *results;
+	pthread_mutex_t lock;
+	pthread_cond_t job_cond, result_cond;
+} MmalBatchObject;
+
+
+static PyObject *MmalBatch_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+
+	MmalBatchObject *self;
+
+	if ((self = (MmalBatchObject *)type->tp_alloc(type, 0)) == NULL) {
+
+		return NULL;
+	}
+
+	self->paths = NULL;
+	self->outputs = NULL;
+	self->results = NULL;
+	self->count = self->next_job = self->next_result = 0;
+	self->lane_count = self->running = 0;
+	memset(self->lanes, 0, sizeof(self->lanes));
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->job_cond, NULL);
+	pthread_cond_init(&self->result_cond, NULL);
+
+	return (PyObject *)self;
+}
+
+
+static void batch_input_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	mmal_buffer_header_release(buffer);
+}
+
+
+static void batch_output_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	BatchLane *lane = (BatchLane *)port->userdata;
+
+	mmal_queue_put(lane->output_ready, buffer);
+}
+
+
+static void batch_refill_output(BatchLane *lane) {
+
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	while ((buffer = mmal_queue_get(lane->output_pool->queue)) != NULL) {
+
+		if (mmal_port_send_buffer(lane->encoder->output[0], buffer) != MMAL_SUCCESS) {
+
+			mmal_queue_put_back(lane->output_pool->queue, buffer);
+			break;
+		}
+	}
+}
+
+
+static void batch_lane_teardown(BatchLane *lane) {
+
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	if (lane->decoder_conn) {
+		mmal_connection_destroy(lane->decoder_conn);
+		lane->decoder_conn = NULL;
+	}
+
+	if (lane->resizer_conn) {
+		mmal_connection_destroy(lane->resizer_conn);
+		lane->resizer_conn = NULL;
+	}
+
+	while (lane->output_ready && (buffer = mmal_queue_get(lane->output_ready)) != NULL) {
+
+		mmal_buffer_header_release(buffer);
+	}
+
+	if (lane->input_pool) {
+		mmal_port_pool_destroy(lane->decoder->input[0], lane->input_pool);
+		lane->input_pool = NULL;
+	}
+
+	if (lane->output_pool) {
+		mmal_port_pool_destroy(lane->encoder->output[0], lane->output_pool);
+		lane->output_pool = NULL;
+	}
+
+	if (lane->decoder) {
+		mmal_component_destroy(lane->decoder);
+		lane->decoder = NULL;
+	}
+
+	if (lane->resizer) {
+		mmal_component_destroy(lane->resizer);
+		lane->resizer = NULL;
+	}
+
+	if (lane->encoder) {
+		mmal_component_destroy(lane->encoder);
+		lane->encoder = NULL;
+	}
+
+	if (lane->output_ready) {
+		mmal_queue_destroy(lane->output_ready);
+		lane->output_ready = NULL;
+	}
+}
+
+
+/* Components are created once per lane and only reconfigured for each image */
+static const char *batch_lane_create(BatchLane *lane) {
+
+	MMAL_STATUS_T status;
+	const char *error = NULL;
+
+	status = mmal_component_create(MMAL_COMPONENT_DEFAULT_IMAGE_DECODER, &lane->decoder);
+	CHECK_STATUS(status, "failed to create decoder");
+
+	status = mmal_component_create(PIPELINE_RESIZER, &lane->resizer);
+	CHECK_STATUS(status, "failed to create resizer");
+
+	status = mmal_component_create(MMAL_COMPONENT_DEFAULT_IMAGE_ENCODER, &lane->encoder);
+	CHECK_STATUS(status, "failed to create encoder");
+
+	if ((lane->output_ready = mmal_queue_create()) == NULL) {
+
+		error = "failed to create encoder output queue";
+		goto error;
+	}
+
+	lane->decoder->input[0]->userdata = (struct MMAL_PORT_USERDATA_T *)lane;
+	lane->encoder->output[0]->userdata = (struct MMAL_PORT_USERDATA_T *)lane;
+
+	status = mmal_component_enable(lane->decoder);
+	CHECK_STATUS(status, "failed to enable decoder");
+
+	status = mmal_component_enable(lane->resizer);
+	CHECK_STATUS(status, "failed to enable resizer");
+
+	status = mmal_component_enable(lane->encoder);
+	CHECK_STATUS(status, "failed to enable encoder");
+
+	return NULL;
+
+error:
+	batch_lane_teardown(lane);
+	return error;
+}
+
+
+static void batch_video_size(MMAL_ES_FORMAT_T *format, uint32_t width, uint32_t height) {
+
+	format->es->video.width = VCOS_ALIGN_UP(width, 32);
+	format->es->video.height = VCOS_ALIGN_UP(height, 16);
+	format->es->video.crop.x = 0;
+	format->es->video.crop.y = 0;
+	format->es->video.crop.width = width;
+	format->es->video.crop.height = height;
+}
+
+
+/* Commit every port for one image, the tunnels are made afterwards since connected ports keep their format */
+static const char *batch_lane_configure(BatchLane *lane, uint32_t encoding, uint32_t source_width, uint32_t source_height,
+                                        uint32_t width, uint32_t height) {
+
+	MMAL_STATUS_T status;
+	const char *error = NULL;
+	MmalBatchObject *batch = lane->batch;
+	MMAL_PORT_T *input = lane->decoder->input[0], *decoded = lane->decoder->output[0];
+	MMAL_PORT_T *resize_in = lane->resizer->input[0], *resize_out = lane->resizer->output[0];
+	MMAL_PORT_T *encode_in = lane->encoder->input[0], *output = lane->encoder->output[0];
+
+	/* Jpeg stays in I420 end to end, other formats go through RGBA */
+	uint32_t pixels = encoding == MMAL_ENCODING_JPEG ? MMAL_ENCODING_I420 : MMAL_ENCODING_RGBA;
+
+	input->format->type = MMAL_ES_TYPE_VIDEO;
+	input->format->encoding = encoding;
+	input->format->flags = MMAL_ES_FORMAT_FLAG_FRAMED;
+	batch_video_size(input->format, source_width, source_height);
+	status = mmal_port_format_commit(input);
+	CHECK_STATUS(status, "decoder does not support input format");
+
+	mmal_format_copy(decoded->format, input->format);
+	decoded->format->encoding = pixels;
+	status = mmal_port_format_commit(decoded);
+	CHECK_STATUS(status, "decoder does not support output format");
+
+	mmal_format_copy(resize_in->format, decoded->format);
+	status = mmal_port_format_commit(resize_in);
+	CHECK_STATUS(status, "resizer does not support input format");
+
+	mmal_format_copy(resize_out->format, resize_in->format);
+	resize_out->format->encoding = batch->encoding == MMAL_ENCODING_JPEG ? MMAL_ENCODING_I420 : MMAL_ENCODING_RGBA;
+	batch_video_size(resize_out->format, width, height);
+	status = mmal_port_format_commit(resize_out);
+	CHECK_STATUS(status, "failed to set resizer output size");
+
+	mmal_format_copy(encode_in->format, resize_out->format);
+	status = mmal_port_format_commit(encode_in);
+	CHECK_STATUS(status, "encoder does not support input format");
+
+	mmal_format_copy(output->format, encode_in->format);
+	output->format->encoding = batch->encoding;
+	status = mmal_port_format_commit(output);
+	CHECK_STATUS(status, "encoder does not support output encoding");
+
+	if (batch->encoding == MMAL_ENCODING_JPEG) {
+
+		status = mmal_port_parameter_set_uint32(output, MMAL_PARAMETER_JPEG_Q_FACTOR, batch->quality);
+		CHECK_STATUS(status, "failed to set jpeg quality");
+	}
+
+	/* Pools are sized by the first image and reused */
+	input->buffer_num = input->buffer_num_recommended > input->buffer_num_min ? input->buffer_num_recommended : input->buffer_num_min;
+	input->buffer_size = input->buffer_size_recommended > input->buffer_size_min ? input->buffer_size_recommended : input->buffer_size_min;
+	output->buffer_num = output->buffer_num_recommended > output->buffer_num_min ? output->buffer_num_recommended : output->buffer_num_min;
+	output->buffer_size = output->buffer_size_recommended > output->buffer_size_min ? output->buffer_size_recommended : output->buffer_size_min;
+
+	if (lane->input_pool == NULL && (lane->input_pool = mmal_port_pool_create(input, input->buffer_num, input->buffer_size)) == NULL) {
+
+		error = "failed to create decoder input pool";
+		goto error;
+	}
+
+	if (lane->output_pool == NULL && (lane->output_pool = mmal_port_pool_create(output, output->buffer_num, output->buffer_size)) == NULL) {
+
+		error = "failed to create encoder output pool";
+		goto error;
+	}
+
+	input->buffer_num = lane->input_pool->headers_num;
+	input->buffer_size = lane->input_pool->header[0]->alloc_size;
+	output->buffer_num = lane->output_pool->headers_num;
+	output->buffer_size = lane->output_pool->header[0]->alloc_size;
+
+	status = mmal_connection_create(&lane->decoder_conn, decoded, resize_in, MMAL_CONNECTION_FLAG_TUNNELLING);
+	CHECK_STATUS(status, "failed to connect decoder to resizer");
+
+	if ((status = mmal_connection_create(&lane->resizer_conn, resize_out, encode_in, MMAL_CONNECTION_FLAG_TUNNELLING)) != MMAL_SUCCESS) {
+
+		/* Only reset after a transfer, the next configure would create it again on top */
+		mmal_connection_destroy(lane->decoder_conn);
+		lane->decoder_conn = NULL;
+		error = "failed to connect resizer to encoder";
+		goto error;
+	}
+
+	return NULL;
+
+error:
+	return error;
+}
+
+
+static int batch_append(BatchResult *result, const uint8_t *data, size_t size) {
+
+	uint8_t *grown;
+	size_t capacity = result->capacity ? result->capacity : 64 * 1024;
+
+	while (result->size + size > capacity) {
+
+		capacity *= 2;
+	}
+
+	if (capacity != result->capacity) {
+
+		if ((grown = realloc(result->data, capacity)) == NULL) {
+
+			return -1;
+		}
+
+		result->data = grown;
+		result->capacity = capacity;
+	}
+
+	memcpy(result->data + result->size, data, size);
+	result->size += size;
+	return 0;
+}
+
+
+/* Feed data to the decoder and gather encoder output until the end of the frame */
+static const char *batch_lane_run(BatchLane *lane, const uint8_t *data, size_t size, BatchResult *result) {
+
+	int done = 0;
+	size_t offset = 0;
+	uint32_t chunk;
+	MMAL_STATUS_T status;
+	const char *error = NULL;
+	MMAL_BUFFER_HEADER_T *buffer;
+	MMAL_PORT_T *input = lane->decoder->input[0], *output = lane->encoder->output[0];
+
+	status = mmal_connection_enable(lane->resizer_conn);
+	CHECK_STATUS(status, "failed to enable resizer to encoder connection");
+
+	status = mmal_connection_enable(lane->decoder_conn);
+	CHECK_STATUS(status, "failed to enable decoder to resizer connection");
+
+	status = mmal_port_enable(output, batch_output_cb);
+	CHECK_STATUS(status, "failed to enable encoder output");
+	batch_refill_output(lane);
+
+	status = mmal_port_enable(input, batch_input_cb);
+	CHECK_STATUS(status, "failed to enable decoder input");
+
+	while (offset < size) {
+
+		if ((buffer = mmal_queue_timedwait(lane->input_pool->queue, BATCH_TIMEOUT)) == NULL) {
+
+			error = "timeout waiting for decoder input";
+			goto error;
+		}
+
+		chunk = size - offset > buffer->alloc_size ? buffer->alloc_size : (uint32_t)(size - offset);
+		mmal_buffer_header_mem_lock(buffer);
+		memcpy(buffer->data, data + offset, chunk);
+		mmal_buffer_header_mem_unlock(buffer);
+		offset += chunk;
+
+		buffer->offset = 0;
+		buffer->length = chunk;
+		buffer->flags = offset == size ? MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_EOS : 0;
+
+		if ((status = mmal_port_send_buffer(input, buffer)) != MMAL_SUCCESS) {
+
+			mmal_buffer_header_release(buffer);
+			error = "failed to send buffer to decoder";
+			goto error;
+		}
+	}
+
+	while (!done) {
+
+		if ((buffer = mmal_queue_timedwait(lane->output_ready, BATCH_TIMEOUT)) == NULL) {
+
+			error = "timeout waiting for encoder output";
+			goto error;
+		}
+
+		done = (buffer->flags & (MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_EOS)) != 0;
+
+		if (buffer->cmd == 0 && buffer->length) {
+
+			mmal_buffer_header_mem_lock(buffer);
+
+			if (batch_append(result, buffer->data + buffer->offset, buffer->length) != 0) {
+
+				error = "out of memory";
+				done = 1;
+			}
+
+			mmal_buffer_header_mem_unlock(buffer);
+		}
+
+		mmal_buffer_header_release(buffer);
+		batch_refill_output(lane);
+	}
+
+error:
+	/* Back to an idle lane, disabled ports return every buffer */
+	mmal_port_disable(input);
+	mmal_port_disable(output);
+
+	while ((buffer = mmal_queue_get(lane->output_ready)) != NULL) {
+
+		mmal_buffer_header_release(buffer);
+	}
+
+	mmal_connection_destroy(lane->decoder_conn);
+	mmal_connection_destroy(lane->resizer_conn);
+	lane->decoder_conn = lane->resizer_conn = NULL;
+	return error;
+}
+
+
+static const char *batch_read_file(const char *path, uint8_t **data, size_t *size) {
+
+	FILE *fp;
+	long length;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+
+		return "failed to open input";
+	}
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (length = ftell(fp)) <= 0 || fseek(fp, 0, SEEK_SET) != 0) {
+
+		fclose(fp);
+		return "failed to read input";
+	}
+
+	if ((*data = malloc(length)) == NULL) {
+
+		fclose(fp);
+		return "out of memory";
+	}
+
+	*size = fread(*data, 1, length, fp);
+	fclose(fp);
+	return *size == (size_t)length ? NULL : "failed to read input";
+}
+
+
+/* One image from path to result, runs without the GIL */
+static void batch_process(BatchLane *lane, Py_ssize_t job, BatchResult *result) {
+
+	FILE *fp;
+	size_t size = 0;
+	uint8_t *data = NULL;
+	uint32_t encoding, source_width, source_height;
+	MmalBatchObject *batch = lane->batch;
+	uint32_t width = batch->width, height = batch->height;
+
+	if ((result->error = batch_read_file(batch->paths[job], &data, &size)) != NULL) {
+
+		goto done;
+	}
+
+	if ((encoding = pipeline_detect_encoding(data, size)) == 0 ||
+	    pipeline_image_size(data, size, &source_width, &source_height) != 0) {
+
+		result->error = "unsupported image format";
+		goto done;
+	}
+
+	pipeline_fit_size(source_width, source_height, &width, &height);
+
+	if ((result->error = batch_lane_configure(lane, encoding, source_width, source_height, width, height)) != NULL ||
+	    (result->error = batch_lane_run(lane, data, size, result)) != NULL) {
+
+		goto done;
+	}
+
+	if (batch->outputs) {
+
+		if ((fp = fopen(batch->outputs[job], "wb")) == NULL) {
+
+			result->error = "failed to open output";
+			goto done;
+		}
+
+		if (fwrite(result->data, 1, result->size, fp) != result->size) {
+
+			result->error = "failed to write output";
+		}
+
+		fclose(fp);
+		free(result->data);
+		result->data = NULL;
+		result->capacity = 0;
+	}
+
+done:
+	free(data);
+}
+
+
+/* Lane worker, takes the next job while it is less than depth ahead of the consumer */
+static void *batch_thread(void *arg) {
+
+	Py_ssize_t job;
+	BatchResult *result;
+	BatchLane *lane = arg;
+	MmalBatchObject *batch = lane->batch;
+
+	pthread_mutex_lock(&batch->lock);
+
+	for (;;) {
+
+		while (!batch->stop && batch->next_job < batch->count && batch->next_job >= batch->next_result + batch->depth) {
+
+			pthread_cond_wait(&batch->job_cond, &batch->lock);
+		}
+
+		if (batch->stop || batch->next_job >= batch->count) {
+
+			break;
+		}
+
+		job = batch->next_job++;
+		result = &batch->results[job % batch->depth];
+		pthread_mutex_unlock(&batch->lock);
+
+		memset(result, 0, sizeof(BatchResult));
+		batch_process(lane, job, result);
+
+		pthread_mutex_lock(&batch->lock);
+		result->ready = 1;
+		batch->last_time = vcos_getmicrosecs64();
+		pthread_cond_broadcast(&batch->result_cond);
+	}
+
+	batch->running--;
+	pthread_cond_broadcast(&batch->result_cond);
+	pthread_mutex_unlock(&batch->lock);
+	return NULL;
+}
+
+
+static void batch_free_strings(char **strings, Py_ssize_t count) {
+
+	Py_ssize_t i;
+
+	for (i = 0; strings && i < count; i++) {
+
+		free(strings[i]);
+	}
+
+	free(strings);
+}
+
+
+/* Stop the lanes and release everything, needs the GIL only for the lock wait */
+static void batch_teardown(MmalBatchObject *self) {
+
+	uint32_t i;
+
+	Py_BEGIN_ALLOW_THREADS
+
+	pthread_mutex_lock(&self->lock);
+	self->stop = 1;
+	pthread_cond_broadcast(&self->job_cond);
+	pthread_mutex_unlock(&self->lock);
+
+	for (i = 0; i < self->lane_count; i++) {
+
+		if (self->lanes[i].thread_started) {
+
+			pthread_join(self->lanes[i].thread, NULL);
+			self->lanes[i].thread_started = 0;
+		}
+
+		batch_lane_teardown(&self->lanes[i]);
+	}
+
+	Py_END_ALLOW_THREADS
+
+	for (i = 0; self->results && i < self->depth; i++) {
+
+		free(self->results[i].data);
+	}
+
+	free(self->results);
+	batch_free_strings(self->paths, self->count);
+	batch_free_strings(self->outputs, self->count);
+	self->results = NULL;
+	self->paths = self->outputs = NULL;
+	self->count = self->next_job = self->next_result = 0;
+	self->lane_count = self->running = 0;
+}
+
+
+PyDoc_STRVAR(MmalBatch_close_doc, "close()\n\nStop the lanes, pending images are dropped.\n");
+static PyObject *MmalBatch_close(MmalBatchObject *self) {
+
+	batch_teardown(self);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+static void MmalBatch_free(MmalBatchObject *self) {
+
+	PyObject *ref = MmalBatch_close(self);
+	Py_XDECREF(ref);
+
+	pthread_cond_destroy(&self->result_cond);
+	pthread_cond_destroy(&self->job_cond);
+	pthread_mutex_destroy(&self->lock);
+	PyTypeObject *type = Py_TYPE(self);
+
+	type->tp_free((PyObject *)self);
+	MODULE_TYPE_RELEASE(type);
+}
+
+
+/* Copy a list of str or bytes paths to C strings in the filesystem encoding */
+static char **batch_copy_paths(PyObject *list, Py_ssize_t *count) {
+
+	Py_ssize_t i;
+	char **paths;
+	PyObject *seq, *item, *encoded;
+
+	if ((seq = PySequence_Fast(list, "paths must be a list of str")) == NULL) {
+
+		return NULL;
+	}
+
+	*count = PySequence_Fast_GET_SIZE(seq);
+
+	if ((paths = calloc(*count ? *count : 1, sizeof(char *))) == NULL) {
+
+		Py_DECREF(seq);
+		PyErr_NoMemory();
+		return NULL;
+	}
+
+	for (i = 0; i < *count; i++) {
+
+		item = PySequence_Fast_GET_ITEM(seq, i);
+
+		encoded = PyUnicode_Check(item) ? PyUnicode_EncodeFSDefault(item) : (Py_INCREF(item), item);
+
+		if (encoded == NULL || !PyBytes_Check(encoded) || (paths[i] = strdup(PyBytes_AsString(encoded))) == NULL) {
+
+			if (encoded != NULL && !PyErr_Occurred()) {
+
+				PyErr_SetString(PyExc_TypeError, "paths must be a list of str");
+			}
+
+			Py_XDECREF(encoded);
+			batch_free_strings(paths, *count);
+			Py_DECREF(seq);
+			return NULL;
+		}
+
+		Py_DECREF(encoded);
+	}
+
+	Py_DECREF(seq);
+	return paths;
+}
+
+
+static int MmalBatch_init(MmalBatchObject *self, PyObject *args, PyObject *kwds) {
+
+	uint32_t i;
+	const char *error = NULL;
+	Py_ssize_t output_count = 0;
+	char *format_name = "jpeg";
+	PyObject *paths, *outputs = Py_None;
+	unsigned int width = 0, height = 0, quality = 85, lanes = 2;
+	static char *kwlist[] = {"paths", "size", "format", "outputs", "quality", "lanes", NULL};
+	TRACE_SCOPE("MmalBatch.__init__");
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O(II)|sOII", kwlist, &paths, &width, &height, &format_name, &outputs, &quality, &lanes)) {
+
+		return -1;
+	}
+
+	if (width == 0 || height == 0) {
+
+		PyErr_SetString(PyExc_ValueError, "size must be positive");
+		return -1;
+	}
+
+	if (lanes == 0 || lanes > BATCH_LANES) {
+
+		PyErr_Format(PyExc_ValueError, "lanes must be between 1 and %d", BATCH_LANES);
+		return -1;
+	}
+
+	/* Reinit case */
+	batch_teardown(self);
+
+	if (strcasecmp(format_name, "jpeg") == 0 || strcasecmp(format_name, "jpg") == 0) {
+
+		self->encoding = MMAL_ENCODING_JPEG;
+	}
+	else if (strcasecmp(format_name, "png") == 0) {
+
+		self->encoding = MMAL_ENCODING_PNG;
+	}
+	else if (strcasecmp(format_name, "bmp") == 0) {
+
+		self->encoding = MMAL_ENCODING_BMP;
+	}
+	else {
+
+		PyErr_Format(PyExc_ValueError, "invalid format '%s' (jpeg, png, bmp)", format_name);
+		return -1;
+	}
+
+	if ((self->paths = batch_copy_paths(paths, &self->count)) == NULL) {
+
+		return -1;
+	}
+
+	if (outputs != Py_None) {
+
+		if ((self->outputs = batch_copy_paths(outputs, &output_count)) == NULL) {
+
+			goto error;
+		}
+
+		if (output_count != self->count) {
+
+			PyErr_SetString(PyExc_ValueError, "outputs must have one path per input");
+			goto error;
+		}
+	}
+
+	self->width = width;
+	self->height = height;
+	self->quality = quality;
+	self->stop = 0;
+	self->depth = lanes * 2;
+
+	if ((self->results = calloc(self->depth, sizeof(BatchResult))) == NULL) {
+
+		PyErr_NoMemory();
+		goto error;
+	}
+
+	vc_host_init();
+
+	Py_BEGIN_ALLOW_THREADS
+
+	for (i = 0; i < lanes && error == NULL; i++) {
+
+		self->lanes[i].batch = self;
+
+		if ((error = batch_lane_create(&self->lanes[i])) == NULL) {
+
+			self->lane_count++;
+		}
+	}
+
+	Py_END_ALLOW_THREADS
+
+	if (error) {
+
+		PyErr_SetString(PyExc_RuntimeError, error);
+		goto error;
+	}
+
+	self->start_time = self->last_time = vcos_getmicrosecs64();
+
+	for (i = 0; i < self->lane_count; i++) {
+
+		pthread_mutex_lock(&self->lock);
+		self->running++;
+		pthread_mutex_unlock(&self->lock);
+
+		if (pthread_create(&self->lanes[i].thread, NULL, batch_thread, &self->lanes[i]) != 0) {
+
+			pthread_mutex_lock(&self->lock);
+			self->running--;
+			pthread_mutex_unlock(&self->lock);
+			PyErr_SetString(PyExc_RuntimeError, "failed to start lane thread");
+			goto error;
+		}
+
+		self->lanes[i].thread_started = 1;
+	}
+
+	return 0;
+
+error:
+	batch_teardown(self);
+	return -1;
+}
+
+
+static PyObject *MmalBatch_iter(PyObject *self) {
+
+	Py_INCREF(self);
+	return self;
+}
+
+
+/* Next result in input order, waits without the GIL until its lane finished it.
+   The job is only claimed under the lock, so threads sharing the iterator each get a different image */
+static PyObject *MmalBatch_iternext(MmalBatchObject *self) {
+
+	Py_ssize_t job = 0;
+	BatchResult result;
+	BatchResult *slot;
+	PyObject *item;
+
+	if (self->results == NULL) {
+
+		return NULL;
+	}
+
+	memset(&result, 0, sizeof(result));
+
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&self->lock);
+
+	for (;;) {
+
+		if ((job = self->next_result) >= self->count) {
+
+			break;
+		}
+
+		slot = &self->results[job % self->depth];
+
+		if (slot->ready || !self->running) {
+
+			result = *slot;
+			memset(slot, 0, sizeof(BatchResult));
+			self->next_result++;
+			pthread_cond_broadcast(&self->job_cond);
+			break;
+		}
+
+		pthread_cond_wait(&self->result_cond, &self->lock);
+	}
+
+	pthread_mutex_unlock(&self->lock);
+	Py_END_ALLOW_THREADS
+
+	if (job >= self->count) {
+
+		return NULL;
+	}
+
+	if (!result.ready) {
+
+		PyErr_SetString(PyExc_RuntimeError, "batch lanes stopped");
+		return NULL;
+	}
+
+	if (result.error) {
+
+		free(result.data);
+		PyErr_Format(PyExc_IOError, "%s: %s", self->paths[job], result.error);
+		return NULL;
+	}
+
+	if (self->outputs) {
+
+		return PyUnicode_DecodeFSDefault(self->outputs[job]);
+	}
+
+	item = PyBytes_FromStringAndSize((const char *)result.data, result.size);
+	free(result.data);
+	return item;
+}
+
+
+static PyObject *MmalBatch_enter(PyObject *self, PyObject *args) {
+
+	Py_INCREF(self);
+	return self;
+}
+
+
+static PyObject *MmalBatch_exit(MmalBatchObject *self, PyObject *args) {
+
+	PyObject *ref = MmalBatch_close(self);
+	Py_XDECREF(ref);
+	Py_RETURN_FALSE;
+}
+
+
+static PyMethodDef MmalBatch_methods[] = {
+
+	{"close", (PyCFunction)MmalBatch_close, METH_NOARGS, MmalBatch_close_doc},
+	{"__enter__", (PyCFunction)MmalBatch_enter, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction)MmalBatch_exit, METH_VARARGS, NULL},
+	{NULL},
+};
+
+
+PyDoc_STRVAR(MmalBatch_done_doc, "MmalBatch number of images returned by next()(read only)\n");
+static PyObject *MmalBatch_get_done(MmalBatchObject *self, void *closure) {
+
+	return PyLong_FromSsize_t(self->next_result);
+}
+
+
+PyDoc_STRVAR(MmalBatch_fps_doc, "MmalBatch images finished per second since the start(read only)\n");
+static PyObject *MmalBatch_get_fps(MmalBatchObject *self, void *closure) {
+
+	Py_ssize_t finished;
+	uint64_t elapsed;
+
+	pthread_mutex_lock(&self->lock);
+	finished = self->next_result;
+	elapsed = self->last_time - self->start_time;
+	pthread_mutex_unlock(&self->lock);
+
+	return Py_BuildValue("d", elapsed ? finished * 1000000.0 / elapsed : 0.0);
+}
+
+
+static PyGetSetDef MmalBatch_getseters[] = {
+
+	{"done", (getter)MmalBatch_get_done, (setter)NULL, MmalBatch_done_doc},
+	{"fps", (getter)MmalBatch_get_fps, (setter)NULL, MmalBatch_fps_doc},
+	{NULL},
+};
+
+
+static PyType_Slot MmalBatch_slots[] = {
+	{Py_tp_doc, (void *)MmalBatchObject_type_doc},
+	{Py_tp_dealloc, (void *)MmalBatch_free},
+	{Py_tp_iter, (void *)MmalBatch_iter},
+	{Py_tp_iternext, (void *)MmalBatch_iternext},
+	{Py_tp_methods, (void *)MmalBatch_methods},
+	{Py_tp_getset, (void *)MmalBatch_getseters},
+	{Py_tp_init, (void *)MmalBatch_init},
+	{Py_tp_new, (void *)MmalBatch_new},
+	{0, NULL},
+};
+
+
+PyType_Spec MmalBatch_spec = {
+	"pylibmmal." MmalBatch_name,
+	sizeof(MmalBatchObject),
+	0,
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+	MmalBatch_slots,
+};
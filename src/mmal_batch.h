@@ -0,0 +1,7 @@
+#ifndef _MMAL_BATCH_H_
+
+#define MmalBatch_name "MmalBatch"
+
+extern PyType_Spec MmalBatch_spec;
+
+#endif
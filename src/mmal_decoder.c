@@ -0,0 +1,363 @@
+#include <Python.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <mmal.h>
+#include <interface/vcos/vcos.h>
+#include "mmal_frame.h"
+#include "mmal_decoder.h"
+#include "mmal_pipeline.h"
+#include "module_state.h"
+#include "trace.h"
+
+
+PyDoc_STRVAR(MmalDecoderObject_type_doc,
+             "MmalDecoder(uri, prefetch=4, format=None, timeout=2.0) -> Iterator over the decoded frames of a video or image.\n\n"
+             "Same container reader and video decoder as MmalGraph, without a display. The decoder keeps up to prefetch\n"
+             "frames decoded ahead and waits when Python falls behind, so no frame is dropped. Frames are MmalFrame\n"
+             "objects sharing video core memory, release() them promptly as held frames also hold decoder buffers.\n"
+             "format converts in the decoder (I420, RGB24, BGR24, RGBA, BGRA), timeout is the longest wait for one frame.\n");
+typedef struct {
+	PyObject_HEAD;
+	int is_open;
+	uint32_t prefetch, timeout_ms;
+	uint64_t frames, first_time, last_time;
+	uint32_t error, status;
+	pthread_mutex_t lock;
+	MmalPipeline *pipeline;
+} MmalDecoderObject;
+
+
+/* Runs on a MMAL thread, only remember a decoder error for the next frame request */
+static void decoder_pipeline_event(MmalPipeline *pipeline, MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	MmalDecoderObject *self = pipeline->owner;
+
+	if (buffer->cmd != MMAL_EVENT_ERROR) {
+
+		return;
+	}
+
+	if (buffer->length >= sizeof(uint32_t)) {
+
+		__atomic_store_n(&self->status, *(uint32_t *)buffer->data, __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&self->error, 1, __ATOMIC_RELEASE);
+}
+
+
+static PyObject *MmalDecoder_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+
+	MmalDecoderObject *self;
+
+	if ((self = (MmalDecoderObject *)type->tp_alloc(type, 0)) == NULL) {
+
+		return NULL;
+	}
+
+	self->is_open = 0;
+	self->prefetch = DECODER_PREFETCH;
+	self->timeout_ms = PIPELINE_INPUT_TIMEOUT;
+	pthread_mutex_init(&self->lock, NULL);
+
+	if ((self->pipeline = pipeline_new(self, decoder_pipeline_event)) == NULL) {
+
+		Py_DECREF(self);
+		return PyErr_NoMemory();
+	}
+
+	/* Tapped link ends in a null sink, every frame goes to Python and the decoder waits for it */
+	self->pipeline->tap = 1;
+	self->pipeline->tap_block = 1;
+	self->pipeline->video = 1;
+	pipeline_set_outputs(self->pipeline, NULL, 0);
+
+	return (PyObject *)self;
+}
+
+
+/* Take the decoder lock, the GIL is only released when the lock is contended */
+static void decoder_lock(MmalDecoderObject *self) {
+
+	if (pthread_mutex_trylock(&self->lock) != 0) {
+
+		Py_BEGIN_ALLOW_THREADS
+		pthread_mutex_lock(&self->lock);
+		Py_END_ALLOW_THREADS
+	}
+}
+
+
+PyDoc_STRVAR(MmalDecoder_close_doc, "close()\n\nStop decoding, frames already returned stay valid until released.\n");
+static PyObject *MmalDecoder_close(MmalDecoderObject *self) {
+
+	decoder_lock(self);
+	self->is_open = 0;
+
+	/* Wakes up a frame request waiting in another thread */
+	Py_BEGIN_ALLOW_THREADS
+	pipeline_teardown(self->pipeline);
+	Py_END_ALLOW_THREADS
+
+	pthread_mutex_unlock(&self->lock);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+static void MmalDecoder_free(MmalDecoderObject *self) {
+
+	if (self->pipeline) {
+
+		PyObject *ref = MmalDecoder_close(self);
+		Py_XDECREF(ref);
+		pipeline_free(self->pipeline);
+	}
+
+	pthread_mutex_destroy(&self->lock);
+	PyTypeObject *type = Py_TYPE(self);
+
+	type->tp_free((PyObject *)self);
+	MODULE_TYPE_RELEASE(type);
+}
+
+
+static int MmalDecoder_init(MmalDecoderObject *self, PyObject *args, PyObject *kwds) {
+
+	int ret;
+	char *uri = NULL;
+	double timeout = PIPELINE_INPUT_TIMEOUT / 1000.0;
+	uint32_t encoding = 0;
+	unsigned int prefetch = DECODER_PREFETCH;
+	PyObject *format = Py_None;
+	LinkOptions links[PIPELINE_LINK_KINDS];
+	GraphError err = {NULL, NULL};
+	static char *kwlist[] = {"uri", "prefetch", "format", "timeout", NULL};
+	TRACE_SCOPE("MmalDecoder.__init__");
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|IOd", kwlist, &uri, &prefetch, &format, &timeout)) {
+
+		return -1;
+	}
+
+	if (prefetch == 0 || prefetch > PIPELINE_TAP_MAX) {
+
+		PyErr_Format(PyExc_ValueError, "prefetch must be between 1 and %d", PIPELINE_TAP_MAX);
+		return -1;
+	}
+
+	if (timeout <= 0) {
+
+		PyErr_SetString(PyExc_ValueError, "timeout must be positive");
+		return -1;
+	}
+
+	if (format != Py_None) {
+
+		PyObject *name = PyUnicode_Check(format) ? PyUnicode_AsASCIIString(format) : (Py_INCREF(format), format);
+
+		if (name == NULL || !PyBytes_Check(name) || (encoding = frame_encoding_from_name(PyBytes_AsString(name))) == 0) {
+
+			Py_XDECREF(name);
+			PyErr_SetString(PyExc_ValueError, "invalid format (I420, RGB24, BGR24, RGBA, BGRA)");
+			return -1;
+		}
+
+		Py_DECREF(name);
+	}
+
+	decoder_lock(self);
+
+	self->is_open = 0;
+	self->prefetch = prefetch;
+	self->timeout_ms = (uint32_t)(timeout * 1000);
+	self->frames = self->first_time = self->last_time = 0;
+	self->error = self->status = 0;
+
+	/* Queued frames, the one the decoder is working on and a couple held by Python share the decoder pool */
+	memcpy(links, self->pipeline->link_options, sizeof(links));
+	links[PIPELINE_LINK_DECODER].buffer_num = prefetch + 3;
+	pipeline_set_link_options(self->pipeline, links);
+	self->pipeline->tap_depth = prefetch;
+	self->pipeline->tap_encoding = encoding;
+
+	/* Reinit case, the old stream is dropped */
+	Py_BEGIN_ALLOW_THREADS
+	ret = pipeline_open(self->pipeline, uri, 0, &err);
+	Py_END_ALLOW_THREADS
+
+	self->is_open = ret == 0;
+	pthread_mutex_unlock(&self->lock);
+
+	if (ret != 0) {
+
+		PyErr_SetString(err.type, err.msg);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static PyObject *MmalDecoder_enter(PyObject *self, PyObject *args) {
+
+	Py_INCREF(self);
+	return self;
+}
+
+
+static PyObject *MmalDecoder_exit(MmalDecoderObject *self, PyObject *args) {
+
+	PyObject *ref = MmalDecoder_close(self);
+	Py_XDECREF(ref);
+	Py_RETURN_FALSE;
+}
+
+
+static PyObject *MmalDecoder_iter(PyObject *self) {
+
+	Py_INCREF(self);
+	return self;
+}
+
+
+/* Next decoded frame, waiting does not need the decoder lock as the pipeline lives as long as the decoder */
+static PyObject *MmalDecoder_iternext(MmalDecoderObject *self) {
+
+	int ret;
+	TapFrame frame;
+	ModuleState *state;
+	uint64_t now;
+
+	if ((state = module_state_by_type(Py_TYPE(self))) == NULL) {
+
+		return NULL;
+	}
+
+	if (!self->is_open) {
+
+		PyErr_SetString(PyExc_RuntimeError, "decoder is closed");
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = pipeline_tap_get(self->pipeline, &frame, self->timeout_ms);
+	Py_END_ALLOW_THREADS
+
+	if (ret == 0) {
+
+		now = vcos_getmicrosecs64();
+
+		MODULE_BEGIN_CRITICAL(self);
+		self->first_time = self->frames++ ? self->first_time : now;
+		self->last_time = now;
+		MODULE_END_CRITICAL();
+
+		return mmal_frame_new(state->frame_type, frame.buffer, frame.connection, &frame.format);
+	}
+
+	if (__atomic_load_n(&self->error, __ATOMIC_ACQUIRE)) {
+
+		PyErr_Format(PyExc_RuntimeError, "decoder error (status %u)", __atomic_load_n(&self->status, __ATOMIC_RELAXED));
+		return NULL;
+	}
+
+	/* Every frame was returned, StopIteration */
+	if (__atomic_load_n(&self->pipeline->eos, __ATOMIC_ACQUIRE)) {
+
+		return NULL;
+	}
+
+	PyErr_SetString(PyExc_RuntimeError, self->is_open ? "timeout waiting for decoded frame" : "decoder is closed");
+	return NULL;
+}
+
+
+static PyMethodDef MmalDecoder_methods[] = {
+
+	{"close", (PyCFunction)MmalDecoder_close, METH_NOARGS, MmalDecoder_close_doc},
+	{"__enter__", (PyCFunction)MmalDecoder_enter, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction)MmalDecoder_exit, METH_VARARGS, NULL},
+	{NULL},
+};
+
+
+PyDoc_STRVAR(MmalDecoder_prefetch_doc, "MmalDecoder number of frames decoded ahead of Python(read only)\n");
+static PyObject *MmalDecoder_get_prefetch(MmalDecoderObject *self, void *closure) {
+
+	return Py_BuildValue("I", self->prefetch);
+}
+
+
+PyDoc_STRVAR(MmalDecoder_queued_doc, "MmalDecoder number of decoded frames waiting to be returned(read only)\n");
+static PyObject *MmalDecoder_get_queued(MmalDecoderObject *self, void *closure) {
+
+	uint32_t queued;
+
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&self->pipeline->tap_lock);
+	queued = self->pipeline->tap_count;
+	pthread_mutex_unlock(&self->pipeline->tap_lock);
+	Py_END_ALLOW_THREADS
+
+	return Py_BuildValue("I", queued);
+}
+
+
+PyDoc_STRVAR(MmalDecoder_frames_doc, "MmalDecoder number of frames returned(read only)\n");
+static PyObject *MmalDecoder_get_frames(MmalDecoderObject *self, void *closure) {
+
+	return PyLong_FromUnsignedLongLong(self->frames);
+}
+
+
+PyDoc_STRVAR(MmalDecoder_fps_doc, "MmalDecoder throughput in frames per second since the first frame(read only)\n");
+static PyObject *MmalDecoder_get_fps(MmalDecoderObject *self, void *closure) {
+
+	uint64_t elapsed = self->last_time > self->first_time ? self->last_time - self->first_time : 0;
+
+	/* First frame starts the clock, it is not part of the measured interval */
+	return Py_BuildValue("d", elapsed ? (self->frames - 1) * 1000000.0 / elapsed : 0.0);
+}
+
+
+PyDoc_STRVAR(MmalDecoder_eos_doc, "MmalDecoder the reader reached the end of the stream(read only)\n");
+static PyObject *MmalDecoder_get_eos(MmalDecoderObject *self, void *closure) {
+
+	return PyBool_FromLong(__atomic_load_n(&self->pipeline->eos, __ATOMIC_ACQUIRE));
+}
+
+
+static PyGetSetDef MmalDecoder_getseters[] = {
+
+	{"prefetch", (getter)MmalDecoder_get_prefetch, (setter)NULL, MmalDecoder_prefetch_doc},
+	{"queued", (getter)MmalDecoder_get_queued, (setter)NULL, MmalDecoder_queued_doc},
+	{"frames", (getter)MmalDecoder_get_frames, (setter)NULL, MmalDecoder_frames_doc},
+	{"fps", (getter)MmalDecoder_get_fps, (setter)NULL, MmalDecoder_fps_doc},
+	{"eos", (getter)MmalDecoder_get_eos, (setter)NULL, MmalDecoder_eos_doc},
+	{NULL},
+};
+
+
+static PyType_Slot MmalDecoder_slots[] = {
+	{Py_tp_doc, (void *)MmalDecoderObject_type_doc},
+	{Py_tp_dealloc, (void *)MmalDecoder_free},
+	{Py_tp_methods, (void *)MmalDecoder_methods},
+	{Py_tp_getset, (void *)MmalDecoder_getseters},
+	{Py_tp_iter, (void *)MmalDecoder_iter},
+	{Py_tp_iternext, (void *)MmalDecoder_iternext},
+	{Py_tp_init, (void *)MmalDecoder_init},
+	{Py_tp_new, (void *)MmalDecoder_new},
+	{0, NULL},
+};
+
+
+PyType_Spec MmalDecoder_spec = {
+	"pylibmmal." MmalDecoder_name,
+	sizeof(MmalDecoderObject),
+	0,
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+	MmalDecoder_slots,
+};
@@ -0,0 +1,8 @@
+#ifndef _MMAL_DECODER_H_
+
+#define MmalDecoder_name "MmalDecoder"
+#define DECODER_PREFETCH 4
+
+extern PyType_Spec MmalDecoder_spec;
+
+#endif
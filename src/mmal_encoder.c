@@ -0,0 +1,861 @@
+#include <Python.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <mmal.h>
+#include <bcm_host.h>
+#include <interface/vcos/vcos.h>
+#include <util/mmal_util.h>
+#include <util/mmal_util_params.h>
+#include <util/mmal_default_components.h>
+#include "mmal_frame.h"
+#include "mmal_encoder.h"
+#include "vc_connection.h"
+#include "module_state.h"
+#include "trace.h"
+
+#define ENCODER_TIMEOUT 2000
+#define CHECK_STATUS(status, exc, msg) if (status != MMAL_SUCCESS) { PyErr_SetString(exc, msg); goto error; }
+
+
+PyDoc_STRVAR(MmalEncoderObject_type_doc,
+             "MmalEncoder(width, height, encoding='jpeg', format='RGB24', quality=85, bitrate=0, framerate=30, buffer_num=3)\n"
+             "-> Video core image (jpeg, png, bmp, gif) or video (h264, mjpeg) encoder.\n");
+
+/* Input header bookkeeping, a header may point into a Python buffer until the encoder returns it */
+typedef struct {
+	int has_view;
+	uint8_t *payload;
+	Py_buffer view;
+} EncoderSlot;
+
+/* Encoded bytes gathered without the GIL */
+typedef struct {
+	uint8_t *data;
+	size_t size, capacity;
+} EncodedData;
+
+typedef struct {
+	PyObject_HEAD;
+	int video;
+	uint32_t width, height;
+	uint32_t frame_size, tight_size;
+	uint64_t frames, bytes;
+	uint64_t first_time, last_time;
+	FrameFormat format;
+	pthread_mutex_t lock;
+	EncoderSlot *slots;
+	MMAL_COMPONENT_T *encoder;
+	MMAL_POOL_T *input_pool, *output_pool;
+	MMAL_QUEUE_T *input_done, *output_ready;
+} MmalEncoderObject;
+
+
+static PyObject *MmalEncoder_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+
+	MmalEncoderObject *self;
+
+	if ((self = (MmalEncoderObject *)type->tp_alloc(type, 0)) == NULL) {
+
+		return NULL;
+	}
+
+	self->slots = NULL;
+	self->encoder = NULL;
+	self->input_pool = NULL;
+	self->output_pool = NULL;
+	self->input_done = NULL;
+	self->output_ready = NULL;
+	pthread_mutex_init(&self->lock, NULL);
+
+	return (PyObject *)self;
+}
+
+
+/* Take the encoder lock, the GIL is only released when the lock is contended */
+static void encoder_lock(MmalEncoderObject *self) {
+
+	if (pthread_mutex_trylock(&self->lock) != 0) {
+
+		Py_BEGIN_ALLOW_THREADS
+		pthread_mutex_lock(&self->lock);
+		Py_END_ALLOW_THREADS
+	}
+}
+
+
+/* Input buffer came back from the encoder, the Python buffer is released later with the GIL held */
+static void encoder_input_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	MmalEncoderObject *self = (MmalEncoderObject *)port->userdata;
+
+	mmal_queue_put(self->input_done, buffer);
+}
+
+
+static void encoder_output_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	MmalEncoderObject *self = (MmalEncoderObject *)port->userdata;
+
+	mmal_queue_put(self->output_ready, buffer);
+}
+
+
+/* Return an input header to its pool, needs the GIL */
+static void encoder_reap(MmalEncoderObject *self, MMAL_BUFFER_HEADER_T *buffer) {
+
+	EncoderSlot *slot = buffer->user_data;
+
+	buffer->data = slot->payload;
+
+	if (slot->has_view) {
+
+		PyBuffer_Release(&slot->view);
+		slot->has_view = 0;
+	}
+
+	mmal_buffer_header_release(buffer);
+}
+
+
+static void encoder_reap_all(MmalEncoderObject *self) {
+
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	while (self->input_done && (buffer = mmal_queue_get(self->input_done)) != NULL) {
+
+		encoder_reap(self, buffer);
+	}
+}
+
+
+static void encoder_refill_output(MmalEncoderObject *self) {
+
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	while ((buffer = mmal_queue_get(self->output_pool->queue)) != NULL) {
+
+		if (mmal_port_send_buffer(self->encoder->output[0], buffer) != MMAL_SUCCESS) {
+
+			mmal_queue_put_back(self->output_pool->queue, buffer);
+			break;
+		}
+	}
+}
+
+
+static void encoder_teardown(MmalEncoderObject *self) {
+
+	if (self->encoder) {
+
+		Py_BEGIN_ALLOW_THREADS
+		mmal_port_disable(self->encoder->input[0]);
+		mmal_port_disable(self->encoder->output[0]);
+		mmal_component_disable(self->encoder);
+		Py_END_ALLOW_THREADS
+	}
+
+	/* Disabled ports handed every input buffer back */
+	encoder_reap_all(self);
+
+	if (self->output_ready) {
+
+		MMAL_BUFFER_HEADER_T *buffer;
+
+		while ((buffer = mmal_queue_get(self->output_ready)) != NULL) {
+
+			mmal_buffer_header_release(buffer);
+		}
+	}
+
+	if (self->input_pool) {
+		mmal_port_pool_destroy(self->encoder->input[0], self->input_pool);
+		self->input_pool = NULL;
+	}
+
+	if (self->output_pool) {
+		mmal_port_pool_destroy(self->encoder->output[0], self->output_pool);
+		self->output_pool = NULL;
+	}
+
+	if (self->encoder) {
+		mmal_component_destroy(self->encoder);
+		self->encoder = NULL;
+	}
+
+	if (self->input_done) {
+		mmal_queue_destroy(self->input_done);
+		self->input_done = NULL;
+	}
+
+	if (self->output_ready) {
+		mmal_queue_destroy(self->output_ready);
+		self->output_ready = NULL;
+	}
+
+	free(self->slots);
+	self->slots = NULL;
+}
+
+
+PyDoc_STRVAR(MmalEncoder_close_doc, "close()\n\nRelease the encoder.\n");
+static PyObject *MmalEncoder_close(MmalEncoderObject *self) {
+
+	encoder_lock(self);
+	encoder_teardown(self);
+	pthread_mutex_unlock(&self->lock);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+static void MmalEncoder_free(MmalEncoderObject *self) {
+
+	PyObject *ref = MmalEncoder_close(self);
+	Py_XDECREF(ref);
+
+	pthread_mutex_destroy(&self->lock);
+	PyTypeObject *type = Py_TYPE(self);
+
+	type->tp_free((PyObject *)self);
+	MODULE_TYPE_RELEASE(type);
+}
+
+
+/* Encoded format name to encoding and component */
+static uint32_t encoder_encoding_from_name(const char *name, int *video) {
+
+	*video = 0;
+
+	if (strcasecmp(name, "jpeg") == 0 || strcasecmp(name, "jpg") == 0) {
+
+		return MMAL_ENCODING_JPEG;
+	}
+	else if (strcasecmp(name, "png") == 0) {
+
+		return MMAL_ENCODING_PNG;
+	}
+	else if (strcasecmp(name, "bmp") == 0) {
+
+		return MMAL_ENCODING_BMP;
+	}
+	else if (strcasecmp(name, "gif") == 0) {
+
+		return MMAL_ENCODING_GIF;
+	}
+
+	*video = 1;
+
+	if (strcasecmp(name, "h264") == 0) {
+
+		return MMAL_ENCODING_H264;
+	}
+	else if (strcasecmp(name, "mjpeg") == 0) {
+
+		return MMAL_ENCODING_MJPEG;
+	}
+
+	return 0;
+}
+
+
+/* Bytes of one frame when rows are not padded */
+static uint32_t encoder_tight_size(uint32_t encoding, uint32_t width, uint32_t height) {
+
+	switch (encoding) {
+		case MMAL_ENCODING_I420:
+			return width * height * 3 / 2;
+
+		case MMAL_ENCODING_RGB24:
+		case MMAL_ENCODING_BGR24:
+			return width * height * 3;
+
+		default:
+			return width * height * 4;
+	}
+}
+
+
+static int MmalEncoder_init(MmalEncoderObject *self, PyObject *args, PyObject *kwds) {
+
+	MMAL_STATUS_T status;
+	MMAL_PORT_T *input, *output;
+	uint32_t i, encoding, pixel_format;
+	unsigned int width = 0, height = 0, quality = 85, bitrate = 0, framerate = 30, buffer_num = 3;
+	char *encoding_name = "jpeg", *format_name = "RGB24";
+	static char *kwlist[] = {"width", "height", "encoding", "format", "quality", "bitrate", "framerate", "buffer_num", NULL};
+	TRACE_SCOPE("MmalEncoder.__init__");
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "II|ssIIII", kwlist, &width, &height, &encoding_name, &format_name,
+	                                 &quality, &bitrate, &framerate, &buffer_num)) {
+
+		return -1;
+	}
+
+	if (width == 0 || height == 0 || buffer_num == 0 || framerate == 0) {
+
+		PyErr_SetString(PyExc_ValueError, "width, height, framerate and buffer_num must be positive");
+		return -1;
+	}
+
+	if ((encoding = encoder_encoding_from_name(encoding_name, &self->video)) == 0) {
+
+		PyErr_Format(PyExc_ValueError, "invalid encoding '%s' (jpeg, png, bmp, gif, h264, mjpeg)", encoding_name);
+		return -1;
+	}
+
+	if ((pixel_format = frame_encoding_from_name(format_name)) == 0) {
+
+		PyErr_Format(PyExc_ValueError, "invalid format '%s' (I420, RGB24, BGR24, RGBA, BGRA)", format_name);
+		return -1;
+	}
+
+	/* Reinit case, encode() in another thread finds either encoder whole */
+	encoder_lock(self);
+	encoder_teardown(self);
+
+	self->frames = self->bytes = 0;
+	self->first_time = self->last_time = 0;
+	self->width = width;
+	self->height = height;
+
+	vc_host_init();
+
+	status = mmal_component_create(self->video ? MMAL_COMPONENT_DEFAULT_VIDEO_ENCODER : MMAL_COMPONENT_DEFAULT_IMAGE_ENCODER, &self->encoder);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create encoder");
+
+	input = self->encoder->input[0];
+	output = self->encoder->output[0];
+	input->userdata = (struct MMAL_PORT_USERDATA_T *)self;
+	output->userdata = (struct MMAL_PORT_USERDATA_T *)self;
+
+	/* Video core wants 32 x 16 aligned frames, the visible area is cropped */
+	input->format->type = MMAL_ES_TYPE_VIDEO;
+	input->format->encoding = pixel_format;
+	input->format->es->video.width = VCOS_ALIGN_UP(width, 32);
+	input->format->es->video.height = VCOS_ALIGN_UP(height, 16);
+	input->format->es->video.crop.x = 0;
+	input->format->es->video.crop.y = 0;
+	input->format->es->video.crop.width = width;
+	input->format->es->video.crop.height = height;
+	input->format->es->video.frame_rate.num = framerate;
+	input->format->es->video.frame_rate.den = 1;
+	status = mmal_port_format_commit(input);
+	CHECK_STATUS(status, PyExc_ValueError, "encoder does not support input format");
+
+	mmal_format_copy(output->format, input->format);
+	output->format->encoding = encoding;
+	output->format->bitrate = bitrate;
+	status = mmal_port_format_commit(output);
+	CHECK_STATUS(status, PyExc_ValueError, "encoder does not support output encoding");
+
+	if (encoding == MMAL_ENCODING_JPEG) {
+
+		status = mmal_port_parameter_set_uint32(output, MMAL_PARAMETER_JPEG_Q_FACTOR, quality);
+		CHECK_STATUS(status, PyExc_ValueError, "failed to set jpeg quality");
+	}
+
+	if (encoding == MMAL_ENCODING_H264) {
+
+		mmal_port_parameter_set_boolean(output, MMAL_PARAMETER_VIDEO_ENCODE_INLINE_HEADER, MMAL_TRUE);
+	}
+
+	frame_format_from_es(&self->format, input->format);
+	self->frame_size = input->format->encoding == MMAL_ENCODING_I420 ?
+	                   self->format.stride * self->format.height * 3 / 2 : self->format.stride * self->format.height;
+	self->tight_size = encoder_tight_size(pixel_format, width, height);
+
+	input->buffer_num = buffer_num > input->buffer_num_min ? buffer_num : input->buffer_num_min;
+	input->buffer_size = self->frame_size > input->buffer_size_min ? self->frame_size : input->buffer_size_min;
+	output->buffer_num = output->buffer_num_recommended > output->buffer_num_min ? output->buffer_num_recommended : output->buffer_num_min;
+	output->buffer_size = output->buffer_size_recommended > output->buffer_size_min ? output->buffer_size_recommended : output->buffer_size_min;
+
+	self->input_done = mmal_queue_create();
+	self->output_ready = mmal_queue_create();
+	self->input_pool = mmal_port_pool_create(input, input->buffer_num, input->buffer_size);
+	self->output_pool = mmal_port_pool_create(output, output->buffer_num, output->buffer_size);
+	self->slots = calloc(input->buffer_num, sizeof(EncoderSlot));
+
+	if (!self->input_done || !self->output_ready || !self->input_pool || !self->output_pool || !self->slots) {
+
+		PyErr_NoMemory();
+		goto error;
+	}
+
+	for (i = 0; i < self->input_pool->headers_num; i++) {
+
+		self->slots[i].payload = self->input_pool->header[i]->data;
+		self->input_pool->header[i]->user_data = &self->slots[i];
+	}
+
+	status = mmal_port_enable(input, encoder_input_cb);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable encoder input");
+
+	status = mmal_port_enable(output, encoder_output_cb);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable encoder output");
+
+	status = mmal_component_enable(self->encoder);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable encoder");
+
+	encoder_refill_output(self);
+	pthread_mutex_unlock(&self->lock);
+	return 0;
+
+error:
+	encoder_teardown(self);
+	pthread_mutex_unlock(&self->lock);
+	return -1;
+}
+
+
+static PyObject *MmalEncoder_enter(PyObject *self, PyObject *args) {
+
+	Py_INCREF(self);
+	return self;
+}
+
+
+static PyObject *MmalEncoder_exit(MmalEncoderObject *self, PyObject *args) {
+
+	PyObject *ref = MmalEncoder_close(self);
+	Py_XDECREF(ref);
+	Py_RETURN_FALSE;
+}
+
+
+static int encoded_append(EncodedData *out, const uint8_t *data, size_t size) {
+
+	uint8_t *grown;
+	size_t capacity = out->capacity ? out->capacity : 64 * 1024;
+
+	while (out->size + size > capacity) {
+
+		capacity *= 2;
+	}
+
+	if (capacity != out->capacity) {
+
+		if ((grown = realloc(out->data, capacity)) == NULL) {
+
+			return -1;
+		}
+
+		out->data = grown;
+		out->capacity = capacity;
+	}
+
+	memcpy(out->data + out->size, data, size);
+	out->size += size;
+	return 0;
+}
+
+
+/* Gather encoder output until a buffer with one of flags arrives, without flags only drain what is ready.
+   Output which can't be stored is still drained, so it does not end up in the result of the next call */
+static const char *encoder_collect(MmalEncoderObject *self, uint32_t flags, EncodedData *out) {
+
+	uint32_t buffer_flags;
+	const char *error = NULL;
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	for (;;) {
+
+		buffer = flags ? mmal_queue_timedwait(self->output_ready, ENCODER_TIMEOUT) : mmal_queue_get(self->output_ready);
+
+		if (buffer == NULL) {
+
+			return flags ? "timeout waiting for encoder output" : error;
+		}
+
+		buffer_flags = buffer->flags;
+
+		if (buffer->cmd == 0 && buffer->length && error == NULL) {
+
+			mmal_buffer_header_mem_lock(buffer);
+
+			if (encoded_append(out, buffer->data + buffer->offset, buffer->length) != 0) {
+
+				error = "out of memory";
+			}
+
+			mmal_buffer_header_mem_unlock(buffer);
+		}
+
+		mmal_buffer_header_release(buffer);
+		encoder_refill_output(self);
+		self->last_time = vcos_getmicrosecs64();
+
+		if (flags && (buffer_flags & flags)) {
+
+			return error;
+		}
+	}
+}
+
+
+/* Hand encoded data to Python, either as bytes or written to path */
+static PyObject *encoder_result(MmalEncoderObject *self, EncodedData *out, const char *path) {
+
+	FILE *fp;
+	size_t written = 0;
+	PyObject *result;
+
+	self->bytes += out->size;
+
+	if (path == NULL) {
+
+		result = PyBytes_FromStringAndSize((const char *)out->data, out->size);
+		free(out->data);
+		return result;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+
+	if ((fp = fopen(path, "wb")) != NULL) {
+
+		written = fwrite(out->data, 1, out->size, fp);
+		fclose(fp);
+	}
+
+	Py_END_ALLOW_THREADS
+
+	free(out->data);
+
+	if (fp == NULL || written != out->size) {
+
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+	}
+
+	return PyLong_FromSize_t(written);
+}
+
+
+/* Copy an unpadded frame into the padded input payload */
+static void encoder_copy_tight(MmalEncoderObject *self, uint8_t *dest, const uint8_t *src) {
+
+	uint32_t row, plane, rows, bytes, stride;
+	const FrameFormat *format = &self->format;
+
+	if (format->encoding != MMAL_ENCODING_I420) {
+
+		bytes = self->tight_size / self->height;
+
+		for (row = 0; row < self->height; row++) {
+
+			memcpy(dest + row * format->stride, src + row * bytes, bytes);
+		}
+
+		return;
+	}
+
+	/* Y, U and V planes */
+	for (plane = 0; plane < 3; plane++) {
+
+		rows = plane ? self->height / 2 : self->height;
+		bytes = plane ? self->width / 2 : self->width;
+		stride = plane ? format->stride / 2 : format->stride;
+
+		for (row = 0; row < rows; row++) {
+
+			memcpy(dest + row * stride, src + row * bytes, bytes);
+		}
+
+		src += rows * bytes;
+		dest += plane ? stride * format->height / 2 : stride * format->height;
+	}
+}
+
+
+PyDoc_STRVAR(MmalEncoder_encode_doc,
+             "encode(frame, path=None)\n\nEncode one frame from any buffer object (bytes, memoryview, numpy array, MmalFrame).\n"
+             "A frame with the encoder's padded layout (stride x 16 aligned rows) is sent without copy,\n"
+             "an unpadded frame is copied once. Image encoders return the encoded image, video encoders return\n"
+             "whatever stream data is ready. With path the data is written to that file and its size is returned.\n");
+static PyObject *MmalEncoder_encode(MmalEncoderObject *self, PyObject *args, PyObject *kwds) {
+
+	EncoderSlot *slot;
+	Py_buffer view;
+	int view_held = 1;
+	PyObject *frame = NULL;
+	char *path = NULL;
+	const char *error = NULL;
+	MMAL_STATUS_T status = MMAL_SUCCESS;
+	MMAL_BUFFER_HEADER_T *buffer = NULL;
+	EncodedData out = {NULL, 0, 0};
+	static char *kwlist[] = {"frame", "path", NULL};
+	TRACE_SCOPE("MmalEncoder.encode");
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|z:encode", kwlist, &frame, &path)) {
+
+		return NULL;
+	}
+
+	if (PyObject_GetBuffer(frame, &view, PyBUF_SIMPLE) != 0) {
+
+		return NULL;
+	}
+
+	/* close() or a reinit in another thread may have run while the lock was awaited */
+	encoder_lock(self);
+
+	if (self->encoder == NULL || self->input_pool == NULL) {
+
+		pthread_mutex_unlock(&self->lock);
+		PyBuffer_Release(&view);
+		PyErr_SetString(PyExc_RuntimeError, "encoder is closed");
+		return NULL;
+	}
+
+	if (view.len != self->frame_size && view.len != self->tight_size) {
+
+		PyErr_Format(PyExc_ValueError, "frame size %zd does not match %u (padded) or %u (unpadded)",
+		             view.len, self->frame_size, self->tight_size);
+		pthread_mutex_unlock(&self->lock);
+		PyBuffer_Release(&view);
+		return NULL;
+	}
+
+	encoder_reap_all(self);
+
+	/* Every header is in flight, wait for the encoder to return one */
+	while ((buffer = mmal_queue_get(self->input_pool->queue)) == NULL) {
+
+		Py_BEGIN_ALLOW_THREADS
+		buffer = mmal_queue_timedwait(self->input_done, ENCODER_TIMEOUT);
+		Py_END_ALLOW_THREADS
+
+		if (buffer == NULL) {
+
+			error = "timeout waiting for encoder input buffer";
+			goto out;
+		}
+
+		encoder_reap(self, buffer);
+	}
+
+	slot = buffer->user_data;
+	mmal_buffer_header_reset(buffer);
+	buffer->length = self->frame_size;
+	buffer->flags = MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+
+	if (view.len == self->frame_size) {
+
+		/* Same layout as the port, the encoder reads the caller's memory */
+		buffer->data = view.buf;
+		slot->view = view;
+		slot->has_view = 1;
+	}
+	else {
+
+		encoder_copy_tight(self, buffer->data, view.buf);
+		PyBuffer_Release(&view);
+	}
+
+	view_held = 0;
+
+	if (self->frames == 0) {
+
+		self->first_time = vcos_getmicrosecs64();
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+
+	if ((status = mmal_port_send_buffer(self->encoder->input[0], buffer)) != MMAL_SUCCESS) {
+
+		error = "failed to send frame to encoder";
+	}
+	else {
+
+		/* Images complete per frame, video output trails the input */
+		error = encoder_collect(self, self->video ? 0 : MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_EOS, &out);
+	}
+
+	Py_END_ALLOW_THREADS
+
+	if (status != MMAL_SUCCESS) {
+
+		encoder_reap(self, buffer);
+	}
+	else {
+
+		self->frames++;
+	}
+
+out:
+	pthread_mutex_unlock(&self->lock);
+
+	if (view_held) {
+
+		PyBuffer_Release(&view);
+	}
+
+	if (error) {
+
+		free(out.data);
+		PyErr_SetString(PyExc_RuntimeError, error);
+		return NULL;
+	}
+
+	return encoder_result(self, &out, path);
+}
+
+
+PyDoc_STRVAR(MmalEncoder_flush_doc,
+             "flush(path=None)\n\nSend end-of-stream and return the remaining encoded data, required to finish a video stream.\n");
+static PyObject *MmalEncoder_flush(MmalEncoderObject *self, PyObject *args, PyObject *kwds) {
+
+	char *path = NULL;
+	const char *error = NULL;
+	MMAL_BUFFER_HEADER_T *buffer;
+	EncodedData out = {NULL, 0, 0};
+	static char *kwlist[] = {"path", NULL};
+	TRACE_SCOPE("MmalEncoder.flush");
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|z:flush", kwlist, &path)) {
+
+		return NULL;
+	}
+
+	encoder_lock(self);
+
+	if (self->encoder == NULL || self->input_pool == NULL) {
+
+		pthread_mutex_unlock(&self->lock);
+		PyErr_SetString(PyExc_RuntimeError, "encoder is closed");
+		return NULL;
+	}
+
+	encoder_reap_all(self);
+
+	/* Frames sent by encode() may all still be in flight, same wait as encode() */
+	while ((buffer = mmal_queue_get(self->input_pool->queue)) == NULL) {
+
+		Py_BEGIN_ALLOW_THREADS
+		buffer = mmal_queue_timedwait(self->input_done, ENCODER_TIMEOUT);
+		Py_END_ALLOW_THREADS
+
+		if (buffer == NULL) {
+
+			break;
+		}
+
+		encoder_reap(self, buffer);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+
+	if (buffer == NULL) {
+
+		error = "timeout waiting for encoder input buffer";
+	}
+	else {
+
+		mmal_buffer_header_reset(buffer);
+		buffer->flags = MMAL_BUFFER_HEADER_FLAG_EOS;
+
+		if (mmal_port_send_buffer(self->encoder->input[0], buffer) != MMAL_SUCCESS) {
+
+			mmal_buffer_header_release(buffer);
+			error = "failed to send end-of-stream to encoder";
+		}
+		else {
+
+			error = encoder_collect(self, MMAL_BUFFER_HEADER_FLAG_EOS, &out);
+		}
+	}
+
+	Py_END_ALLOW_THREADS
+
+	encoder_reap_all(self);
+	pthread_mutex_unlock(&self->lock);
+
+	if (error) {
+
+		free(out.data);
+		PyErr_SetString(PyExc_RuntimeError, error);
+		return NULL;
+	}
+
+	return encoder_result(self, &out, path);
+}
+
+
+static PyMethodDef MmalEncoder_methods[] = {
+
+	{"encode", (PyCFunction)MmalEncoder_encode, METH_VARARGS | METH_KEYWORDS, MmalEncoder_encode_doc},
+	{"flush", (PyCFunction)MmalEncoder_flush, METH_VARARGS | METH_KEYWORDS, MmalEncoder_flush_doc},
+	{"close", (PyCFunction)MmalEncoder_close, METH_NOARGS, MmalEncoder_close_doc},
+	{"__enter__", (PyCFunction)MmalEncoder_enter, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction)MmalEncoder_exit, METH_VARARGS, NULL},
+	{NULL},
+};
+
+
+PyDoc_STRVAR(MmalEncoder_frames_doc, "MmalEncoder number of frames encoded(read only)\n");
+static PyObject *MmalEncoder_get_frames(MmalEncoderObject *self, void *closure) {
+
+	return PyLong_FromUnsignedLongLong(self->frames);
+}
+
+
+PyDoc_STRVAR(MmalEncoder_bytes_doc, "MmalEncoder number of encoded bytes returned(read only)\n");
+static PyObject *MmalEncoder_get_bytes(MmalEncoderObject *self, void *closure) {
+
+	return PyLong_FromUnsignedLongLong(self->bytes);
+}
+
+
+PyDoc_STRVAR(MmalEncoder_fps_doc, "MmalEncoder throughput in frames per second since the first frame(read only)\n");
+static PyObject *MmalEncoder_get_fps(MmalEncoderObject *self, void *closure) {
+
+	uint64_t elapsed = self->last_time > self->first_time ? self->last_time - self->first_time : 0;
+
+	return Py_BuildValue("d", elapsed ? self->frames * 1000000.0 / elapsed : 0.0);
+}
+
+
+PyDoc_STRVAR(MmalEncoder_frame_size_doc, "MmalEncoder bytes of a padded input frame, sent without copy(read only)\n");
+static PyObject *MmalEncoder_get_frame_size(MmalEncoderObject *self, void *closure) {
+
+	return Py_BuildValue("I", self->frame_size);
+}
+
+
+PyDoc_STRVAR(MmalEncoder_stride_doc, "MmalEncoder row pitch in bytes of a padded input frame(read only)\n");
+static PyObject *MmalEncoder_get_stride(MmalEncoderObject *self, void *closure) {
+
+	return Py_BuildValue("I", self->format.stride);
+}
+
+
+static PyGetSetDef MmalEncoder_getseters[] = {
+
+	{"frames", (getter)MmalEncoder_get_frames, (setter)NULL, MmalEncoder_frames_doc},
+	{"bytes", (getter)MmalEncoder_get_bytes, (setter)NULL, MmalEncoder_bytes_doc},
+	{"fps", (getter)MmalEncoder_get_fps, (setter)NULL, MmalEncoder_fps_doc},
+	{"frame_size", (getter)MmalEncoder_get_frame_size, (setter)NULL, MmalEncoder_frame_size_doc},
+	{"stride", (getter)MmalEncoder_get_stride, (setter)NULL, MmalEncoder_stride_doc},
+	{NULL},
+};
+
+
+static PyType_Slot MmalEncoder_slots[] = {
+	{Py_tp_doc, (void *)MmalEncoderObject_type_doc},
+	{Py_tp_dealloc, (void *)MmalEncoder_free},
+	{Py_tp_methods, (void *)MmalEncoder_methods},
+	{Py_tp_getset, (void *)MmalEncoder_getseters},
+	{Py_tp_init, (void *)MmalEncoder_init},
+	{Py_tp_new, (void *)MmalEncoder_new},
+	{0, NULL},
+};
+
+
+PyType_Spec MmalEncoder_spec = {
+	"pylibmmal." MmalEncoder_name,
+	sizeof(MmalEncoderObject),
+	0,
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+	MmalEncoder_slots,
+};
@@ -0,0 +1,7 @@
+#ifndef _MMAL_ENCODER_H_
+
+#define MmalEncoder_name "MmalEncoder"
+
+extern PyType_Spec MmalEncoder_spec;
+
+#endif
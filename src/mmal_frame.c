@@ -0,0 +1,395 @@
+#include <Python.h>
+#include <string.h>
+#include <mmal.h>
+#include <util/mmal_util.h>
+#include <util/mmal_connection.h>
+#include "mmal_frame.h"
+#include "module_state.h"
+#include "trace.h"
+
+
+PyDoc_STRVAR(MmalFrameObject_type_doc,
+             "MmalFrame -> Decoded video core buffer exposed through the buffer protocol without copy.\n"
+             "numpy.asarray(frame) shares its memory, the buffer returns to the decoder on release().\n");
+typedef struct {
+	PyObject_HEAD;
+	int ndim;
+	int exports;
+	FrameFormat format;
+	Py_ssize_t shape[3];
+	Py_ssize_t strides[3];
+	MMAL_BUFFER_HEADER_T *buffer;
+	MMAL_CONNECTION_T *connection;
+} MmalFrameObject;
+
+
+void frame_format_from_es(FrameFormat *format, MMAL_ES_FORMAT_T *es) {
+
+	format->encoding = es->encoding;
+	format->width = es->es->video.width;
+	format->height = es->es->video.height;
+	format->crop_width = es->es->video.crop.width ? (uint32_t)es->es->video.crop.width : format->width;
+	format->crop_height = es->es->video.crop.height ? (uint32_t)es->es->video.crop.height : format->height;
+
+	if ((format->stride = mmal_encoding_width_to_stride(es->encoding, format->width)) == 0) {
+
+		format->stride = format->width;
+	}
+}
+
+
+/* Convert format name (I420, RGB24, BGR24, RGBA, BGRA) to encoding, returns 0 when unknown */
+uint32_t frame_encoding_from_name(const char *name) {
+
+	if (strcasecmp(name, "I420") == 0) {
+
+		return MMAL_ENCODING_I420;
+	}
+	else if (strcasecmp(name, "RGB24") == 0) {
+
+		return MMAL_ENCODING_RGB24;
+	}
+	else if (strcasecmp(name, "BGR24") == 0) {
+
+		return MMAL_ENCODING_BGR24;
+	}
+	else if (strcasecmp(name, "RGBA") == 0) {
+
+		return MMAL_ENCODING_RGBA;
+	}
+	else if (strcasecmp(name, "BGRA") == 0) {
+
+		return MMAL_ENCODING_BGRA;
+	}
+
+	return 0;
+}
+
+
+/* Describe the buffer as a NumPy friendly array, falls back to flat bytes when layout does not fit */
+static void frame_set_layout(MmalFrameObject *self) {
+
+	Py_ssize_t needed;
+	const FrameFormat *format = &self->format;
+
+	switch (format->encoding) {
+		case MMAL_ENCODING_RGB24:
+		case MMAL_ENCODING_BGR24:
+		case MMAL_ENCODING_RGBA:
+		case MMAL_ENCODING_BGRA:
+			self->ndim = 3;
+			self->shape[0] = format->crop_height;
+			self->shape[1] = format->crop_width;
+			self->shape[2] = format->encoding == MMAL_ENCODING_RGB24 || format->encoding == MMAL_ENCODING_BGR24 ? 3 : 4;
+			self->strides[0] = format->stride;
+			self->strides[1] = self->shape[2];
+			self->strides[2] = 1;
+			needed = (self->shape[0] - 1) * self->strides[0] + self->shape[1] * self->shape[2];
+			break;
+
+		case MMAL_ENCODING_I420:
+			/* Y plane followed by U and V planes, the classic height * 3 / 2 view */
+			self->ndim = 2;
+			self->shape[0] = format->height * 3 / 2;
+			self->shape[1] = format->stride;
+			self->strides[0] = format->stride;
+			self->strides[1] = 1;
+			needed = self->shape[0] * self->shape[1];
+			break;
+
+		default:
+			needed = -1;
+			break;
+	}
+
+	if (needed < 0 || needed > (Py_ssize_t)self->buffer->length) {
+
+		self->ndim = 1;
+		self->shape[0] = self->buffer->length;
+		self->strides[0] = 1;
+	}
+}
+
+
+/* Takes over one buffer reference and one connection reference */
+PyObject *mmal_frame_new(PyTypeObject *type, MMAL_BUFFER_HEADER_T *buffer, MMAL_CONNECTION_T *connection, const FrameFormat *format) {
+
+	MmalFrameObject *self;
+
+	if ((self = (MmalFrameObject *)type->tp_alloc(type, 0)) == NULL) {
+
+		mmal_buffer_header_release(buffer);
+		mmal_connection_release(connection);
+		return NULL;
+	}
+
+	self->exports = 0;
+	self->buffer = buffer;
+	self->format = *format;
+	self->connection = connection;
+	mmal_buffer_header_mem_lock(buffer);
+	frame_set_layout(self);
+
+	return (PyObject *)self;
+}
+
+
+/* Give the buffer back to the decoder */
+static void frame_release(MmalFrameObject *self) {
+
+	if (self->buffer) {
+		mmal_buffer_header_mem_unlock(self->buffer);
+		mmal_buffer_header_release(self->buffer);
+		self->buffer = NULL;
+	}
+
+	if (self->connection) {
+		mmal_connection_release(self->connection);
+		self->connection = NULL;
+	}
+}
+
+
+static void MmalFrame_free(MmalFrameObject *self) {
+
+	frame_release(self);
+	PyTypeObject *type = Py_TYPE(self);
+
+	type->tp_free((PyObject *)self);
+	MODULE_TYPE_RELEASE(type);
+}
+
+
+PyDoc_STRVAR(MmalFrame_release_doc, "release()\n\nReturn the buffer to the decoder, all memoryviews must be released first.\n");
+static PyObject *MmalFrame_release(MmalFrameObject *self) {
+
+	int exported;
+
+	MODULE_BEGIN_CRITICAL((PyObject *)self);
+
+	if ((exported = self->exports > 0) == 0) {
+
+		frame_release(self);
+	}
+
+	MODULE_END_CRITICAL();
+
+	if (exported) {
+
+		PyErr_SetString(PyExc_BufferError, "frame is still exported");
+		return NULL;
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+static PyObject *MmalFrame_enter(PyObject *self, PyObject *args) {
+
+	Py_INCREF(self);
+	return self;
+}
+
+
+static PyObject *MmalFrame_exit(MmalFrameObject *self, PyObject *args) {
+
+	return MmalFrame_release(self);
+}
+
+
+static int frame_getbuffer(MmalFrameObject *self, Py_buffer *view, int flags) {
+
+	int i;
+
+	if (self->buffer == NULL) {
+
+		PyErr_SetString(PyExc_BufferError, "frame is released");
+		view->obj = NULL;
+		return -1;
+	}
+
+	if (flags & PyBUF_WRITABLE) {
+
+		PyErr_SetString(PyExc_BufferError, "frame is read only");
+		view->obj = NULL;
+		return -1;
+	}
+
+	/* Padded rows can only be described with strides */
+	if ((flags & PyBUF_ND) == PyBUF_ND && (flags & PyBUF_STRIDES) != PyBUF_STRIDES && self->ndim > 1 &&
+	        self->strides[0] != self->shape[1] * (self->ndim == 3 ? self->shape[2] : 1)) {
+
+		PyErr_SetString(PyExc_BufferError, "frame rows are padded, strides are required");
+		view->obj = NULL;
+		return -1;
+	}
+
+	view->obj = (PyObject *)self;
+	view->buf = self->buffer->data + self->buffer->offset;
+	view->len = self->buffer->length;
+
+	/* The shaped view only covers the crop, bytes past it were never written by the decoder */
+	if ((flags & PyBUF_ND) == PyBUF_ND) {
+
+		for (view->len = 1, i = 0; i < self->ndim; i++) {
+
+			view->len *= self->shape[i];
+		}
+	}
+
+	view->readonly = 1;
+	view->itemsize = 1;
+	view->format = (flags & PyBUF_FORMAT) ? "B" : NULL;
+	view->ndim = (flags & PyBUF_ND) == PyBUF_ND ? self->ndim : 1;
+	view->shape = (flags & PyBUF_ND) == PyBUF_ND ? self->shape : NULL;
+	view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+
+	Py_INCREF(self);
+	self->exports++;
+	return 0;
+}
+
+
+/* Exports and release() may race on free-threaded builds */
+static int MmalFrame_getbuffer(MmalFrameObject *self, Py_buffer *view, int flags) {
+
+	int ret;
+
+	MODULE_BEGIN_CRITICAL((PyObject *)self);
+	ret = frame_getbuffer(self, view, flags);
+	MODULE_END_CRITICAL();
+
+	return ret;
+}
+
+
+static void MmalFrame_releasebuffer(MmalFrameObject *self, Py_buffer *view) {
+
+	MODULE_BEGIN_CRITICAL((PyObject *)self);
+	self->exports--;
+	MODULE_END_CRITICAL();
+}
+
+
+static PyMethodDef MmalFrame_methods[] = {
+
+	{"release", (PyCFunction)MmalFrame_release, METH_NOARGS, MmalFrame_release_doc},
+	{"__enter__", (PyCFunction)MmalFrame_enter, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction)MmalFrame_exit, METH_VARARGS, NULL},
+	{NULL},
+};
+
+
+static PyObject *frame_tuple(Py_ssize_t *values, int count) {
+
+	int i;
+	PyObject *result = PyTuple_New(count);
+
+	for (i = 0; result && i < count; i++) {
+
+		PyTuple_SET_ITEM(result, i, PyLong_FromSsize_t(values[i]));
+	}
+
+	return result;
+}
+
+
+PyDoc_STRVAR(MmalFrame_shape_doc, "MmalFrame array shape, (height, width, channels) for RGB formats(read only)\n");
+static PyObject *MmalFrame_get_shape(MmalFrameObject *self, void *closure) {
+
+	return frame_tuple(self->shape, self->ndim);
+}
+
+
+PyDoc_STRVAR(MmalFrame_strides_doc, "MmalFrame array strides in bytes(read only)\n");
+static PyObject *MmalFrame_get_strides(MmalFrameObject *self, void *closure) {
+
+	return frame_tuple(self->strides, self->ndim);
+}
+
+
+PyDoc_STRVAR(MmalFrame_format_doc, "MmalFrame pixel format fourcc, e.g. I420, RGB3, RGBA(read only)\n");
+static PyObject *MmalFrame_get_format(MmalFrameObject *self, void *closure) {
+
+	int size = 4;
+	char fourcc[4];
+
+	memcpy(fourcc, &self->format.encoding, sizeof(fourcc));
+
+	while (size > 0 && fourcc[size - 1] == ' ') {
+
+		size--;
+	}
+
+	return PyUnicode_FromStringAndSize(fourcc, size);
+}
+
+
+PyDoc_STRVAR(MmalFrame_width_doc, "MmalFrame visible width in pixels(read only)\n");
+static PyObject *MmalFrame_get_width(MmalFrameObject *self, void *closure) {
+
+	return Py_BuildValue("I", self->format.crop_width);
+}
+
+
+PyDoc_STRVAR(MmalFrame_height_doc, "MmalFrame visible height in pixels(read only)\n");
+static PyObject *MmalFrame_get_height(MmalFrameObject *self, void *closure) {
+
+	return Py_BuildValue("I", self->format.crop_height);
+}
+
+
+PyDoc_STRVAR(MmalFrame_pts_doc, "MmalFrame presentation timestamp in microseconds or None(read only)\n");
+static PyObject *MmalFrame_get_pts(MmalFrameObject *self, void *closure) {
+
+	if (self->buffer == NULL || self->buffer->pts == MMAL_TIME_UNKNOWN) {
+
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	return PyLong_FromLongLong(self->buffer->pts);
+}
+
+
+PyDoc_STRVAR(MmalFrame_released_doc, "MmalFrame buffer is returned to the decoder(read only)\n");
+static PyObject *MmalFrame_is_released(MmalFrameObject *self, void *closure) {
+
+	return PyBool_FromLong(self->buffer == NULL);
+}
+
+
+static PyGetSetDef MmalFrame_getseters[] = {
+
+	{"shape", (getter)MmalFrame_get_shape, (setter)NULL, MmalFrame_shape_doc},
+	{"strides", (getter)MmalFrame_get_strides, (setter)NULL, MmalFrame_strides_doc},
+	{"format", (getter)MmalFrame_get_format, (setter)NULL, MmalFrame_format_doc},
+	{"width", (getter)MmalFrame_get_width, (setter)NULL, MmalFrame_width_doc},
+	{"height", (getter)MmalFrame_get_height, (setter)NULL, MmalFrame_height_doc},
+	{"pts", (getter)MmalFrame_get_pts, (setter)NULL, MmalFrame_pts_doc},
+	{"released", (getter)MmalFrame_is_released, (setter)NULL, MmalFrame_released_doc},
+	{NULL},
+};
+
+
+static PyType_Slot MmalFrame_slots[] = {
+	{Py_tp_doc, (void *)MmalFrameObject_type_doc},
+	{Py_tp_dealloc, (void *)MmalFrame_free},
+	{Py_tp_methods, (void *)MmalFrame_methods},
+	{Py_tp_getset, (void *)MmalFrame_getseters},
+	{Py_bf_getbuffer, (void *)MmalFrame_getbuffer},
+	{Py_bf_releasebuffer, (void *)MmalFrame_releasebuffer},
+	{0, NULL},
+};
+
+
+PyType_Spec MmalFrame_spec = {
+	"pylibmmal." MmalFrame_name,
+	sizeof(MmalFrameObject),
+	0,
+	Py_TPFLAGS_DEFAULT | MODULE_TPFLAGS_NO_NEW,
+	MmalFrame_slots,
+};
@@ -0,0 +1,23 @@
+#ifndef _MMAL_FRAME_H_
+#define _MMAL_FRAME_H_
+
+#include <mmal.h>
+#include <util/mmal_connection.h>
+
+#define MmalFrame_name "MmalFrame"
+
+/* Pixel layout of a decoded buffer, captured when the buffer was produced */
+typedef struct {
+	uint32_t encoding;
+	uint32_t width, height;
+	uint32_t crop_width, crop_height;
+	uint32_t stride;
+} FrameFormat;
+
+extern PyType_Spec MmalFrame_spec;
+
+void frame_format_from_es(FrameFormat *format, MMAL_ES_FORMAT_T *es);
+uint32_t frame_encoding_from_name(const char *name);
+PyObject *mmal_frame_new(PyTypeObject *type, MMAL_BUFFER_HEADER_T *buffer, MMAL_CONNECTION_T *connection, const FrameFormat *format);
+
+#endif
@@ -1,198 +1,2469 @@
 #include <Python.h>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
 #include <mmal.h>
-#include <bcm_host.h>
-#include <util/mmal_graph.h>
-#include <util/mmal_util_params.h>
-#include <util/mmal_default_components.h>
+#include <interface/vcos/vcos.h>
+#include "constants.h"
 #include "mmal_graph.h"
+#include "mmal_frame.h"
+#include "event_queue.h"
+#include "frame_cache.h"
+#include "timing_feed.h"
+#include "mmal_pipeline.h"
+#include "mmal_animator.h"
+#include "module_state.h"
+#include "trace.h"
+
+
+PyDoc_STRVAR(MmalGraphObject_type_doc,
+             "MmalGraph(display=HDMI, persistent=False, tap=None, resize=None, links=None, cache=0, timing=False, timing_batch=64)\n"
+             "-> Video core graph object.\n"
+             "display is a display number, a dict with display, fullscreen, dest_rect and transform,\n"
+             "or a list of those to decode once and render on every display.\n"
+             "resize=(width, height) or resize=True (current display mode) scales decoded pictures in hardware\n"
+             "before the renderer, keeping the aspect ratio.\n"
+             "links maps 'reader', 'decoder', 'resizer' or 'splitter' to the options of the connection leaving it:\n"
+             "{'buffer_num', 'buffer_size', 'tunnelling', 'zero_copy'}, stats() reports the values in effect.\n"
+             "cache=bytes keeps decoded pictures of files in host memory up to that budget, evicting the least recently\n"
+             "used. Opening a cached file again (same size and mtime) sends the picture straight to the renderer.\n"
+             "Pictures are copied off the decoder link, so it is not tunnelled while the cache is on.\n"
+             "timing=True records when each frame reaches the renderer against its pts, stats() reports intervals,\n"
+             "jitter, late, dropped and missing frames. A callable also gets lists of up to timing_batch MmalGraphTiming\n"
+             "samples from a background thread, at least once a second. Timing forwards the decoder link on the host.\n");
+typedef struct {
+	PyObject_HEAD;
+	int tap;
+	int persistent;
+	uint32_t tap_encoding;
+	uint64_t open_time;
+	uint32_t display_count;
+	MMAL_DISPLAYREGION_T displays[PIPELINE_OUTPUTS];
+	int resize_mode;
+	uint32_t resize_width, resize_height;
+	LinkOptions links[PIPELINE_LINK_KINDS];
+	FrameCache cache;
+	int timing;
+	uint32_t timing_batch;
+	PyObject *timing_callback;
+	PyInterpreterState *interp;
+	TimingFeed timing_feed;
+	MmalPipeline *active, *standby;
+	RegionAnimator animator;
+	/* Set by close(), native drivers such as playlists stop until the graph is opened again */
+	int closed;
+	pthread_mutex_t lock;
+	EventQueue events;
+	PyObject *backlog, *eos_waiters, *loop;
+} MmalGraphObject;
+
+
+static PyStructSequence_Field MmalGraphEvent_fields[] = {
+	{"type", "Event type (EVENT_EOS, EVENT_ERROR, EVENT_FORMAT_CHANGED, EVENT_PARAMETER_CHANGED)"},
+	{"source", "Name of the port which raised the event"},
+	{"status", "MMAL status code carried by EVENT_ERROR"},
+	{"timestamp", "Monotonic clock time in seconds, comparable with time.monotonic()"},
+	{NULL},
+};
+
+PyStructSequence_Desc MmalGraphEvent_desc = {
+	"pylibmmal." MmalGraphEvent_name,
+	"Graph control event",
+	MmalGraphEvent_fields,
+	4,
+};
+
+
+static PyStructSequence_Field MmalGraphTiming_fields[] = {
+	{"pts", "Presentation timestamp of the frame in microseconds, None when the stream has none"},
+	{"timestamp", "Monotonic clock time in seconds the frame was sent to the renderer, comparable with time.monotonic()"},
+	{"interval", "Seconds since the previous frame was sent"},
+	{"lateness", "Seconds behind the pts schedule of the stream"},
+	{"vsyncs", "Vsyncs since the previous frame, 0 when it was replaced before scanout, None without a vsync source"},
+	{NULL},
+};
+
+PyStructSequence_Desc MmalGraphTiming_desc = {
+	"pylibmmal." MmalGraphTiming_name,
+	"Presentation timing of one frame",
+	MmalGraphTiming_fields,
+	5,
+};
+
+
+/* Background open_async() request */
+typedef struct {
+	char *uri;
+	PyObject *callback;
+	MmalGraphObject *graph;
+	PyInterpreterState *interp;
+} GraphOpenJob;
+
+
+/* Runs on tap_thread, only frames of the shown pipeline are streamed */
+static void graph_timing_push(MmalPipeline *pipeline, const TimingSample *sample) {
+
+	MmalGraphObject *self = pipeline->owner;
+
+	if (pipeline == __atomic_load_n(&self->active, __ATOMIC_ACQUIRE)) {
+
+		timing_feed_push(&self->timing_feed, sample);
+	}
+}
+
+
+static PyObject *graph_timing_object(ModuleState *state, const TimingSample *sample) {
+
+	PyObject *item;
+
+	if ((item = PyStructSequence_New(state->graph_timing_type)) == NULL) {
+
+		return NULL;
+	}
+
+	if (sample->pts == MMAL_TIME_UNKNOWN) {
+
+		Py_INCREF(Py_None);
+		PyStructSequence_SET_ITEM(item, 0, Py_None);
+	}
+	else {
+
+		PyStructSequence_SET_ITEM(item, 0, PyLong_FromLongLong(sample->pts));
+	}
+
+	PyStructSequence_SET_ITEM(item, 1, PyFloat_FromDouble(sample->time_us / 1000000.0));
+	PyStructSequence_SET_ITEM(item, 2, PyFloat_FromDouble(sample->interval_us / 1000000.0));
+	PyStructSequence_SET_ITEM(item, 3, PyFloat_FromDouble(sample->lateness_us / 1000000.0));
+
+	if (sample->vsyncs < 0) {
+
+		Py_INCREF(Py_None);
+		PyStructSequence_SET_ITEM(item, 4, Py_None);
+	}
+	else {
+
+		PyStructSequence_SET_ITEM(item, 4, PyLong_FromLong(sample->vsyncs));
+	}
+
+	return item;
+}
+
+
+/* Runs on the timing feed thread, attaches to the interpreter which created the graph to call the callback */
+static void graph_timing_deliver(void *arg, const TimingSample *samples, uint32_t count) {
+
+	uint32_t i;
+	PyThreadState *tstate;
+	ModuleState *state;
+	MmalGraphObject *self = arg;
+	PyObject *list, *item, *result = NULL;
+
+	tstate = PyThreadState_New(self->interp);
+	PyEval_RestoreThread(tstate);
+
+	if ((state = module_state_by_type(Py_TYPE(self))) != NULL && (list = PyList_New(count)) != NULL) {
+
+		for (i = 0; i < count; i++) {
+
+			if ((item = graph_timing_object(state, &samples[i])) == NULL) {
+
+				break;
+			}
+
+			PyList_SET_ITEM(list, i, item);
+		}
+
+		if (i == count) {
+
+			result = PyObject_CallFunctionObjArgs(self->timing_callback, list, NULL);
+		}
+
+		Py_DECREF(list);
+	}
+
+	if (!result) {
+
+		PyErr_WriteUnraisable(self->timing_callback);
+	}
+
+	Py_XDECREF(result);
+	PyThreadState_Clear(tstate);
+	PyThreadState_DeleteCurrent();
+}
+
+
+/* Runs on a MMAL thread, queue the event for Python and never block */
+static void graph_pipeline_event(MmalPipeline *pipeline, MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	uint32_t status = 0;
+	MmalGraphObject *self = pipeline->owner;
+
+	/* A prefetched item reports its events once it is shown */
+	if (pipeline != __atomic_load_n(&self->active, __ATOMIC_ACQUIRE)) {
+
+		return;
+	}
+
+	if (buffer->cmd == MMAL_EVENT_ERROR && buffer->length >= sizeof(uint32_t)) {
+
+		status = *(uint32_t *)buffer->data;
+	}
+
+	event_queue_push(&self->events, buffer->cmd, status, 0, port->name);
+}
+
+
+static PyObject *MmalGraph_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+
+	MmalGraphObject *self;
+
+	if ((self = (MmalGraphObject *)type->tp_alloc(type, 0)) == NULL) {
+
+		return NULL;
+	}
+
+	self->tap = 0;
+	self->tap_encoding = 0;
+	self->active = NULL;
+	self->standby = NULL;
+	self->persistent = 0;
+	self->open_time = 0;
+	self->display_count = 1;
+	self->resize_mode = PIPELINE_RESIZE_OFF;
+	self->resize_width = self->resize_height = 0;
+	memset(self->displays, 0, sizeof(self->displays));
+	self->displays[0].display_num = HDMI;
+	frame_cache_init(&self->cache, 0);
+	self->timing = 0;
+	self->timing_batch = GRAPH_TIMING_BATCH;
+	self->timing_callback = NULL;
+	timing_feed_init(&self->timing_feed);
+	self->loop = NULL;
+	self->events.fd = -1;
+	self->closed = 0;
+	pthread_mutex_init(&self->lock, NULL);
+	animator_init(&self->animator);
+
+	if (event_queue_init(&self->events) != 0) {
+
+		PyErr_SetFromErrno(PyExc_OSError);
+		Py_DECREF(self);
+		return NULL;
+	}
+
+	if ((self->backlog = PyList_New(0)) == NULL || (self->eos_waiters = PyList_New(0)) == NULL) {
+
+		Py_DECREF(self);
+		return NULL;
+	}
+
+	if ((self->active = pipeline_new(self, graph_pipeline_event)) == NULL) {
+
+		Py_DECREF(self);
+		return PyErr_NoMemory();
+	}
+
+	memcpy(self->links, self->active->link_options, sizeof(self->links));
+
+	pipeline_set_outputs(self->active, self->displays, self->display_count);
+
+	return (PyObject *)self;
+}
+
+
+/* Take the graph lock, the GIL is only released when the lock is contended */
+static void graph_lock(MmalGraphObject *self) {
+
+	if (pthread_mutex_trylock(&self->lock) != 0) {
+
+		Py_BEGIN_ALLOW_THREADS
+		pthread_mutex_lock(&self->lock);
+		Py_END_ALLOW_THREADS
+	}
+}
+
+
+/* Move the picture pipeline decoded into the frame cache, called with self->lock held and without the GIL */
+static void graph_cache_store(MmalGraphObject *self, MmalPipeline *pipeline) {
+
+	FrameCacheEntry *entry;
+
+	if (pipeline == NULL || !pipeline->capture || pipeline->uri == NULL || (entry = pipeline_take_capture(pipeline)) == NULL) {
+
+		return;
+	}
+
+	entry->key = pipeline->capture_key;
+
+	if ((entry->uri = strdup(pipeline->uri)) == NULL) {
+
+		frame_cache_entry_free(entry);
+		return;
+	}
+
+	frame_cache_insert(&self->cache, entry);
+}
+
+
+/* Tap the decoder link for Python, or only to capture pictures for the cache or time frames */
+static void graph_set_tap(MmalGraphObject *self, MmalPipeline *pipeline) {
+
+	pipeline->tap = self->tap || self->cache.budget || self->timing;
+	pipeline->tap_depth = self->tap ? PIPELINE_TAP_DEPTH : 0;
+	pipeline->tap_encoding = self->tap_encoding;
+	pipeline->timing = self->timing;
+	pipeline->timing_cb = self->timing_callback ? graph_timing_push : NULL;
+}
+
+
+/* Open uri on pipeline, from the frame cache when it holds the picture. Called with self->lock held and without the GIL */
+static int graph_pipeline_open(MmalGraphObject *self, MmalPipeline *pipeline, const char *uri, GraphError *err) {
+
+	FrameCacheKey key;
+	FrameCacheEntry *entry;
+
+	/* Pictures decoded by either pipeline since their open may be the one asked for */
+	graph_cache_store(self, self->active);
+	graph_cache_store(self, self->standby);
+	pipeline->capture = 0;
+
+	if (self->cache.budget == 0 || frame_cache_key(uri, &key) != 0) {
+
+		return pipeline_open(pipeline, uri, self->persistent, err);
+	}
+
+	if ((entry = frame_cache_lookup(&self->cache, uri, &key)) != NULL) {
+
+		return pipeline_open_frame(pipeline, entry, self->persistent, err);
+	}
+
+	pipeline->capture = 1;
+	pipeline->capture_key = key;
+	return pipeline_open(pipeline, uri, self->persistent, err);
+}
+
+
+/* Release everything, called with self->lock held and without the GIL */
+static void graph_teardown(MmalGraphObject *self) {
+
+	animator_stop(&self->animator);
+	graph_cache_store(self, self->active);
+	graph_cache_store(self, self->standby);
+
+	if (self->active) {
+
+		pipeline_teardown(self->active);
+	}
+
+	if (self->standby) {
+
+		pipeline_teardown(self->standby);
+	}
+}
+
+
+PyDoc_STRVAR(MmalGraph_close_doc, "close()\n\nStop playback, a playlist driving the graph stops too.\n");
+static PyObject *MmalGraph_close(MmalGraphObject *self) {
+
+	TRACE_SCOPE("MmalGraph.close");
+
+	graph_lock(self);
+
+	Py_BEGIN_ALLOW_THREADS
+	graph_teardown(self);
+	self->closed = 1;
+	Py_END_ALLOW_THREADS
+
+	pthread_mutex_unlock(&self->lock);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+/* Callables and futures held by the graph often refer back to it, e.g. timing=self.on_timing */
+static int MmalGraph_traverse(MmalGraphObject *self, visitproc visit, void *arg) {
+
+#if PY_VERSION_HEX >= 0x03090000
+	Py_VISIT(Py_TYPE(self));
+#endif
+	Py_VISIT(self->timing_callback);
+	Py_VISIT(self->loop);
+	Py_VISIT(self->backlog);
+	Py_VISIT(self->eos_waiters);
+	return 0;
+}
+
+
+/* Break reference cycles, the event lists stay usable for a finalizer which still reaches the graph */
+static int MmalGraph_clear(MmalGraphObject *self) {
+
+	/* A batch may be on its way to the callback, it needs the GIL to finish */
+	Py_BEGIN_ALLOW_THREADS
+	timing_feed_stop(&self->timing_feed);
+	Py_END_ALLOW_THREADS
+
+	Py_CLEAR(self->timing_callback);
+	Py_CLEAR(self->loop);
+
+	if (self->backlog) {
+
+		PyList_SetSlice(self->backlog, 0, PyList_GET_SIZE(self->backlog), NULL);
+	}
+
+	if (self->eos_waiters) {
+
+		PyList_SetSlice(self->eos_waiters, 0, PyList_GET_SIZE(self->eos_waiters), NULL);
+	}
+
+	return 0;
+}
+
+
+static void MmalGraph_free(MmalGraphObject *self) {
+
+	PyObject *ref;
+
+	PyObject_GC_UnTrack(self);
+	ref = MmalGraph_close(self);
+	Py_XDECREF(ref);
+
+	pipeline_free(self->active);
+	pipeline_free(self->standby);
+	frame_cache_clear(&self->cache);
+	animator_destroy(&self->animator);
+
+	/* A batch may be on its way to the callback, it needs the GIL to finish */
+	Py_BEGIN_ALLOW_THREADS
+	timing_feed_destroy(&self->timing_feed);
+	Py_END_ALLOW_THREADS
+	Py_XDECREF(self->timing_callback);
+	Py_XDECREF(self->loop);
+	Py_XDECREF(self->backlog);
+	Py_XDECREF(self->eos_waiters);
+	event_queue_destroy(&self->events);
+	pthread_mutex_destroy(&self->lock);
+	PyTypeObject *type = Py_TYPE(self);
+
+	type->tp_free((PyObject *)self);
+	MODULE_TYPE_RELEASE(type);
+}
+
+
+/* Region fields of a dict, alpha and layer are only accepted for a live update */
+static int graph_parse_fields(PyObject *item, MMAL_DISPLAYREGION_T *region, int live) {
+
+	long value;
+	Py_ssize_t pos = 0;
+	PyObject *key, *field;
+	static const char *names[] = {"fullscreen", "dest_rect", "transform", "display", "alpha", "layer", "output", NULL};
+
+	while (PyDict_Next(item, &pos, &key, &field)) {
+
+		const char **name = names;
+		PyObject *ascii = PyUnicode_Check(key) ? PyUnicode_AsASCIIString(key) : (Py_INCREF(key), key);
+
+		if (ascii == NULL) {
+
+			return -1;
+		}
+
+		while (*name && (!PyBytes_Check(ascii) || strcmp(*name, PyBytes_AsString(ascii)) != 0)) {
+
+			name++;
+		}
+
+		Py_DECREF(ascii);
+
+		/* display only names a constructor entry, the rest only make sense on a live graph */
+		if (*name == NULL || (live ? name - names == 3 : name - names > 3)) {
+
+			PyErr_Format(PyExc_TypeError, "unexpected display region field %R", key);
+			return -1;
+		}
+	}
+
+	if ((field = PyDict_GetItemString(item, "fullscreen")) != NULL) {
+
+		region->set |= MMAL_DISPLAY_SET_FULLSCREEN;
+		region->fullscreen = PyObject_IsTrue(field) ? MMAL_TRUE : MMAL_FALSE;
+	}
+
+	if ((field = PyDict_GetItemString(item, "dest_rect")) != NULL) {
+
+		if (!PyArg_ParseTuple(field, "iiii;dest_rect must be (x, y, width, height)", &region->dest_rect.x, &region->dest_rect.y,
+		                      &region->dest_rect.width, &region->dest_rect.height)) {
+
+			return -1;
+		}
+
+		/* The renderer ignores dest_rect while fullscreen */
+		if (!(region->set & MMAL_DISPLAY_SET_FULLSCREEN)) {
+
+			region->set |= MMAL_DISPLAY_SET_FULLSCREEN;
+			region->fullscreen = MMAL_FALSE;
+		}
+
+		region->set |= MMAL_DISPLAY_SET_DEST_RECT;
+	}
+
+	if ((field = PyDict_GetItemString(item, "transform")) != NULL) {
+
+		if ((value = PyLong_AsLong(field)) == -1 && PyErr_Occurred()) {
+
+			return -1;
+		}
+
+		if (value < MMAL_DISPLAY_ROT0 || value > MMAL_DISPLAY_MIRROR_ROT270) {
+
+			PyErr_SetString(PyExc_ValueError, "transform must be between 0 and 7");
+			return -1;
+		}
+
+		region->set |= MMAL_DISPLAY_SET_TRANSFORM;
+		region->transform = value;
+	}
+
+	if ((field = PyDict_GetItemString(item, "alpha")) != NULL) {
+
+		if ((value = PyLong_AsLong(field)) == -1 && PyErr_Occurred()) {
+
+			return -1;
+		}
+
+		if (value < 0 || value > 255) {
+
+			PyErr_SetString(PyExc_ValueError, "alpha must be between 0 and 255");
+			return -1;
+		}
+
+		region->set |= MMAL_DISPLAY_SET_ALPHA;
+		region->alpha = value;
+	}
+
+	if ((field = PyDict_GetItemString(item, "layer")) != NULL) {
+
+		if ((value = PyLong_AsLong(field)) == -1 && PyErr_Occurred()) {
+
+			return -1;
+		}
+
+		region->set |= MMAL_DISPLAY_SET_LAYER;
+		region->layer = value;
+	}
+
+	return 0;
+}
+
+
+/* Display region settings from a display number or a dict with display, fullscreen, dest_rect and transform */
+static int graph_parse_region(PyObject *item, MMAL_DISPLAYREGION_T *region) {
+
+	long value;
+	PyObject *field;
+
+	if (!PyDict_Check(item)) {
+
+		if ((value = PyLong_AsLong(item)) == -1 && PyErr_Occurred()) {
+
+			PyErr_SetString(PyExc_TypeError, "display must be a number or a dict");
+			return -1;
+		}
+
+		region->display_num = value;
+		return 0;
+	}
+
+	if ((field = PyDict_GetItemString(item, "display")) == NULL) {
+
+		PyErr_SetString(PyExc_KeyError, "display");
+		return -1;
+	}
+
+	if ((value = PyLong_AsLong(field)) == -1 && PyErr_Occurred()) {
+
+		return -1;
+	}
+
+	region->display_num = value;
+	return graph_parse_fields(item, region, 0);
+}
+
+
+/* display is one display or a list of up to PIPELINE_OUTPUTS, each a number or a region dict */
+static int graph_parse_displays(PyObject *display, MMAL_DISPLAYREGION_T *regions, uint32_t *count) {
+
+	Py_ssize_t i, size;
+
+	memset(regions, 0, sizeof(MMAL_DISPLAYREGION_T) * PIPELINE_OUTPUTS);
+
+	if (!PyList_Check(display) && !PyTuple_Check(display)) {
+
+		*count = 1;
+		return graph_parse_region(display, &regions[0]);
+	}
+
+	if ((size = PySequence_Fast_GET_SIZE(display)) < 1 || size > PIPELINE_OUTPUTS) {
+
+		PyErr_Format(PyExc_ValueError, "between 1 and %d displays are supported", PIPELINE_OUTPUTS);
+		return -1;
+	}
+
+	for (i = 0; i < size; i++) {
+
+		if (graph_parse_region(PySequence_Fast_GET_ITEM(display, i), &regions[i]) != 0) {
+
+			return -1;
+		}
+	}
+
+	*count = size;
+	return 0;
+}
+
+
+/* resize is None, True for the display mode, or a (width, height) tuple */
+static int graph_parse_resize(PyObject *resize, int *mode, uint32_t *width, uint32_t *height) {
+
+	int w = 0, h = 0;
+
+	*width = *height = 0;
+
+	if (resize == Py_None || resize == Py_False) {
+
+		*mode = PIPELINE_RESIZE_OFF;
+		return 0;
+	}
+
+	if (resize == Py_True) {
+
+		*mode = PIPELINE_RESIZE_DISPLAY;
+		return 0;
+	}
+
+	if (!PyTuple_Check(resize) || !PyArg_ParseTuple(resize, "ii;resize must be True or (width, height)", &w, &h)) {
+
+		if (!PyErr_Occurred()) {
+
+			PyErr_SetString(PyExc_TypeError, "resize must be True or (width, height)");
+		}
+
+		return -1;
+	}
+
+	if (w <= 0 || h <= 0) {
+
+		PyErr_SetString(PyExc_ValueError, "resize width and height must be positive");
+		return -1;
+	}
+
+	*width = w;
+	*height = h;
+	*mode = PIPELINE_RESIZE_FIXED;
+	return 0;
+}
+
+
+/* Optional unsigned or boolean entry of a link options dict, value is left alone when missing */
+static int graph_link_option(PyObject *item, const char *name, int boolean, long *value) {
+
+	PyObject *field;
+
+	if ((field = PyDict_GetItemString(item, name)) == NULL) {
+
+		return 0;
+	}
+
+	if (boolean) {
+
+		*value = PyObject_IsTrue(field);
+		return *value < 0 ? -1 : 0;
+	}
+
+	if (((*value = PyLong_AsLong(field)) == -1 && PyErr_Occurred()) || *value < 0) {
+
+		if (!PyErr_Occurred()) {
+
+			PyErr_Format(PyExc_ValueError, "%s must not be negative", name);
+		}
+
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* links is None or a dict of link kind to {'buffer_num', 'buffer_size', 'tunnelling', 'zero_copy'} */
+static int graph_parse_links(PyObject *links, LinkOptions *options) {
+
+	int kind;
+	long value;
+	Py_ssize_t pos = 0;
+	PyObject *key, *item;
+	static const char *kinds[PIPELINE_LINK_KINDS] = {"reader", "decoder", "resizer", "splitter"};
+
+	for (kind = 0; kind < PIPELINE_LINK_KINDS; kind++) {
+
+		memset(&options[kind], 0, sizeof(LinkOptions));
+		options[kind].tunnelling = -1;
+		options[kind].zero_copy = -1;
+	}
+
+	if (links == Py_None) {
+
+		return 0;
+	}
+
+	if (!PyDict_Check(links)) {
+
+		PyErr_SetString(PyExc_TypeError, "links must be a dict");
+		return -1;
+	}
+
+	while (PyDict_Next(links, &pos, &key, &item)) {
+
+		for (kind = 0; kind < PIPELINE_LINK_KINDS; kind++) {
+
+			PyObject *name = PyUnicode_FromString(kinds[kind]);
+			int match = name ? PyObject_RichCompareBool(key, name, Py_EQ) : -1;
+
+			Py_XDECREF(name);
+
+			if (match < 0) {
+
+				return -1;
+			}
+
+			if (match) {
+
+				break;
+			}
+		}
+
+		if (kind == PIPELINE_LINK_KINDS) {
+
+			PyErr_Format(PyExc_KeyError, "unknown link %R (reader, decoder, resizer, splitter)", key);
+			return -1;
+		}
+
+		if (!PyDict_Check(item)) {
+
+			PyErr_SetString(PyExc_TypeError, "link options must be a dict");
+			return -1;
+		}
+
+		/* Every key is checked so a typo does not silently keep the default */
+		if (PyDict_Size(item) != (PyDict_GetItemString(item, "buffer_num") != NULL) + (PyDict_GetItemString(item, "buffer_size") != NULL) +
+		                         (PyDict_GetItemString(item, "tunnelling") != NULL) + (PyDict_GetItemString(item, "zero_copy") != NULL)) {
+
+			PyErr_SetString(PyExc_KeyError, "link options are buffer_num, buffer_size, tunnelling and zero_copy");
+			return -1;
+		}
+
+		value = options[kind].buffer_num;
+		if (graph_link_option(item, "buffer_num", 0, &value) != 0) {
+
+			return -1;
+		}
+		options[kind].buffer_num = value;
+
+		value = options[kind].buffer_size;
+		if (graph_link_option(item, "buffer_size", 0, &value) != 0) {
+
+			return -1;
+		}
+		options[kind].buffer_size = value;
+
+		value = options[kind].tunnelling;
+		if (graph_link_option(item, "tunnelling", 1, &value) != 0) {
+
+			return -1;
+		}
+		options[kind].tunnelling = value;
+
+		value = options[kind].zero_copy;
+		if (graph_link_option(item, "zero_copy", 1, &value) != 0) {
+
+			return -1;
+		}
+		options[kind].zero_copy = value;
+	}
+
+	return 0;
+}
+
+
+static int MmalGraph_init(MmalGraphObject *self, PyObject *args, PyObject *kwds) {
+
+	int persistent = 0, resize_mode, timing_on, tap_on, ret = 0;
+	Py_ssize_t cache = 0;
+	unsigned int timing_batch = GRAPH_TIMING_BATCH;
+	uint32_t display_count = 0, resize_width, resize_height, tap_encoding = 0;
+	PyObject *tap = Py_None, *display = Py_None, *resize = Py_None, *links = Py_None, *timing = Py_None, *callback = NULL;
+	PyObject *previous;
+	LinkOptions link_options[PIPELINE_LINK_KINDS];
+	MMAL_DISPLAYREGION_T displays[PIPELINE_OUTPUTS];
+	static char *kwlist[] = {"display", "persistent", "tap", "resize", "links", "cache", "timing", "timing_batch", NULL};
+	TRACE_SCOPE("MmalGraph.__init__");
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OiOOOnOI", kwlist, &display, &persistent, &tap, &resize, &links, &cache,
+	                                 &timing, &timing_batch)) {
+
+		return -1;
+	}
+
+	if (cache < 0) {
+
+		PyErr_SetString(PyExc_ValueError, "cache must be a budget in bytes, 0 disables it");
+		return -1;
+	}
+
+	if (timing_batch == 0 || timing_batch > GRAPH_TIMING_BATCH_MAX) {
+
+		PyErr_Format(PyExc_ValueError, "timing_batch must be between 1 and %d", GRAPH_TIMING_BATCH_MAX);
+		return -1;
+	}
+
+	/* timing=callable streams the samples, anything true only keeps the statistics */
+	if (timing != Py_None && PyCallable_Check(timing)) {
+
+		callback = timing;
+		timing_on = 1;
+	}
+	else if ((timing_on = timing != Py_None ? PyObject_IsTrue(timing) : 0) < 0) {
+
+		return -1;
+	}
+
+	if (graph_parse_links(links, link_options) != 0) {
+
+		return -1;
+	}
+
+	if (display != Py_None && graph_parse_displays(display, displays, &display_count) != 0) {
+
+		return -1;
+	}
+
+	if (graph_parse_resize(resize, &resize_mode, &resize_width, &resize_height) != 0) {
+
+		return -1;
+	}
+
+	/* tap=True shares decoder output as is, a format name asks the decoder to convert */
+	if (PyUnicode_Check(tap) || PyBytes_Check(tap)) {
+
+		PyObject *name = PyUnicode_Check(tap) ? PyUnicode_AsASCIIString(tap) : (Py_INCREF(tap), tap);
+
+		if (name == NULL) {
+
+			return -1;
+		}
+
+		tap_encoding = frame_encoding_from_name(PyBytes_AsString(name));
+		Py_DECREF(name);
+
+		if (tap_encoding == 0) {
+
+			PyErr_SetString(PyExc_ValueError, "invalid tap format (I420, RGB24, BGR24, RGBA, BGRA)");
+			return -1;
+		}
+
+		tap_on = 1;
+	}
+	else if ((tap_on = tap != Py_None ? PyObject_IsTrue(tap) : 0) < 0) {
+
+		return -1;
+	}
+
+	/* Cached pictures skip the decoder, so there would be no frames for Python */
+	if (tap_on && cache) {
+
+		PyErr_SetString(PyExc_ValueError, "tap and cache can't be used together");
+		return -1;
+	}
+
+	/* New displays, resize stage, links or cache budget need new components, so a built graph is released first */
+	if (display_count || resize_mode != self->resize_mode || resize_width != self->resize_width || resize_height != self->resize_height ||
+	    memcmp(link_options, self->links, sizeof(link_options)) != 0 || (size_t)cache != self->cache.budget || timing_on != self->timing) {
+
+		graph_lock(self);
+
+		Py_BEGIN_ALLOW_THREADS
+		graph_teardown(self);
+		Py_END_ALLOW_THREADS
+
+		/* Cached pictures were decoded for the old displays and resize stage */
+		frame_cache_clear(&self->cache);
+		self->cache.budget = (size_t)cache;
+
+		if (display_count) {
+
+			memcpy(self->displays, displays, sizeof(displays));
+			self->display_count = display_count;
+		}
+
+		self->resize_mode = resize_mode;
+		self->resize_width = resize_width;
+		self->resize_height = resize_height;
+		memcpy(self->links, link_options, sizeof(link_options));
+		pipeline_set_outputs(self->active, self->displays, self->display_count);
+		pipeline_set_resize(self->active, self->resize_mode, self->resize_width, self->resize_height);
+		pipeline_set_link_options(self->active, self->links);
+
+		if (self->standby) {
+
+			pipeline_set_outputs(self->standby, self->displays, self->display_count);
+			pipeline_set_resize(self->standby, self->resize_mode, self->resize_width, self->resize_height);
+			pipeline_set_link_options(self->standby, self->links);
+		}
+
+		pthread_mutex_unlock(&self->lock);
+	}
+
+	/* Reinit case, the old callback gets no more samples */
+	Py_BEGIN_ALLOW_THREADS
+	timing_feed_stop(&self->timing_feed);
+	Py_END_ALLOW_THREADS
+
+	/* Every argument is valid, apply them at once. The old callback is released without the lock, it may run any code */
+	graph_lock(self);
+	Py_XINCREF(callback);
+	previous = self->timing_callback;
+	self->timing_callback = callback;
+	self->timing = timing_on;
+	self->timing_batch = timing_batch;
+	self->tap = tap_on;
+	self->tap_encoding = tap_encoding;
+	self->persistent = persistent ? 1 : 0;
+	graph_set_tap(self, self->active);
+	pthread_mutex_unlock(&self->lock);
+	Py_XDECREF(previous);
+
+	if (callback) {
+
+#if PY_VERSION_HEX >= 0x03090000
+		self->interp = PyInterpreterState_Get();
+#else
+		self->interp = PyThreadState_Get()->interp;
+#endif
+
+		if ((ret = timing_feed_start(&self->timing_feed, timing_batch, graph_timing_deliver, self)) != 0) {
+
+			PyErr_SetString(PyExc_RuntimeError, "failed to start timing thread");
+		}
+	}
+
+	return ret;
+}
+
+
+static PyObject *MmalGraph_enter(PyObject *self, PyObject *args) {
+
+	Py_INCREF(self);
+	return self;
+}
+
+
+static PyObject *MmalGraph_exit(MmalGraphObject *self, PyObject *args) {
+
+	PyObject *exc_type = 0;
+	PyObject *exc_value = 0;
+	PyObject *traceback = 0;
+
+	if (!PyArg_UnpackTuple(args, "__exit__", 3, 3, &exc_type, &exc_value, &traceback)) {
+
+		return 0;
+	}
+
+	Py_XDECREF(MmalGraph_close(self));
+	Py_RETURN_FALSE;
+}
+
+
+/* Open uri on self, called with self->lock held and without the GIL */
+static int graph_open_uri(MmalGraphObject *self, const char *uri, GraphError *err) {
+
+	uint64_t start = vcos_getmicrosecs64();
+
+	/* Components may be rebuilt under a running animation */
+	animator_stop(&self->animator);
+	self->closed = 0;
+
+	if (graph_pipeline_open(self, self->active, uri, err) != 0) {
+
+		return -1;
+	}
+
+	self->open_time = vcos_getmicrosecs64() - start;
+	return 0;
+}
+
+
+PyDoc_STRVAR(MmalGraph_open_doc, "open(uri)\n\nOpen a uri to start playback, a persistent graph only swaps the reader uri.\n");
+static PyObject *MmalGraph_open(MmalGraphObject *self, PyObject *args, PyObject *kwds) {
+
+	int ret;
+	char *uri = NULL;
+	GraphError err = {NULL, NULL};
+	TRACE_SCOPE("MmalGraph.open");
+
+	/* Get input uri */
+	if (!PyArg_ParseTuple(args, "s:open", &uri)) {
+
+		return NULL;
+	}
+
+	graph_lock(self);
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = graph_open_uri(self, uri, &err);
+	Py_END_ALLOW_THREADS
+
+	pthread_mutex_unlock(&self->lock);
+
+	if (ret != 0) {
+
+		PyErr_SetString(err.type, err.msg);
+		return NULL;
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+PyDoc_STRVAR(MmalGraph_open_bytes_doc,
+             "open_bytes(obj)\n\nDecode an in-memory JPEG, PNG, GIF or BMP image from any buffer object (bytes, memoryview, mmap)\n"
+             "straight into the decoder. Aligned data is not copied, obj must stay unchanged until the call returns.\n");
+static PyObject *MmalGraph_open_bytes(MmalGraphObject *self, PyObject *args) {
+
+	int ret;
+	Py_buffer view;
+	PyObject *obj = NULL;
+	uint64_t start = vcos_getmicrosecs64();
+	GraphError err = {NULL, NULL};
+	TRACE_SCOPE("MmalGraph.open_bytes");
+
+	if (!PyArg_ParseTuple(args, "O:open_bytes", &obj)) {
+
+		return NULL;
+	}
+
+	if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) != 0) {
+
+		return NULL;
+	}
+
+	graph_lock(self);
+
+	Py_BEGIN_ALLOW_THREADS
+	animator_stop(&self->animator);
+	graph_cache_store(self, self->active);
+	self->active->capture = 0;
+	self->closed = 0;
+	ret = pipeline_open_buffer(self->active, view.buf, view.len, self->persistent, &err);
+
+	if (ret == 0) {
+
+		self->open_time = vcos_getmicrosecs64() - start;
+	}
+
+	Py_END_ALLOW_THREADS
+
+	pthread_mutex_unlock(&self->lock);
+	PyBuffer_Release(&view);
+
+	if (ret != 0) {
+
+		PyErr_SetString(err.type, err.msg);
+		return NULL;
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+PyDoc_STRVAR(MmalGraph_open_stream_doc,
+             "open_stream(encoding='h264', fd=None, framed=False)\n\nDecode an H.264 or MJPEG elementary stream instead of a uri.\n"
+             "Without fd the stream is pushed with feed(), with fd (an int or an object with fileno(), a pipe or a socket)\n"
+             "a background thread reads a copy of it until end of file. framed=True tells the decoder every feed() is one\n"
+             "whole frame, otherwise it finds the frame boundaries itself, fd is always unframed. Input buffers are bounded\n"
+             "by the 'reader' links option.\n");
+static PyObject *MmalGraph_open_stream(MmalGraphObject *self, PyObject *args, PyObject *kwds) {
+
+	uint32_t encoding;
+	int ret, fd = -1, framed = 0;
+	char *encoding_name = "h264";
+	PyObject *fd_obj = Py_None;
+	uint64_t start = vcos_getmicrosecs64();
+	GraphError err = {NULL, NULL};
+	static char *kwlist[] = {"encoding", "fd", "framed", NULL};
+	TRACE_SCOPE("MmalGraph.open_stream");
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|sOp:open_stream", kwlist, &encoding_name, &fd_obj, &framed)) {
+
+		return NULL;
+	}
+
+	if (strcasecmp(encoding_name, "h264") == 0) {
+
+		encoding = MMAL_ENCODING_H264;
+	}
+	else if (strcasecmp(encoding_name, "mjpeg") == 0) {
+
+		encoding = MMAL_ENCODING_MJPEG;
+	}
+	else {
+
+		PyErr_Format(PyExc_ValueError, "unsupported stream encoding '%s', expected 'h264' or 'mjpeg'", encoding_name);
+		return NULL;
+	}
+
+	/* Reads from fd don't follow frame boundaries */
+	if (framed && fd_obj != Py_None) {
+
+		PyErr_SetString(PyExc_ValueError, "framed streams must be fed with feed(), not read from fd");
+		return NULL;
+	}
+
+	if (fd_obj != Py_None && (fd = PyObject_AsFileDescriptor(fd_obj)) < 0) {
+
+		return NULL;
+	}
+
+	graph_lock(self);
+
+	Py_BEGIN_ALLOW_THREADS
+	animator_stop(&self->animator);
+	graph_cache_store(self, self->active);
+	self->active->capture = 0;
+	self->closed = 0;
+	ret = pipeline_open_stream(self->active, encoding, framed, fd, &err);
+
+	if (ret == 0) {
+
+		self->open_time = vcos_getmicrosecs64() - start;
+	}
+
+	Py_END_ALLOW_THREADS
+
+	pthread_mutex_unlock(&self->lock);
+
+	if (ret != 0) {
+
+		PyErr_SetString(err.type, err.msg);
+		return NULL;
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+PyDoc_STRVAR(MmalGraph_feed_doc,
+             "feed(data, pts=None, eos=False, timeout=None)\n\nPush a chunk of the stream opened by open_stream() from any buffer\n"
+             "object, pts in microseconds goes with the first buffer of the chunk and eos=True ends the stream.\n"
+             "Waits for the decoder to give input buffers back, up to timeout seconds (None waits forever), and returns\n"
+             "the number of bytes queued: less than len(data) on timeout, the rest is fed again by the caller.\n");
+static PyObject *MmalGraph_feed(MmalGraphObject *self, PyObject *args, PyObject *kwds) {
+
+	long ret;
+	int eos = 0, fed_by_fd;
+	Py_buffer view;
+	MmalPipeline *pipeline;
+	int64_t pts = MMAL_TIME_UNKNOWN, timeout_us = -1;
+	PyObject *obj = NULL, *pts_obj = Py_None, *timeout_obj = Py_None;
+	GraphError err = {NULL, NULL};
+	static char *kwlist[] = {"data", "pts", "eos", "timeout", NULL};
+	TRACE_SCOPE("MmalGraph.feed");
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OpO:feed", kwlist, &obj, &pts_obj, &eos, &timeout_obj)) {
+
+		return NULL;
+	}
+
+	if (pts_obj != Py_None && (pts = PyLong_AsLongLong(pts_obj)) == -1 && PyErr_Occurred()) {
+
+		return NULL;
+	}
+
+	if (timeout_obj != Py_None) {
+
+		double timeout = PyFloat_AsDouble(timeout_obj);
+
+		if (timeout == -1.0 && PyErr_Occurred()) {
+
+			return NULL;
+		}
+
+		timeout_us = timeout > 0 ? (int64_t)(timeout * 1000000) : 0;
+	}
+
+	if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) != 0) {
+
+		return NULL;
+	}
+
+	/* Writers hold the stream, not the graph, so close() and stats() are not stuck behind a full decoder */
+	graph_lock(self);
+	pipeline = self->active;
+	fed_by_fd = pipeline->stream_running;
+	ret = fed_by_fd ? -1 : pipeline_stream_enter(pipeline);
+	pthread_mutex_unlock(&self->lock);
+
+	if (ret != 0) {
+
+		PyBuffer_Release(&view);
+		PyErr_SetString(PyExc_ValueError, fed_by_fd ? "stream is read from a file descriptor" : "graph is not streaming, call open_stream() first");
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = pipeline_stream_write(pipeline, view.buf, view.len, pts, eos, timeout_us, &err);
+	pipeline_stream_leave(pipeline);
+	Py_END_ALLOW_THREADS
+
+	PyBuffer_Release(&view);
+
+	if (ret < 0) {
+
+		PyErr_SetString(err.type, err.msg);
+		return NULL;
+	}
+
+	return PyLong_FromLong(ret);
+}
+
+
+PyDoc_STRVAR(MmalGraph_get_frame_doc,
+             "get_frame(timeout=1.0)\n\nReturn the next decoded MmalFrame of a graph created with tap, None on timeout.\n"
+             "The frame shares video core memory, release() it promptly to give the buffer back to the decoder.\n");
+static PyObject *MmalGraph_get_frame(MmalGraphObject *self, PyObject *args, PyObject *kwds) {
+
+	int ret;
+	TapFrame frame;
+	double timeout = 1.0;
+	ModuleState *state;
+	MmalPipeline *pipeline;
+	static char *kwlist[] = {"timeout", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|d:get_frame", kwlist, &timeout)) {
+
+		return NULL;
+	}
+
+	if ((state = module_state_by_type(Py_TYPE(self))) == NULL) {
+
+		return NULL;
+	}
+
+	if (!self->tap) {
+
+		PyErr_SetString(PyExc_RuntimeError, "graph is created without tap");
+		return NULL;
+	}
+
+	/* Pipelines live as long as the graph, waiting does not need the graph lock */
+	pipeline = __atomic_load_n(&self->active, __ATOMIC_ACQUIRE);
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = pipeline_tap_get(pipeline, &frame, timeout > 0 ? (uint32_t)(timeout * 1000) : 0);
+	Py_END_ALLOW_THREADS
+
+	if (ret != 0) {
+
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	return mmal_frame_new(state->frame_type, frame.buffer, frame.connection, &frame.format);
+}
+
+
+/* Build the standby pipeline hidden below the active one, called with self->lock held and without the GIL */
+static int graph_prefetch_uri(MmalGraphObject *self, const char *uri, GraphError *err) {
+
+	if (self->standby == NULL) {
+
+		if ((self->standby = pipeline_new(self, graph_pipeline_event)) == NULL) {
+
+			err->type = PyExc_MemoryError;
+			err->msg = "failed to allocate pipeline";
+			return -1;
+		}
+
+		pipeline_set_outputs(self->standby, self->displays, self->display_count);
+	}
+
+	graph_set_tap(self, self->standby);
+	pipeline_set_resize(self->standby, self->resize_mode, self->resize_width, self->resize_height);
+	pipeline_set_link_options(self->standby, self->links);
+
+	if (pipeline_set_layer(self->standby, PIPELINE_LAYER - 1, 0, err) != 0) {
+
+		return -1;
+	}
+
+	return graph_pipeline_open(self, self->standby, uri, err);
+}
+
+
+PyDoc_STRVAR(MmalGraph_prefetch_doc,
+             "prefetch(uri)\n\nRead and decode uri into a hidden standby renderer while the current picture stays on screen,\n"
+             "show() swaps it in.\n");
+static PyObject *MmalGraph_prefetch(MmalGraphObject *self, PyObject *args) {
+
+	int ret;
+	char *uri = NULL;
+	GraphError err = {NULL, NULL};
+	TRACE_SCOPE("MmalGraph.prefetch");
+
+	if (!PyArg_ParseTuple(args, "s:prefetch", &uri)) {
+
+		return NULL;
+	}
+
+	graph_lock(self);
+
+	Py_BEGIN_ALLOW_THREADS
+	self->closed = 0;
+	ret = graph_prefetch_uri(self, uri, &err);
+	Py_END_ALLOW_THREADS
+
+	pthread_mutex_unlock(&self->lock);
+
+	if (ret != 0) {
+
+		PyErr_SetString(err.type, err.msg);
+		return NULL;
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+/* Raise standby above active, then retire the old active pipeline, called with self->lock held and without the GIL.
+   A fade keeps the old picture below until the next prefetch, the new one is faded in over it */
+static int graph_swap_standby(MmalGraphObject *self, uint32_t fade_ms, GraphError *err) {
+
+	MMAL_DISPLAYREGION_T target;
+	MmalPipeline *previous = self->active;
+
+	/* An animation belongs to the pipeline which is about to be retired */
+	animator_stop(&self->animator);
+
+	if (fade_ms) {
+
+		if (pipeline_set_layer(previous, PIPELINE_LAYER - 1, previous->alpha, err) != 0 ||
+		    pipeline_set_layer(self->standby, PIPELINE_LAYER, 0, err) != 0) {
+
+			return -1;
+		}
+
+		__atomic_store_n(&self->active, self->standby, __ATOMIC_RELEASE);
+		self->standby = previous;
+
+		memset(&target, 0, sizeof(target));
+		target.set = MMAL_DISPLAY_SET_ALPHA;
+		target.alpha = 255;
+		return animator_start(&self->animator, self->active, -1, &target, fade_ms, err);
+	}
+
+	/* Single display update, the new picture covers the old one on the next vsync */
+	if (pipeline_set_layer(self->standby, PIPELINE_LAYER + 1, 255, err) != 0) {
+
+		return -1;
+	}
+
+	__atomic_store_n(&self->active, self->standby, __ATOMIC_RELEASE);
+	self->standby = previous;
+
+	/* A persistent graph keeps the old components hidden for the next prefetch */
+	if (self->persistent) {
+
+		pipeline_set_layer(previous, PIPELINE_LAYER - 1, 0, err);
+	}
+	else {
+
+		graph_cache_store(self, previous);
+		pipeline_teardown(previous);
+	}
+
+	return pipeline_set_layer(self->active, PIPELINE_LAYER, 255, err);
+}
+
+
+/* Wait up to timeout_ms for standby to finish decoding and swap it in, called with self->lock held and without the GIL */
+static int graph_show_standby(MmalGraphObject *self, uint32_t timeout_ms, uint32_t fade_ms, int *ready, GraphError *err) {
+
+	if (self->standby == NULL || self->standby->graph == NULL) {
+
+		err->type = PyExc_RuntimeError;
+		err->msg = "nothing prefetched";
+		return -1;
+	}
+
+	*ready = pipeline_wait_eos(self->standby, timeout_ms) == 0;
+
+	if (graph_swap_standby(self, fade_ms, err) != 0) {
+
+		return -1;
+	}
+
+	if (*ready) {
+
+		event_queue_push(&self->events, MMAL_EVENT_EOS, 0, 0, self->active->outputs[0].renderer->input[0]->name);
+	}
+
+	return 0;
+}
+
+
+PyDoc_STRVAR(MmalGraph_show_doc,
+             "show(timeout=1.0, fade=0.0)\n\nShow the prefetched uri, waits up to timeout seconds for it to finish decoding.\n"
+             "fade cross-fades from the current picture over that many seconds instead of switching on the next vsync.\n"
+             "Returns True if it was fully decoded before the switch.\n");
+static PyObject *MmalGraph_show(MmalGraphObject *self, PyObject *args, PyObject *kwds) {
+
+	int ret, ready = 0;
+	double timeout = 1.0, fade = 0.0;
+	GraphError err = {NULL, NULL};
+	static char *kwlist[] = {"timeout", "fade", NULL};
+	TRACE_SCOPE("MmalGraph.show");
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|dd:show", kwlist, &timeout, &fade)) {
+
+		return NULL;
+	}
+
+	if (fade < 0) {
+
+		PyErr_SetString(PyExc_ValueError, "fade must be positive");
+		return NULL;
+	}
+
+	graph_lock(self);
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = graph_show_standby(self, timeout > 0 ? (uint32_t)(timeout * 1000) : 0, (uint32_t)(fade * 1000), &ready, &err);
+	Py_END_ALLOW_THREADS
+
+	pthread_mutex_unlock(&self->lock);
+
+	if (ret != 0) {
+
+		PyErr_SetString(err.type, err.msg);
+		return NULL;
+	}
+
+	return PyBool_FromLong(ready);
+}
+
+
+/* A native driver starts on graph, called with the GIL held. Reopens a closed graph like open() does */
+void graph_native_attach(PyObject *graph) {
+
+	MmalGraphObject *self = (MmalGraphObject *)graph;
+
+	graph_lock(self);
+	self->closed = 0;
+	pthread_mutex_unlock(&self->lock);
+}
+
+
+/* Called with self->lock held */
+static int graph_native_closed(MmalGraphObject *self, GraphError *err) {
+
+	if (!self->closed) {
+
+		return 0;
+	}
+
+	err->type = PyExc_RuntimeError;
+	err->msg = "graph is closed";
+	return GRAPH_CLOSED;
+}
+
+
+/* Prefetch for a native thread which drives the graph, such as a playlist. Takes the graph lock, never the GIL */
+int graph_native_prefetch(PyObject *graph, const char *uri, GraphError *err) {
+
+	int ret;
+	MmalGraphObject *self = (MmalGraphObject *)graph;
+
+	pthread_mutex_lock(&self->lock);
+
+	if ((ret = graph_native_closed(self, err)) == 0) {
+
+		ret = graph_prefetch_uri(self, uri, err);
+	}
+
+	pthread_mutex_unlock(&self->lock);
+	return ret;
+}
+
+
+/* show() for a native thread, *ready tells whether the picture was decoded before the switch */
+int graph_native_show(PyObject *graph, uint32_t timeout_ms, uint32_t fade_ms, int *ready, GraphError *err) {
+
+	int ret;
+	MmalGraphObject *self = (MmalGraphObject *)graph;
+
+	pthread_mutex_lock(&self->lock);
+
+	if ((ret = graph_native_closed(self, err)) == 0) {
+
+		ret = graph_show_standby(self, timeout_ms, fade_ms, ready, err);
+	}
+
+	pthread_mutex_unlock(&self->lock);
+	return ret;
+}
+
+
+/* Wait for the fade started by a show, the animator lives as long as the graph so no lock is needed */
+int graph_native_wait_animation(PyObject *graph, uint32_t timeout_ms) {
+
+	return animator_wait(&((MmalGraphObject *)graph)->animator, timeout_ms);
+}
+
+
+/* open_async() worker, reports the result to the callback with the GIL held */
+static void *graph_open_thread(void *arg) {
+
+	int ret;
+	PyThreadState *tstate;
+	GraphOpenJob *job = arg;
+	GraphError err = {NULL, NULL};
+	PyObject *error = NULL, *result = NULL;
+	TRACE_SCOPE("MmalGraph.open_async");
+
+	pthread_mutex_lock(&job->graph->lock);
+	ret = graph_open_uri(job->graph, job->uri, &err);
+	pthread_mutex_unlock(&job->graph->lock);
+
+	/* PyGILState_Ensure() only knows the main interpreter, attach to the one which called open_async() */
+	tstate = PyThreadState_New(job->interp);
+	PyEval_RestoreThread(tstate);
+
+	if (job->callback != Py_None) {
+
+		if (ret == 0) {
+
+			Py_INCREF(Py_None);
+			error = Py_None;
+		}
+		else {
+
+			error = PyObject_CallFunction(err.type, "s", err.msg);
+		}
+
+		if (error) {
+
+			result = PyObject_CallFunctionObjArgs(job->callback, (PyObject *)job->graph, error, NULL);
+		}
+
+		if (!result) {
+
+			PyErr_WriteUnraisable(job->callback);
+		}
+
+		Py_XDECREF(error);
+		Py_XDECREF(result);
+	}
+
+	Py_DECREF(job->callback);
+	Py_DECREF(job->graph);
+	PyThreadState_Clear(tstate);
+	PyThreadState_DeleteCurrent();
+
+	free(job->uri);
+	free(job);
+	return NULL;
+}
+
+
+PyDoc_STRVAR(MmalGraph_open_async_doc,
+             "open_async(uri, callback=None)\n\nOpen a uri from a background thread and return immediately,\n"
+             "callback(graph, error) is invoked on completion, error is None on success.\n");
+static PyObject *MmalGraph_open_async(MmalGraphObject *self, PyObject *args, PyObject *kwds) {
+
+	int ret;
+	pthread_t thread;
+	pthread_attr_t attr;
+	char *uri = NULL;
+	GraphOpenJob *job = NULL;
+	PyObject *callback = Py_None;
+	static char *kwlist[] = {"uri", "callback", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|O:open_async", kwlist, &uri, &callback)) {
+
+		return NULL;
+	}
+
+	if (callback != Py_None && !PyCallable_Check(callback)) {
+
+		PyErr_SetString(PyExc_TypeError, "callback must be callable");
+		return NULL;
+	}
+
+	if ((job = calloc(1, sizeof(GraphOpenJob))) == NULL || (job->uri = strdup(uri)) == NULL) {
+
+		free(job);
+		return PyErr_NoMemory();
+	}
+
+	Py_INCREF(self);
+	Py_INCREF(callback);
+	job->graph = self;
+	job->callback = callback;
+#if PY_VERSION_HEX >= 0x03090000
+	job->interp = PyInterpreterState_Get();
+#else
+	job->interp = PyThreadState_Get()->interp;
+#endif
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	/* pthread_create() returns its error, errno is left alone */
+	if ((ret = pthread_create(&thread, &attr, graph_open_thread, job)) != 0) {
+
+		pthread_attr_destroy(&attr);
+		Py_DECREF(callback);
+		Py_DECREF(self);
+		free(job->uri);
+		free(job);
+		PyErr_Format(PyExc_RuntimeError, "failed to start open thread: %s", strerror(ret));
+		return NULL;
+	}
+
+	pthread_attr_destroy(&attr);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+static const char *graph_event_name(uint32_t cmd) {
+
+	switch (cmd) {
+		case MMAL_EVENT_EOS:
+			return EVENT_EOS;
+
+		case MMAL_EVENT_ERROR:
+			return EVENT_ERROR;
+
+		case MMAL_EVENT_FORMAT_CHANGED:
+			return EVENT_FORMAT_CHANGED;
+
+		case MMAL_EVENT_PARAMETER_CHANGED:
+			return EVENT_PARAMETER_CHANGED;
+
+		default:
+			return "unknown";
+	}
+}
+
+
+static PyObject *graph_event_object(MmalGraphObject *self, QueueEvent *event) {
+
+	PyObject *item;
+	ModuleState *state = module_state_by_type(Py_TYPE(self));
+
+	if (state == NULL || (item = PyStructSequence_New(state->graph_event_type)) == NULL) {
+
+		return NULL;
+	}
+
+	PyStructSequence_SET_ITEM(item, 0, PyUnicode_FromString(graph_event_name(event->type)));
+	PyStructSequence_SET_ITEM(item, 1, PyUnicode_FromString(event->source));
+	PyStructSequence_SET_ITEM(item, 2, PyLong_FromUnsignedLong(event->param1));
+	PyStructSequence_SET_ITEM(item, 3, PyFloat_FromDouble(event_queue_seconds(event->timestamp)));
+	return item;
+}
+
+
+/* Complete pending wait_eos() futures on EOS, fail them on a graph error */
+static void graph_resolve_waiters(MmalGraphObject *self, QueueEvent *event, PyObject *item) {
+
+	Py_ssize_t i;
+	PyObject *done, *result, *value = NULL;
+	const char *method = event->type == MMAL_EVENT_EOS ? "set_result" : "set_exception";
+
+	if (PyList_GET_SIZE(self->eos_waiters) == 0 || (event->type != MMAL_EVENT_EOS && event->type != MMAL_EVENT_ERROR)) {
+
+		return;
+	}
+
+	if (event->type == MMAL_EVENT_EOS) {
+
+		Py_INCREF(item);
+		value = item;
+	}
+	else if ((value = PyObject_CallFunctionObjArgs(PyExc_RuntimeError, item, NULL)) == NULL) {
+
+		PyErr_Clear();
+		return;
+	}
+
+	for (i = 0; i < PyList_GET_SIZE(self->eos_waiters); i++) {
+
+		PyObject *future = PyList_GET_ITEM(self->eos_waiters, i);
+
+		if ((done = PyObject_CallMethod(future, "done", NULL)) == NULL) {
+
+			PyErr_Clear();
+			continue;
+		}
+
+		if (!PyObject_IsTrue(done) && (result = PyObject_CallMethod(future, (char *)method, "(O)", value)) != NULL) {
+
+			Py_DECREF(result);
+		}
+
+		PyErr_Clear();
+		Py_DECREF(done);
+	}
+
+	PyList_SetSlice(self->eos_waiters, 0, PyList_GET_SIZE(self->eos_waiters), NULL);
+	Py_DECREF(value);
+}
+
+
+/* Move queued events into the backlog and resolve waiters. Callers hold the object critical section */
+static int graph_drain_events(MmalGraphObject *self) {
+
+	QueueEvent event;
+	PyObject *item;
+	Py_ssize_t size;
+
+	event_queue_clear_fd(&self->events);
+
+	while (event_queue_pop(&self->events, &event) == 0) {
+
+		if ((item = graph_event_object(self, &event)) == NULL) {
+
+			return -1;
+		}
+
+		PyList_Append(self->backlog, item);
+		graph_resolve_waiters(self, &event, item);
+		Py_DECREF(item);
+	}
+
+	/* Keep the backlog bounded when only wait_eos() is used */
+	if ((size = PyList_GET_SIZE(self->backlog)) > EVENT_QUEUE_SIZE) {
+
+		PyList_SetSlice(self->backlog, 0, size - EVENT_QUEUE_SIZE, NULL);
+	}
+
+	return 0;
+}
+
+
+PyDoc_STRVAR(MmalGraph_fileno_doc, "fileno()\n\nReturn an eventfd which becomes readable when control events are queued.\n");
+static PyObject *MmalGraph_fileno(MmalGraphObject *self) {
+
+	return Py_BuildValue("i", self->events.fd);
+}
+
+
+PyDoc_STRVAR(MmalGraph_read_events_doc, "read_events()\n\nReturn and clear the list of pending MmalGraphEvent, never blocks.\n");
+static PyObject *MmalGraph_read_events(MmalGraphObject *self) {
+
+	PyObject *events = NULL;
+
+	MODULE_BEGIN_CRITICAL((PyObject *)self);
+
+	if (graph_drain_events(self) == 0) {
+
+		events = self->backlog;
+
+		if ((self->backlog = PyList_New(0)) == NULL) {
+
+			self->backlog = events;
+			events = NULL;
+		}
+	}
+
+	MODULE_END_CRITICAL();
+	return events;
+}
+
+
+/* Stop watching the fd once no waiter is left. Callers hold the object critical section */
+static int graph_dispatch_events(MmalGraphObject *self) {
+
+	PyObject *result;
+
+	if (graph_drain_events(self) != 0) {
+
+		return -1;
+	}
+
+	if (PyList_GET_SIZE(self->eos_waiters) == 0 && self->loop) {
+
+		if ((result = PyObject_CallMethod(self->loop, "remove_reader", "i", self->events.fd)) == NULL) {
+
+			return -1;
+		}
+
+		Py_DECREF(result);
+		Py_CLEAR(self->loop);
+	}
+
+	return 0;
+}
+
+
+/* Event loop reader callback registered by wait_eos() */
+static PyObject *MmalGraph_dispatch_events(MmalGraphObject *self) {
+
+	int ret;
+
+	MODULE_BEGIN_CRITICAL((PyObject *)self);
+	ret = graph_dispatch_events(self);
+	MODULE_END_CRITICAL();
+
+	if (ret != 0) {
+
+		return NULL;
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+/* Queue future and watch fd from loop, a single loop serves all waiters. Callers hold the object critical section */
+static int graph_add_waiter(MmalGraphObject *self, PyObject *loop, PyObject *future) {
+
+	PyObject *dispatch, *result;
+
+	if (PyList_Append(self->eos_waiters, future) != 0) {
+
+		return -1;
+	}
+
+	if (self->loop == loop) {
+
+		return 0;
+	}
+
+	if (self->loop) {
+
+		if ((result = PyObject_CallMethod(self->loop, "remove_reader", "i", self->events.fd)) == NULL) {
+
+			return -1;
+		}
+
+		Py_DECREF(result);
+		Py_CLEAR(self->loop);
+	}
+
+	if ((dispatch = PyObject_GetAttrString((PyObject *)self, "_dispatch_events")) == NULL) {
+
+		return -1;
+	}
+
+	result = PyObject_CallMethod(loop, "add_reader", "iO", self->events.fd, dispatch);
+	Py_DECREF(dispatch);
 
+	if (result == NULL) {
 
-PyDoc_STRVAR(MmalGraphObject_type_doc, "MmalGraph() -> Video core graph object.\n");
-typedef struct {
-	char *uri;
-	PyObject_HEAD;
-	MMAL_GRAPH_T *graph;
-	uint32_t display_num;
-	MMAL_COMPONENT_T *reader, *decoder, *renderer;
-} MmalGraphObject;
+		return -1;
+	}
+
+	Py_DECREF(result);
+	Py_INCREF(loop);
+	self->loop = loop;
+	return 0;
+}
 
 
-static PyObject *MmalGraph_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+PyDoc_STRVAR(MmalGraph_wait_eos_doc,
+             "wait_eos()\n\nReturn an asyncio future of the running loop completed with the MmalGraphEvent of the next\n"
+             "end-of-stream, a graph error fails the future with RuntimeError. Usage: await graph.wait_eos()\n");
+static PyObject *MmalGraph_wait_eos(MmalGraphObject *self) {
 
-	MmalGraphObject *self;
+	int ret;
+	PyObject *asyncio = NULL, *loop = NULL, *future = NULL;
 
-	if ((self = (MmalGraphObject *)type->tp_alloc(type, 0)) == NULL) {
+	if ((asyncio = PyImport_ImportModule("asyncio")) == NULL) {
 
 		return NULL;
 	}
 
-	self->graph = NULL;
-	self->reader = NULL;
-	self->decoder = NULL;
-	self->renderer = NULL;
-	self->display_num = 5;
+	/* Only a coroutine knows which loop will await the future, elsewhere this raises RuntimeError */
+	if ((loop = PyObject_CallMethod(asyncio, "get_running_loop", NULL)) == NULL ||
+	        (future = PyObject_CallMethod(loop, "create_future", NULL)) == NULL) {
 
-	Py_INCREF(self);
-	return (PyObject *)self;
+		goto error;
+	}
+
+	MODULE_BEGIN_CRITICAL((PyObject *)self);
+	ret = graph_add_waiter(self, loop, future);
+	MODULE_END_CRITICAL();
+
+	if (ret != 0) {
+
+		goto error;
+	}
+
+	Py_DECREF(asyncio);
+	Py_DECREF(loop);
+	return future;
+
+error:
+	Py_XDECREF(future);
+	Py_XDECREF(loop);
+	Py_XDECREF(asyncio);
+	return NULL;
 }
 
 
-PyDoc_STRVAR(MmalGraph_close_doc, "close()\n\nStop playback.\n");
-static PyObject *MmalGraph_close(MmalGraphObject *self) {
+/* [(upper edge in ms or None, count), ...] */
+static PyObject *graph_timing_histogram(const uint32_t *counts) {
+
+	uint32_t i;
+	PyObject *list, *item;
+
+	if ((list = PyList_New(PIPELINE_TIMING_BUCKETS)) == NULL) {
 
-	if (self->graph) {
-		mmal_graph_disable(self->graph);
-		mmal_graph_destroy(self->graph);
-		self->graph = NULL;
-		self->uri = NULL;
+		return NULL;
 	}
 
-	if (self->reader) {
-		mmal_component_release(self->reader);
-		self->reader = NULL;
+	for (i = 0; i < PIPELINE_TIMING_BUCKETS; i++) {
+
+		if (i < PIPELINE_TIMING_BUCKETS - 1) {
+
+			item = Py_BuildValue("(II)", pipeline_timing_edges_ms[i], counts[i]);
+		}
+		else {
+
+			item = Py_BuildValue("(OI)", Py_None, counts[i]);
+		}
+
+		if (item == NULL) {
+
+			Py_DECREF(list);
+			return NULL;
+		}
+
+		PyList_SET_ITEM(list, i, item);
 	}
 
-	if (self->decoder) {
-		mmal_component_release(self->decoder);
-		self->decoder = NULL;
+	return list;
+}
+
+
+static PyObject *graph_timing_stats(MmalGraphObject *self, const TimingStats *timing) {
+
+	PyObject *vsync;
+	uint64_t intervals = timing->frames > 1 ? timing->frames - 1 : 0;
+	double jitter = intervals > 1 ? sqrt(timing->interval_m2 / (intervals - 1)) : 0.0;
+
+	if (timing->vsyncs > 1) {
+
+		vsync = Py_BuildValue("{s:d,s:[IIIII]}",
+		                      "period", (timing->vsync_last_us - timing->vsync_first_us) / (timing->vsyncs - 1) / 1000000.0,
+		                      "histogram", timing->vsync_hist[0], timing->vsync_hist[1], timing->vsync_hist[2],
+		                      timing->vsync_hist[3], timing->vsync_hist[4]);
+
+		if (vsync == NULL) {
+
+			return NULL;
+		}
 	}
+	else {
 
-	if (self->renderer) {
-		mmal_component_release(self->renderer);
-		self->renderer = NULL;
+		Py_INCREF(Py_None);
+		vsync = Py_None;
 	}
 
-	Py_INCREF(Py_None);
-	return Py_None;
+	return Py_BuildValue("{s:K,s:K,s:K,s:K,s:{s:d,s:d,s:N},s:{s:d,s:N},s:N,s:I}",
+	                     "frames", (unsigned PY_LONG_LONG)timing->frames, "late", (unsigned PY_LONG_LONG)timing->late,
+	                     "dropped", (unsigned PY_LONG_LONG)timing->dropped, "missing", (unsigned PY_LONG_LONG)timing->missing,
+	                     "interval", "mean", timing->interval_mean / 1000000.0, "jitter", jitter / 1000000.0,
+	                     "histogram", graph_timing_histogram(timing->interval_hist),
+	                     "lateness", "max", timing->lateness_max / 1000000.0, "histogram", graph_timing_histogram(timing->lateness_hist),
+	                     "vsync", vsync, "lost", timing_feed_lost(&self->timing_feed));
 }
 
 
-static void MmalGraph_free(MmalGraphObject *self) {
+PyDoc_STRVAR(MmalGraph_stats_doc,
+             "stats()\n\nReturn timings of the last open() and buffer counters sampled from the active graph:\n"
+             "{'phases': {'create', 'open', 'connect', 'enable', 'first_frame'} in seconds (first_frame is None until\n"
+             "the renderer got a buffer), 'ports': {name: {'buffers', 'max_delay', 'frames', 'bytes'}},\n"
+             "'links': {name: {'queued', 'pool_free', 'pool_size', 'buffer_num', 'buffer_size', 'tunnelled', 'zero_copy'}},\n"
+             "'resize': None or {'source', 'target', 'source_size', 'target_size', 'bytes_saved'},\n"
+             "'cache': None or {'hits', 'misses', 'evictions', 'entries', 'bytes', 'budget'},\n"
+             "'timing': None or {'frames', 'late', 'dropped', 'missing', 'interval': {'mean', 'jitter', 'histogram'},\n"
+             "'lateness': {'max', 'histogram'}, 'vsync': None or {'period', 'histogram'}, 'lost'},\n"
+             "'stream': None or {'bytes', 'buffers', 'stalls', 'stall_time', 'fd', 'eos', 'error'}}.\n"
+             "Timing histograms are [(upper edge in ms, count), ..., (None, count)], the vsync histogram counts frames\n"
+             "shown for 0 (dropped), 1, 2, 3 and 4 or more vsyncs. late frames are more than a frame period behind their\n"
+             "pts, missing ones are pts gaps, lost counts samples the callback could not take in time\n"
+             "stalls counts writes of open_stream() input which waited for the decoder, stall_time their total seconds.\n"
+             "Timings are taken once per open and counters are only read here, so it is cheap to leave on.\n");
+static PyObject *MmalGraph_stats(MmalGraphObject *self) {
+
+	uint32_t i;
+	FrameCache cache;
+	PipelineStats stats;
+	PyObject *result, *phases, *ports, *links, *item, *first_frame, *resize, *cached, *timing, *stream;
+
+	graph_lock(self);
+	Py_BEGIN_ALLOW_THREADS
+	graph_cache_store(self, self->active);
+	pipeline_stats(self->active, &stats);
+	cache = self->cache;
+	Py_END_ALLOW_THREADS
+	pthread_mutex_unlock(&self->lock);
+
+	if (stats.first_frame_us >= 0) {
+
+		first_frame = PyFloat_FromDouble(stats.first_frame_us / 1000000.0);
+	}
+	else {
 
-	PyObject *ref = MmalGraph_close(self);
-	Py_XDECREF(ref);
+		Py_INCREF(Py_None);
+		first_frame = Py_None;
+	}
+
+	phases = Py_BuildValue("{s:d,s:d,s:d,s:d,s:N}",
+	                       "create", stats.phase_us[PIPELINE_PHASE_CREATE] / 1000000.0,
+	                       "open", stats.phase_us[PIPELINE_PHASE_OPEN] / 1000000.0,
+	                       "connect", stats.phase_us[PIPELINE_PHASE_CONNECT] / 1000000.0,
+	                       "enable", stats.phase_us[PIPELINE_PHASE_ENABLE] / 1000000.0,
+	                       "first_frame", first_frame);
+	ports = PyDict_New();
+	links = PyDict_New();
+
+	if (phases == NULL || ports == NULL || links == NULL) {
+
+		goto error;
+	}
+
+	for (i = 0; i < stats.port_count; i++) {
+
+		PortStats *port = &stats.ports[i];
+
+		if (port->has_stats) {
+
+			item = Py_BuildValue("{s:I,s:I,s:I,s:L}", "buffers", port->buffers, "max_delay", port->max_delay,
+			                     "frames", port->frames, "bytes", (PY_LONG_LONG)port->bytes);
+		}
+		else {
+
+			item = Py_BuildValue("{s:I,s:I,s:O,s:O}", "buffers", port->buffers, "max_delay", port->max_delay,
+			                     "frames", Py_None, "bytes", Py_None);
+		}
+
+		if (item == NULL || PyDict_SetItemString(ports, port->name, item) != 0) {
+
+			Py_XDECREF(item);
+			goto error;
+		}
+
+		Py_DECREF(item);
+	}
+
+	for (i = 0; i < stats.link_count; i++) {
 
-	Py_TYPE(self)->tp_free((PyObject *)self);
+		LinkStats *link = &stats.links[i];
+
+		item = Py_BuildValue("{s:I,s:I,s:I,s:I,s:I,s:N,s:N}", "queued", link->queued, "pool_free", link->pool_free,
+		                     "pool_size", link->pool_size, "buffer_num", link->buffer_num, "buffer_size", link->buffer_size,
+		                     "tunnelled", PyBool_FromLong(link->tunnelled), "zero_copy", PyBool_FromLong(link->zero_copy));
+
+		if (item == NULL || PyDict_SetItemString(links, link->name, item) != 0) {
+
+			Py_XDECREF(item);
+			goto error;
+		}
+
+		Py_DECREF(item);
+	}
+
+	/* Renderer side buffers no longer hold full size pictures */
+	if (stats.resized) {
+
+		ResizeStats *rs = &stats.resize;
+		int64_t saved = ((int64_t)rs->source_size - rs->target_size) * rs->buffer_num;
+
+		resize = Py_BuildValue("{s:(II),s:(II),s:I,s:I,s:L}", "source", rs->source_width, rs->source_height,
+		                       "target", rs->target_width, rs->target_height, "source_size", rs->source_size,
+		                       "target_size", rs->target_size, "bytes_saved", (PY_LONG_LONG)saved);
+
+		if (resize == NULL) {
+
+			goto error;
+		}
+	}
+	else {
+
+		Py_INCREF(Py_None);
+		resize = Py_None;
+	}
+
+	if (cache.budget) {
+
+		cached = Py_BuildValue("{s:K,s:K,s:K,s:I,s:n,s:n}", "hits", (unsigned PY_LONG_LONG)cache.hits,
+		                       "misses", (unsigned PY_LONG_LONG)cache.misses, "evictions", (unsigned PY_LONG_LONG)cache.evictions,
+		                       "entries", cache.count, "bytes", (Py_ssize_t)cache.used, "budget", (Py_ssize_t)cache.budget);
+
+		if (cached == NULL) {
+
+			Py_DECREF(resize);
+			goto error;
+		}
+	}
+	else {
+
+		Py_INCREF(Py_None);
+		cached = Py_None;
+	}
+
+	if (stats.timed) {
+
+		if ((timing = graph_timing_stats(self, &stats.timing)) == NULL) {
+
+			Py_DECREF(resize);
+			Py_DECREF(cached);
+			goto error;
+		}
+	}
+	else {
+
+		Py_INCREF(Py_None);
+		timing = Py_None;
+	}
+
+	if (stats.streamed) {
+
+		StreamStats *ss = &stats.stream;
+
+		stream = Py_BuildValue("{s:K,s:K,s:K,s:d,s:N,s:N,s:N}", "bytes", (unsigned PY_LONG_LONG)ss->bytes,
+		                       "buffers", (unsigned PY_LONG_LONG)ss->buffers, "stalls", (unsigned PY_LONG_LONG)ss->stalls,
+		                       "stall_time", ss->stall_us / 1000000.0,
+		                       "fd", ss->fd >= 0 ? PyLong_FromLong(ss->fd) : (Py_INCREF(Py_None), Py_None),
+		                       "eos", PyBool_FromLong(ss->eos),
+		                       "error", ss->error ? PyUnicode_FromString(strerror(ss->error)) : (Py_INCREF(Py_None), Py_None));
+
+		if (stream == NULL) {
+
+			Py_DECREF(resize);
+			Py_DECREF(cached);
+			Py_DECREF(timing);
+			goto error;
+		}
+	}
+	else {
+
+		Py_INCREF(Py_None);
+		stream = Py_None;
+	}
+
+	result = Py_BuildValue("{s:N,s:N,s:N,s:N,s:N,s:N,s:N}", "phases", phases, "ports", ports, "links", links, "resize", resize,
+	                       "cache", cached, "timing", timing, "stream", stream);
+	return result;
+
+error:
+	Py_XDECREF(phases);
+	Py_XDECREF(ports);
+	Py_XDECREF(links);
+	return NULL;
 }
 
 
-static int MmalGraph_init(MmalGraphObject *self, PyObject *args, PyObject *kwds) {
+/* Output index of a region update, None or missing for every output */
+static int graph_parse_output(MmalGraphObject *self, PyObject *item, int *output) {
 
-	int display = -1;
-	static char *kwlist[] = {"display", NULL};
+	long value;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i", kwlist, &display)) {
+	*output = -1;
+
+	if (item == NULL || item == Py_None) {
+
+		return 0;
+	}
+
+	if ((value = PyLong_AsLong(item)) == -1 && PyErr_Occurred()) {
 
 		return -1;
 	}
 
-	if (display >= 0) {
+	if (value < 0 || value >= (long)self->display_count) {
 
-		self->display_num = display;
+		PyErr_Format(PyExc_IndexError, "output must be between 0 and %u", self->display_count - 1);
+		return -1;
 	}
 
+	*output = value;
 	return 0;
 }
 
 
-static PyObject *MmalGraph_enter(PyObject *self, PyObject *args) {
+/* Keep the graph displays and the hidden standby in step with a live update so later items show in place */
+static void graph_remember_region(MmalGraphObject *self, int output, const MMAL_DISPLAYREGION_T *update) {
 
-	if (!PyArg_ParseTuple(args, ""))
-		return NULL;
+	uint32_t i;
+	GraphError err;
+	MMAL_DISPLAYREGION_T geometry = *update;
 
-	Py_INCREF(self);
-	return self;
+	for (i = 0; i < self->display_count; i++) {
+
+		if (output < 0 || (uint32_t)output == i) {
+
+			pipeline_merge_region(&self->displays[i], update);
+		}
+	}
+
+	geometry.set &= ~(MMAL_DISPLAY_SET_LAYER | MMAL_DISPLAY_SET_ALPHA);
+
+	if (self->standby && geometry.set) {
+
+		pipeline_set_region(self->standby, output, &geometry, &err);
+	}
 }
 
 
-static PyObject *MmalGraph_exit(MmalGraphObject *self, PyObject *args) {
+/* Apply count updates as one batch, called with self->lock held and without the GIL */
+static int graph_apply_regions(MmalGraphObject *self, const int *outputs, const MMAL_DISPLAYREGION_T *updates, Py_ssize_t count,
+                               GraphError *err) {
 
-	PyObject *exc_type = 0;
-	PyObject *exc_value = 0;
-	PyObject *traceback = 0;
+	Py_ssize_t i;
 
-	if (!PyArg_UnpackTuple(args, "__exit__", 3, 3, &exc_type, &exc_value, &traceback)) {
+	animator_stop(&self->animator);
 
-		return 0;
+	for (i = 0; i < count; i++) {
+
+		if (pipeline_set_region(self->active, outputs[i], &updates[i], err) != 0) {
+
+			return -1;
+		}
+
+		graph_remember_region(self, outputs[i], &updates[i]);
 	}
 
-	MmalGraph_close(self);
-	Py_RETURN_FALSE;
+	return 0;
 }
 
 
-static void graph_control_cb(MMAL_GRAPH_T *graph, MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer, void *cb_data) {
+PyDoc_STRVAR(MmalGraph_set_region_doc,
+             "set_region(output=None, **fields)\n\nUpdate the display region of output, every output when None, without rebuilding the graph.\n"
+             "fields are fullscreen, dest_rect=(x, y, width, height), transform, alpha and layer.\n"
+             "alpha and layer apply to every output, show() resets them. A running animation is stopped.\n");
+static PyObject *MmalGraph_set_region(MmalGraphObject *self, PyObject *args, PyObject *kwds) {
+
+	int ret, output;
+	PyObject *item = Py_None;
+	GraphError err = {NULL, NULL};
+	MMAL_DISPLAYREGION_T update;
+
+	if (!PyArg_ParseTuple(args, "|O:set_region", &item)) {
+
+		return NULL;
+	}
+
+	if (kwds && PyDict_GetItemString(kwds, "output")) {
+
+		item = PyDict_GetItemString(kwds, "output");
+	}
+
+	memset(&update, 0, sizeof(update));
+
+	if (graph_parse_output(self, item, &output) != 0 || (kwds && graph_parse_fields(kwds, &update, 1) != 0)) {
+
+		return NULL;
+	}
+
+	graph_lock(self);
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = graph_apply_regions(self, &output, &update, 1, &err);
+	Py_END_ALLOW_THREADS
+
+	pthread_mutex_unlock(&self->lock);
+
+	if (ret != 0) {
+
+		PyErr_SetString(err.type, err.msg);
+		return NULL;
+	}
 
-	mmal_buffer_header_release(buffer);
+	Py_INCREF(Py_None);
+	return Py_None;
 }
 
 
-PyDoc_STRVAR(MmalGraph_open_doc, "open(uri)\n\nOpen a uri to start playback.\n");
-#define CHECK_STATUS(status, errno, msg) if (status != MMAL_SUCCESS) { PyErr_SetString(errno, msg); goto error; }
-static PyObject *MmalGraph_open(MmalGraphObject *self, PyObject *args, PyObject *kwds) {
+PyDoc_STRVAR(MmalGraph_set_regions_doc,
+             "set_regions(updates)\n\nApply a list of set_region() dicts, each with an optional output, in one batch.\n"
+             "Every dict is checked before any output changes.\n");
+static PyObject *MmalGraph_set_regions(MmalGraphObject *self, PyObject *args) {
 
-	//char *uri = NULL;
-	MMAL_STATUS_T status;
-	MMAL_DISPLAYREGION_T param;
+	int ret = -1;
+	Py_ssize_t i, count;
+	int *outputs = NULL;
+	PyObject *list, *seq, *item;
+	GraphError err = {NULL, NULL};
+	MMAL_DISPLAYREGION_T *updates = NULL;
 
-	/* Reopen case */
-	if (self->graph) {
+	if (!PyArg_ParseTuple(args, "O:set_regions", &list)) {
 
-		MmalGraph_close(self);
+		return NULL;
 	}
 
-	/* Get input uri */
-	if (!PyArg_ParseTuple(args, "s::open", &self->uri)) {
+	if ((seq = PySequence_Fast(list, "updates must be a list of dicts")) == NULL) {
+
+		return NULL;
+	}
 
+	count = PySequence_Fast_GET_SIZE(seq);
+	outputs = PyMem_Malloc(sizeof(int) * (count ? count : 1));
+	updates = PyMem_Malloc(sizeof(MMAL_DISPLAYREGION_T) * (count ? count : 1));
+
+	if (outputs == NULL || updates == NULL) {
+
+		PyErr_NoMemory();
 		goto error;
 	}
 
-	bcm_host_init();
+	memset(updates, 0, sizeof(MMAL_DISPLAYREGION_T) * (count ? count : 1));
+
+	for (i = 0; i < count; i++) {
+
+		item = PySequence_Fast_GET_ITEM(seq, i);
 
-	/* Create the graph */
-	status = mmal_graph_create(&self->graph, 0);
-	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create graph");
+		if (!PyDict_Check(item)) {
+
+			PyErr_SetString(PyExc_TypeError, "updates must be a list of dicts");
+			goto error;
+		}
+
+		if (graph_parse_output(self, PyDict_GetItemString(item, "output"), &outputs[i]) != 0 ||
+		    graph_parse_fields(item, &updates[i], 1) != 0) {
+
+			goto error;
+		}
+	}
 
-	/* Add the components */
-	status = mmal_graph_new_component(self->graph, MMAL_COMPONENT_DEFAULT_CONTAINER_READER, &self->reader);
-	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create reader");
+	graph_lock(self);
 
-	status = mmal_graph_new_component(self->graph, MMAL_COMPONENT_DEFAULT_IMAGE_DECODER, &self->decoder);
-	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create decoder");
+	Py_BEGIN_ALLOW_THREADS
+	ret = graph_apply_regions(self, outputs, updates, count, &err);
+	Py_END_ALLOW_THREADS
 
-	status = mmal_graph_new_component(self->graph, MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER, &self->renderer);
-	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create renderer");
+	pthread_mutex_unlock(&self->lock);
 
-	param.hdr.id = MMAL_PARAMETER_DISPLAYREGION;
-	param.hdr.size = sizeof(MMAL_DISPLAYREGION_T);
-	param.set = MMAL_DISPLAY_SET_LAYER | MMAL_DISPLAY_SET_NUM;
-	param.display_num = self->display_num;
-	status = mmal_port_parameter_set(self->renderer->input[0], &param.hdr);
-	CHECK_STATUS(status, PyExc_RuntimeError, "failed to set display number");
+	if (ret != 0) {
 
-	/* Configure the reader using the given URI */
-	status = mmal_util_port_set_uri(self->reader->control, self->uri);
-	CHECK_STATUS(status, PyExc_IOError, "failed to open url");
+		PyErr_SetString(err.type, err.msg);
+	}
 
-	/* connect them up - this propagates port settings from outputs to inputs */
-	status = mmal_graph_new_connection(self->graph, self->reader->output[0], self->decoder->input[0], 0, NULL);
-	CHECK_STATUS(status, PyExc_RuntimeError, "failed to connect reader to decoder");
+error:
+	PyMem_Free(outputs);
+	PyMem_Free(updates);
+	Py_DECREF(seq);
 
-	status = mmal_graph_new_connection(self->graph, self->decoder->output[0], self->renderer->input[0], 0, NULL);
-	CHECK_STATUS(status, PyExc_RuntimeError, "failed to connect decoder to renderer");
+	if (ret != 0) {
 
-	/* Start playback */
-	status = mmal_graph_enable(self->graph, graph_control_cb, NULL);
-	CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable graph");
+		return NULL;
+	}
 
 	Py_INCREF(Py_None);
 	return Py_None;
+}
 
-error:
-	/* Cleanup everything */
-	MmalGraph_close(self);
-	return NULL;
+
+PyDoc_STRVAR(MmalGraph_animate_doc,
+             "animate(duration, output=None, alpha=None, dest_rect=None, wait=False)\n\n"
+             "Move alpha and/or dest_rect of output from their current values to the given ones over duration seconds.\n"
+             "Steps once per vsync on a native thread, wait=True blocks until the animation finished.\n");
+static PyObject *MmalGraph_animate(MmalGraphObject *self, PyObject *args, PyObject *kwds) {
+
+	int ret, output, wait = 0;
+	double duration;
+	uint32_t duration_ms;
+	GraphError err = {NULL, NULL};
+	MMAL_DISPLAYREGION_T target, geometry;
+	PyObject *item = Py_None, *alpha = Py_None, *rect = Py_None, *fields;
+	static char *kwlist[] = {"duration", "output", "alpha", "dest_rect", "wait", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "d|OOOi:animate", kwlist, &duration, &item, &alpha, &rect, &wait)) {
+
+		return NULL;
+	}
+
+	if (duration < 0) {
+
+		PyErr_SetString(PyExc_ValueError, "duration must be positive");
+		return NULL;
+	}
+
+	if (alpha == Py_None && rect == Py_None) {
+
+		PyErr_SetString(PyExc_ValueError, "nothing to animate, give alpha and/or dest_rect");
+		return NULL;
+	}
+
+	if (graph_parse_output(self, item, &output) != 0 || (fields = PyDict_New()) == NULL) {
+
+		return NULL;
+	}
+
+	memset(&target, 0, sizeof(target));
+
+	if ((alpha != Py_None && PyDict_SetItemString(fields, "alpha", alpha) != 0) ||
+	    (rect != Py_None && PyDict_SetItemString(fields, "dest_rect", rect) != 0) ||
+	    graph_parse_fields(fields, &target, 1) != 0) {
+
+		Py_DECREF(fields);
+		return NULL;
+	}
+
+	Py_DECREF(fields);
+	duration_ms = (uint32_t)(duration * 1000);
+
+	graph_lock(self);
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = animator_start(&self->animator, self->active, output, &target, duration_ms, &err);
+
+	/* Later items show where the animation ends */
+	if (ret == 0) {
+
+		geometry = target;
+		geometry.set &= ~MMAL_DISPLAY_SET_ALPHA;
+		graph_remember_region(self, output, &geometry);
+	}
+
+	Py_END_ALLOW_THREADS
+
+	pthread_mutex_unlock(&self->lock);
+
+	if (ret != 0) {
+
+		PyErr_SetString(err.type, err.msg);
+		return NULL;
+	}
+
+	if (wait) {
+
+		Py_BEGIN_ALLOW_THREADS
+		animator_wait(&self->animator, duration_ms + 1000);
+		Py_END_ALLOW_THREADS
+	}
+
+	Py_INCREF(Py_None);
+	return Py_None;
 }
 
 
@@ -200,9 +2471,24 @@ error:
 static PyMethodDef MmalGraph_methods[] = {
 
 	{"open", (PyCFunction)MmalGraph_open, METH_VARARGS, MmalGraph_open_doc},
+	{"open_async", (PyCFunction)MmalGraph_open_async, METH_VARARGS | METH_KEYWORDS, MmalGraph_open_async_doc},
+	{"open_bytes", (PyCFunction)MmalGraph_open_bytes, METH_VARARGS, MmalGraph_open_bytes_doc},
+	{"open_stream", (PyCFunction)MmalGraph_open_stream, METH_VARARGS | METH_KEYWORDS, MmalGraph_open_stream_doc},
+	{"feed", (PyCFunction)MmalGraph_feed, METH_VARARGS | METH_KEYWORDS, MmalGraph_feed_doc},
+	{"get_frame", (PyCFunction)MmalGraph_get_frame, METH_VARARGS | METH_KEYWORDS, MmalGraph_get_frame_doc},
+	{"prefetch", (PyCFunction)MmalGraph_prefetch, METH_VARARGS, MmalGraph_prefetch_doc},
+	{"show", (PyCFunction)MmalGraph_show, METH_VARARGS | METH_KEYWORDS, MmalGraph_show_doc},
 	{"close", (PyCFunction)MmalGraph_close, METH_NOARGS, MmalGraph_close_doc},
+	{"fileno", (PyCFunction)MmalGraph_fileno, METH_NOARGS, MmalGraph_fileno_doc},
+	{"read_events", (PyCFunction)MmalGraph_read_events, METH_NOARGS, MmalGraph_read_events_doc},
+	{"wait_eos", (PyCFunction)MmalGraph_wait_eos, METH_NOARGS, MmalGraph_wait_eos_doc},
+	{"stats", (PyCFunction)MmalGraph_stats, METH_NOARGS, MmalGraph_stats_doc},
+	{"set_region", (PyCFunction)MmalGraph_set_region, METH_VARARGS | METH_KEYWORDS, MmalGraph_set_region_doc},
+	{"set_regions", (PyCFunction)MmalGraph_set_regions, METH_VARARGS, MmalGraph_set_regions_doc},
+	{"animate", (PyCFunction)MmalGraph_animate, METH_VARARGS | METH_KEYWORDS, MmalGraph_animate_doc},
+	{"_dispatch_events", (PyCFunction)MmalGraph_dispatch_events, METH_NOARGS, NULL},
 	{"__enter__", (PyCFunction)MmalGraph_enter, METH_NOARGS, NULL},
-	{"__exit__", (PyCFunction)MmalGraph_exit, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction)MmalGraph_exit, METH_VARARGS, NULL},
 	{NULL},
 };
 
@@ -210,8 +2496,24 @@ static PyMethodDef MmalGraph_methods[] = {
 PyDoc_STRVAR(MmalGraph_uri_doc, "MmalGraph current uri(read only)\n");
 static PyObject *MmalGraph_get_uri(MmalGraphObject *self, void *closure) {
 
-	PyObject *result = Py_BuildValue("s", self->graph ? self->uri : "");
-	Py_INCREF(result);
+	PyObject *result;
+
+	graph_lock(self);
+	result = Py_BuildValue("s", self->active->graph ? self->active->uri : "");
+	pthread_mutex_unlock(&self->lock);
+	return result;
+}
+
+
+PyDoc_STRVAR(MmalGraph_prefetched_doc, "MmalGraph uri waiting in the standby renderer(read only)\n");
+static PyObject *MmalGraph_get_prefetched(MmalGraphObject *self, void *closure) {
+
+	PyObject *result;
+
+	graph_lock(self);
+	result = Py_BuildValue("s", self->standby && self->standby->graph ? self->standby->uri : "");
+	pthread_mutex_unlock(&self->lock);
+
 	return result;
 }
 
@@ -219,75 +2521,99 @@ static PyObject *MmalGraph_get_uri(MmalGraphObject *self, void *closure) {
 PyDoc_STRVAR(MmalGraph_is_open_doc, "MmalGraph display is open(read only)\n");
 static PyObject *MmalGraph_is_open(MmalGraphObject *self, void *closure) {
 
-	PyObject *result = self->graph ? Py_True : Py_False;
+	PyObject *result = self->active->graph ? Py_True : Py_False;
 	Py_INCREF(result);
 	return result;
 }
 
 
-PyDoc_STRVAR(MmalGraph_display_num_doc, "MmalGraph display target number(read only)\n");
-static PyObject *MmalGraph_get_display_num(MmalGraphObject *self, void *closure) {
+PyDoc_STRVAR(MmalGraph_persistent_doc, "MmalGraph keeps its components across open() calls(read only)\n");
+static PyObject *MmalGraph_is_persistent(MmalGraphObject *self, void *closure) {
 
-	PyObject *result = Py_BuildValue("I", self->display_num);
+	PyObject *result = self->persistent ? Py_True : Py_False;
 	Py_INCREF(result);
 	return result;
 }
 
 
+PyDoc_STRVAR(MmalGraph_open_time_doc, "MmalGraph last open() duration in seconds(read only)\n");
+static PyObject *MmalGraph_get_open_time(MmalGraphObject *self, void *closure) {
+
+	return Py_BuildValue("d", self->open_time / 1000000.0);
+}
+
+
+PyDoc_STRVAR(MmalGraph_frames_dropped_doc, "MmalGraph tapped frames dropped because they were not read in time(read only)\n");
+static PyObject *MmalGraph_get_frames_dropped(MmalGraphObject *self, void *closure) {
+
+	return Py_BuildValue("I", self->active->tap_dropped + (self->standby ? self->standby->tap_dropped : 0));
+}
+
+
+PyDoc_STRVAR(MmalGraph_display_num_doc, "MmalGraph first display target number(read only)\n");
+static PyObject *MmalGraph_get_display_num(MmalGraphObject *self, void *closure) {
+
+	return Py_BuildValue("I", self->displays[0].display_num);
+}
+
+
+PyDoc_STRVAR(MmalGraph_animating_doc, "MmalGraph display region animation is running(read only)\n");
+static PyObject *MmalGraph_is_animating(MmalGraphObject *self, void *closure) {
+
+	return PyBool_FromLong(animator_running(&self->animator));
+}
+
+
+PyDoc_STRVAR(MmalGraph_displays_doc, "MmalGraph display target numbers, one renderer each(read only)\n");
+static PyObject *MmalGraph_get_displays(MmalGraphObject *self, void *closure) {
+
+	uint32_t i;
+	PyObject *displays = PyTuple_New(self->display_count);
+
+	for (i = 0; displays && i < self->display_count; i++) {
+
+		PyTuple_SET_ITEM(displays, i, PyLong_FromUnsignedLong(self->displays[i].display_num));
+	}
+
+	return displays;
+}
+
+
 
 static PyGetSetDef MmalGraph_getseters[] = {
 
 	{"uri", (getter)MmalGraph_get_uri, (setter)NULL, MmalGraph_uri_doc},
 	{"is_open", (getter)MmalGraph_is_open, (setter)NULL, MmalGraph_is_open_doc},
+	{"prefetched", (getter)MmalGraph_get_prefetched, (setter)NULL, MmalGraph_prefetched_doc},
 	{"display_num", (getter)MmalGraph_get_display_num, (setter)NULL, MmalGraph_display_num_doc},
+	{"displays", (getter)MmalGraph_get_displays, (setter)NULL, MmalGraph_displays_doc},
+	{"animating", (getter)MmalGraph_is_animating, (setter)NULL, MmalGraph_animating_doc},
+	{"persistent", (getter)MmalGraph_is_persistent, (setter)NULL, MmalGraph_persistent_doc},
+	{"open_time", (getter)MmalGraph_get_open_time, (setter)NULL, MmalGraph_open_time_doc},
+	{"frames_dropped", (getter)MmalGraph_get_frames_dropped, (setter)NULL, MmalGraph_frames_dropped_doc},
 	{NULL},
 };
 
 
 
-PyTypeObject MmalGraphObjectType = {
-#if PY_MAJOR_VERSION >= 3
-	PyVarObject_HEAD_INIT(NULL, 0)
-#else
-	PyObject_HEAD_INIT(NULL)
-	0,				            /* ob_size */
-#endif
-	MmalGraph_name,		        /* tp_name */
-	sizeof(MmalGraphObject),	/* tp_basicsize */
-	0,			        	    /* tp_itemsize */
-	(destructor)MmalGraph_free,/* tp_dealloc */
-	0,				            /* tp_print */
-	0,				            /* tp_getattr */
-	0,				            /* tp_setattr */
-	0,				            /* tp_compare */
-	0,				            /* tp_repr */
-	0,				            /* tp_as_number */
-	0,				            /* tp_as_sequence */
-	0,				            /* tp_as_mapping */
-	0,				            /* tp_hash */
-	0,				            /* tp_call */
-	0,				            /* tp_str */
-	0,				            /* tp_getattro */
-	0,				            /* tp_setattro */
-	0,				            /* tp_as_buffer */
-	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /* tp_flags */
-	MmalGraphObject_type_doc,	/* tp_doc */
-	0,				            /* tp_traverse */
-	0,				            /* tp_clear */
-	0,				            /* tp_richcompare */
-	0,				            /* tp_weaklistoffset */
-	0,				            /* tp_iter */
-	0,				            /* tp_iternext */
-	MmalGraph_methods,		    /* tp_methods */
-	0,				            /* tp_members */
-	MmalGraph_getseters,		/* tp_getset */
-	0,		                    /* tp_base */
-	0,				            /* tp_dict */
-	0,				            /* tp_descr_get */
-	0,				            /* tp_descr_set */
-	0,				            /* tp_dictoffset */
-	(initproc)MmalGraph_init,	/* tp_init */
-	0,				            /* tp_alloc */
-	MmalGraph_new,		        /* tp_new */
+static PyType_Slot MmalGraph_slots[] = {
+	{Py_tp_doc, (void *)MmalGraphObject_type_doc},
+	{Py_tp_dealloc, (void *)MmalGraph_free},
+	{Py_tp_traverse, (void *)MmalGraph_traverse},
+	{Py_tp_clear, (void *)MmalGraph_clear},
+	{Py_tp_methods, (void *)MmalGraph_methods},
+	{Py_tp_getset, (void *)MmalGraph_getseters},
+	{Py_tp_init, (void *)MmalGraph_init},
+	{Py_tp_new, (void *)MmalGraph_new},
+	{0, NULL},
+};
+
+
+PyType_Spec MmalGraph_spec = {
+	"pylibmmal." MmalGraph_name,
+	sizeof(MmalGraphObject),
+	0,
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC,
+	MmalGraph_slots,
 };
 
@@ -1,7 +1,28 @@
 #ifndef _MMAL_GRAPH_H_
+#define _MMAL_GRAPH_H_
+
+#include <structseq.h>
+#include "mmal_pipeline.h"
 
 #define MmalGraph_name "MmalGraph"
+#define MmalGraphEvent_name "MmalGraphEvent"
+#define MmalGraphTiming_name "MmalGraphTiming"
+
+/* Presentation timing samples per callback */
+#define GRAPH_TIMING_BATCH 64
+#define GRAPH_TIMING_BATCH_MAX 4096
+
+extern PyType_Spec MmalGraph_spec;
+extern PyStructSequence_Desc MmalGraphEvent_desc;
+extern PyStructSequence_Desc MmalGraphTiming_desc;
+
+/* Returned by the native calls once close() was called on the graph, the driver should stop */
+#define GRAPH_CLOSED 1
 
-PyTypeObject MmalGraphObjectType;
+/* Drive a graph from a native thread, graph must be a MmalGraph kept alive by the caller */
+void graph_native_attach(PyObject *graph);
+int graph_native_prefetch(PyObject *graph, const char *uri, GraphError *err);
+int graph_native_show(PyObject *graph, uint32_t timeout_ms, uint32_t fade_ms, int *ready, GraphError *err);
+int graph_native_wait_animation(PyObject *graph, uint32_t timeout_ms);
 
 #endif
@@ -0,0 +1,2379 @@
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <bcm_host.h>
+#include <interface/vcos/vcos.h>
+#include <util/mmal_util.h>
+#include <util/mmal_connection.h>
+#include <util/mmal_util_params.h>
+#include <util/mmal_default_components.h>
+#include "mmal_pipeline.h"
+#include "vc_connection.h"
+#include "trace.h"
+
+#define CHECK_STATUS(status, exc, message) if (status != MMAL_SUCCESS) { err->type = exc; err->msg = message; goto error; }
+
+
+static const char *pipeline_renderer_names[PIPELINE_OUTPUTS] = {
+	"renderer.input", "renderer1.input", "renderer2.input", "renderer3.input"
+};
+
+static const char *pipeline_sink_link_names[2][2] = {
+	{"decoder->renderer", "decoder->splitter"}, {"resizer->renderer", "resizer->splitter"}
+};
+
+static const char *pipeline_split_names[PIPELINE_OUTPUTS] = {
+	"splitter->renderer", "splitter->renderer1", "splitter->renderer2", "splitter->renderer3"
+};
+
+/* 60 Hz and 50 Hz frame periods fall in their own buckets */
+const uint32_t pipeline_timing_edges_ms[PIPELINE_TIMING_BUCKETS] = {
+	5, 10, 15, 18, 22, 30, 35, 42, 50, 67, 100, UINT32_MAX
+};
+
+
+MmalPipeline *pipeline_new(void *owner, PipelineEventCb event_cb) {
+
+	MmalPipeline *pipeline;
+
+	if ((pipeline = calloc(1, sizeof(MmalPipeline))) == NULL) {
+
+		return NULL;
+	}
+
+	pipeline->owner = owner;
+	pipeline->alpha = 255;
+	pipeline->event_cb = event_cb;
+	pipeline->layer = PIPELINE_LAYER;
+	pipeline->output_count = 1;
+	pipeline->tap_depth = PIPELINE_TAP_DEPTH;
+	pipeline->outputs[0].region.display_num = 5;
+	pipeline_set_link_options(pipeline, NULL);
+	pthread_mutex_init(&pipeline->eos_lock, NULL);
+	pthread_cond_init(&pipeline->eos_cond, NULL);
+	pthread_mutex_init(&pipeline->tap_lock, NULL);
+	pthread_cond_init(&pipeline->tap_cond, NULL);
+	pthread_cond_init(&pipeline->tap_wake, NULL);
+	pthread_mutex_init(&pipeline->timing_lock, NULL);
+	pthread_mutex_init(&pipeline->stream_lock, NULL);
+	pthread_mutex_init(&pipeline->stream_write_lock, NULL);
+	pthread_cond_init(&pipeline->stream_idle, NULL);
+	pipeline->stream_fd = pipeline->stream_wake = -1;
+	return pipeline;
+}
+
+
+/* Display settings of each renderer, used by the next build */
+void pipeline_set_outputs(MmalPipeline *pipeline, const MMAL_DISPLAYREGION_T *regions, uint32_t count) {
+
+	uint32_t i;
+
+	pipeline->output_count = count > PIPELINE_OUTPUTS ? PIPELINE_OUTPUTS : count;
+
+	for (i = 0; i < pipeline->output_count; i++) {
+
+		pipeline->outputs[i].region = regions[i];
+	}
+}
+
+
+/* Resize stage used by the next build, width and height only matter for PIPELINE_RESIZE_FIXED */
+void pipeline_set_resize(MmalPipeline *pipeline, int mode, uint32_t width, uint32_t height) {
+
+	pipeline->resize_mode = mode;
+	pipeline->resize_width = width;
+	pipeline->resize_height = height;
+}
+
+
+/* Connection options of every link kind used by the next build, NULL restores the defaults */
+void pipeline_set_link_options(MmalPipeline *pipeline, const LinkOptions *options) {
+
+	uint32_t i;
+
+	for (i = 0; i < PIPELINE_LINK_KINDS; i++) {
+
+		if (options) {
+
+			pipeline->link_options[i] = options[i];
+		}
+		else {
+
+			memset(&pipeline->link_options[i], 0, sizeof(LinkOptions));
+			pipeline->link_options[i].tunnelling = -1;
+			pipeline->link_options[i].zero_copy = -1;
+		}
+	}
+}
+
+
+void pipeline_free(MmalPipeline *pipeline) {
+
+	if (pipeline == NULL) {
+
+		return;
+	}
+
+	pipeline_teardown(pipeline);
+	pthread_cond_destroy(&pipeline->eos_cond);
+	pthread_mutex_destroy(&pipeline->eos_lock);
+	pthread_cond_destroy(&pipeline->tap_wake);
+	pthread_cond_destroy(&pipeline->tap_cond);
+	pthread_mutex_destroy(&pipeline->tap_lock);
+	pthread_mutex_destroy(&pipeline->timing_lock);
+	pthread_cond_destroy(&pipeline->stream_idle);
+	pthread_mutex_destroy(&pipeline->stream_write_lock);
+	pthread_mutex_destroy(&pipeline->stream_lock);
+	free(pipeline);
+}
+
+
+/* Connection callback, runs on a MMAL thread and only wakes tap_thread */
+static void pipeline_tap_conn_cb(MMAL_CONNECTION_T *connection) {
+
+	MmalPipeline *pipeline = connection->user_data;
+
+	pthread_mutex_lock(&pipeline->tap_lock);
+	pipeline->tap_wakeup = 1;
+	pthread_cond_signal(&pipeline->tap_wake);
+	pthread_mutex_unlock(&pipeline->tap_lock);
+}
+
+
+/* Callback of a connection which outlives its pipeline because frames still reference it */
+static void pipeline_tap_detached_cb(MMAL_CONNECTION_T *connection) {
+
+}
+
+
+/* Queue a decoded buffer for Python, the oldest one is dropped so display never stalls.
+   With tap_block the decoder waits for Python instead, which stalls the whole chain back to the reader */
+static void pipeline_tap_push(MmalPipeline *pipeline, MMAL_BUFFER_HEADER_T *buffer) {
+
+	TapFrame *frame;
+	MMAL_BUFFER_HEADER_T *dropped = NULL;
+
+	/* Link only tapped for the frame cache */
+	if (pipeline->tap_depth == 0) {
+
+		return;
+	}
+
+	pthread_mutex_lock(&pipeline->tap_lock);
+
+	while (pipeline->tap_block && pipeline->tap_count >= pipeline->tap_depth && !pipeline->tap_stop) {
+
+		pthread_cond_wait(&pipeline->tap_cond, &pipeline->tap_lock);
+	}
+
+	if (pipeline->tap_stop) {
+
+		pthread_mutex_unlock(&pipeline->tap_lock);
+		return;
+	}
+
+	if (pipeline->tap_count >= pipeline->tap_depth) {
+
+		dropped = pipeline->tap_frames[pipeline->tap_head].buffer;
+		pipeline->tap_head = (pipeline->tap_head + 1) % PIPELINE_TAP_MAX;
+		pipeline->tap_count--;
+		pipeline->tap_dropped++;
+	}
+
+	mmal_buffer_header_acquire(buffer);
+	frame = &pipeline->tap_frames[(pipeline->tap_head + pipeline->tap_count) % PIPELINE_TAP_MAX];
+	frame->buffer = buffer;
+	frame->connection = pipeline->tap_conn;
+	frame_format_from_es(&frame->format, pipeline->tap_conn->out->format);
+	pipeline->tap_count++;
+
+	pthread_cond_broadcast(&pipeline->tap_cond);
+	pthread_mutex_unlock(&pipeline->tap_lock);
+
+	/* Releasing runs the connection callback, which takes tap_lock */
+	if (dropped) {
+
+		mmal_buffer_header_release(dropped);
+	}
+}
+
+
+/* Copy the first decoded frame to host memory, runs on tap_thread. Opaque frames have no host visible pixels */
+static void pipeline_capture(MmalPipeline *pipeline, MMAL_BUFFER_HEADER_T *buffer) {
+
+	int first;
+	FrameCacheEntry *entry;
+	MMAL_ES_FORMAT_T *format = pipeline->tap_conn->out->format;
+
+	pthread_mutex_lock(&pipeline->tap_lock);
+	first = pipeline->capture_frames++ == 0;
+	pthread_mutex_unlock(&pipeline->tap_lock);
+
+	if (!first || format->encoding == MMAL_ENCODING_OPAQUE || !(buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)) {
+
+		return;
+	}
+
+	if ((entry = calloc(1, sizeof(FrameCacheEntry))) == NULL || (entry->data = malloc(buffer->length)) == NULL) {
+
+		frame_cache_entry_free(entry);
+		return;
+	}
+
+	mmal_buffer_header_mem_lock(buffer);
+	memcpy(entry->data, buffer->data + buffer->offset, buffer->length);
+	mmal_buffer_header_mem_unlock(buffer);
+
+	entry->length = buffer->length;
+	entry->encoding = format->encoding;
+	entry->video = format->es->video;
+
+	pthread_mutex_lock(&pipeline->tap_lock);
+
+	if (pipeline->captured == NULL) {
+
+		pipeline->captured = entry;
+		entry = NULL;
+	}
+
+	pthread_mutex_unlock(&pipeline->tap_lock);
+	frame_cache_entry_free(entry);
+}
+
+
+/* Forget the capture of the previous stream */
+static void pipeline_reset_capture(MmalPipeline *pipeline) {
+
+	FrameCacheEntry *entry;
+
+	pthread_mutex_lock(&pipeline->tap_lock);
+	entry = pipeline->captured;
+	pipeline->captured = NULL;
+	pipeline->capture_frames = 0;
+	pthread_mutex_unlock(&pipeline->tap_lock);
+
+	frame_cache_entry_free(entry);
+}
+
+
+/* Hand over the captured frame once the stream ended with it as its only frame, NULL otherwise */
+FrameCacheEntry *pipeline_take_capture(MmalPipeline *pipeline) {
+
+	FrameCacheEntry *entry = NULL;
+
+	pthread_mutex_lock(&pipeline->tap_lock);
+
+	if (pipeline->captured && pipeline->capture_frames == 1 && __atomic_load_n(&pipeline->eos, __ATOMIC_ACQUIRE)) {
+
+		entry = pipeline->captured;
+		pipeline->captured = NULL;
+	}
+
+	pthread_mutex_unlock(&pipeline->tap_lock);
+	return entry;
+}
+
+
+/* Same clock as time.monotonic() */
+static uint64_t pipeline_now_us(void) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+
+/* Runs on the dispmanx callback thread, only counts */
+static void pipeline_vsync_cb(void *data) {
+
+	uint64_t now = pipeline_now_us();
+	MmalPipeline *pipeline = data;
+
+	pthread_mutex_lock(&pipeline->timing_lock);
+	pipeline->timing_stats.vsync_first_us = pipeline->timing_stats.vsyncs++ ? pipeline->timing_stats.vsync_first_us : now;
+	pipeline->timing_stats.vsync_last_us = now;
+	pthread_mutex_unlock(&pipeline->timing_lock);
+}
+
+
+static void pipeline_timing_bucket(uint32_t *histogram, int64_t value_us) {
+
+	uint32_t i;
+
+	for (i = 0; i < PIPELINE_TIMING_BUCKETS - 1 && value_us >= (int64_t)pipeline_timing_edges_ms[i] * 1000; i++);
+	histogram[i]++;
+}
+
+
+/* Forget the previous stream, vsync counting goes on */
+static void pipeline_reset_timing(MmalPipeline *pipeline) {
+
+	TimingStats *stats = &pipeline->timing_stats;
+
+	pthread_mutex_lock(&pipeline->timing_lock);
+	memset(stats, 0, offsetof(TimingStats, vsyncs));
+	stats->last_pts = stats->base_pts = MMAL_TIME_UNKNOWN;
+	pthread_mutex_unlock(&pipeline->timing_lock);
+}
+
+
+/* Time a frame about to be sent to the renderer, runs on tap_thread */
+static void pipeline_timing_sample(MmalPipeline *pipeline, MMAL_BUFFER_HEADER_T *buffer) {
+
+	int64_t step;
+	double delta;
+	TimingSample sample;
+	TimingStats *stats = &pipeline->timing_stats;
+
+	sample.pts = buffer->pts;
+	sample.time_us = pipeline_now_us();
+	sample.interval_us = sample.lateness_us = 0;
+	sample.vsyncs = -1;
+
+	pthread_mutex_lock(&pipeline->timing_lock);
+
+	if (stats->frames) {
+
+		/* Welford running variance, jitter is the deviation of the interval */
+		sample.interval_us = sample.time_us - stats->last_us;
+		delta = sample.interval_us - stats->interval_mean;
+		stats->interval_mean += delta / stats->frames;
+		stats->interval_m2 += delta * (sample.interval_us - stats->interval_mean);
+		pipeline_timing_bucket(stats->interval_hist, sample.interval_us);
+
+		/* No vsync since the previous frame, the renderer replaces it before it is ever scanned out */
+		if (pipeline->timing_vsync) {
+
+			sample.vsyncs = stats->vsyncs - stats->last_vsync;
+			stats->vsync_hist[sample.vsyncs < PIPELINE_TIMING_VSYNCS ? sample.vsyncs : PIPELINE_TIMING_VSYNCS - 1]++;
+			stats->dropped += sample.vsyncs == 0;
+		}
+	}
+
+	if (sample.pts != MMAL_TIME_UNKNOWN) {
+
+		/* Smallest pts step is the frame period, larger gaps are frames which never reached the renderer */
+		if (stats->last_pts != MMAL_TIME_UNKNOWN && (step = sample.pts - stats->last_pts) > 0) {
+
+			stats->pts_step = stats->pts_step && stats->pts_step < step ? stats->pts_step : step;
+			stats->missing += step > stats->pts_step * 3 / 2 ? (step + stats->pts_step / 2) / stats->pts_step - 1 : 0;
+		}
+
+		if (stats->base_pts == MMAL_TIME_UNKNOWN) {
+
+			stats->base_pts = sample.pts;
+			stats->base_us = sample.time_us;
+		}
+
+		sample.lateness_us = (int64_t)(sample.time_us - stats->base_us) - (sample.pts - stats->base_pts);
+
+		if (sample.lateness_us < 0) {
+
+			stats->base_us += sample.lateness_us;
+			sample.lateness_us = 0;
+		}
+
+		pipeline_timing_bucket(stats->lateness_hist, sample.lateness_us);
+		stats->lateness_max = sample.lateness_us > stats->lateness_max ? sample.lateness_us : stats->lateness_max;
+		stats->late += stats->pts_step && sample.lateness_us > stats->pts_step;
+		stats->last_pts = sample.pts;
+	}
+
+	stats->frames++;
+	stats->last_us = sample.time_us;
+	stats->last_vsync = stats->vsyncs;
+	pthread_mutex_unlock(&pipeline->timing_lock);
+
+	if (pipeline->timing_cb) {
+
+		pipeline->timing_cb(pipeline, &sample);
+	}
+}
+
+
+/* Count vsyncs of the first display while frames are timed, shared with other pipelines and the animator */
+static void pipeline_start_vsync(MmalPipeline *pipeline) {
+
+	if (!pipeline->timing || pipeline->null_sink || pipeline->timing_vsync) {
+
+		return;
+	}
+
+	pthread_mutex_lock(&pipeline->timing_lock);
+	pipeline->timing_stats.vsyncs = pipeline->timing_stats.vsync_first_us = pipeline->timing_stats.vsync_last_us = 0;
+	pthread_mutex_unlock(&pipeline->timing_lock);
+
+	if (vc_vsync_add_listener(pipeline->outputs[0].region.display_num, pipeline_vsync_cb, pipeline) != 0) {
+
+		return;
+	}
+
+	pthread_mutex_lock(&pipeline->timing_lock);
+	pipeline->timing_vsync = 1;
+	pthread_mutex_unlock(&pipeline->timing_lock);
+}
+
+
+static void pipeline_stop_vsync(MmalPipeline *pipeline) {
+
+	if (!pipeline->timing_vsync) {
+
+		return;
+	}
+
+	vc_vsync_remove_listener(pipeline_vsync_cb, pipeline);
+
+	pthread_mutex_lock(&pipeline->timing_lock);
+	pipeline->timing_vsync = 0;
+	pthread_mutex_unlock(&pipeline->timing_lock);
+}
+
+
+/* Forward decoder output to the renderer and keep a reference for Python */
+static void *pipeline_tap_thread(void *arg) {
+
+	MmalPipeline *pipeline = arg;
+	MMAL_BUFFER_HEADER_T *buffer;
+	MMAL_CONNECTION_T *connection = pipeline->tap_conn;
+
+	pthread_mutex_lock(&pipeline->tap_lock);
+
+	while (!pipeline->tap_stop) {
+
+		pipeline->tap_wakeup = 0;
+		pthread_mutex_unlock(&pipeline->tap_lock);
+
+		/* Decoded buffers go on to the renderer, events are handled here */
+		while ((buffer = mmal_queue_get(connection->queue)) != NULL) {
+
+			if (buffer->cmd) {
+
+				if (buffer->cmd == MMAL_EVENT_FORMAT_CHANGED) {
+
+					mmal_connection_event_format_changed(connection, buffer);
+				}
+
+				mmal_buffer_header_release(buffer);
+				continue;
+			}
+
+			if (buffer->length) {
+
+				if (pipeline->capture) {
+
+					pipeline_capture(pipeline, buffer);
+				}
+
+				pipeline_tap_push(pipeline, buffer);
+
+				if (pipeline->timing) {
+
+					pipeline_timing_sample(pipeline, buffer);
+				}
+			}
+
+			if (mmal_port_send_buffer(connection->in, buffer) != MMAL_SUCCESS) {
+
+				mmal_buffer_header_release(buffer);
+			}
+		}
+
+		/* Empty buffers go back to the decoder */
+		while ((buffer = mmal_queue_get(connection->pool->queue)) != NULL) {
+
+			if (mmal_port_send_buffer(connection->out, buffer) != MMAL_SUCCESS) {
+
+				mmal_queue_put_back(connection->pool->queue, buffer);
+				break;
+			}
+		}
+
+		pthread_mutex_lock(&pipeline->tap_lock);
+
+		if (!pipeline->tap_stop && !pipeline->tap_wakeup) {
+
+			pthread_cond_wait(&pipeline->tap_wake, &pipeline->tap_lock);
+		}
+	}
+
+	pthread_mutex_unlock(&pipeline->tap_lock);
+	return NULL;
+}
+
+
+/* Stop forwarding, frames still held by Python keep the connection alive through their own reference */
+static void pipeline_stop_tap(MmalPipeline *pipeline) {
+
+	int count = 0;
+	MMAL_CONNECTION_T *connection = pipeline->tap_conn;
+	MMAL_BUFFER_HEADER_T *queued[PIPELINE_TAP_MAX];
+
+	pthread_mutex_lock(&pipeline->tap_lock);
+	pipeline->tap_stop = 1;
+	pthread_cond_signal(&pipeline->tap_wake);
+	pthread_cond_broadcast(&pipeline->tap_cond);
+	pthread_mutex_unlock(&pipeline->tap_lock);
+
+	if (pipeline->tap_running) {
+
+		pthread_join(pipeline->tap_thread, NULL);
+		pipeline->tap_running = 0;
+	}
+
+	pipeline_stop_vsync(pipeline);
+
+	pthread_mutex_lock(&pipeline->tap_lock);
+
+	while (pipeline->tap_count) {
+
+		queued[count++] = pipeline->tap_frames[pipeline->tap_head].buffer;
+		pipeline->tap_head = (pipeline->tap_head + 1) % PIPELINE_TAP_MAX;
+		pipeline->tap_count--;
+	}
+
+	pipeline->tap_conn = NULL;
+	pthread_mutex_unlock(&pipeline->tap_lock);
+
+	if (connection) {
+
+		/* Detach first, queued frames go back to the pool without calling into this pipeline */
+		connection->callback = pipeline_tap_detached_cb;
+
+		while (count) {
+
+			mmal_buffer_header_release(queued[--count]);
+		}
+
+		mmal_connection_disable(connection);
+		mmal_connection_release(connection);
+		pipeline->decoder_conn = NULL;
+	}
+}
+
+
+/* Connect output to input with the options of kind. Zero copy is set before the connection allocates its pool,
+   buffer counts are applied to both ports since mmal_connection_enable sizes the pool from them.
+   A tapped link is forwarded by the host so it is never tunnelled */
+static MMAL_STATUS_T pipeline_new_link(MmalPipeline *pipeline, int kind, MMAL_PORT_T *output, MMAL_PORT_T *input, int tapped,
+                                       MMAL_CONNECTION_T **connection) {
+
+	uint32_t value;
+	MMAL_STATUS_T status;
+	const LinkOptions *options = &pipeline->link_options[kind];
+	uint32_t flags = options->tunnelling > 0 && !tapped ? MMAL_CONNECTION_FLAG_TUNNELLING : 0;
+
+	if (options->zero_copy >= 0) {
+
+		if ((status = mmal_port_parameter_set_boolean(output, MMAL_PARAMETER_ZERO_COPY, options->zero_copy)) != MMAL_SUCCESS ||
+		    (status = mmal_port_parameter_set_boolean(input, MMAL_PARAMETER_ZERO_COPY, options->zero_copy)) != MMAL_SUCCESS) {
+
+			return status;
+		}
+	}
+
+	if (tapped) {
+
+		status = mmal_connection_create(connection, output, input, flags);
+	}
+	else {
+
+		status = mmal_graph_new_connection(pipeline->graph, output, input, flags, connection);
+	}
+
+	if (status != MMAL_SUCCESS) {
+
+		return status;
+	}
+
+	if (options->buffer_num) {
+
+		value = options->buffer_num > output->buffer_num_min ? options->buffer_num : output->buffer_num_min;
+		value = value > input->buffer_num_min ? value : input->buffer_num_min;
+		output->buffer_num = input->buffer_num = value;
+	}
+
+	if (options->buffer_size) {
+
+		value = options->buffer_size > output->buffer_size_min ? options->buffer_size : output->buffer_size_min;
+		value = value > input->buffer_size_min ? value : input->buffer_size_min;
+		output->buffer_size = input->buffer_size = value;
+	}
+
+	return MMAL_SUCCESS;
+}
+
+
+/* Apply the output region with the pipeline layer and alpha */
+static MMAL_STATUS_T pipeline_apply_region(MmalPipeline *pipeline, PipelineOutput *output) {
+
+	MMAL_DISPLAYREGION_T param = output->region;
+
+	param.hdr.id = MMAL_PARAMETER_DISPLAYREGION;
+	param.hdr.size = sizeof(MMAL_DISPLAYREGION_T);
+	param.set |= MMAL_DISPLAY_SET_LAYER | MMAL_DISPLAY_SET_NUM | MMAL_DISPLAY_SET_ALPHA;
+	param.layer = pipeline->layer;
+	param.alpha = pipeline->alpha;
+	return mmal_port_parameter_set(output->renderer->input[0], &param.hdr);
+}
+
+
+/* One renderer per display, and a splitter in front of them when there are several.
+   Without a display a tapped link ends in a null sink, which only returns the buffers */
+static int pipeline_create_renderers(MmalPipeline *pipeline, GraphError *err) {
+
+	uint32_t i;
+	MMAL_STATUS_T status;
+
+	if (pipeline->output_count == 0) {
+
+		status = mmal_graph_new_component(pipeline->graph, PIPELINE_NULL_SINK, &pipeline->null_sink);
+		CHECK_STATUS(status, PyExc_RuntimeError, "failed to create null sink");
+	}
+
+	for (i = 0; i < pipeline->output_count; i++) {
+
+		status = mmal_graph_new_component(pipeline->graph, MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER, &pipeline->outputs[i].renderer);
+		CHECK_STATUS(status, PyExc_RuntimeError, "failed to create renderer");
+
+		status = pipeline_apply_region(pipeline, &pipeline->outputs[i]);
+		CHECK_STATUS(status, PyExc_RuntimeError, "failed to set display region");
+	}
+
+	if (pipeline->output_count > 1) {
+
+		status = mmal_graph_new_component(pipeline->graph, MMAL_COMPONENT_DEFAULT_VIDEO_SPLITTER, &pipeline->splitter);
+		CHECK_STATUS(status, PyExc_RuntimeError, "failed to create splitter");
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Shrink width x height to the largest size with the aspect ratio of the source, a smaller source is kept as is */
+void pipeline_fit_size(uint32_t source_width, uint32_t source_height, uint32_t *width, uint32_t *height) {
+
+	if (source_width == 0 || source_height == 0) {
+
+		return;
+	}
+
+	if (source_width <= *width && source_height <= *height) {
+
+		*width = source_width;
+		*height = source_height;
+	}
+	else if ((uint64_t)source_width * *height > (uint64_t)source_height * *width) {
+
+		*height = (uint32_t)((uint64_t)source_height * *width / source_width);
+	}
+	else {
+
+		*width = (uint32_t)((uint64_t)source_width * *height / source_height);
+	}
+
+	*width = *width ? *width : 1;
+	*height = *height ? *height : 1;
+}
+
+
+/* Resize target, the largest current mode among the output displays for PIPELINE_RESIZE_DISPLAY */
+static void pipeline_resize_target(MmalPipeline *pipeline, uint32_t *width, uint32_t *height) {
+
+	uint32_t i;
+	DISPMANX_MODEINFO_T info;
+	DISPMANX_DISPLAY_HANDLE_T display;
+
+	*width = pipeline->resize_width;
+	*height = pipeline->resize_height;
+
+	if (pipeline->resize_mode != PIPELINE_RESIZE_DISPLAY) {
+
+		return;
+	}
+
+	*width = *height = 0;
+
+	for (i = 0; i < pipeline->output_count; i++) {
+
+		if ((display = vc_dispmanx_display_open(pipeline->outputs[i].region.display_num)) == DISPMANX_NO_HANDLE) {
+
+			continue;
+		}
+
+		if (vc_dispmanx_display_get_info(display, &info) == 0) {
+
+			*width = (uint32_t)info.width > *width ? (uint32_t)info.width : *width;
+			*height = (uint32_t)info.height > *height ? (uint32_t)info.height : *height;
+		}
+
+		vc_dispmanx_display_close(display);
+	}
+}
+
+
+/* Put the resizer behind the decoder and return the port which now feeds the renderer(s).
+   Picture is fitted into the target keeping its aspect ratio and never scaled up */
+static MMAL_PORT_T *pipeline_connect_resizer(MmalPipeline *pipeline, GraphError *err) {
+
+	MMAL_STATUS_T status;
+	MMAL_PORT_T *output;
+	MMAL_VIDEO_FORMAT_T *video;
+	uint32_t width, height, source_width, source_height;
+
+	pipeline_resize_target(pipeline, &width, &height);
+
+	if (width == 0 || height == 0) {
+
+		err->type = PyExc_RuntimeError;
+		err->msg = "failed to get resize target from display";
+		goto error;
+	}
+
+	status = mmal_graph_new_component(pipeline->graph, PIPELINE_RESIZER, &pipeline->resizer);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create resizer");
+
+	status = pipeline_new_link(pipeline, PIPELINE_LINK_DECODER, pipeline->decoder->output[0], pipeline->resizer->input[0], 0,
+	                           &pipeline->resizer_conn);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to connect decoder to resizer");
+
+	/* Source size is known once the stream header was parsed, otherwise the target is used as is */
+	video = &pipeline->resizer->input[0]->format->es->video;
+	source_width = video->crop.width ? (uint32_t)video->crop.width : video->width;
+	source_height = video->crop.height ? (uint32_t)video->crop.height : video->height;
+	pipeline_fit_size(source_width, source_height, &width, &height);
+
+	output = pipeline->resizer->output[0];
+	mmal_format_copy(output->format, pipeline->resizer->input[0]->format);
+	output->format->encoding = MMAL_ENCODING_I420;
+	video = &output->format->es->video;
+	video->width = VCOS_ALIGN_UP(width, 32);
+	video->height = VCOS_ALIGN_UP(height, 16);
+	video->crop.x = video->crop.y = 0;
+	video->crop.width = width;
+	video->crop.height = height;
+	status = mmal_port_format_commit(output);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to set resizer output size");
+
+	/* Buffers were sized for the source until now, take what the smaller format needs */
+	output->buffer_num = output->buffer_num_recommended > output->buffer_num_min ? output->buffer_num_recommended : output->buffer_num_min;
+	output->buffer_size = output->buffer_size_recommended > output->buffer_size_min ? output->buffer_size_recommended : output->buffer_size_min;
+	return output;
+
+error:
+	return NULL;
+}
+
+
+/* Splitter outputs take the format of its input, so they are connected once the input format is set */
+static int pipeline_connect_splitter(MmalPipeline *pipeline, GraphError *err) {
+
+	uint32_t i;
+	MMAL_STATUS_T status;
+
+	for (i = 0; pipeline->splitter && i < pipeline->output_count; i++) {
+
+		status = pipeline_new_link(pipeline, PIPELINE_LINK_SPLITTER, pipeline->splitter->output[i], pipeline->outputs[i].renderer->input[0], 0,
+		                           &pipeline->outputs[i].connection);
+		CHECK_STATUS(status, PyExc_RuntimeError, "failed to connect splitter to renderer");
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Connect decoder output to the renderer, or to the splitter which copies each frame to every renderer.
+   With a resizer the same applies to its output. A tapped link is driven by tap_thread instead of the graph */
+static int pipeline_connect_renderer(MmalPipeline *pipeline, GraphError *err) {
+
+	MMAL_STATUS_T status;
+	int kind = PIPELINE_LINK_DECODER;
+	MMAL_PORT_T *output = pipeline->decoder->output[0];
+	MMAL_PORT_T *sink;
+
+	if (pipeline->null_sink) {
+
+		sink = pipeline->null_sink->input[0];
+	}
+	else {
+
+		sink = pipeline->splitter ? pipeline->splitter->input[0] : pipeline->outputs[0].renderer->input[0];
+	}
+
+	if (pipeline->resize_mode != PIPELINE_RESIZE_OFF) {
+
+		if ((output = pipeline_connect_resizer(pipeline, err)) == NULL) {
+
+			goto error;
+		}
+
+		kind = PIPELINE_LINK_RESIZER;
+	}
+
+	if (!pipeline->tap) {
+
+		status = pipeline_new_link(pipeline, kind, output, sink, 0, &pipeline->decoder_conn);
+		CHECK_STATUS(status, PyExc_RuntimeError, "failed to connect decoder to renderer");
+	}
+	else {
+
+		if (pipeline->tap_encoding) {
+
+			output->format->encoding = pipeline->tap_encoding;
+			status = mmal_port_format_commit(output);
+			CHECK_STATUS(status, PyExc_ValueError, "decoder or resizer does not support tap format");
+		}
+
+		status = pipeline_new_link(pipeline, kind, output, sink, 1, &pipeline->tap_conn);
+		CHECK_STATUS(status, PyExc_RuntimeError, "failed to connect decoder to renderer");
+
+		pipeline->decoder_conn = pipeline->tap_conn;
+		pipeline->tap_conn->user_data = pipeline;
+		pipeline->tap_conn->callback = pipeline_tap_conn_cb;
+	}
+
+	return pipeline_connect_splitter(pipeline, err);
+
+error:
+	return -1;
+}
+
+
+/* Enable the tapped link once the graph is running */
+static int pipeline_start_tap(MmalPipeline *pipeline, GraphError *err) {
+
+	MMAL_STATUS_T status;
+
+	if (pipeline->tap_conn == NULL) {
+
+		return 0;
+	}
+
+	pipeline->tap_stop = 0;
+	pipeline->tap_wakeup = 1;
+
+	status = mmal_connection_enable(pipeline->tap_conn);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable decoder to renderer connection");
+
+	if (pthread_create(&pipeline->tap_thread, NULL, pipeline_tap_thread, pipeline) != 0) {
+
+		err->type = PyExc_RuntimeError;
+		err->msg = "failed to start tap thread";
+		goto error;
+	}
+
+	pipeline->tap_running = 1;
+	pipeline_start_vsync(pipeline);
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Wait for the next decoded frame, takes a connection reference on success.
+   Fails on timeout and once the stream ended with nothing left queued */
+int pipeline_tap_get(MmalPipeline *pipeline, TapFrame *frame, uint32_t timeout_ms) {
+
+	int ret = 0;
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+
+	if (deadline.tv_nsec >= 1000000000L) {
+
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&pipeline->tap_lock);
+
+	while (!pipeline->tap_count && pipeline->tap_running && !pipeline->tap_stop && !__atomic_load_n(&pipeline->eos, __ATOMIC_ACQUIRE) &&
+	       ret != ETIMEDOUT) {
+
+		ret = pthread_cond_timedwait(&pipeline->tap_cond, &pipeline->tap_lock, &deadline);
+	}
+
+	if (pipeline->tap_count == 0) {
+
+		pthread_mutex_unlock(&pipeline->tap_lock);
+		return -1;
+	}
+
+	*frame = pipeline->tap_frames[pipeline->tap_head];
+	pipeline->tap_head = (pipeline->tap_head + 1) % PIPELINE_TAP_MAX;
+	pipeline->tap_count--;
+	mmal_connection_acquire(frame->connection);
+
+	/* Room for the next frame when the decoder waits on a full queue */
+	pthread_cond_broadcast(&pipeline->tap_cond);
+
+	pthread_mutex_unlock(&pipeline->tap_lock);
+	return 0;
+}
+
+
+/* Stop stream writers and the file descriptor reader, input buffers still queued come back when the decoder input is disabled */
+static void pipeline_stop_stream(MmalPipeline *pipeline) {
+
+	pthread_mutex_lock(&pipeline->stream_lock);
+	__atomic_store_n(&pipeline->stream_stop, 1, __ATOMIC_RELEASE);
+
+	if (pipeline->stream_wake >= 0) {
+
+		eventfd_write(pipeline->stream_wake, 1);
+	}
+
+	while (pipeline->stream_users) {
+
+		pthread_cond_wait(&pipeline->stream_idle, &pipeline->stream_lock);
+	}
+
+	pthread_mutex_unlock(&pipeline->stream_lock);
+
+	if (pipeline->stream_running) {
+
+		pthread_join(pipeline->stream_thread, NULL);
+		pipeline->stream_running = 0;
+	}
+
+	if (pipeline->stream_wake >= 0) {
+
+		close(pipeline->stream_wake);
+		pipeline->stream_wake = -1;
+	}
+
+	if (pipeline->stream_fd >= 0) {
+
+		close(pipeline->stream_fd);
+		pipeline->stream_fd = -1;
+	}
+
+	pipeline->stream = 0;
+}
+
+
+void pipeline_teardown(MmalPipeline *pipeline) {
+
+	uint32_t i;
+
+	if (pipeline->stream) {
+
+		pipeline_stop_stream(pipeline);
+	}
+
+	if (pipeline->tap_conn) {
+
+		pipeline_stop_tap(pipeline);
+	}
+
+	if (pipeline->input_pool) {
+		mmal_port_disable(pipeline->input_port);
+		mmal_port_pool_destroy(pipeline->input_port, pipeline->input_pool);
+		pipeline->input_pool = NULL;
+		pipeline->input_port = NULL;
+	}
+
+	if (pipeline->graph) {
+		mmal_graph_disable(pipeline->graph);
+		mmal_graph_destroy(pipeline->graph);
+		pipeline->graph = NULL;
+		pipeline->reader_conn = NULL;
+		pipeline->decoder_conn = NULL;
+		pipeline->resizer_conn = NULL;
+	}
+
+	if (pipeline->uri) {
+		free(pipeline->uri);
+		pipeline->uri = NULL;
+	}
+
+	pipeline_reset_capture(pipeline);
+
+	if (pipeline->reader) {
+		mmal_component_release(pipeline->reader);
+		pipeline->reader = NULL;
+	}
+
+	if (pipeline->decoder) {
+		mmal_component_release(pipeline->decoder);
+		pipeline->decoder = NULL;
+	}
+
+	if (pipeline->resizer) {
+		mmal_component_release(pipeline->resizer);
+		pipeline->resizer = NULL;
+	}
+
+	if (pipeline->splitter) {
+		mmal_component_release(pipeline->splitter);
+		pipeline->splitter = NULL;
+	}
+
+	if (pipeline->null_sink) {
+		mmal_component_release(pipeline->null_sink);
+		pipeline->null_sink = NULL;
+	}
+
+	for (i = 0; i < PIPELINE_OUTPUTS; i++) {
+
+		pipeline->outputs[i].connection = NULL;
+
+		if (pipeline->outputs[i].renderer) {
+			mmal_component_release(pipeline->outputs[i].renderer);
+			pipeline->outputs[i].renderer = NULL;
+		}
+	}
+}
+
+
+/* Runs on a MMAL thread, track end-of-stream and forward the event to the owner */
+static void pipeline_control_cb(MMAL_GRAPH_T *graph, MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer, void *cb_data) {
+
+	MmalPipeline *pipeline = cb_data;
+
+	if (buffer->cmd == MMAL_EVENT_EOS) {
+
+		pthread_mutex_lock(&pipeline->eos_lock);
+		__atomic_store_n(&pipeline->eos, 1, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&pipeline->eos_cond);
+		pthread_mutex_unlock(&pipeline->eos_lock);
+
+		/* Readers of the tap stop waiting once the queue is drained */
+		pthread_mutex_lock(&pipeline->tap_lock);
+		pthread_cond_broadcast(&pipeline->tap_cond);
+		pthread_mutex_unlock(&pipeline->tap_lock);
+	}
+
+	if (pipeline->event_cb) {
+
+		pipeline->event_cb(pipeline, port, buffer);
+	}
+
+	mmal_buffer_header_release(buffer);
+}
+
+
+/* Start timing an open, a reused renderer restarts its counters so first frame refers to this open */
+static void pipeline_start_clock(MmalPipeline *pipeline) {
+
+	MMAL_CORE_STATISTICS_T stats;
+
+	memset(pipeline->phase_us, 0, sizeof(pipeline->phase_us));
+	pipeline->open_start = pipeline->phase_mark = vcos_getmicrosecs64();
+
+	if (pipeline->outputs[0].renderer) {
+
+		mmal_util_get_core_port_stats(pipeline->outputs[0].renderer->input[0], MMAL_CORE_STATS_RX, MMAL_TRUE, &stats);
+	}
+}
+
+
+static void pipeline_mark(MmalPipeline *pipeline, int phase) {
+
+	uint64_t now = vcos_getmicrosecs64();
+
+	pipeline->phase_us[phase] = now - pipeline->phase_mark;
+	pipeline->phase_mark = now;
+}
+
+
+static void pipeline_reset_eos(MmalPipeline *pipeline) {
+
+	pthread_mutex_lock(&pipeline->eos_lock);
+	pipeline->eos = 0;
+	pthread_mutex_unlock(&pipeline->eos_lock);
+}
+
+
+/* Swap the reader uri on a live graph, components and the decoder to renderer connection stay enabled */
+static int pipeline_switch_uri(MmalPipeline *pipeline, GraphError *err) {
+
+	MMAL_STATUS_T status;
+
+	/* Stop feeding the decoder, this flushes reader output and decoder input */
+	status = mmal_connection_disable(pipeline->reader_conn);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to disable reader connection");
+
+	status = mmal_util_port_set_uri(pipeline->reader->control, pipeline->uri);
+	CHECK_STATUS(status, PyExc_IOError, "failed to open url");
+
+	/* New container may carry a different format, propagate it to the decoder */
+	status = mmal_format_full_copy(pipeline->decoder->input[0]->format, pipeline->reader->output[0]->format);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to copy reader format");
+
+	status = mmal_port_format_commit(pipeline->decoder->input[0]);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to commit decoder format");
+	pipeline_mark(pipeline, PIPELINE_PHASE_OPEN);
+
+	status = mmal_connection_enable(pipeline->reader_conn);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable reader connection");
+	pipeline_mark(pipeline, PIPELINE_PHASE_ENABLE);
+
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Create reader -> decoder -> renderer(s) graph from scratch */
+static int pipeline_build(MmalPipeline *pipeline, GraphError *err) {
+
+	MMAL_STATUS_T status;
+
+	vc_host_init();
+
+	/* Create the graph */
+	status = mmal_graph_create(&pipeline->graph, 0);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create graph");
+
+	/* Add the components */
+	status = mmal_graph_new_component(pipeline->graph, MMAL_COMPONENT_DEFAULT_CONTAINER_READER, &pipeline->reader);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create reader");
+
+	status = mmal_graph_new_component(pipeline->graph, pipeline->video ? MMAL_COMPONENT_DEFAULT_VIDEO_DECODER : MMAL_COMPONENT_DEFAULT_IMAGE_DECODER,
+	                                  &pipeline->decoder);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create decoder");
+
+	if (pipeline_create_renderers(pipeline, err) != 0) {
+
+		goto error;
+	}
+
+	pipeline_mark(pipeline, PIPELINE_PHASE_CREATE);
+
+	/* Configure the reader using the given URI */
+	status = mmal_util_port_set_uri(pipeline->reader->control, pipeline->uri);
+	CHECK_STATUS(status, PyExc_IOError, "failed to open url");
+	pipeline_mark(pipeline, PIPELINE_PHASE_OPEN);
+
+	/* connect them up - this propagates port settings from outputs to inputs */
+	status = pipeline_new_link(pipeline, PIPELINE_LINK_READER, pipeline->reader->output[0], pipeline->decoder->input[0], 0, &pipeline->reader_conn);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to connect reader to decoder");
+
+	if (pipeline_connect_renderer(pipeline, err) != 0) {
+
+		goto error;
+	}
+
+	pipeline_mark(pipeline, PIPELINE_PHASE_CONNECT);
+
+	/* Start playback */
+	status = mmal_graph_enable(pipeline->graph, pipeline_control_cb, pipeline);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable graph");
+
+	if (pipeline_start_tap(pipeline, err) != 0) {
+
+		goto error;
+	}
+
+	pipeline_mark(pipeline, PIPELINE_PHASE_ENABLE);
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Open uri, a persistent pipeline which is already built only swaps the reader uri */
+int pipeline_open(MmalPipeline *pipeline, const char *uri, int persistent, GraphError *err) {
+
+	/* Reopen case, a graph fed from memory has no reader to reuse */
+	if (pipeline->graph && (!persistent || pipeline->reader == NULL)) {
+
+		pipeline_teardown(pipeline);
+	}
+
+	free(pipeline->uri);
+	if ((pipeline->uri = strdup(uri)) == NULL) {
+
+		err->type = PyExc_MemoryError;
+		err->msg = "failed to copy uri";
+		goto error;
+	}
+
+	pipeline_reset_eos(pipeline);
+	pipeline_reset_capture(pipeline);
+	pipeline_reset_timing(pipeline);
+	pipeline_start_clock(pipeline);
+
+	if (pipeline->graph) {
+
+		if (pipeline_switch_uri(pipeline, err) != 0) {
+
+			goto error;
+		}
+	}
+	else if (pipeline_build(pipeline, err) != 0) {
+
+		goto error;
+	}
+
+	return 0;
+
+error:
+	/* Cleanup everything */
+	pipeline_teardown(pipeline);
+	return -1;
+}
+
+
+/* Guess the image encoding from its leading magic bytes, returns 0 when unknown */
+uint32_t pipeline_detect_encoding(const uint8_t *data, size_t size) {
+
+	if (size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff) {
+
+		return MMAL_ENCODING_JPEG;
+	}
+	else if (size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0) {
+
+		return MMAL_ENCODING_PNG;
+	}
+	else if (size >= 6 && (memcmp(data, "GIF87a", 6) == 0 || memcmp(data, "GIF89a", 6) == 0)) {
+
+		return MMAL_ENCODING_GIF;
+	}
+	else if (size >= 2 && data[0] == 'B' && data[1] == 'M') {
+
+		return MMAL_ENCODING_BMP;
+	}
+
+	return 0;
+}
+
+
+static uint32_t pipeline_be16(const uint8_t *data) {
+
+	return (data[0] << 8) | data[1];
+}
+
+
+static uint32_t pipeline_le32(const uint8_t *data) {
+
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+
+/* Picture size from the image header, returns -1 when it cannot be found in data */
+int pipeline_image_size(const uint8_t *data, size_t size, uint32_t *width, uint32_t *height) {
+
+	size_t offset = 2;
+	int32_t value;
+
+	switch (pipeline_detect_encoding(data, size)) {
+		case MMAL_ENCODING_JPEG:
+			/* Walk the marker segments up to the first start of frame */
+			while (offset + 9 <= size && data[offset] == 0xff) {
+
+				uint8_t marker = data[offset + 1];
+
+				if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+
+					*height = pipeline_be16(data + offset + 5);
+					*width = pipeline_be16(data + offset + 7);
+					return *width && *height ? 0 : -1;
+				}
+
+				offset += 2 + pipeline_be16(data + offset + 2);
+			}
+
+			return -1;
+
+		case MMAL_ENCODING_PNG:
+			if (size < 24) {
+
+				return -1;
+			}
+
+			*width = (pipeline_be16(data + 16) << 16) | pipeline_be16(data + 18);
+			*height = (pipeline_be16(data + 20) << 16) | pipeline_be16(data + 22);
+			return 0;
+
+		case MMAL_ENCODING_GIF:
+			if (size < 10) {
+
+				return -1;
+			}
+
+			*width = data[6] | (data[7] << 8);
+			*height = data[8] | (data[9] << 8);
+			return 0;
+
+		case MMAL_ENCODING_BMP:
+			if (size < 26) {
+
+				return -1;
+			}
+
+			/* Negative height is a top-down bitmap */
+			*width = pipeline_le32(data + 18);
+			value = (int32_t)pipeline_le32(data + 22);
+			*height = value < 0 ? -value : value;
+			return 0;
+
+		default:
+			return -1;
+	}
+}
+
+
+/* Decoder input returned a buffer, restore its own payload and give it back to the pool */
+static void pipeline_input_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	buffer->data = buffer->user_data;
+	mmal_buffer_header_release(buffer);
+}
+
+
+/* Create decoder -> renderer graph, decoder input is fed from input_pool */
+static int pipeline_build_decoder(MmalPipeline *pipeline, const char *component, uint32_t encoding, uint32_t flags, GraphError *err) {
+
+	MMAL_PORT_T *input;
+	MMAL_STATUS_T status;
+	LinkOptions *options = &pipeline->link_options[PIPELINE_LINK_READER];
+
+	vc_host_init();
+
+	status = mmal_graph_create(&pipeline->graph, 0);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create graph");
+
+	status = mmal_graph_new_component(pipeline->graph, component, &pipeline->decoder);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create decoder");
+
+	if (pipeline_create_renderers(pipeline, err) != 0) {
+
+		goto error;
+	}
+
+	pipeline_mark(pipeline, PIPELINE_PHASE_CREATE);
+
+	input = pipeline->decoder->input[0];
+	input->format->type = MMAL_ES_TYPE_VIDEO;
+	input->format->encoding = encoding;
+	input->format->flags = flags;
+	status = mmal_port_format_commit(input);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to commit decoder format");
+
+	if (pipeline_connect_renderer(pipeline, err) != 0) {
+
+		goto error;
+	}
+
+	pipeline_mark(pipeline, PIPELINE_PHASE_CONNECT);
+
+	status = mmal_graph_enable(pipeline->graph, pipeline_control_cb, pipeline);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable graph");
+
+	if (pipeline_start_tap(pipeline, err) != 0) {
+
+		goto error;
+	}
+
+	/* Input buffers stay with us, the decoder hands them back through pipeline_input_cb */
+	input->buffer_num = input->buffer_num_recommended > input->buffer_num_min ? input->buffer_num_recommended : input->buffer_num_min;
+	input->buffer_size = input->buffer_size_recommended > input->buffer_size_min ? input->buffer_size_recommended : input->buffer_size_min;
+
+	/* A stream is fed in place of the reader, so the reader link options size its pool */
+	if (pipeline->stream && options->buffer_num) {
+
+		input->buffer_num = options->buffer_num > input->buffer_num_min ? options->buffer_num : input->buffer_num_min;
+	}
+
+	if (pipeline->stream && options->buffer_size) {
+
+		input->buffer_size = options->buffer_size > input->buffer_size_min ? options->buffer_size : input->buffer_size_min;
+	}
+
+	if ((pipeline->input_pool = mmal_port_pool_create(input, input->buffer_num, input->buffer_size)) == NULL) {
+
+		err->type = PyExc_MemoryError;
+		err->msg = "failed to create decoder input pool";
+		goto error;
+	}
+
+	pipeline->input_port = input;
+
+	status = mmal_port_enable(input, pipeline_input_cb);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable decoder input");
+	pipeline_mark(pipeline, PIPELINE_PHASE_ENABLE);
+
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Restart decoder input on a live graph for a new stream of the given encoding */
+static int pipeline_switch_encoding(MmalPipeline *pipeline, uint32_t encoding, GraphError *err) {
+
+	MMAL_STATUS_T status;
+	MMAL_PORT_T *input = pipeline->decoder->input[0];
+
+	status = mmal_port_disable(input);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to disable decoder input");
+
+	input->format->encoding = encoding;
+	status = mmal_port_format_commit(input);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to commit decoder format");
+
+	status = mmal_port_enable(input, pipeline_input_cb);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable decoder input");
+	pipeline_mark(pipeline, PIPELINE_PHASE_ENABLE);
+
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Send data to decoder input, return once the decoder consumed every buffer */
+static int pipeline_feed(MmalPipeline *pipeline, const uint8_t *data, size_t size, GraphError *err) {
+
+	uint32_t i, count, chunk;
+	size_t offset = 0;
+	MMAL_STATUS_T status;
+	MMAL_BUFFER_HEADER_T *buffer, **held;
+	MMAL_PORT_T *input = pipeline->decoder->input[0];
+	uint32_t alignment = input->buffer_alignment_min > 4 ? input->buffer_alignment_min : 4;
+
+	/* Aligned data is handed to the decoder in place, only misaligned data is copied into the pool */
+	int in_place = ((uintptr_t)data % alignment) == 0 && (input->buffer_size % alignment) == 0;
+
+	while (offset < size) {
+
+		if ((buffer = mmal_queue_timedwait(pipeline->input_pool->queue, PIPELINE_INPUT_TIMEOUT)) == NULL) {
+
+			err->type = PyExc_RuntimeError;
+			err->msg = "timeout waiting for decoder input buffer";
+			goto error;
+		}
+
+		mmal_buffer_header_reset(buffer);
+		buffer->user_data = buffer->data;
+		chunk = size - offset > buffer->alloc_size ? buffer->alloc_size : size - offset;
+
+		if (in_place) {
+
+			buffer->data = (uint8_t *)data + offset;
+		}
+		else {
+
+			memcpy(buffer->data, data + offset, chunk);
+		}
+
+		buffer->length = chunk;
+		offset += chunk;
+		buffer->flags = offset == size ? MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_EOS : 0;
+
+		status = mmal_port_send_buffer(input, buffer);
+
+		if (status != MMAL_SUCCESS) {
+
+			buffer->data = buffer->user_data;
+			mmal_buffer_header_release(buffer);
+			err->type = PyExc_RuntimeError;
+			err->msg = "failed to send decoder input";
+			goto error;
+		}
+	}
+
+	/* Data belongs to the caller, so every in flight buffer must be back before returning. Headers are held until
+	   all of them are in, one put back right away would satisfy every following wait */
+	if ((held = malloc(sizeof(MMAL_BUFFER_HEADER_T *) * pipeline->input_pool->headers_num)) == NULL) {
+
+		err->type = PyExc_MemoryError;
+		err->msg = "failed to allocate decoder input headers";
+		goto error;
+	}
+
+	for (count = 0; count < pipeline->input_pool->headers_num; count++) {
+
+		if ((held[count] = mmal_queue_timedwait(pipeline->input_pool->queue, PIPELINE_INPUT_TIMEOUT)) == NULL) {
+
+			break;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+
+		mmal_queue_put(pipeline->input_pool->queue, held[i]);
+	}
+
+	free(held);
+
+	if (count < pipeline->input_pool->headers_num) {
+
+		err->type = PyExc_RuntimeError;
+		err->msg = "timeout waiting for decoder to consume input";
+		goto error;
+	}
+
+	return 0;
+
+error:
+	/* Disabling the port returns every buffer still owned by the decoder */
+	mmal_port_disable(input);
+	return -1;
+}
+
+
+/* Decode an in-memory image, a persistent pipeline already fed from memory keeps its components */
+int pipeline_open_buffer(MmalPipeline *pipeline, const uint8_t *data, size_t size, int persistent, GraphError *err) {
+
+	uint32_t encoding;
+
+	if ((encoding = pipeline_detect_encoding(data, size)) == 0) {
+
+		err->type = PyExc_ValueError;
+		err->msg = "unknown image format (JPEG, PNG, GIF, BMP)";
+		return -1;
+	}
+
+	/* Reopen case, a reader based graph, a stream or one without decoder can't be reused */
+	if (pipeline->graph && (!persistent || pipeline->reader || pipeline->stream || pipeline->decoder == NULL)) {
+
+		pipeline_teardown(pipeline);
+	}
+
+	free(pipeline->uri);
+	if ((pipeline->uri = strdup("")) == NULL) {
+
+		err->type = PyExc_MemoryError;
+		err->msg = "failed to copy uri";
+		goto error;
+	}
+
+	pipeline_reset_eos(pipeline);
+	pipeline_reset_capture(pipeline);
+	pipeline_reset_timing(pipeline);
+	pipeline_start_clock(pipeline);
+
+	if (pipeline->graph) {
+
+		if (pipeline_switch_encoding(pipeline, encoding, err) != 0) {
+
+			goto error;
+		}
+	}
+	else if (pipeline_build_decoder(pipeline, MMAL_COMPONENT_DEFAULT_IMAGE_DECODER, encoding, MMAL_ES_FORMAT_FLAG_FRAMED, err) != 0) {
+
+		goto error;
+	}
+
+	/* Memory input is opened by feeding it, after the graph is running */
+	if (pipeline_feed(pipeline, data, size, err) != 0) {
+
+		goto error;
+	}
+
+	pipeline_mark(pipeline, PIPELINE_PHASE_OPEN);
+	return 0;
+
+error:
+	pipeline_teardown(pipeline);
+	return -1;
+}
+
+
+/* Next free stream input buffer, waits in slices until deadline_us or until the stream stops, NULL on either */
+static MMAL_BUFFER_HEADER_T *pipeline_stream_buffer(MmalPipeline *pipeline, uint64_t deadline_us) {
+
+	uint32_t slice;
+	uint64_t now, stall = 0;
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	while ((buffer = mmal_queue_get(pipeline->input_pool->queue)) == NULL) {
+
+		now = pipeline_now_us();
+
+		/* Backpressure, the decoder still holds every input buffer */
+		if (stall == 0) {
+
+			stall = now;
+			pthread_mutex_lock(&pipeline->stream_lock);
+			pipeline->stream_stats.stalls++;
+			pthread_mutex_unlock(&pipeline->stream_lock);
+		}
+
+		if (__atomic_load_n(&pipeline->stream_stop, __ATOMIC_ACQUIRE) || now >= deadline_us) {
+
+			break;
+		}
+
+		slice = deadline_us - now < PIPELINE_STREAM_SLICE * 1000ULL ? (deadline_us - now + 999) / 1000 : PIPELINE_STREAM_SLICE;
+
+		if ((buffer = mmal_queue_timedwait(pipeline->input_pool->queue, slice)) != NULL) {
+
+			break;
+		}
+	}
+
+	if (stall) {
+
+		pthread_mutex_lock(&pipeline->stream_lock);
+		pipeline->stream_stats.stall_us += pipeline_now_us() - stall;
+		pthread_mutex_unlock(&pipeline->stream_lock);
+	}
+
+	if (buffer) {
+
+		mmal_buffer_header_reset(buffer);
+		buffer->user_data = buffer->data;
+		buffer->pts = buffer->dts = MMAL_TIME_UNKNOWN;
+		buffer->flags = 0;
+	}
+
+	return buffer;
+}
+
+
+/* Queue a filled stream buffer, the decoder hands it back through pipeline_input_cb. Counted first, the end
+   of stream event may reach the host before mmal_port_send_buffer() returns */
+static int pipeline_stream_send(MmalPipeline *pipeline, MMAL_BUFFER_HEADER_T *buffer) {
+
+	pthread_mutex_lock(&pipeline->stream_lock);
+	pipeline->stream_stats.bytes += buffer->length;
+	pipeline->stream_stats.buffers++;
+	pipeline->stream_stats.eos = (buffer->flags & MMAL_BUFFER_HEADER_FLAG_EOS) != 0;
+	pthread_mutex_unlock(&pipeline->stream_lock);
+
+	if (mmal_port_send_buffer(pipeline->input_port, buffer) != MMAL_SUCCESS) {
+
+		mmal_buffer_header_release(buffer);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Read the stream from a file descriptor until end of file, which ends the stream. Waits for input buffers before
+   reading, so a decoder falling behind leaves the data in the pipe or socket */
+static void *pipeline_stream_thread(void *arg) {
+
+	ssize_t size;
+	struct pollfd fds[2];
+	MmalPipeline *pipeline = arg;
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	fds[0].fd = pipeline->stream_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = pipeline->stream_wake;
+	fds[1].events = POLLIN;
+
+	while ((buffer = pipeline_stream_buffer(pipeline, UINT64_MAX)) != NULL) {
+
+		if (poll(fds, 2, -1) < 0 || fds[1].revents) {
+
+			mmal_buffer_header_release(buffer);
+
+			if (fds[1].revents || errno != EINTR) {
+
+				break;
+			}
+
+			continue;
+		}
+
+		if ((size = read(fds[0].fd, buffer->data, buffer->alloc_size)) < 0 && (errno == EINTR || errno == EAGAIN)) {
+
+			mmal_buffer_header_release(buffer);
+			continue;
+		}
+
+		if (size < 0) {
+
+			pthread_mutex_lock(&pipeline->stream_lock);
+			pipeline->stream_stats.error = errno;
+			pthread_mutex_unlock(&pipeline->stream_lock);
+		}
+
+		buffer->length = size > 0 ? size : 0;
+		buffer->flags = size > 0 ? 0 : MMAL_BUFFER_HEADER_FLAG_EOS;
+
+		if (pipeline_stream_send(pipeline, buffer) != 0 || size <= 0) {
+
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Decode an H.264 or MJPEG elementary stream, fed by pipeline_stream_write() or read from fd when it is not -1.
+   fd is duplicated, the caller may close its own. framed streams get one whole frame per write, others are
+   parsed by the decoder */
+int pipeline_open_stream(MmalPipeline *pipeline, uint32_t encoding, int framed, int fd, GraphError *err) {
+
+	/* Every stream starts on a new decoder */
+	if (pipeline->graph) {
+
+		pipeline_teardown(pipeline);
+	}
+
+	free(pipeline->uri);
+	if ((pipeline->uri = strdup("")) == NULL) {
+
+		err->type = PyExc_MemoryError;
+		err->msg = "failed to copy uri";
+		goto error;
+	}
+
+	pipeline_reset_eos(pipeline);
+	pipeline_reset_capture(pipeline);
+	pipeline_reset_timing(pipeline);
+	pipeline_start_clock(pipeline);
+
+	pthread_mutex_lock(&pipeline->stream_lock);
+	memset(&pipeline->stream_stats, 0, sizeof(StreamStats));
+	pipeline->stream_stats.fd = fd;
+	pipeline->stream = 1;
+	pipeline->stream_framed = framed;
+	pipeline->stream_partial = 0;
+	pipeline->stream_stop = 0;
+	pthread_mutex_unlock(&pipeline->stream_lock);
+
+	if (pipeline_build_decoder(pipeline, MMAL_COMPONENT_DEFAULT_VIDEO_DECODER, encoding, framed ? MMAL_ES_FORMAT_FLAG_FRAMED : 0, err) != 0) {
+
+		goto error;
+	}
+
+	if (fd >= 0) {
+
+		/* The reader outlives the Python object which handed out fd */
+		if ((pipeline->stream_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+
+			err->type = PyExc_OSError;
+			err->msg = "failed to duplicate stream fd";
+			goto error;
+		}
+
+		if ((pipeline->stream_wake = eventfd(0, EFD_CLOEXEC)) < 0 ||
+		    pthread_create(&pipeline->stream_thread, NULL, pipeline_stream_thread, pipeline) != 0) {
+
+			err->type = PyExc_RuntimeError;
+			err->msg = "failed to start stream reader";
+			goto error;
+		}
+
+		pipeline->stream_running = 1;
+	}
+
+	pipeline_mark(pipeline, PIPELINE_PHASE_OPEN);
+	return 0;
+
+error:
+	pipeline_teardown(pipeline);
+	return -1;
+}
+
+
+/* Register a writer of a stream fed by the host, fails when it is not streaming or it is being torn down */
+int pipeline_stream_enter(MmalPipeline *pipeline) {
+
+	int ret = -1;
+
+	pthread_mutex_lock(&pipeline->stream_lock);
+
+	if (pipeline->stream && !pipeline->stream_stop && !pipeline->stream_running) {
+
+		pipeline->stream_users++;
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&pipeline->stream_lock);
+	return ret;
+}
+
+
+void pipeline_stream_leave(MmalPipeline *pipeline) {
+
+	pthread_mutex_lock(&pipeline->stream_lock);
+
+	if (--pipeline->stream_users == 0) {
+
+		pthread_cond_broadcast(&pipeline->stream_idle);
+	}
+
+	pthread_mutex_unlock(&pipeline->stream_lock);
+}
+
+
+/* Copy data into stream input buffers, between pipeline_stream_enter() and pipeline_stream_leave(). Waits up to
+   timeout_us for free buffers (forever when negative) and returns the bytes queued, less than size on timeout.
+   pts goes with the first buffer of a frame, a framed write cut short by the timeout is continued by the next one */
+long pipeline_stream_write(MmalPipeline *pipeline, const uint8_t *data, size_t size, int64_t pts, int eos, int64_t timeout_us, GraphError *err) {
+
+	size_t offset = 0;
+	MMAL_BUFFER_HEADER_T *buffer;
+	uint64_t deadline_us = timeout_us < 0 ? UINT64_MAX : pipeline_now_us() + timeout_us;
+
+	if (size == 0 && !eos) {
+
+		return 0;
+	}
+
+	pthread_mutex_lock(&pipeline->stream_write_lock);
+
+	if (__atomic_load_n(&pipeline->stream_stats.eos, __ATOMIC_RELAXED)) {
+
+		err->type = PyExc_ValueError;
+		err->msg = "end of stream was already fed";
+		goto error;
+	}
+
+	do {
+
+		if ((buffer = pipeline_stream_buffer(pipeline, deadline_us)) == NULL) {
+
+			if (__atomic_load_n(&pipeline->stream_stop, __ATOMIC_ACQUIRE)) {
+
+				err->type = PyExc_RuntimeError;
+				err->msg = "stream was closed";
+				goto error;
+			}
+
+			break;
+		}
+
+		buffer->length = size - offset > buffer->alloc_size ? buffer->alloc_size : size - offset;
+		memcpy(buffer->data, data + offset, buffer->length);
+		offset += buffer->length;
+
+		if (!pipeline->stream_partial) {
+
+			buffer->pts = pts;
+			buffer->flags |= pipeline->stream_framed ? MMAL_BUFFER_HEADER_FLAG_FRAME_START : 0;
+		}
+
+		if (offset == size) {
+
+			buffer->flags |= (pipeline->stream_framed ? MMAL_BUFFER_HEADER_FLAG_FRAME_END : 0) | (eos ? MMAL_BUFFER_HEADER_FLAG_EOS : 0);
+		}
+
+		pipeline->stream_partial = offset < size;
+
+		if (pipeline_stream_send(pipeline, buffer) != 0) {
+
+			err->type = PyExc_RuntimeError;
+			err->msg = "failed to send decoder input";
+			goto error;
+		}
+	} while (offset < size);
+
+	pthread_mutex_unlock(&pipeline->stream_write_lock);
+	return offset;
+
+error:
+	pthread_mutex_unlock(&pipeline->stream_write_lock);
+	return -1;
+}
+
+
+/* Renderer or splitter input, fed from input_pool when a cached picture is shown */
+static MMAL_PORT_T *pipeline_frame_sink(MmalPipeline *pipeline) {
+
+	return pipeline->splitter ? pipeline->splitter->input[0] : pipeline->outputs[0].renderer->input[0];
+}
+
+
+/* Cached picture came back from the renderer */
+static void pipeline_frame_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	mmal_buffer_header_release(buffer);
+}
+
+
+/* Sink input takes the format of the cached picture. The renderer holds the picture on screen until the next one
+   arrives, so the pool has room for two */
+static int pipeline_set_frame_format(MmalPipeline *pipeline, const FrameCacheEntry *frame, GraphError *err) {
+
+	MMAL_STATUS_T status;
+	MMAL_PORT_T *input = pipeline_frame_sink(pipeline);
+
+	/* Same geometry as the picture on screen, port and pool are kept */
+	if (pipeline->input_pool && input->format->encoding == frame->encoding && input->buffer_size >= frame->length &&
+	    memcmp(&input->format->es->video, &frame->video, sizeof(frame->video)) == 0) {
+
+		return 0;
+	}
+
+	if (pipeline->input_pool) {
+
+		mmal_port_disable(input);
+		mmal_port_pool_destroy(input, pipeline->input_pool);
+		pipeline->input_pool = NULL;
+		pipeline->input_port = NULL;
+	}
+
+	input->format->type = MMAL_ES_TYPE_VIDEO;
+	input->format->encoding = frame->encoding;
+	input->format->es->video = frame->video;
+	status = mmal_port_format_commit(input);
+	CHECK_STATUS(status, PyExc_RuntimeError, "renderer does not support cached picture format");
+
+	input->buffer_num = input->buffer_num_min > 2 ? input->buffer_num_min : 2;
+	input->buffer_size = frame->length > input->buffer_size_min ? frame->length : input->buffer_size_min;
+
+	if ((pipeline->input_pool = mmal_port_pool_create(input, input->buffer_num, input->buffer_size)) == NULL) {
+
+		err->type = PyExc_MemoryError;
+		err->msg = "failed to create renderer input pool";
+		goto error;
+	}
+
+	pipeline->input_port = input;
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Create renderer(s) only graph, the cached picture is sent by pipeline_feed_frame */
+static int pipeline_build_sink(MmalPipeline *pipeline, const FrameCacheEntry *frame, GraphError *err) {
+
+	MMAL_STATUS_T status;
+
+	vc_host_init();
+
+	status = mmal_graph_create(&pipeline->graph, 0);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to create graph");
+
+	if (pipeline_create_renderers(pipeline, err) != 0) {
+
+		goto error;
+	}
+
+	pipeline_mark(pipeline, PIPELINE_PHASE_CREATE);
+
+	/* Splitter outputs follow its input, so the picture format comes first */
+	if (pipeline_set_frame_format(pipeline, frame, err) != 0 || pipeline_connect_splitter(pipeline, err) != 0) {
+
+		goto error;
+	}
+
+	pipeline_mark(pipeline, PIPELINE_PHASE_CONNECT);
+
+	status = mmal_graph_enable(pipeline->graph, pipeline_control_cb, pipeline);
+	CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable graph");
+
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Copy the cached picture into a renderer buffer, the renderer reports end-of-stream like after a decode */
+static int pipeline_feed_frame(MmalPipeline *pipeline, const FrameCacheEntry *frame, GraphError *err) {
+
+	MMAL_STATUS_T status;
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	if (!pipeline->input_port->is_enabled) {
+
+		status = mmal_port_enable(pipeline->input_port, pipeline_frame_cb);
+		CHECK_STATUS(status, PyExc_RuntimeError, "failed to enable renderer input");
+	}
+
+	pipeline_mark(pipeline, PIPELINE_PHASE_ENABLE);
+
+	if ((buffer = mmal_queue_timedwait(pipeline->input_pool->queue, PIPELINE_INPUT_TIMEOUT)) == NULL) {
+
+		err->type = PyExc_RuntimeError;
+		err->msg = "timeout waiting for renderer input buffer";
+		goto error;
+	}
+
+	mmal_buffer_header_reset(buffer);
+	mmal_buffer_header_mem_lock(buffer);
+	memcpy(buffer->data, frame->data, frame->length);
+	mmal_buffer_header_mem_unlock(buffer);
+	buffer->length = frame->length;
+	buffer->flags = MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_EOS;
+
+	if ((status = mmal_port_send_buffer(pipeline->input_port, buffer)) != MMAL_SUCCESS) {
+
+		mmal_buffer_header_release(buffer);
+		CHECK_STATUS(status, PyExc_RuntimeError, "failed to send cached picture to renderer");
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Show a picture from the frame cache, reader and decoder are skipped.
+   A persistent pipeline which showed a cached picture on a single display keeps its renderer */
+int pipeline_open_frame(MmalPipeline *pipeline, const FrameCacheEntry *frame, int persistent, GraphError *err) {
+
+	int reuse = pipeline->graph && persistent && pipeline->decoder == NULL && pipeline->splitter == NULL;
+
+	if (pipeline->graph && !reuse) {
+
+		pipeline_teardown(pipeline);
+	}
+
+	free(pipeline->uri);
+	if ((pipeline->uri = strdup(frame->uri)) == NULL) {
+
+		err->type = PyExc_MemoryError;
+		err->msg = "failed to copy uri";
+		goto error;
+	}
+
+	pipeline_reset_eos(pipeline);
+	pipeline_reset_capture(pipeline);
+	pipeline_reset_timing(pipeline);
+	pipeline_start_clock(pipeline);
+
+	if (reuse) {
+
+		if (pipeline_set_frame_format(pipeline, frame, err) != 0) {
+
+			goto error;
+		}
+	}
+	else if (pipeline_build_sink(pipeline, frame, err) != 0) {
+
+		goto error;
+	}
+
+	pipeline_mark(pipeline, PIPELINE_PHASE_OPEN);
+
+	if (pipeline_feed_frame(pipeline, frame, err) != 0) {
+
+		goto error;
+	}
+
+	return 0;
+
+error:
+	pipeline_teardown(pipeline);
+	return -1;
+}
+
+
+/* Move the renderers on their displays, takes effect on the next display update */
+int pipeline_set_layer(MmalPipeline *pipeline, int32_t layer, uint32_t alpha, GraphError *err) {
+
+	uint32_t i;
+	MMAL_STATUS_T status;
+	MMAL_DISPLAYREGION_T param;
+
+	pipeline->layer = layer;
+	pipeline->alpha = alpha;
+
+	memset(&param, 0, sizeof(param));
+	param.hdr.id = MMAL_PARAMETER_DISPLAYREGION;
+	param.hdr.size = sizeof(MMAL_DISPLAYREGION_T);
+	param.set = MMAL_DISPLAY_SET_LAYER | MMAL_DISPLAY_SET_ALPHA;
+	param.layer = layer;
+	param.alpha = alpha;
+
+	for (i = 0; i < pipeline->output_count && pipeline->outputs[i].renderer; i++) {
+
+		status = mmal_port_parameter_set(pipeline->outputs[i].renderer->input[0], &param.hdr);
+		CHECK_STATUS(status, PyExc_RuntimeError, "failed to set display layer");
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Copy the fields flagged in update->set into region, layer and alpha are kept by the pipeline */
+void pipeline_merge_region(MMAL_DISPLAYREGION_T *region, const MMAL_DISPLAYREGION_T *update) {
+
+	if (update->set & MMAL_DISPLAY_SET_FULLSCREEN) {
+
+		region->fullscreen = update->fullscreen;
+	}
+
+	if (update->set & MMAL_DISPLAY_SET_TRANSFORM) {
+
+		region->transform = update->transform;
+	}
+
+	if (update->set & MMAL_DISPLAY_SET_DEST_RECT) {
+
+		region->dest_rect = update->dest_rect;
+	}
+
+	region->set |= update->set & ~(MMAL_DISPLAY_SET_LAYER | MMAL_DISPLAY_SET_ALPHA);
+}
+
+
+/* Apply update to output, -1 for every output, as one parameter per renderer so it lands on a single display update.
+   Layer and alpha always apply to every renderer */
+int pipeline_set_region(MmalPipeline *pipeline, int output, const MMAL_DISPLAYREGION_T *update, GraphError *err) {
+
+	uint32_t i;
+	MMAL_STATUS_T status;
+	MMAL_DISPLAYREGION_T param = *update;
+	uint32_t shared = update->set & (MMAL_DISPLAY_SET_LAYER | MMAL_DISPLAY_SET_ALPHA);
+
+	if (update->set & MMAL_DISPLAY_SET_LAYER) {
+
+		pipeline->layer = update->layer;
+	}
+
+	if (update->set & MMAL_DISPLAY_SET_ALPHA) {
+
+		pipeline->alpha = update->alpha;
+	}
+
+	param.hdr.id = MMAL_PARAMETER_DISPLAYREGION;
+	param.hdr.size = sizeof(MMAL_DISPLAYREGION_T);
+
+	for (i = 0; i < pipeline->output_count; i++) {
+
+		param.set = shared;
+
+		if (output < 0 || (uint32_t)output == i) {
+
+			param.set = update->set;
+			pipeline_merge_region(&pipeline->outputs[i].region, update);
+		}
+
+		if (pipeline->outputs[i].renderer == NULL || param.set == 0) {
+
+			continue;
+		}
+
+		status = mmal_port_parameter_set(pipeline->outputs[i].renderer->input[0], &param.hdr);
+		CHECK_STATUS(status, PyExc_RuntimeError, "failed to set display region");
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/* Wait until the renderer reported end-of-stream, returns 0 on success and -1 on timeout */
+int pipeline_wait_eos(MmalPipeline *pipeline, uint32_t timeout_ms) {
+
+	int ret = 0;
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+
+	if (deadline.tv_nsec >= 1000000000L) {
+
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&pipeline->eos_lock);
+
+	while (!pipeline->eos && ret != ETIMEDOUT) {
+
+		ret = pthread_cond_timedwait(&pipeline->eos_cond, &pipeline->eos_lock, &deadline);
+	}
+
+	ret = pipeline->eos ? 0 : -1;
+	pthread_mutex_unlock(&pipeline->eos_lock);
+	return ret;
+}
+
+
+static void pipeline_port_stats(PortStats *stats, const char *name, MMAL_PORT_T *port) {
+
+	MMAL_CORE_STATISTICS_T core;
+	MMAL_PARAMETER_STATISTICS_T param;
+
+	memset(stats, 0, sizeof(PortStats));
+	stats->name = name;
+
+	/* Input ports count buffers sent in, output ports buffers handed back filled */
+	if (mmal_util_get_core_port_stats(port, port->type == MMAL_PORT_TYPE_INPUT ? MMAL_CORE_STATS_RX : MMAL_CORE_STATS_TX,
+	                                  MMAL_FALSE, &core) == MMAL_SUCCESS) {
+
+		stats->buffers = core.buffer_count;
+		stats->max_delay = core.max_delay;
+	}
+
+	memset(&param, 0, sizeof(param));
+	param.hdr.id = MMAL_PARAMETER_STATISTICS;
+	param.hdr.size = sizeof(MMAL_PARAMETER_STATISTICS_T);
+
+	if (mmal_port_parameter_get(port, &param.hdr) == MMAL_SUCCESS) {
+
+		stats->has_stats = 1;
+		stats->frames = param.frame_count;
+		stats->bytes = param.total_bytes;
+	}
+}
+
+
+static void pipeline_link_stats(LinkStats *stats, const char *name, MMAL_POOL_T *pool, MMAL_QUEUE_T *queue) {
+
+	memset(stats, 0, sizeof(LinkStats));
+	stats->name = name;
+
+	if (queue) {
+
+		stats->queued = mmal_queue_length(queue);
+	}
+
+	if (pool) {
+
+		stats->pool_free = mmal_queue_length(pool->queue);
+		stats->pool_size = pool->headers_num;
+		stats->buffer_num = pool->headers_num;
+		stats->buffer_size = pool->headers_num ? pool->header[0]->alloc_size : 0;
+	}
+}
+
+
+/* A tunnelled connection has no host pool, its buffers are described by the ports */
+static void pipeline_connection_stats(LinkStats *stats, const char *name, MMAL_CONNECTION_T *connection) {
+
+	MMAL_BOOL_T zero_copy = MMAL_FALSE;
+
+	pipeline_link_stats(stats, name, connection->pool, connection->queue);
+	stats->tunnelled = (connection->flags & MMAL_CONNECTION_FLAG_TUNNELLING) != 0;
+	stats->buffer_num = connection->out->buffer_num;
+
+	if (stats->buffer_size == 0) {
+
+		stats->buffer_size = connection->out->buffer_size;
+	}
+
+	mmal_port_parameter_get_boolean(connection->out, MMAL_PARAMETER_ZERO_COPY, &zero_copy);
+	stats->zero_copy = zero_copy ? 1 : 0;
+}
+
+
+/* Frame geometry before and after the resizer, from the committed port formats */
+static void pipeline_resize_stats(MmalPipeline *pipeline, ResizeStats *stats) {
+
+	MMAL_PORT_T *input = pipeline->resizer->input[0], *output = pipeline->resizer->output[0];
+
+	stats->source_width = input->format->es->video.crop.width;
+	stats->source_height = input->format->es->video.crop.height;
+	stats->source_size = input->buffer_size;
+	stats->target_width = output->format->es->video.crop.width;
+	stats->target_height = output->format->es->video.crop.height;
+	stats->target_size = output->buffer_size;
+	stats->buffer_num = output->buffer_num;
+}
+
+
+/* Sample counters of a built pipeline, only queries port parameters and queue lengths */
+void pipeline_stats(MmalPipeline *pipeline, PipelineStats *stats) {
+
+	uint32_t i;
+	MMAL_CORE_STATISTICS_T core;
+
+	memset(stats, 0, sizeof(PipelineStats));
+	memcpy(stats->phase_us, pipeline->phase_us, sizeof(stats->phase_us));
+	stats->first_frame_us = -1;
+
+	if (pipeline->graph == NULL) {
+
+		return;
+	}
+
+	if (pipeline->reader) {
+
+		pipeline_port_stats(&stats->ports[stats->port_count++], "reader.output", pipeline->reader->output[0]);
+	}
+
+	if (pipeline->decoder) {
+
+		pipeline_port_stats(&stats->ports[stats->port_count++], "decoder.input", pipeline->decoder->input[0]);
+		pipeline_port_stats(&stats->ports[stats->port_count++], "decoder.output", pipeline->decoder->output[0]);
+	}
+
+	if (pipeline->resizer) {
+
+		pipeline_port_stats(&stats->ports[stats->port_count++], "resizer.input", pipeline->resizer->input[0]);
+		pipeline_port_stats(&stats->ports[stats->port_count++], "resizer.output", pipeline->resizer->output[0]);
+		pipeline_resize_stats(pipeline, &stats->resize);
+		stats->resized = 1;
+	}
+
+	for (i = 0; i < pipeline->output_count; i++) {
+
+		pipeline_port_stats(&stats->ports[stats->port_count++], pipeline_renderer_names[i], pipeline->outputs[i].renderer->input[0]);
+	}
+
+	if (pipeline->reader_conn) {
+
+		pipeline_connection_stats(&stats->links[stats->link_count++], "reader->decoder", pipeline->reader_conn);
+	}
+
+	if (pipeline->input_pool) {
+
+		pipeline_link_stats(&stats->links[stats->link_count++], pipeline->stream ? "stream->decoder" : pipeline->decoder ? "memory->decoder" : "cache->renderer",
+		                    pipeline->input_pool, NULL);
+	}
+
+	if (pipeline->resizer_conn) {
+
+		pipeline_connection_stats(&stats->links[stats->link_count++], "decoder->resizer", pipeline->resizer_conn);
+	}
+
+	if (pipeline->decoder_conn) {
+
+		pipeline_connection_stats(&stats->links[stats->link_count++], pipeline_sink_link_names[!!pipeline->resizer][!!pipeline->splitter],
+		                          pipeline->decoder_conn);
+	}
+
+	for (i = 0; i < pipeline->output_count; i++) {
+
+		if (pipeline->outputs[i].connection) {
+
+			pipeline_connection_stats(&stats->links[stats->link_count++], pipeline_split_names[i], pipeline->outputs[i].connection);
+		}
+	}
+
+	if (pipeline->stream) {
+
+		pthread_mutex_lock(&pipeline->stream_lock);
+		stats->stream = pipeline->stream_stats;
+		stats->streamed = 1;
+		pthread_mutex_unlock(&pipeline->stream_lock);
+	}
+
+	if (pipeline->timing) {
+
+		pthread_mutex_lock(&pipeline->timing_lock);
+		stats->timing = pipeline->timing_stats;
+		stats->timed = 1;
+		pthread_mutex_unlock(&pipeline->timing_lock);
+	}
+
+	/* Core counters use the 32 bit microsecond clock, wrap around cancels out in the difference */
+	if (mmal_util_get_core_port_stats(pipeline->outputs[0].renderer->input[0], MMAL_CORE_STATS_RX, MMAL_FALSE, &core) == MMAL_SUCCESS &&
+	    core.buffer_count) {
+
+		stats->first_frame_us = (uint32_t)(core.first_buffer_time - (uint32_t)pipeline->open_start);
+	}
+}
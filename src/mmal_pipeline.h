@@ -0,0 +1,255 @@
+#ifndef _MMAL_PIPELINE_H_
+#define _MMAL_PIPELINE_H_
+
+#include <Python.h>
+#include <pthread.h>
+#include <mmal.h>
+#include <bcm_host.h>
+#include <util/mmal_graph.h>
+#include "mmal_frame.h"
+#include "frame_cache.h"
+
+#define PIPELINE_LAYER 2
+#define PIPELINE_TAP_DEPTH 4
+#define PIPELINE_TAP_MAX 32
+#define PIPELINE_INPUT_TIMEOUT 2000
+
+/* Stream writers wait for a free input buffer in slices of this many ms, so a teardown stops them promptly */
+#define PIPELINE_STREAM_SLICE 20
+
+#define PIPELINE_OUTPUTS 4
+#define PIPELINE_PORTS (5 + PIPELINE_OUTPUTS)
+#define PIPELINE_LINKS (4 + PIPELINE_OUTPUTS)
+
+/* ISP scales in hardware and converts format in the same pass */
+#define PIPELINE_RESIZER "vc.ril.isp"
+
+/* End of a tapped link without a display, buffers only go on to Python */
+#define PIPELINE_NULL_SINK "vc.null_sink"
+
+/* Presentation timing histograms, interval and lateness buckets end at pipeline_timing_edges_ms, the last is open ended.
+   Frames are also counted by how many vsyncs they stayed on screen: 0 (replaced before scanout), 1, 2, 3, 4 or more */
+#define PIPELINE_TIMING_BUCKETS 12
+#define PIPELINE_TIMING_VSYNCS 5
+
+extern const uint32_t pipeline_timing_edges_ms[PIPELINE_TIMING_BUCKETS];
+
+/* Resize stage between decoder and renderer(s) */
+enum {
+	PIPELINE_RESIZE_OFF,
+	PIPELINE_RESIZE_FIXED,
+	PIPELINE_RESIZE_DISPLAY,
+};
+
+/* Phases of an open, each timed in microseconds */
+enum {
+	PIPELINE_PHASE_CREATE,
+	PIPELINE_PHASE_OPEN,
+	PIPELINE_PHASE_CONNECT,
+	PIPELINE_PHASE_ENABLE,
+	PIPELINE_PHASES
+};
+
+/* Links named after the component they leave, the splitter kind covers every splitter output */
+enum {
+	PIPELINE_LINK_READER,
+	PIPELINE_LINK_DECODER,
+	PIPELINE_LINK_RESIZER,
+	PIPELINE_LINK_SPLITTER,
+	PIPELINE_LINK_KINDS
+};
+
+/* Connection options, 0 or -1 keeps the MMAL default */
+typedef struct {
+	uint32_t buffer_num, buffer_size;
+	int tunnelling, zero_copy;
+} LinkOptions;
+
+/* Error recorded while the GIL is released, raised once it is taken back */
+typedef struct {
+	PyObject *type;
+	const char *msg;
+} GraphError;
+
+/* Decoded buffer waiting for Python, holds one buffer reference */
+typedef struct {
+	FrameFormat format;
+	MMAL_BUFFER_HEADER_T *buffer;
+	MMAL_CONNECTION_T *connection;
+} TapFrame;
+
+/* Buffers through a port, from the MMAL core counters and the component statistics when it has them */
+typedef struct {
+	const char *name;
+	uint32_t buffers, max_delay;
+	int has_stats;
+	uint32_t frames;
+	int64_t bytes;
+} PortStats;
+
+/* Depth of a connection sampled at one point in time, with the buffer settings it actually runs with */
+typedef struct {
+	const char *name;
+	uint32_t queued, pool_free, pool_size, buffer_size;
+	uint32_t buffer_num;
+	int tunnelled, zero_copy;
+} LinkStats;
+
+/* Decoded and resized frame geometry, sizes are bytes of one frame buffer */
+typedef struct {
+	uint32_t source_width, source_height, source_size;
+	uint32_t target_width, target_height, target_size;
+	uint32_t buffer_num;
+} ResizeStats;
+
+/* One frame sent to the renderer, times are CLOCK_MONOTONIC microseconds. pts is MMAL_TIME_UNKNOWN when the stream
+   has none and vsyncs is -1 without a vsync source or for the first frame */
+typedef struct {
+	int64_t pts;
+	uint64_t time_us;
+	int64_t interval_us, lateness_us;
+	int32_t vsyncs;
+} TimingSample;
+
+/* Presentation of one stream on the renderer input. Lateness is measured against the pts schedule anchored at the
+   first frame, moved back whenever a frame arrives early. missing counts pts gaps, dropped frames replaced before a vsync */
+typedef struct {
+	uint64_t frames, late, dropped, missing;
+	int64_t base_pts, last_pts, pts_step, lateness_max;
+	uint64_t base_us, last_us, last_vsync;
+	double interval_mean, interval_m2;
+	uint32_t interval_hist[PIPELINE_TIMING_BUCKETS], lateness_hist[PIPELINE_TIMING_BUCKETS];
+	uint32_t vsync_hist[PIPELINE_TIMING_VSYNCS];
+
+	/* Vsyncs of the first display, counted for the life of the tap */
+	uint64_t vsyncs, vsync_first_us, vsync_last_us;
+} TimingStats;
+
+/* Elementary stream fed by the host since it was opened. stalls counts writes which found no free input buffer,
+   error is the errno which ended reading from a file descriptor */
+typedef struct {
+	uint64_t bytes, buffers, stalls, stall_us;
+	int fd, eos, error;
+} StreamStats;
+
+typedef struct {
+	uint64_t phase_us[PIPELINE_PHASES];
+	int64_t first_frame_us;
+	int resized;
+	ResizeStats resize;
+	int timed;
+	TimingStats timing;
+	int streamed;
+	StreamStats stream;
+	uint32_t port_count, link_count;
+	PortStats ports[PIPELINE_PORTS];
+	LinkStats links[PIPELINE_LINKS];
+} PipelineStats;
+
+/* One renderer, region holds its display settings, layer and alpha are applied on top */
+typedef struct {
+	MMAL_DISPLAYREGION_T region;
+	MMAL_COMPONENT_T *renderer;
+	MMAL_CONNECTION_T *connection;
+} PipelineOutput;
+
+typedef struct MmalPipeline MmalPipeline;
+typedef void (*PipelineEventCb)(MmalPipeline *pipeline, MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer);
+typedef void (*PipelineTimingCb)(MmalPipeline *pipeline, const TimingSample *sample);
+
+/* reader -> decoder [-> resizer] -> renderer chain, with several displays a splitter feeds one renderer each.
+   In memory and stream mode the host takes the place of the reader.
+   Without outputs the tapped link ends in a null sink. All functions run without the GIL */
+struct MmalPipeline {
+	char *uri;
+	int eos;
+	int video;
+	void *owner;
+	int32_t layer;
+	uint32_t alpha;
+	uint32_t output_count;
+	PipelineOutput outputs[PIPELINE_OUTPUTS];
+	PipelineEventCb event_cb;
+	pthread_mutex_t eos_lock;
+	pthread_cond_t eos_cond;
+	MMAL_GRAPH_T *graph;
+	MMAL_COMPONENT_T *reader, *decoder, *splitter, *null_sink;
+	MMAL_CONNECTION_T *reader_conn, *decoder_conn;
+
+	/* Optional resizer, decoder_conn then starts at its output */
+	int resize_mode;
+	uint32_t resize_width, resize_height;
+	MMAL_COMPONENT_T *resizer;
+	MMAL_CONNECTION_T *resizer_conn;
+
+	LinkOptions link_options[PIPELINE_LINK_KINDS];
+	MMAL_POOL_T *input_pool;
+	MMAL_PORT_T *input_port;
+
+	/* Open timing, phase_mark is the end of the last finished phase */
+	uint64_t open_start, phase_mark;
+	uint64_t phase_us[PIPELINE_PHASES];
+
+	/* Optional tap, decoder -> renderer buffers are forwarded by tap_thread and shared with Python.
+	   Up to tap_depth frames are queued, then the oldest is dropped or with tap_block the decoder waits */
+	int tap, tap_block;
+	uint32_t tap_encoding, tap_depth;
+	int tap_running, tap_stop, tap_wakeup;
+	uint32_t tap_head, tap_count, tap_dropped;
+	pthread_t tap_thread;
+	pthread_mutex_t tap_lock;
+	pthread_cond_t tap_cond, tap_wake;
+	MMAL_CONNECTION_T *tap_conn;
+	TapFrame tap_frames[PIPELINE_TAP_MAX];
+
+	/* Optional copy of the first frame of a tapped link for the frame cache, only kept when it was the only one */
+	int capture;
+	uint32_t capture_frames;
+	FrameCacheKey capture_key;
+	FrameCacheEntry *captured;
+
+	/* Optional presentation timing of a tapped link, sampled on tap_thread as frames go to the renderer.
+	   timing_cb gets every sample on tap_thread, it must not block */
+	int timing;
+	PipelineTimingCb timing_cb;
+	TimingStats timing_stats;
+	pthread_mutex_t timing_lock;
+	int timing_vsync;
+
+	/* Optional elementary stream input, the host fills input_pool from pipeline_stream_write() or stream_thread
+	   reading stream_fd, a copy of the caller's descriptor closed on teardown. Writers register in stream_users,
+	   teardown sets stream_stop and waits for them to leave */
+	int stream, stream_framed, stream_partial, stream_stop, stream_running;
+	uint32_t stream_users;
+	int stream_fd, stream_wake;
+	pthread_t stream_thread;
+	pthread_mutex_t stream_lock, stream_write_lock;
+	pthread_cond_t stream_idle;
+	StreamStats stream_stats;
+};
+
+MmalPipeline *pipeline_new(void *owner, PipelineEventCb event_cb);
+void pipeline_set_outputs(MmalPipeline *pipeline, const MMAL_DISPLAYREGION_T *regions, uint32_t count);
+void pipeline_set_resize(MmalPipeline *pipeline, int mode, uint32_t width, uint32_t height);
+void pipeline_set_link_options(MmalPipeline *pipeline, const LinkOptions *options);
+void pipeline_free(MmalPipeline *pipeline);
+void pipeline_teardown(MmalPipeline *pipeline);
+int pipeline_open(MmalPipeline *pipeline, const char *uri, int persistent, GraphError *err);
+int pipeline_open_buffer(MmalPipeline *pipeline, const uint8_t *data, size_t size, int persistent, GraphError *err);
+int pipeline_open_frame(MmalPipeline *pipeline, const FrameCacheEntry *frame, int persistent, GraphError *err);
+int pipeline_open_stream(MmalPipeline *pipeline, uint32_t encoding, int framed, int fd, GraphError *err);
+int pipeline_stream_enter(MmalPipeline *pipeline);
+void pipeline_stream_leave(MmalPipeline *pipeline);
+long pipeline_stream_write(MmalPipeline *pipeline, const uint8_t *data, size_t size, int64_t pts, int eos, int64_t timeout_us, GraphError *err);
+FrameCacheEntry *pipeline_take_capture(MmalPipeline *pipeline);
+uint32_t pipeline_detect_encoding(const uint8_t *data, size_t size);
+int pipeline_image_size(const uint8_t *data, size_t size, uint32_t *width, uint32_t *height);
+void pipeline_fit_size(uint32_t source_width, uint32_t source_height, uint32_t *width, uint32_t *height);
+int pipeline_set_layer(MmalPipeline *pipeline, int32_t layer, uint32_t alpha, GraphError *err);
+void pipeline_merge_region(MMAL_DISPLAYREGION_T *region, const MMAL_DISPLAYREGION_T *update);
+int pipeline_set_region(MmalPipeline *pipeline, int output, const MMAL_DISPLAYREGION_T *update, GraphError *err);
+int pipeline_wait_eos(MmalPipeline *pipeline, uint32_t timeout_ms);
+int pipeline_tap_get(MmalPipeline *pipeline, TapFrame *frame, uint32_t timeout_ms);
+void pipeline_stats(MmalPipeline *pipeline, PipelineStats *stats);
+
+#endif
@@ -0,0 +1,659 @@
+#include <Python.h>
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "mmal_graph.h"
+#include "mmal_playlist.h"
+#include "module_state.h"
+
+
+PyDoc_STRVAR(MmalPlaylistObject_type_doc,
+             "MmalPlaylist(graph, items, loop=False, timeout=1.0) -> Slideshow scheduled on a native thread.\n\n"
+             "items is a list of (uri, duration) or (uri, duration, fade) in seconds. Each item is prefetched into the\n"
+             "standby renderer of graph while the previous one is shown, then swapped in when its time is due on the\n"
+             "monotonic clock, cross-fading over fade seconds when given. Switch times are planned from the start, a\n"
+             "late switch does not delay the following ones. timeout is the longest wait for an item still decoding\n"
+             "at its switch time, an item which fails to open is skipped and keeps the previous picture on screen.\n"
+             "Playback starts at once, timings reports planned against actual switch times.\n");
+typedef struct {
+	char *uri;
+	uint64_t duration_us;
+	uint32_t fade_ms;
+} PlaylistItem;
+
+/* One due switch, times are CLOCK_MONOTONIC microseconds */
+typedef struct {
+	uint32_t index;
+	uint64_t planned_us, actual_us, dwell_us;
+	int shown, ready;
+	const char *error;
+} PlaylistRecord;
+
+typedef struct {
+	PyObject_HEAD;
+	int loop, running, stop, joinable;
+	int32_t current;
+	uint32_t count, timeout_ms;
+	uint64_t records;
+	PlaylistItem *items;
+	PlaylistRecord history[PLAYLIST_HISTORY];
+	PyObject *graph;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake, done;
+} MmalPlaylistObject;
+
+
+/* Same clock as time.monotonic(), the playlist conditions wait on it too */
+static uint64_t playlist_now_us(void) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+
+/* Sleep until deadline_us unless stopped, called with self->lock held */
+static void playlist_wait_until(MmalPlaylistObject *self, uint64_t deadline_us) {
+
+	struct timespec deadline;
+
+	deadline.tv_sec = deadline_us / 1000000ULL;
+	deadline.tv_nsec = (deadline_us % 1000000ULL) * 1000L;
+
+	while (!self->stop && pthread_cond_timedwait(&self->wake, &self->lock, &deadline) != ETIMEDOUT);
+}
+
+
+/* Slot for the next record, a full history reuses the oldest one. Called with self->lock held */
+static PlaylistRecord *playlist_record(MmalPlaylistObject *self, uint32_t index, uint64_t planned_us) {
+
+	PlaylistRecord *record = &self->history[self->records++ % PLAYLIST_HISTORY];
+
+	memset(record, 0, sizeof(PlaylistRecord));
+	record->index = index;
+	record->planned_us = planned_us;
+	return record;
+}
+
+
+/* Shown record number seq if it is still in the history */
+static PlaylistRecord *playlist_history(MmalPlaylistObject *self, uint64_t seq) {
+
+	return seq && self->records - seq < PLAYLIST_HISTORY ? &self->history[(seq - 1) % PLAYLIST_HISTORY] : NULL;
+}
+
+
+/* Scheduler, never takes the GIL. The graph lock is only held while an item is prefetched or swapped in */
+static void *playlist_thread(void *arg) {
+
+	int ret, ready = 0;
+	uint32_t index = 0;
+	uint64_t planned, actual = 0, shown = 0;
+	GraphError err;
+	PlaylistItem *item;
+	PlaylistRecord *record, *previous;
+	MmalPlaylistObject *self = arg;
+
+	pthread_mutex_lock(&self->lock);
+	planned = playlist_now_us();
+
+	while (!self->stop) {
+
+		item = &self->items[index];
+		pthread_mutex_unlock(&self->lock);
+
+		/* Decode while the previous item is on screen */
+		err.type = NULL;
+		err.msg = NULL;
+		ret = graph_native_prefetch(self->graph, item->uri, &err);
+
+		pthread_mutex_lock(&self->lock);
+		playlist_wait_until(self, planned);
+
+		if (self->stop) {
+
+			break;
+		}
+
+		if (ret == 0) {
+
+			pthread_mutex_unlock(&self->lock);
+			ret = graph_native_show(self->graph, self->timeout_ms, item->fade_ms, &ready, &err);
+			actual = playlist_now_us();
+			pthread_mutex_lock(&self->lock);
+		}
+
+		record = playlist_record(self, index, planned);
+
+		if (ret != 0) {
+
+			record->error = err.msg;
+
+			/* Nothing more can be shown, the graph was closed under the playlist */
+			if (ret == GRAPH_CLOSED) {
+
+				break;
+			}
+		}
+		else {
+
+			record->shown = 1;
+			record->ready = ready;
+			record->actual_us = actual;
+
+			if ((previous = playlist_history(self, shown)) != NULL) {
+
+				previous->dwell_us = actual - previous->actual_us;
+			}
+
+			shown = self->records;
+			self->current = index;
+		}
+
+		/* The old picture is the backdrop of the fade, the next prefetch must not take it away */
+		if (ret == 0 && item->fade_ms) {
+
+			pthread_mutex_unlock(&self->lock);
+			graph_native_wait_animation(self->graph, item->fade_ms + 1000);
+			pthread_mutex_lock(&self->lock);
+		}
+
+		planned += item->duration_us;
+
+		if (++index == self->count) {
+
+			index = 0;
+
+			if (!self->loop) {
+
+				playlist_wait_until(self, planned);
+				break;
+			}
+		}
+	}
+
+	/* Last picture stays on screen, its dwell ends here */
+	if ((previous = playlist_history(self, shown)) != NULL) {
+
+		previous->dwell_us = playlist_now_us() - previous->actual_us;
+	}
+
+	self->running = 0;
+	pthread_cond_broadcast(&self->done);
+	pthread_mutex_unlock(&self->lock);
+	return NULL;
+}
+
+
+static PyObject *MmalPlaylist_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+
+	MmalPlaylistObject *self;
+	pthread_condattr_t attr;
+
+	if ((self = (MmalPlaylistObject *)type->tp_alloc(type, 0)) == NULL) {
+
+		return NULL;
+	}
+
+	self->loop = 0;
+	self->running = self->stop = self->joinable = 0;
+	self->current = -1;
+	self->count = self->records = 0;
+	self->items = NULL;
+	self->graph = NULL;
+	pthread_mutex_init(&self->lock, NULL);
+
+	/* Deadlines are monotonic, wall clock adjustments don't move the schedule */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&self->wake, &attr);
+	pthread_cond_init(&self->done, &attr);
+	pthread_condattr_destroy(&attr);
+
+	return (PyObject *)self;
+}
+
+
+/* Take the playlist lock, the GIL is only released when the lock is contended */
+static void playlist_lock(MmalPlaylistObject *self) {
+
+	if (pthread_mutex_trylock(&self->lock) != 0) {
+
+		Py_BEGIN_ALLOW_THREADS
+		pthread_mutex_lock(&self->lock);
+		Py_END_ALLOW_THREADS
+	}
+}
+
+
+/* Stop the scheduler and wait for it, only one caller joins the thread */
+static void playlist_stop(MmalPlaylistObject *self) {
+
+	int joinable;
+
+	playlist_lock(self);
+	self->stop = 1;
+	joinable = self->joinable;
+	self->joinable = 0;
+	pthread_cond_broadcast(&self->wake);
+	pthread_mutex_unlock(&self->lock);
+
+	if (joinable) {
+
+		Py_BEGIN_ALLOW_THREADS
+		pthread_join(self->thread, NULL);
+		Py_END_ALLOW_THREADS
+	}
+}
+
+
+static void playlist_free_items(PlaylistItem *items, uint32_t count) {
+
+	uint32_t i;
+
+	for (i = 0; items && i < count; i++) {
+
+		free(items[i].uri);
+	}
+
+	free(items);
+}
+
+
+PyDoc_STRVAR(MmalPlaylist_close_doc, "close()\n\nStop the playlist, the picture on screen stays until the graph is closed.\n");
+static PyObject *MmalPlaylist_close(MmalPlaylistObject *self) {
+
+	playlist_stop(self);
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+
+static void MmalPlaylist_free(MmalPlaylistObject *self) {
+
+	playlist_stop(self);
+	playlist_free_items(self->items, self->count);
+	Py_XDECREF(self->graph);
+
+	pthread_cond_destroy(&self->done);
+	pthread_cond_destroy(&self->wake);
+	pthread_mutex_destroy(&self->lock);
+	PyTypeObject *type = Py_TYPE(self);
+
+	type->tp_free((PyObject *)self);
+	MODULE_TYPE_RELEASE(type);
+}
+
+
+/* Copy (uri, duration[, fade]) items to C, uris in the filesystem encoding */
+static PlaylistItem *playlist_copy_items(PyObject *list, uint32_t *count) {
+
+	Py_ssize_t i, size;
+	double duration, fade;
+	PlaylistItem *items;
+	PyObject *seq, *item = NULL, *encoded;
+
+	if ((seq = PySequence_Fast(list, "items must be a list of (uri, duration[, fade])")) == NULL) {
+
+		return NULL;
+	}
+
+	if ((size = PySequence_Fast_GET_SIZE(seq)) == 0 || size > UINT32_MAX) {
+
+		Py_DECREF(seq);
+		PyErr_SetString(PyExc_ValueError, "items must not be empty");
+		return NULL;
+	}
+
+	if ((items = calloc(size, sizeof(PlaylistItem))) == NULL) {
+
+		Py_DECREF(seq);
+		PyErr_NoMemory();
+		return NULL;
+	}
+
+	for (i = 0; i < size; i++) {
+
+		fade = 0.0;
+
+		if ((item = PySequence_Fast(PySequence_Fast_GET_ITEM(seq, i), "items must be a list of (uri, duration[, fade])")) == NULL) {
+
+			goto error;
+		}
+
+		if (PySequence_Fast_GET_SIZE(item) < 2 || PySequence_Fast_GET_SIZE(item) > 3) {
+
+			PyErr_SetString(PyExc_TypeError, "items must be a list of (uri, duration[, fade])");
+			goto error;
+		}
+
+		duration = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(item, 1));
+
+		if (PySequence_Fast_GET_SIZE(item) == 3) {
+
+			fade = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(item, 2));
+		}
+
+		if (PyErr_Occurred()) {
+
+			goto error;
+		}
+
+		if (duration <= 0 || fade < 0 || fade > duration) {
+
+			PyErr_Format(PyExc_ValueError, "item %zd: duration must be positive and fade between 0 and duration", i);
+			goto error;
+		}
+
+		encoded = PySequence_Fast_GET_ITEM(item, 0);
+		encoded = PyUnicode_Check(encoded) ? PyUnicode_EncodeFSDefault(encoded) : (Py_INCREF(encoded), encoded);
+
+		if (encoded == NULL || !PyBytes_Check(encoded) || (items[i].uri = strdup(PyBytes_AsString(encoded))) == NULL) {
+
+			if (encoded != NULL && !PyErr_Occurred()) {
+
+				PyErr_SetString(PyExc_TypeError, "item uri must be a str");
+			}
+
+			Py_XDECREF(encoded);
+			goto error;
+		}
+
+		Py_DECREF(encoded);
+		Py_DECREF(item);
+		items[i].duration_us = (uint64_t)(duration * 1000000);
+		items[i].fade_ms = (uint32_t)(fade * 1000);
+	}
+
+	Py_DECREF(seq);
+	*count = size;
+	return items;
+
+error:
+	Py_XDECREF(item);
+	Py_DECREF(seq);
+	playlist_free_items(items, size);
+	return NULL;
+}
+
+
+static int MmalPlaylist_init(MmalPlaylistObject *self, PyObject *args, PyObject *kwds) {
+
+	int loop = 0;
+	uint32_t count;
+	double timeout = 1.0;
+	ModuleState *state;
+	PlaylistItem *items;
+	PyObject *graph = NULL, *list = NULL;
+	static char *kwlist[] = {"graph", "items", "loop", "timeout", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|id", kwlist, &graph, &list, &loop, &timeout)) {
+
+		return -1;
+	}
+
+	if ((state = module_state_by_type(Py_TYPE(self))) == NULL) {
+
+		return -1;
+	}
+
+	if (!PyObject_TypeCheck(graph, state->graph_type)) {
+
+		PyErr_SetString(PyExc_TypeError, "graph must be a MmalGraph");
+		return -1;
+	}
+
+	if (timeout < 0) {
+
+		PyErr_SetString(PyExc_ValueError, "timeout must be positive");
+		return -1;
+	}
+
+	if ((items = playlist_copy_items(list, &count)) == NULL) {
+
+		return -1;
+	}
+
+	/* Reinit case, the old schedule is dropped */
+	playlist_stop(self);
+	graph_native_attach(graph);
+	playlist_lock(self);
+	playlist_free_items(self->items, self->count);
+	Py_XDECREF(self->graph);
+
+	Py_INCREF(graph);
+	self->graph = graph;
+	self->items = items;
+	self->count = count;
+	self->loop = loop;
+	self->timeout_ms = (uint32_t)(timeout * 1000);
+	self->current = -1;
+	self->records = 0;
+	self->stop = 0;
+	self->running = 1;
+	pthread_mutex_unlock(&self->lock);
+
+	if (pthread_create(&self->thread, NULL, playlist_thread, self) != 0) {
+
+		self->running = 0;
+		PyErr_SetString(PyExc_RuntimeError, "failed to start playlist thread");
+		return -1;
+	}
+
+	self->joinable = 1;
+	return 0;
+}
+
+
+static PyObject *MmalPlaylist_enter(PyObject *self, PyObject *args) {
+
+	Py_INCREF(self);
+	return self;
+}
+
+
+static PyObject *MmalPlaylist_exit(MmalPlaylistObject *self, PyObject *args) {
+
+	playlist_stop(self);
+	Py_RETURN_FALSE;
+}
+
+
+PyDoc_STRVAR(MmalPlaylist_wait_doc,
+             "wait(timeout=None)\n\nBlock until a playlist without loop showed its last item for its duration.\n"
+             "Returns False on timeout.\n");
+static PyObject *MmalPlaylist_wait(MmalPlaylistObject *self, PyObject *args, PyObject *kwds) {
+
+	int running;
+	uint64_t deadline_us;
+	struct timespec deadline;
+	PyObject *timeout = Py_None;
+	static char *kwlist[] = {"timeout", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:wait", kwlist, &timeout)) {
+
+		return NULL;
+	}
+
+	deadline_us = playlist_now_us();
+
+	if (timeout != Py_None) {
+
+		double seconds = PyFloat_AsDouble(timeout);
+
+		if (PyErr_Occurred()) {
+
+			return NULL;
+		}
+
+		deadline_us += seconds > 0 ? (uint64_t)(seconds * 1000000) : 0;
+	}
+
+	deadline.tv_sec = deadline_us / 1000000ULL;
+	deadline.tv_nsec = (deadline_us % 1000000ULL) * 1000L;
+
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&self->lock);
+
+	while (self->running) {
+
+		if (timeout == Py_None) {
+
+			pthread_cond_wait(&self->done, &self->lock);
+		}
+		else if (pthread_cond_timedwait(&self->done, &self->lock, &deadline) == ETIMEDOUT) {
+
+			break;
+		}
+	}
+
+	running = self->running;
+	pthread_mutex_unlock(&self->lock);
+	Py_END_ALLOW_THREADS
+
+	return PyBool_FromLong(!running);
+}
+
+
+static PyMethodDef MmalPlaylist_methods[] = {
+
+	{"close", (PyCFunction)MmalPlaylist_close, METH_NOARGS, MmalPlaylist_close_doc},
+	{"wait", (PyCFunction)MmalPlaylist_wait, METH_VARARGS | METH_KEYWORDS, MmalPlaylist_wait_doc},
+	{"__enter__", (PyCFunction)MmalPlaylist_enter, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction)MmalPlaylist_exit, METH_VARARGS, NULL},
+	{NULL},
+};
+
+
+PyDoc_STRVAR(MmalPlaylist_running_doc, "MmalPlaylist scheduler is running(read only)\n");
+static PyObject *MmalPlaylist_is_running(MmalPlaylistObject *self, void *closure) {
+
+	int running;
+
+	playlist_lock(self);
+	running = self->running;
+	pthread_mutex_unlock(&self->lock);
+
+	return PyBool_FromLong(running);
+}
+
+
+PyDoc_STRVAR(MmalPlaylist_index_doc, "MmalPlaylist index of the item on screen, None before the first switch(read only)\n");
+static PyObject *MmalPlaylist_get_index(MmalPlaylistObject *self, void *closure) {
+
+	int32_t current;
+
+	playlist_lock(self);
+	current = self->current;
+	pthread_mutex_unlock(&self->lock);
+
+	if (current < 0) {
+
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	return Py_BuildValue("i", current);
+}
+
+
+PyDoc_STRVAR(MmalPlaylist_loop_doc, "MmalPlaylist starts over after the last item(read only)\n");
+static PyObject *MmalPlaylist_get_loop(MmalPlaylistObject *self, void *closure) {
+
+	return PyBool_FromLong(self->loop);
+}
+
+
+/* Seconds on the time.monotonic() clock, None when the time is not known */
+static PyObject *playlist_seconds(uint64_t us, int known) {
+
+	if (!known) {
+
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	return PyFloat_FromDouble(us / 1000000.0);
+}
+
+
+PyDoc_STRVAR(MmalPlaylist_timings_doc,
+             "MmalPlaylist due switches, oldest first, as dicts of index, uri, planned and actual (time.monotonic() seconds),\n"
+             "late (actual - planned), dwell (seconds on screen, None while shown), ready (decoded before the switch)\n"
+             "and error (None or why the item was skipped). A looping playlist keeps the last 256(read only)\n");
+static PyObject *MmalPlaylist_get_timings(MmalPlaylistObject *self, void *closure) {
+
+	uint64_t seq;
+	PyObject *list, *item;
+	PlaylistRecord *record;
+
+	if ((list = PyList_New(0)) == NULL) {
+
+		return NULL;
+	}
+
+	/* The scheduler never needs the GIL, building the list under the playlist lock can't deadlock */
+	playlist_lock(self);
+
+	for (seq = self->records > PLAYLIST_HISTORY ? self->records - PLAYLIST_HISTORY : 0; seq < self->records; seq++) {
+
+		record = &self->history[seq % PLAYLIST_HISTORY];
+		item = Py_BuildValue("{s:I,s:s,s:N,s:N,s:N,s:N,s:O,s:z}",
+		                     "index", record->index,
+		                     "uri", self->items[record->index].uri,
+		                     "planned", playlist_seconds(record->planned_us, 1),
+		                     "actual", playlist_seconds(record->actual_us, record->shown),
+		                     "late", playlist_seconds(record->actual_us - record->planned_us, record->shown),
+		                     "dwell", playlist_seconds(record->dwell_us, record->dwell_us != 0),
+		                     "ready", record->ready ? Py_True : Py_False,
+		                     "error", record->error);
+
+		if (item == NULL || PyList_Append(list, item) != 0) {
+
+			pthread_mutex_unlock(&self->lock);
+			Py_XDECREF(item);
+			Py_DECREF(list);
+			return NULL;
+		}
+
+		Py_DECREF(item);
+	}
+
+	pthread_mutex_unlock(&self->lock);
+	return list;
+}
+
+
+static PyGetSetDef MmalPlaylist_getseters[] = {
+
+	{"running", (getter)MmalPlaylist_is_running, (setter)NULL, MmalPlaylist_running_doc},
+	{"index", (getter)MmalPlaylist_get_index, (setter)NULL, MmalPlaylist_index_doc},
+	{"loop", (getter)MmalPlaylist_get_loop, (setter)NULL, MmalPlaylist_loop_doc},
+	{"timings", (getter)MmalPlaylist_get_timings, (setter)NULL, MmalPlaylist_timings_doc},
+	{NULL},
+};
+
+
+static PyType_Slot MmalPlaylist_slots[] = {
+	{Py_tp_doc, (void *)MmalPlaylistObject_type_doc},
+	{Py_tp_dealloc, (void *)MmalPlaylist_free},
+	{Py_tp_methods, (void *)MmalPlaylist_methods},
+	{Py_tp_getset, (void *)MmalPlaylist_getseters},
+	{Py_tp_init, (void *)MmalPlaylist_init},
+	{Py_tp_new, (void *)MmalPlaylist_new},
+	{0, NULL},
+};
+
+
+PyType_Spec MmalPlaylist_spec = {
+	"pylibmmal." MmalPlaylist_name,
+	sizeof(MmalPlaylistObject),
+	0,
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+	MmalPlaylist_slots,
+};
@@ -0,0 +1,11 @@
+#ifndef _MMAL_PLAYLIST_H_
+#define _MMAL_PLAYLIST_H_
+
+#define MmalPlaylist_name "MmalPlaylist"
+
+/* Switches remembered for timings, a looping playlist keeps the most recent ones */
+#define PLAYLIST_HISTORY 256
+
+extern PyType_Spec MmalPlaylist_spec;
+
+#endif
@@ -0,0 +1,170 @@
+#include <Python.h>
+#include <string.h>
+#include "module_state.h"
+
+/*
+ * Per module state instead of static types, so the module can be imported by
+ * several (sub)interpreters and unloaded with them. Objects find the types they
+ * create (events, frames, mode changes) through the module of their own type.
+ */
+
+
+ModuleState *module_state(PyObject *module) {
+
+	return (ModuleState *)PyModule_GetState(module);
+}
+
+
+/* Module state of the pylibmmal type or subclass type, NULL with an exception set when it has none */
+ModuleState *module_state_by_type(PyTypeObject *type) {
+
+	PyObject *module;
+
+#if PY_VERSION_HEX >= 0x030B0000
+	module = PyType_GetModuleByDef(type, &pylibmmal_module);
+#elif PY_VERSION_HEX >= 0x03090000
+	Py_ssize_t i;
+	PyTypeObject *base;
+
+	/* Python subclasses have no module, look for the pylibmmal base */
+	for (i = 0, module = NULL; module == NULL && i < PyTuple_GET_SIZE(type->tp_mro); i++) {
+
+		base = (PyTypeObject *)PyTuple_GET_ITEM(type->tp_mro, i);
+
+		if (!(base->tp_flags & Py_TPFLAGS_HEAPTYPE) || (module = PyType_GetModule(base)) == NULL) {
+
+			PyErr_Clear();
+			continue;
+		}
+
+		if (PyModule_GetDef(module) != &pylibmmal_module) {
+
+			module = NULL;
+		}
+	}
+
+	if (module == NULL) {
+
+		PyErr_Format(PyExc_TypeError, "'%s' is not a pylibmmal type", type->tp_name);
+	}
+#else
+	/* Single phase init, one module per process */
+	if ((module = PyState_FindModule(&pylibmmal_module)) == NULL) {
+
+		PyErr_SetString(PyExc_RuntimeError, "pylibmmal is not initialised");
+	}
+#endif
+
+	return module ? module_state(module) : NULL;
+}
+
+
+/* Create a heap type bound to module and add it under its short name, returns a new reference */
+PyTypeObject *module_add_type(PyObject *module, PyType_Spec *spec) {
+
+	PyObject *type;
+	const char *name = strrchr(spec->name, '.') ? strrchr(spec->name, '.') + 1 : spec->name;
+
+#if PY_VERSION_HEX >= 0x03090000
+	type = PyType_FromModuleAndSpec(module, spec, NULL);
+#else
+	type = PyType_FromSpec(spec);
+#endif
+
+	if (type == NULL) {
+
+		return NULL;
+	}
+
+#ifndef Py_TPFLAGS_DISALLOW_INSTANTIATION
+	PyType_Slot *slot;
+
+	for (slot = spec->slots; slot->slot && slot->slot != Py_tp_new; slot++);
+
+	if (slot->slot == 0) {
+
+		((PyTypeObject *)type)->tp_new = NULL;
+	}
+#endif
+
+	Py_INCREF(type);
+
+	if (PyModule_AddObject(module, name, type) != 0) {
+
+		Py_DECREF(type);
+		Py_DECREF(type);
+		return NULL;
+	}
+
+	return (PyTypeObject *)type;
+}
+
+
+PyTypeObject *module_add_struct_sequence(PyObject *module, PyStructSequence_Desc *desc, const char *name) {
+
+	PyTypeObject *type;
+
+	if ((type = PyStructSequence_NewType(desc)) == NULL) {
+
+		return NULL;
+	}
+
+	Py_INCREF(type);
+
+	if (PyModule_AddObject(module, name, (PyObject *)type) != 0) {
+
+		Py_DECREF(type);
+		Py_DECREF(type);
+		return NULL;
+	}
+
+	return type;
+}
+
+
+int module_state_traverse(PyObject *module, visitproc visit, void *arg) {
+
+	ModuleState *state = module_state(module);
+
+	if (state == NULL) {
+
+		return 0;
+	}
+
+	Py_VISIT(state->graph_type);
+	Py_VISIT(state->graph_event_type);
+	Py_VISIT(state->graph_timing_type);
+	Py_VISIT(state->frame_type);
+	Py_VISIT(state->encoder_type);
+	Py_VISIT(state->decoder_type);
+	Py_VISIT(state->playlist_type);
+	Py_VISIT(state->batch_type);
+	Py_VISIT(state->tv_type);
+	Py_VISIT(state->tv_event_type);
+	Py_VISIT(state->mode_change_type);
+	return 0;
+}
+
+
+int module_state_clear(PyObject *module) {
+
+	ModuleState *state = module_state(module);
+
+	if (state == NULL) {
+
+		return 0;
+	}
+
+	Py_CLEAR(state->graph_type);
+	Py_CLEAR(state->graph_event_type);
+	Py_CLEAR(state->graph_timing_type);
+	Py_CLEAR(state->frame_type);
+	Py_CLEAR(state->encoder_type);
+	Py_CLEAR(state->decoder_type);
+	Py_CLEAR(state->playlist_type);
+	Py_CLEAR(state->batch_type);
+	Py_CLEAR(state->tv_type);
+	Py_CLEAR(state->tv_event_type);
+	Py_CLEAR(state->mode_change_type);
+	return 0;
+}
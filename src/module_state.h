@@ -0,0 +1,54 @@
+#ifndef _MODULE_STATE_H_
+#define _MODULE_STATE_H_
+
+#include <Python.h>
+#include <structseq.h>
+
+/* Heap types of one module instance, every (sub)interpreter imports its own */
+typedef struct {
+	PyTypeObject *graph_type;
+	PyTypeObject *graph_event_type;
+	PyTypeObject *graph_timing_type;
+	PyTypeObject *frame_type;
+	PyTypeObject *encoder_type;
+	PyTypeObject *decoder_type;
+	PyTypeObject *playlist_type;
+	PyTypeObject *batch_type;
+	PyTypeObject *tv_type;
+	PyTypeObject *tv_event_type;
+	PyTypeObject *mode_change_type;
+} ModuleState;
+
+/* Types which are only created from C, Python can't instantiate them */
+#ifdef Py_TPFLAGS_DISALLOW_INSTANTIATION
+#define MODULE_TPFLAGS_NO_NEW Py_TPFLAGS_DISALLOW_INSTANTIATION
+#else
+#define MODULE_TPFLAGS_NO_NEW 0
+#endif
+
+/* Instances of heap types own a reference on their type since 3.8, dropped after tp_free */
+#if PY_VERSION_HEX >= 0x03080000
+#define MODULE_TYPE_RELEASE(type) Py_DECREF(type)
+#else
+#define MODULE_TYPE_RELEASE(type)
+#endif
+
+/* The GIL serialises short object updates, free-threaded builds need a critical section instead */
+#ifdef Py_GIL_DISABLED
+#define MODULE_BEGIN_CRITICAL(op) Py_BEGIN_CRITICAL_SECTION(op)
+#define MODULE_END_CRITICAL() Py_END_CRITICAL_SECTION()
+#else
+#define MODULE_BEGIN_CRITICAL(op) {
+#define MODULE_END_CRITICAL() }
+#endif
+
+extern struct PyModuleDef pylibmmal_module;
+
+ModuleState *module_state(PyObject *module);
+ModuleState *module_state_by_type(PyTypeObject *type);
+PyTypeObject *module_add_type(PyObject *module, PyType_Spec *spec);
+PyTypeObject *module_add_struct_sequence(PyObject *module, PyStructSequence_Desc *desc, const char *name);
+int module_state_traverse(PyObject *module, visitproc visit, void *arg);
+int module_state_clear(PyObject *module);
+
+#endif
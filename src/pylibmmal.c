@@ -1,7 +1,15 @@
 #include <Python.h>
 #include "constants.h"
 #include "mmal_graph.h"
+#include "mmal_frame.h"
+#include "mmal_encoder.h"
+#include "mmal_decoder.h"
+#include "mmal_playlist.h"
+#include "mmal_batch.h"
 #include "tv_service.h"
+#include "vc_connection.h"
+#include "module_state.h"
+#include "trace.h"
 
 
 #define _VERSION_ "0.1"
@@ -9,75 +17,179 @@
 PyDoc_STRVAR(pylibmmal_doc, "Raspberry Multi-Media Abstraction Layer Library.\n");
 
 
-static PyMethodDef pylibmmal_methods[] = {
-	{NULL}
-};
+PyDoc_STRVAR(pylibmmal_connection_users_doc, "connection_users()\n\nNumber of objects sharing the VideoCore connection, it is closed when this drops to 0.\n");
+static PyObject *pylibmmal_connection_users(PyObject *module) {
 
+	return PyLong_FromUnsignedLong(vc_connection_users());
+}
 
-#if PY_MAJOR_VERSION >= 3
-static struct PyModuleDef pylibmmalmodule = {
-	PyModuleDef_HEAD_INIT,
-	_NAME_,		            /* Module name */
-	pylibmmal_doc,	        /* Module pylibi2cMethods */
-	-1,			            /* size of per-interpreter state of the module, size of per-interpreter state of the module,*/
-	pylibmmal_methods,      /* Module methods */
-};
-#endif
 
+PyDoc_STRVAR(pylibmmal_trace_enable_doc,
+             "trace_enable(enabled=True) -> bool\n\n"
+             "Start or stop recording every MMAL/VCHI call with its thread, begin and end time, returns the previous state.\n"
+             "Each thread keeps its last 8192 calls. Raises NotImplementedError when built with PYLIBMMAL_TRACE=0.\n");
+static PyObject *pylibmmal_trace_enable(PyObject *module, PyObject *args, PyObject *kwds) {
 
-#if PY_MAJOR_VERSION >= 3
-PyMODINIT_FUNC PyInit_pylibmmal(void)
-#else
-PyMODINIT_FUNC initpylibmmal(void)
-#endif
-{
+	int enabled = 1;
+	static char *kwlist[] = {"enabled", NULL};
 
-	PyObject *module;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|p:trace_enable", kwlist, &enabled)) {
 
-	if (PyType_Ready(&MmalGraphObjectType) < 0) {
+		return NULL;
+	}
 
-#if PY_MAJOR_VERSION >= 3
+#ifdef PYLIBMMAL_NO_TRACE
+	if (enabled) {
+
+		PyErr_SetString(PyExc_NotImplementedError, "built without tracing");
 		return NULL;
-#else
-		return;
+	}
 #endif
+
+	return PyBool_FromLong(trace_enable(enabled));
+}
+
+
+PyDoc_STRVAR(pylibmmal_trace_dump_doc,
+             "trace_dump(path, clear=True) -> int\n\n"
+             "Write the recorded calls to path as Chrome trace / Perfetto JSON, returns the number of calls written.\n"
+             "clear=True drops them from the buffers, so the next dump only has newer calls.\n");
+static PyObject *pylibmmal_trace_dump(PyObject *module, PyObject *args, PyObject *kwds) {
+
+	long written;
+	int clear = 1;
+	PyObject *path;
+	static char *kwlist[] = {"path", "clear", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|p:trace_dump", kwlist, PyUnicode_FSConverter, &path, &clear)) {
+
+		return NULL;
 	}
 
-	if (PyType_Ready(&TVServiceObjectType) < 0) {
+	Py_BEGIN_ALLOW_THREADS
+	written = trace_dump(PyBytes_AS_STRING(path), clear);
+	Py_END_ALLOW_THREADS
+
+	if (written < 0) {
 
-#if PY_MAJOR_VERSION >= 3
+		PyErr_SetFromErrnoWithFilenameObject(PyExc_IOError, path);
+		Py_DECREF(path);
 		return NULL;
-#else
-		return;
-#endif
 	}
 
-#if PY_MAJOR_VERSION >= 3
-	module = PyModule_Create(&pylibmmalmodule);
-	PyObject *version = PyUnicode_FromString(_VERSION_);
-#else
-	module = Py_InitModule3(_NAME_, pylibmmal_methods, pylibmmal_doc);
-	PyObject *version = PyString_FromString(_VERSION_);
-#endif
+	Py_DECREF(path);
+	return PyLong_FromLong(written);
+}
+
+
+static PyMethodDef pylibmmal_methods[] = {
+	{"connection_users", (PyCFunction)pylibmmal_connection_users, METH_NOARGS, pylibmmal_connection_users_doc},
+	{"trace_enable", (PyCFunction)pylibmmal_trace_enable, METH_VARARGS | METH_KEYWORDS, pylibmmal_trace_enable_doc},
+	{"trace_dump", (PyCFunction)pylibmmal_trace_dump, METH_VARARGS | METH_KEYWORDS, pylibmmal_trace_dump_doc},
+	{NULL}
+};
+
+
+/* Types, version and constants of one module instance */
+static int pylibmmal_exec(PyObject *module) {
+
+	ModuleState *state = module_state(module);
+
+	if (PyModule_AddStringConstant(module, "__version__", _VERSION_) != 0) {
 
-	/* Version */
-	PyObject *dict = PyModule_GetDict(module);
-	PyDict_SetItemString(dict, "__version__", version);
-	Py_DECREF(version);
+		return -1;
+	}
 
 	/* Constants */
 	define_constants(module);
 
 	/* TVService */
-	Py_INCREF(&TVServiceObjectType);
-	PyModule_AddObject(module, TVService_name, (PyObject *)&TVServiceObjectType);
+	if ((state->tv_type = module_add_type(module, &TVService_spec)) == NULL ||
+	    (state->mode_change_type = module_add_type(module, &TVModeChange_spec)) == NULL ||
+	    (state->tv_event_type = module_add_struct_sequence(module, &TVEvent_desc, TVEvent_name)) == NULL) {
+
+		return -1;
+	}
 
 	/* MmalGraph */
-	Py_INCREF(&MmalGraphObjectType);
-	PyModule_AddObject(module, MmalGraph_name, (PyObject *)&MmalGraphObjectType);
+	if ((state->graph_type = module_add_type(module, &MmalGraph_spec)) == NULL ||
+	    (state->graph_event_type = module_add_struct_sequence(module, &MmalGraphEvent_desc, MmalGraphEvent_name)) == NULL ||
+	    (state->graph_timing_type = module_add_struct_sequence(module, &MmalGraphTiming_desc, MmalGraphTiming_name)) == NULL) {
+
+		return -1;
+	}
+
+	/* MmalFrame, MmalEncoder, MmalDecoder, MmalBatch */
+	if ((state->frame_type = module_add_type(module, &MmalFrame_spec)) == NULL ||
+	    (state->encoder_type = module_add_type(module, &MmalEncoder_spec)) == NULL ||
+	    (state->decoder_type = module_add_type(module, &MmalDecoder_spec)) == NULL ||
+	    (state->playlist_type = module_add_type(module, &MmalPlaylist_spec)) == NULL ||
+	    (state->batch_type = module_add_type(module, &MmalBatch_spec)) == NULL) {
+
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void pylibmmal_free(void *module) {
+
+	module_state_clear((PyObject *)module);
+}
+
+
+#if PY_VERSION_HEX >= 0x03090000
+static PyModuleDef_Slot pylibmmal_slots[] = {
+	{Py_mod_exec, (void *)pylibmmal_exec},
+#ifdef Py_mod_multiple_interpreters
+	{Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+	/* Objects guard their state with their own locks */
+	{Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+	{0, NULL},
+};
+#endif
+
+
+struct PyModuleDef pylibmmal_module = {
+	PyModuleDef_HEAD_INIT,
+	_NAME_,		            /* Module name */
+	pylibmmal_doc,	        /* Module doc */
+	sizeof(ModuleState),    /* Size of per-interpreter state of the module */
+	pylibmmal_methods,      /* Module methods */
+#if PY_VERSION_HEX >= 0x03090000
+	pylibmmal_slots,        /* Multi-phase init, types are created per module */
+#else
+	NULL,
+#endif
+	module_state_traverse,
+	module_state_clear,
+	pylibmmal_free,
+};
+
+
+PyMODINIT_FUNC PyInit_pylibmmal(void) {
+
+#if PY_VERSION_HEX < 0x03070000
+	/* open_async() calls back into Python from its own thread */
+	PyEval_InitThreads();
+#endif
+
+#if PY_VERSION_HEX >= 0x03090000
+	return PyModuleDef_Init(&pylibmmal_module);
+#else
+	/* Without PyType_GetModule() types find their state through PyState_FindModule() */
+	PyObject *module = PyModule_Create(&pylibmmal_module);
+
+	if (module == NULL || pylibmmal_exec(module) != 0 || PyState_AddModule(module, &pylibmmal_module) != 0) {
+
+		Py_XDECREF(module);
+		return NULL;
+	}
 
-#if PY_MAJOR_VERSION >= 3
 	return module;
 #endif
 }
-
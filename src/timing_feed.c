@@ -0,0 +1,177 @@
+#include <time.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "timing_feed.h"
+
+
+void timing_feed_init(TimingFeed *feed) {
+
+	pthread_condattr_t attr;
+
+	memset(feed, 0, sizeof(TimingFeed));
+	pthread_mutex_init(&feed->lock, NULL);
+
+	/* Sample times are monotonic, so is the flush deadline */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&feed->cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+
+void timing_feed_destroy(TimingFeed *feed) {
+
+	timing_feed_stop(feed);
+	pthread_cond_destroy(&feed->cond);
+	pthread_mutex_destroy(&feed->lock);
+}
+
+
+static void *timing_feed_thread(void *arg) {
+
+	uint32_t i, count;
+	struct timespec deadline;
+	uint64_t deadline_us;
+	TimingFeed *feed = arg;
+	TimingSample *out = feed->samples + feed->batch * TIMING_FEED_BATCHES;
+
+	pthread_mutex_lock(&feed->lock);
+
+	while (!feed->stop) {
+
+		if (feed->count == 0) {
+
+			pthread_cond_wait(&feed->cond, &feed->lock);
+			continue;
+		}
+
+		/* Partial batch waits until its oldest sample is due */
+		if (feed->count < feed->batch) {
+
+			deadline_us = feed->samples[feed->head].time_us + TIMING_FEED_FLUSH_MS * 1000ULL;
+			deadline.tv_sec = deadline_us / 1000000ULL;
+			deadline.tv_nsec = (deadline_us % 1000000ULL) * 1000L;
+
+			if (pthread_cond_timedwait(&feed->cond, &feed->lock, &deadline) != ETIMEDOUT || feed->stop || feed->count == 0) {
+
+				continue;
+			}
+		}
+
+		count = feed->count < feed->batch ? feed->count : feed->batch;
+
+		for (i = 0; i < count; i++) {
+
+			out[i] = feed->samples[(feed->head + i) % (feed->batch * TIMING_FEED_BATCHES)];
+		}
+
+		feed->head = (feed->head + count) % (feed->batch * TIMING_FEED_BATCHES);
+		feed->count -= count;
+
+		pthread_mutex_unlock(&feed->lock);
+		feed->deliver(feed->arg, out, count);
+		pthread_mutex_lock(&feed->lock);
+	}
+
+	pthread_mutex_unlock(&feed->lock);
+	return NULL;
+}
+
+
+/* Deliver batches of up to batch samples to deliver, called on the feed thread */
+int timing_feed_start(TimingFeed *feed, uint32_t batch, TimingDeliverCb deliver, void *arg) {
+
+	timing_feed_stop(feed);
+
+	/* Ring of TIMING_FEED_BATCHES batches followed by the batch being delivered */
+	if ((feed->samples = calloc(batch * (TIMING_FEED_BATCHES + 1), sizeof(TimingSample))) == NULL) {
+
+		return -1;
+	}
+
+	feed->batch = batch;
+	feed->head = feed->count = feed->lost = 0;
+	feed->deliver = deliver;
+	feed->arg = arg;
+	feed->stop = 0;
+
+	if (pthread_create(&feed->thread, NULL, timing_feed_thread, feed) != 0) {
+
+		free(feed->samples);
+		feed->samples = NULL;
+		return -1;
+	}
+
+	feed->running = 1;
+	return 0;
+}
+
+
+/* Stop delivering, samples not delivered yet are dropped */
+void timing_feed_stop(TimingFeed *feed) {
+
+	if (!feed->running) {
+
+		return;
+	}
+
+	pthread_mutex_lock(&feed->lock);
+	feed->stop = 1;
+	pthread_cond_signal(&feed->cond);
+	pthread_mutex_unlock(&feed->lock);
+
+	pthread_join(feed->thread, NULL);
+	feed->running = 0;
+
+	pthread_mutex_lock(&feed->lock);
+	free(feed->samples);
+	feed->samples = NULL;
+	feed->batch = feed->count = 0;
+	pthread_mutex_unlock(&feed->lock);
+}
+
+
+/* Queue one sample, never blocks. A full ring loses the newest sample */
+void timing_feed_push(TimingFeed *feed, const TimingSample *sample) {
+
+	uint32_t size;
+
+	pthread_mutex_lock(&feed->lock);
+	size = feed->batch * TIMING_FEED_BATCHES;
+
+	if (feed->samples == NULL || feed->stop) {
+
+		pthread_mutex_unlock(&feed->lock);
+		return;
+	}
+
+	if (feed->count == size) {
+
+		feed->lost++;
+		pthread_mutex_unlock(&feed->lock);
+		return;
+	}
+
+	feed->samples[(feed->head + feed->count) % size] = *sample;
+	feed->count++;
+
+	/* Wake on the first sample to arm the flush deadline and on a full batch */
+	if (feed->count == 1 || feed->count == feed->batch) {
+
+		pthread_cond_signal(&feed->cond);
+	}
+
+	pthread_mutex_unlock(&feed->lock);
+}
+
+
+uint32_t timing_feed_lost(TimingFeed *feed) {
+
+	uint32_t lost;
+
+	pthread_mutex_lock(&feed->lock);
+	lost = feed->lost;
+	pthread_mutex_unlock(&feed->lock);
+	return lost;
+}
@@ -0,0 +1,35 @@
+#ifndef _TIMING_FEED_H_
+#define _TIMING_FEED_H_
+
+#include <pthread.h>
+#include "mmal_pipeline.h"
+
+/* Samples kept while the consumer is busy, in batches. Samples arriving beyond that are lost */
+#define TIMING_FEED_BATCHES 4
+
+/* A partial batch is delivered once its first sample is this old */
+#define TIMING_FEED_FLUSH_MS 1000
+
+typedef void (*TimingDeliverCb)(void *arg, const TimingSample *samples, uint32_t count);
+
+/* Batches samples pushed from tap_thread and hands them to deliver on its own thread, so a slow consumer never
+   holds up the video path */
+typedef struct {
+	uint32_t batch, head, count, lost;
+	int running, stop;
+	TimingSample *samples;
+	TimingDeliverCb deliver;
+	void *arg;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} TimingFeed;
+
+void timing_feed_init(TimingFeed *feed);
+int timing_feed_start(TimingFeed *feed, uint32_t batch, TimingDeliverCb deliver, void *arg);
+void timing_feed_stop(TimingFeed *feed);
+void timing_feed_destroy(TimingFeed *feed);
+void timing_feed_push(TimingFeed *feed, const TimingSample *sample);
+uint32_t timing_feed_lost(TimingFeed *feed);
+
+#endif
@@ -0,0 +1,257 @@
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+typedef struct {
+	const char *name;
+	uint64_t begin_ns, end_ns;
+	uint32_t tid;
+} TraceEvent;
+
+/*
+ * Written by its owner thread only. claim is bumped before an event slot is
+ * overwritten and head after it is complete, a reader which copied the slots
+ * between reading head and claim keeps the events the owner did not touch.
+ */
+typedef struct {
+	uint64_t claim, head;
+	uint64_t tail;		/* First event not dumped yet, under trace_lock */
+	int owned;
+	TraceEvent events[TRACE_RING_EVENTS];
+} TraceRing;
+
+int trace_enabled = 0;
+
+static uint64_t trace_lost_events;
+static uint32_t trace_ring_count;
+static TraceRing *trace_rings[TRACE_RINGS_MAX];
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static __thread TraceRing *trace_ring;
+static __thread uint32_t trace_tid;
+
+
+uint64_t trace_now_ns(void) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+/* Thread exit, the ring keeps its events and goes to the next new thread */
+static void trace_ring_release(void *arg) {
+
+	TraceRing *ring = arg;
+
+	pthread_mutex_lock(&trace_lock);
+	ring->owned = 0;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+
+static void trace_key_create(void) {
+
+	pthread_key_create(&trace_key, trace_ring_release);
+}
+
+
+/* First event of a thread, only place a writer takes a lock */
+static TraceRing *trace_ring_acquire(void) {
+
+	uint32_t i;
+	TraceRing *ring = NULL;
+
+	pthread_once(&trace_key_once, trace_key_create);
+	pthread_mutex_lock(&trace_lock);
+
+	for (i = 0; i < trace_ring_count; i++) {
+
+		if (!trace_rings[i]->owned) {
+
+			ring = trace_rings[i];
+			break;
+		}
+	}
+
+	if (ring == NULL && trace_ring_count < TRACE_RINGS_MAX && (ring = calloc(1, sizeof(TraceRing))) != NULL) {
+
+		trace_rings[trace_ring_count++] = ring;
+	}
+
+	if (ring) {
+
+		ring->owned = 1;
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+
+	if (ring) {
+
+		pthread_setspecific(trace_key, ring);
+		trace_tid = syscall(SYS_gettid);
+		trace_ring = ring;
+	}
+
+	return ring;
+}
+
+
+void trace_record(const char *name, uint64_t begin_ns) {
+
+	uint64_t head;
+	TraceEvent *event;
+	TraceRing *ring = trace_ring;
+	uint64_t end_ns = trace_now_ns();
+
+	if (ring == NULL && (ring = trace_ring_acquire()) == NULL) {
+
+		__atomic_fetch_add(&trace_lost_events, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	head = ring->head;
+	__atomic_store_n(&ring->claim, head + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	event = &ring->events[head & (TRACE_RING_EVENTS - 1)];
+	event->name = name;
+	event->begin_ns = begin_ns;
+	event->end_ns = end_ns;
+	event->tid = trace_tid;
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+int trace_enable(int enabled) {
+
+	return __atomic_exchange_n(&trace_enabled, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+
+/* Copy the events of ring not dumped yet, returns their number */
+static uint32_t trace_ring_copy(TraceRing *ring, TraceEvent *events, uint64_t *first) {
+
+	uint64_t i, start, head, claim;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	start = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+	start = start > ring->tail ? start : ring->tail;
+
+	for (i = start; i < head; i++) {
+
+		events[i - start] = ring->events[i & (TRACE_RING_EVENTS - 1)];
+	}
+
+	/* Slots the owner started overwriting while they were copied */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	claim = __atomic_load_n(&ring->claim, __ATOMIC_RELAXED);
+
+	if (claim > TRACE_RING_EVENTS && claim - TRACE_RING_EVENTS > start) {
+
+		*first = claim - TRACE_RING_EVENTS < head ? claim - TRACE_RING_EVENTS - start : head - start;
+	}
+	else {
+
+		*first = 0;
+	}
+
+	ring->tail = head;
+	return head - start;
+}
+
+
+static const char *trace_category(const char *name) {
+
+	if (strncmp(name, "mmal_", 5) == 0) {
+
+		return "mmal";
+	}
+
+	if (strncmp(name, "vc_", 3) == 0 || strncmp(name, "vchi_", 5) == 0 || strncmp(name, "vcos_", 5) == 0 || strncmp(name, "bcm_host_", 9) == 0) {
+
+		return "vchi";
+	}
+
+	return "api";
+}
+
+
+long trace_dump(const char *path, int clear) {
+
+	FILE *fp;
+	uint32_t i, count;
+	uint64_t j, first, tail;
+	long written = 0;
+	int pid = getpid();
+	TraceEvent *events;
+
+	if ((events = malloc(sizeof(TraceEvent) * TRACE_RING_EVENTS)) == NULL) {
+
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if ((fp = fopen(path, "w")) == NULL) {
+
+		free(events);
+		return -1;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, \"args\": {\"name\": \"pylibmmal\"}}", pid);
+
+	pthread_mutex_lock(&trace_lock);
+
+	for (i = 0; i < trace_ring_count; i++) {
+
+		tail = trace_rings[i]->tail;
+		count = trace_ring_copy(trace_rings[i], events, &first);
+
+		if (!clear) {
+
+			trace_rings[i]->tail = tail;
+		}
+
+		/* Complete events, microseconds with nanosecond decimals */
+		for (j = first; j < count; j++) {
+
+			fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %llu.%03u, \"dur\": %llu.%03u, \"pid\": %d, \"tid\": %u}",
+			        events[j].name, trace_category(events[j].name),
+			        (unsigned long long)(events[j].begin_ns / 1000), (unsigned int)(events[j].begin_ns % 1000),
+			        (unsigned long long)((events[j].end_ns - events[j].begin_ns) / 1000),
+			        (unsigned int)((events[j].end_ns - events[j].begin_ns) % 1000),
+			        pid, events[j].tid);
+			written++;
+		}
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+	free(events);
+
+	/* Events of threads started after every ring was taken */
+	fprintf(fp, "\n], \"otherData\": {\"lost\": %llu}}\n", (unsigned long long)__atomic_load_n(&trace_lost_events, __ATOMIC_RELAXED));
+
+	if (ferror(fp)) {
+
+		fclose(fp);
+		errno = EIO;
+		return -1;
+	}
+
+	if (fclose(fp) != 0) {
+
+		return -1;
+	}
+
+	return written;
+}
@@ -0,0 +1,166 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <bcm_host.h>
+#include <mmal.h>
+#include <util/mmal_util.h>
+#include <util/mmal_graph.h>
+#include <util/mmal_connection.h>
+#include <util/mmal_util_params.h>
+#include <interface/vcos/vcos.h>
+#include <interface/vchi/vchi.h>
+#include <interface/vmcs_host/vc_tvservice.h>
+
+/*
+ * Tracer of MMAL/VCHI calls, exported as Chrome trace / Perfetto JSON.
+ *
+ * Include this header last, after it every MMAL/VCHI function listed below is a
+ * macro recording the call name, the calling thread and its begin and end times
+ * into a ring owned by that thread. Writers never lock, trace_dump() copies the
+ * rings and drops whatever a writer overwrote meanwhile. With tracing stopped a
+ * call site costs one predictable branch, building with PYLIBMMAL_NO_TRACE
+ * leaves the plain calls.
+ */
+
+/* Events kept per thread, a power of two, older ones are overwritten */
+#define TRACE_RING_EVENTS	8192
+
+/* Threads traced at once, rings of exited threads are reused */
+#define TRACE_RINGS_MAX		64
+
+typedef struct {
+	const char *name;
+	uint64_t begin_ns;
+} TraceScope;
+
+extern int trace_enabled;
+
+uint64_t trace_now_ns(void);
+void trace_record(const char *name, uint64_t begin_ns);
+
+/* Start or stop recording, returns the previous state */
+int trace_enable(int enabled);
+
+/* Write the recorded events to path, returns their number or -1 with errno set */
+long trace_dump(const char *path, int clear);
+
+#define trace_on() __builtin_expect(__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED), 0)
+
+#ifndef PYLIBMMAL_NO_TRACE
+
+static inline void trace_scope_end(TraceScope *scope) {
+
+	if (scope->begin_ns) {
+
+		trace_record(scope->name, scope->begin_ns);
+	}
+}
+
+/* Spans the rest of the enclosing block, nests the MMAL/VCHI calls made inside */
+#define TRACE_SCOPE(scope_name) \
+	TraceScope _trace_scope __attribute__((cleanup(trace_scope_end))) = {scope_name, trace_on() ? trace_now_ns() : 0}
+
+#define TRACE_CALL(fn, ...) __extension__ ({ \
+	__typeof__(fn(__VA_ARGS__)) _trace_ret; \
+	if (trace_on()) { \
+		uint64_t _trace_begin = trace_now_ns(); \
+		_trace_ret = fn(__VA_ARGS__); \
+		trace_record(#fn, _trace_begin); \
+	} \
+	else { \
+		_trace_ret = fn(__VA_ARGS__); \
+	} \
+	_trace_ret; })
+
+#define TRACE_CALL_VOID(fn, ...) do { \
+	if (trace_on()) { \
+		uint64_t _trace_begin = trace_now_ns(); \
+		fn(__VA_ARGS__); \
+		trace_record(#fn, _trace_begin); \
+	} \
+	else { \
+		fn(__VA_ARGS__); \
+	} \
+} while (0)
+
+/* MMAL core */
+#define mmal_component_create(...)			TRACE_CALL(mmal_component_create, __VA_ARGS__)
+#define mmal_component_enable(...)			TRACE_CALL(mmal_component_enable, __VA_ARGS__)
+#define mmal_component_disable(...)			TRACE_CALL(mmal_component_disable, __VA_ARGS__)
+#define mmal_component_release(...)			TRACE_CALL(mmal_component_release, __VA_ARGS__)
+#define mmal_component_destroy(...)			TRACE_CALL(mmal_component_destroy, __VA_ARGS__)
+#define mmal_port_enable(...)				TRACE_CALL(mmal_port_enable, __VA_ARGS__)
+#define mmal_port_disable(...)				TRACE_CALL(mmal_port_disable, __VA_ARGS__)
+#define mmal_port_format_commit(...)			TRACE_CALL(mmal_port_format_commit, __VA_ARGS__)
+#define mmal_port_send_buffer(...)			TRACE_CALL(mmal_port_send_buffer, __VA_ARGS__)
+#define mmal_port_parameter_set(...)			TRACE_CALL(mmal_port_parameter_set, __VA_ARGS__)
+#define mmal_port_parameter_get(...)			TRACE_CALL(mmal_port_parameter_get, __VA_ARGS__)
+#define mmal_port_parameter_set_boolean(...)		TRACE_CALL(mmal_port_parameter_set_boolean, __VA_ARGS__)
+#define mmal_port_parameter_get_boolean(...)		TRACE_CALL(mmal_port_parameter_get_boolean, __VA_ARGS__)
+#define mmal_port_parameter_set_uint32(...)		TRACE_CALL(mmal_port_parameter_set_uint32, __VA_ARGS__)
+#define mmal_port_pool_create(...)			TRACE_CALL(mmal_port_pool_create, __VA_ARGS__)
+#define mmal_port_pool_destroy(...)			TRACE_CALL_VOID(mmal_port_pool_destroy, __VA_ARGS__)
+#define mmal_format_copy(...)				TRACE_CALL_VOID(mmal_format_copy, __VA_ARGS__)
+#define mmal_format_full_copy(...)			TRACE_CALL(mmal_format_full_copy, __VA_ARGS__)
+#define mmal_queue_create(...)				TRACE_CALL(mmal_queue_create, __VA_ARGS__)
+#define mmal_queue_destroy(...)				TRACE_CALL_VOID(mmal_queue_destroy, __VA_ARGS__)
+#define mmal_queue_get(...)				TRACE_CALL(mmal_queue_get, __VA_ARGS__)
+#define mmal_queue_timedwait(...)			TRACE_CALL(mmal_queue_timedwait, __VA_ARGS__)
+#define mmal_queue_put(...)				TRACE_CALL_VOID(mmal_queue_put, __VA_ARGS__)
+#define mmal_queue_put_back(...)			TRACE_CALL_VOID(mmal_queue_put_back, __VA_ARGS__)
+#define mmal_queue_length(...)				TRACE_CALL(mmal_queue_length, __VA_ARGS__)
+#define mmal_buffer_header_acquire(...)			TRACE_CALL_VOID(mmal_buffer_header_acquire, __VA_ARGS__)
+#define mmal_buffer_header_release(...)			TRACE_CALL_VOID(mmal_buffer_header_release, __VA_ARGS__)
+#define mmal_buffer_header_reset(...)			TRACE_CALL_VOID(mmal_buffer_header_reset, __VA_ARGS__)
+#define mmal_buffer_header_mem_lock(...)		TRACE_CALL(mmal_buffer_header_mem_lock, __VA_ARGS__)
+#define mmal_buffer_header_mem_unlock(...)		TRACE_CALL_VOID(mmal_buffer_header_mem_unlock, __VA_ARGS__)
+
+/* MMAL util */
+#define mmal_connection_create(...)			TRACE_CALL(mmal_connection_create, __VA_ARGS__)
+#define mmal_connection_enable(...)			TRACE_CALL(mmal_connection_enable, __VA_ARGS__)
+#define mmal_connection_disable(...)			TRACE_CALL(mmal_connection_disable, __VA_ARGS__)
+#define mmal_connection_acquire(...)			TRACE_CALL_VOID(mmal_connection_acquire, __VA_ARGS__)
+#define mmal_connection_release(...)			TRACE_CALL(mmal_connection_release, __VA_ARGS__)
+#define mmal_connection_destroy(...)			TRACE_CALL(mmal_connection_destroy, __VA_ARGS__)
+#define mmal_connection_event_format_changed(...)	TRACE_CALL(mmal_connection_event_format_changed, __VA_ARGS__)
+#define mmal_graph_create(...)				TRACE_CALL(mmal_graph_create, __VA_ARGS__)
+#define mmal_graph_new_component(...)			TRACE_CALL(mmal_graph_new_component, __VA_ARGS__)
+#define mmal_graph_new_connection(...)			TRACE_CALL(mmal_graph_new_connection, __VA_ARGS__)
+#define mmal_graph_enable(...)				TRACE_CALL(mmal_graph_enable, __VA_ARGS__)
+#define mmal_graph_disable(...)				TRACE_CALL(mmal_graph_disable, __VA_ARGS__)
+#define mmal_graph_destroy(...)				TRACE_CALL(mmal_graph_destroy, __VA_ARGS__)
+#define mmal_util_port_set_uri(...)			TRACE_CALL(mmal_util_port_set_uri, __VA_ARGS__)
+#define mmal_util_get_core_port_stats(...)		TRACE_CALL(mmal_util_get_core_port_stats, __VA_ARGS__)
+
+/* Dispmanx */
+#define vc_dispmanx_display_open(...)			TRACE_CALL(vc_dispmanx_display_open, __VA_ARGS__)
+#define vc_dispmanx_display_close(...)			TRACE_CALL(vc_dispmanx_display_close, __VA_ARGS__)
+#define vc_dispmanx_display_get_info(...)		TRACE_CALL(vc_dispmanx_display_get_info, __VA_ARGS__)
+#define vc_dispmanx_vsync_callback(...)			TRACE_CALL(vc_dispmanx_vsync_callback, __VA_ARGS__)
+
+/* VCHI and tvservice */
+#define bcm_host_init(...)				TRACE_CALL_VOID(bcm_host_init, __VA_ARGS__)
+#define vcos_init(...)					TRACE_CALL(vcos_init, __VA_ARGS__)
+#define vchi_initialise(...)				TRACE_CALL(vchi_initialise, __VA_ARGS__)
+#define vchi_connect(...)				TRACE_CALL(vchi_connect, __VA_ARGS__)
+#define vchi_disconnect(...)				TRACE_CALL(vchi_disconnect, __VA_ARGS__)
+#define vc_vchi_tv_init(...)				TRACE_CALL(vc_vchi_tv_init, __VA_ARGS__)
+#define vc_vchi_tv_stop(...)				TRACE_CALL_VOID(vc_vchi_tv_stop, __VA_ARGS__)
+#define vc_tv_register_callback(...)			TRACE_CALL_VOID(vc_tv_register_callback, __VA_ARGS__)
+#define vc_tv_unregister_callback_full(...)		TRACE_CALL_VOID(vc_tv_unregister_callback_full, __VA_ARGS__)
+#define vc_tv_get_display_state(...)			TRACE_CALL(vc_tv_get_display_state, __VA_ARGS__)
+#define vc_tv_power_off(...)				TRACE_CALL(vc_tv_power_off, __VA_ARGS__)
+#define vc_tv_hdmi_power_on_preferred(...)		TRACE_CALL(vc_tv_hdmi_power_on_preferred, __VA_ARGS__)
+#define vc_tv_hdmi_power_on_explicit_new(...)		TRACE_CALL(vc_tv_hdmi_power_on_explicit_new, __VA_ARGS__)
+#define vc_tv_hdmi_get_supported_modes_new(...)		TRACE_CALL(vc_tv_hdmi_get_supported_modes_new, __VA_ARGS__)
+#define vc_tv_hdmi_get_property(...)			TRACE_CALL(vc_tv_hdmi_get_property, __VA_ARGS__)
+#define vc_tv_hdmi_set_property(...)			TRACE_CALL(vc_tv_hdmi_set_property, __VA_ARGS__)
+
+#else
+
+#define TRACE_SCOPE(scope_name) do {} while (0)
+
+#endif
+
+#endif
@@ -1,10 +1,19 @@
 #include <Python.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
 #include <interface/vmcs_host/vc_tvservice.h>
+#include "constants.h"
 #include "tv_service.h"
+#include "event_queue.h"
+#include "vc_connection.h"
+#include "module_state.h"
+#include "trace.h"
 
 #define MAX_MODE_ID (127)
+#define MODE_GROUPS 2
 #define CHECK_ERROR(ret, fmt, arg...) if (ret != 0) { fprintf(stderr, "[E] " fmt "\n", ##arg); goto error; }
 
 
@@ -20,11 +29,59 @@ typedef struct {
 	PyObject_HEAD;
 	uint32_t preferred_mode;
 	HDMI_RES_GROUP_T preferred_group;
-	VCHI_INSTANCE_T vchi_instance;
-	VCHI_CONNECTION_T *vchi_connection;
+
+	/* Mode tables (CEA, DMT) and preferred mode are valid while their generation matches edid_generation */
+	uint32_t edid_generation;
+	uint32_t preferred_generation;
+	uint32_t modes_generation[MODE_GROUPS];
+	PyObject *modes[MODE_GROUPS];
+
+	/* Filled by the tvservice callback, read by read_events() */
+	EventQueue events;
+
+	/* Last mode reported by a dvi/hdmi notification, mode_seq counts them */
+	uint32_t mode_seq;
+	uint32_t mode_code;
+	HDMI_RES_GROUP_T mode_group;
+	pthread_mutex_t mode_lock;
+	pthread_cond_t mode_cond;
+
+	/* Holds a reference on the shared VideoCore connection */
+	int connected;
+
+	/* Guards the mode table cache and the connection, threads may share one TVService */
+	pthread_mutex_t lock;
 } TVServiceObject;
 
 
+static PyStructSequence_Field TVEvent_fields[] = {
+	{"type", "Event type (TV_EVENT_UNPLUGGED, TV_EVENT_ATTACHED, TV_EVENT_DVI, TV_EVENT_HDMI, TV_EVENT_CHANGING_MODE, ...)"},
+	{"group", "Resolution group (CEA, DMT) of dvi, hdmi and changing_mode events, else None"},
+	{"mode", "Resolution mode of dvi, hdmi and changing_mode events, else None"},
+	{"timestamp", "Monotonic clock time in seconds, comparable with time.monotonic()"},
+	{NULL},
+};
+
+PyStructSequence_Desc TVEvent_desc = {
+	"pylibmmal." TVEvent_name,
+	"HDMI or SDTV notification",
+	TVEvent_fields,
+	4,
+};
+
+
+PyDoc_STRVAR(TVModeChangeObject_type_doc,
+             "TVModeChange -> Pending mode switch returned by set_preferred_async() and set_explicit_async().\n");
+typedef struct {
+	PyObject_HEAD;
+	int settled;
+	uint32_t seq;
+	uint32_t mode;
+	HDMI_RES_GROUP_T group;
+	TVServiceObject *tv;
+} TVModeChangeObject;
+
+
 static PyObject *TVService_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
 
 	TVServiceObject *self;
@@ -34,18 +91,78 @@ static PyObject *TVService_new(PyTypeObject *type, PyObject *args, PyObject *kwd
 		return NULL;
 	}
 
-	Py_INCREF(self);
+	self->events.fd = -1;
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_mutex_init(&self->mode_lock, NULL);
+	pthread_cond_init(&self->mode_cond, NULL);
+
+	if (event_queue_init(&self->events) != 0) {
+
+		PyErr_SetFromErrno(PyExc_OSError);
+		Py_DECREF(self);
+		return NULL;
+	}
+
 	return (PyObject *)self;
 }
 
 
+/* Runs on the VCHI notification thread, queue the event and never block */
+static void tvservice_notify_cb(void *callback_data, uint32_t reason, uint32_t param1, uint32_t param2) {
+
+	TVServiceObject *self = callback_data;
+
+	/* A hotplug means the EDID and so the mode tables may have changed */
+	if (reason & (VC_HDMI_UNPLUGGED | VC_HDMI_ATTACHED)) {
+
+		__atomic_add_fetch(&self->edid_generation, 1, __ATOMIC_RELEASE);
+	}
+
+	/* Wake set_*() calls waiting for the mode to settle */
+	if (reason & (VC_HDMI_DVI | VC_HDMI_HDMI)) {
+
+		pthread_mutex_lock(&self->mode_lock);
+		self->mode_seq++;
+		self->mode_group = param1;
+		self->mode_code = param2;
+		pthread_cond_broadcast(&self->mode_cond);
+		pthread_mutex_unlock(&self->mode_lock);
+	}
+
+	event_queue_push(&self->events, reason, param1, param2, reason >= VC_SDTV_UNPLUGGED ? "sdtv" : "hdmi");
+}
+
+
+/* Take the TVService lock, the GIL is only released when the lock is contended */
+static void tvservice_lock(TVServiceObject *self) {
+
+	if (pthread_mutex_trylock(&self->lock) != 0) {
+
+		Py_BEGIN_ALLOW_THREADS
+		pthread_mutex_lock(&self->lock);
+		Py_END_ALLOW_THREADS
+	}
+}
+
+
 static PyObject *TVService_stop(TVServiceObject *self) {
 
-	/* Stop tvservice */
-	vc_vchi_tv_stop();
+	tvservice_lock(self);
+
+	if (self->connected) {
 
-	/* Disconnect the VCHI connection */
-	vchi_disconnect(self->vchi_instance);
+		Py_BEGIN_ALLOW_THREADS
+
+		/* Only the last TVService stops tvservice and disconnects */
+		vc_connection_remove_listener(tvservice_notify_cb, self);
+		vc_connection_release();
+
+		Py_END_ALLOW_THREADS
+
+		self->connected = 0;
+	}
+
+	pthread_mutex_unlock(&self->lock);
 
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -54,42 +171,69 @@ static PyObject *TVService_stop(TVServiceObject *self) {
 
 static void TVService_free(TVServiceObject *self) {
 
+	int i;
 	PyObject *ref = TVService_stop(self);
 	Py_XDECREF(ref);
 
-	Py_TYPE(self)->tp_free((PyObject *)self);
+	for (i = 0; i < MODE_GROUPS; i++) {
+
+		Py_CLEAR(self->modes[i]);
+	}
+
+	event_queue_destroy(&self->events);
+	pthread_cond_destroy(&self->mode_cond);
+	pthread_mutex_destroy(&self->mode_lock);
+	pthread_mutex_destroy(&self->lock);
+
+	PyTypeObject *type = Py_TYPE(self);
+
+	type->tp_free((PyObject *)self);
+	MODULE_TYPE_RELEASE(type);
 }
 
 
 static int TVService_init(TVServiceObject *self, PyObject *args, PyObject *kwds) {
 
-	int32_t ret = 0;
+	int ret = 0;
+	TRACE_SCOPE("TVService.__init__");
 
-	/* Initialize VCOS */
-	vcos_init();
+	tvservice_lock(self);
 
-	/* Initialize the VCHI connection */
-	ret = vchi_initialise(&self->vchi_instance);
-	CHECK_ERROR(ret, "Failed to initialize VCHI");
+	/* Reinit case */
+	if (self->connected) {
 
-	ret = vchi_connect(NULL, 0, self->vchi_instance);
-	CHECK_ERROR(ret, "Failed to create VCHI connection");
+		pthread_mutex_unlock(&self->lock);
+		return 0;
+	}
 
-	/* Initialize the tvservice */
-	vc_vchi_tv_init(self->vchi_instance, &self->vchi_connection, 1);
+	/* Generation 0 is never current so the first query fills the cache */
+	self->edid_generation = 1;
 
-	return 0;
+	/* Borrow the process wide connection, only the first TVService connects */
+	Py_BEGIN_ALLOW_THREADS
 
-error:
-	return -1;
+	if ((ret = vc_connection_acquire()) == 0 && (ret = vc_connection_add_listener(tvservice_notify_cb, self)) != 0) {
+
+		vc_connection_release();
+	}
+
+	Py_END_ALLOW_THREADS
+
+	self->connected = ret == 0;
+	pthread_mutex_unlock(&self->lock);
+
+	if (ret != 0) {
+
+		PyErr_SetString(PyExc_RuntimeError, "Failed to connect to the tvservice over VCHI");
+		return -1;
+	}
+
+	return 0;
 }
 
 
 static PyObject *TVService_enter(PyObject *self, PyObject *args) {
 
-	if (!PyArg_ParseTuple(args, ""))
-		return NULL;
-
 	Py_INCREF(self);
 	return self;
 }
@@ -106,7 +250,7 @@ static PyObject *TVService_exit(TVServiceObject *self, PyObject *args) {
 		return 0;
 	}
 
-	TVService_stop(self);
+	Py_XDECREF(TVService_stop(self));
 	Py_RETURN_FALSE;
 }
 
@@ -120,7 +264,10 @@ static int hdmi_set_property(HDMI_PROPERTY_T prop, uint32_t param1, uint32_t par
 	property.param1 = param1;
 	property.param2 = param2;
 
+	Py_BEGIN_ALLOW_THREADS
 	ret = vc_tv_hdmi_set_property(&property);
+	Py_END_ALLOW_THREADS
+
 	CHECK_ERROR(ret, "Failed to set property");
 
 error:
@@ -128,59 +275,194 @@ error:
 }
 
 
-PyDoc_STRVAR(TVService_set_preferred_doc, "set_preferred()\n\nPower on HDMI with preferred settings\n");
-static PyObject *TVService_set_preferred(TVServiceObject *self, PyObject *args, PyObject *kwds) {
+/* Convert group name to group */
+static HDMI_RES_GROUP_T get_group_from_name(const char *name) {
+
+	if (vcos_strcasecmp(HDMI_RES_GROUP_NAME(HDMI_RES_GROUP_CEA), name) == 0) {
+
+		return HDMI_RES_GROUP_CEA;
+	}
+	else if (vcos_strcasecmp(HDMI_RES_GROUP_NAME(HDMI_RES_GROUP_DMT), name) == 0) {
+
+		return HDMI_RES_GROUP_DMT;
+	}
+	else {
+
+		PyErr_Format(PyExc_ValueError, "invalid group '%s' (DMT, CEA)", name);
+		return HDMI_RES_GROUP_INVALID;
+	}
+}
+
+
+/* Mode switch sequence number, taken before powering on so the matching notification can't be missed */
+static uint32_t tvservice_mode_seq(TVServiceObject *self) {
+
+	uint32_t seq;
+
+	pthread_mutex_lock(&self->mode_lock);
+	seq = self->mode_seq;
+	pthread_mutex_unlock(&self->mode_lock);
+	return seq;
+}
+
+
+/* Wait without the GIL for a dvi/hdmi notification after seq reporting group and mode, any mode for an invalid group.
+   A negative timeout waits forever, returns 1 once settled and 0 on timeout */
+static int tvservice_wait_mode(TVServiceObject *self, uint32_t seq, HDMI_RES_GROUP_T group, uint32_t mode, double timeout) {
+
+	int ret = 0, settled = 0;
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+
+	if (timeout >= 0) {
+
+		deadline.tv_sec += (time_t)timeout;
+		deadline.tv_nsec += (long)((timeout - (time_t)timeout) * 1000000000.0);
+
+		if (deadline.tv_nsec >= 1000000000L) {
+
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&self->mode_lock);
+
+	while (ret != ETIMEDOUT) {
+
+		settled = self->mode_seq != seq &&
+		          (group == HDMI_RES_GROUP_INVALID || (self->mode_group == group && self->mode_code == mode));
+
+		if (settled) {
+
+			break;
+		}
+
+		ret = timeout >= 0 ? pthread_cond_timedwait(&self->mode_cond, &self->mode_lock, &deadline) :
+		      pthread_cond_wait(&self->mode_cond, &self->mode_lock);
+	}
+
+	pthread_mutex_unlock(&self->mode_lock);
+	Py_END_ALLOW_THREADS
+
+	return settled;
+}
+
+
+/* Power on HDMI with the preferred mode when group is invalid, else with group and mode */
+static int tvservice_power_on(TVServiceObject *self, HDMI_RES_GROUP_T group, uint32_t mode) {
 
 	int ret;
+	PyObject *ref;
+	uint32_t drive = HDMI_MODE_HDMI;
 
 	if (hdmi_set_property(HDMI_PROPERTY_3D_STRUCTURE, HDMI_3D_FORMAT_NONE, 0) != 0) {
 
-		PyErr_SetFromErrno(PyExc_RuntimeError);
+		PyErr_SetString(PyExc_RuntimeError, "Failed to set 3D structure");
 		goto error;
 	}
 
-	ret = vc_tv_hdmi_power_on_preferred();
-	CHECK_ERROR(ret, "Failed to power on HDMI with preferred settings");
+	if (group == HDMI_RES_GROUP_INVALID) {
 
-	Py_INCREF(Py_None);
-	return Py_None;
+		Py_BEGIN_ALLOW_THREADS
+		ret = vc_tv_hdmi_power_on_preferred();
+		Py_END_ALLOW_THREADS
+		CHECK_ERROR(ret, "Failed to power on HDMI with preferred settings");
+		return 0;
+	}
+
+	if (hdmi_set_property(HDMI_PROPERTY_PIXEL_CLOCK_TYPE, HDMI_PIXEL_CLOCK_TYPE_PAL, 0) != 0) {
+
+		PyErr_SetString(PyExc_RuntimeError, "Failed to set pixel clock type");
+		goto error;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = vc_tv_hdmi_power_on_explicit_new(drive, group, mode);
+	Py_END_ALLOW_THREADS
+	CHECK_ERROR(ret, "Failed to power on HDMI with explicit settings (%s, mode %u)", HDMI_RES_GROUP_NAME(group), mode);
+
+	return 0;
 
 error:
+	if (!PyErr_Occurred()) {
+
+		PyErr_SetString(PyExc_RuntimeError, "Failed to power on HDMI");
+	}
 
 	/* Cleanup everything */
-	return TVService_stop(self);
+	ref = TVService_stop(self);
+	Py_XDECREF(ref);
+	return -1;
 }
 
 
-/* Convert group name to group */
-static HDMI_RES_GROUP_T get_group_from_name(const char *name) {
+/* Shared by the blocking and async setters, optionally waits for the switch to settle */
+static PyObject *tvservice_set_mode(TVServiceObject *self, HDMI_RES_GROUP_T group, uint32_t mode, PyObject *timeout) {
 
-	if (vcos_strcasecmp(HDMI_RES_GROUP_NAME(HDMI_RES_GROUP_CEA), name) == 0) {
+	uint32_t seq;
+	double seconds = -1.0;
 
-		return HDMI_RES_GROUP_CEA;
+	if (timeout != Py_None && (seconds = PyFloat_AsDouble(timeout)) < 0) {
+
+		if (!PyErr_Occurred()) {
+
+			PyErr_SetString(PyExc_ValueError, "timeout must not be negative");
+		}
+
+		return NULL;
 	}
-	else if (vcos_strcasecmp(HDMI_RES_GROUP_NAME(HDMI_RES_GROUP_DMT), name) == 0) {
 
-		return HDMI_RES_GROUP_DMT;
+	seq = tvservice_mode_seq(self);
+
+	if (tvservice_power_on(self, group, mode) != 0) {
+
+		return NULL;
 	}
-	else {
 
-		PyErr_Format(PyExc_ValueError, "invalid group '%s' (DMT, CEA)", name);
-		return HDMI_RES_GROUP_INVALID;
+	if (timeout == Py_None) {
+
+		Py_INCREF(Py_None);
+		return Py_None;
 	}
+
+	return PyBool_FromLong(tvservice_wait_mode(self, seq, group, mode, seconds));
 }
 
 
-PyDoc_STRVAR(TVService_set_explicit_doc, "set_explicit(group, mode)\n\nPower on HDMI with explicit GROUP(CEA, DMT, CEA_3D_SBS, CEA_3D_TB, CEA_3D_FP, CEA_3D_FS) and MODE\n");
+PyDoc_STRVAR(TVService_set_preferred_doc,
+             "set_preferred(timeout=None)\n\nPower on HDMI with preferred settings.\n"
+             "With a timeout in seconds wait for the tvservice to report the new mode, return True once settled, False on timeout\n");
+static PyObject *TVService_set_preferred(TVServiceObject *self, PyObject *args, PyObject *kwds) {
+
+	PyObject *timeout = Py_None;
+	static char *kwlist[] = {"timeout", NULL};
+	TRACE_SCOPE("TVService.set_preferred");
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:set_preferred", kwlist, &timeout)) {
+
+		return NULL;
+	}
+
+	return tvservice_set_mode(self, HDMI_RES_GROUP_INVALID, 0, timeout);
+}
+
+
+PyDoc_STRVAR(TVService_set_explicit_doc,
+             "set_explicit(group, mode, timeout=None)\n\nPower on HDMI with explicit GROUP(CEA, DMT, CEA_3D_SBS, CEA_3D_TB, CEA_3D_FP, CEA_3D_FS) and MODE.\n"
+             "With a timeout in seconds wait for the tvservice to report this mode, return True once settled, False on timeout\n");
 static PyObject *TVService_set_explicit(TVServiceObject *self, PyObject *args, PyObject *kwds) {
 
-	int ret;
 	char *group_name = NULL;
-	uint32_t mode, drive = HDMI_MODE_HDMI;
+	uint32_t mode;
+	PyObject *timeout = Py_None;
 	HDMI_RES_GROUP_T group = HDMI_RES_GROUP_INVALID;
-	static char *kwlist[] = {"group", "mode", NULL};
+	static char *kwlist[] = {"group", "mode", "timeout", NULL};
+	TRACE_SCOPE("TVService.set_explicit");
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "si:set_explicit", kwlist, &group_name, &mode)) {
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "sI|O:set_explicit", kwlist, &group_name, &mode, &timeout)) {
 
 		return NULL;
 	}
@@ -191,34 +473,79 @@ static PyObject *TVService_set_explicit(TVServiceObject *self, PyObject *args, P
 		return NULL;
 	}
 
-	if (hdmi_set_property(HDMI_PROPERTY_3D_STRUCTURE, HDMI_3D_FORMAT_NONE, 0) != 0) {
+	return tvservice_set_mode(self, group, mode, timeout);
+}
 
-		PyErr_SetFromErrno(PyExc_RuntimeError);
-		goto error;
+
+/* Start a mode switch and return a TVModeChange to wait on */
+static PyObject *tvservice_set_mode_async(TVServiceObject *self, HDMI_RES_GROUP_T group, uint32_t mode) {
+
+	TVModeChangeObject *change;
+	ModuleState *state = module_state_by_type(Py_TYPE(self));
+
+	if (state == NULL || (change = (TVModeChangeObject *)state->mode_change_type->tp_alloc(state->mode_change_type, 0)) == NULL) {
+
+		return NULL;
 	}
 
-	if (hdmi_set_property(HDMI_PROPERTY_PIXEL_CLOCK_TYPE, HDMI_PIXEL_CLOCK_TYPE_PAL, 0) != 0) {
+	change->settled = 0;
+	change->group = group;
+	change->mode = mode;
+	change->seq = tvservice_mode_seq(self);
 
-		PyErr_SetFromErrno(PyExc_RuntimeError);
-		goto error;
+	Py_INCREF(self);
+	change->tv = self;
+
+	if (tvservice_power_on(self, group, mode) != 0) {
+
+		Py_DECREF(change);
+		return NULL;
 	}
 
-	ret = vc_tv_hdmi_power_on_explicit_new(drive, group, mode);
-	CHECK_ERROR(ret, "Failed to power on HDMI with explicit settings (%s, mode %u)", HDMI_RES_GROUP_NAME(group), mode);
+	return (PyObject *)change;
+}
 
-	Py_INCREF(Py_None);
-	return Py_None;
 
-error:
-	/* Cleanup everything */
-	return TVService_stop(self);
+PyDoc_STRVAR(TVService_set_preferred_async_doc,
+             "set_preferred_async()\n\nPower on HDMI with preferred settings, return a TVModeChange which settles with the new mode\n");
+static PyObject *TVService_set_preferred_async(TVServiceObject *self) {
+
+	return tvservice_set_mode_async(self, HDMI_RES_GROUP_INVALID, 0);
+}
+
+
+PyDoc_STRVAR(TVService_set_explicit_async_doc,
+             "set_explicit_async(group, mode)\n\nPower on HDMI with explicit GROUP and MODE, return a TVModeChange which settles with that mode\n");
+static PyObject *TVService_set_explicit_async(TVServiceObject *self, PyObject *args, PyObject *kwds) {
+
+	char *group_name = NULL;
+	uint32_t mode;
+	HDMI_RES_GROUP_T group = HDMI_RES_GROUP_INVALID;
+	static char *kwlist[] = {"group", "mode", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "sI:set_explicit_async", kwlist, &group_name, &mode)) {
+
+		return NULL;
+	}
+
+	if ((group = get_group_from_name(group_name)) == HDMI_RES_GROUP_INVALID) {
+
+		return NULL;
+	}
+
+	return tvservice_set_mode_async(self, group, mode);
 }
 
 
 PyDoc_STRVAR(TVService_power_off_doc, "power_off()\n\nPower off the display\n");
 static PyObject *TVService_power_off(TVServiceObject *self, PyObject *args, PyObject *kwds) {
 
-	int ret = vc_tv_power_off();
+	int ret;
+	TRACE_SCOPE("TVService.power_off");
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = vc_tv_power_off();
+	Py_END_ALLOW_THREADS
 	CHECK_ERROR(ret, "Failed to power off HDMI");
 
 	Py_INCREF(Py_None);
@@ -261,14 +588,93 @@ static const char *aspect_ratio_str(HDMI_ASPECT_T aspect_ratio) {
 }
 
 
-PyDoc_STRVAR(TVService_get_modes_doc, "get_modes(group)\n\nGet supported modes for GROUP (CEA, DMT)\n");
+/* Mode table of group, only queried over VCHI when a hotplug happened since the last query.
+   Called with self->lock held, so concurrent callers wait for one query instead of repeating it */
+static PyObject *tvservice_mode_table(TVServiceObject *self, HDMI_RES_GROUP_T group) {
+
+	int num_modes, j;
+	uint32_t generation, preferred_mode = 0;
+	int index = group == HDMI_RES_GROUP_CEA ? 0 : 1;
+	PyObject *item, *modes;
+	HDMI_RES_GROUP_T preferred_group = HDMI_RES_GROUP_INVALID;
+	TV_SUPPORTED_MODE_NEW_T supported_modes[MAX_MODE_ID];
+
+	/* Read before the query, a hotplug while it runs leaves the result stale */
+	generation = __atomic_load_n(&self->edid_generation, __ATOMIC_ACQUIRE);
+
+	if (self->modes[index] && self->modes_generation[index] == generation) {
+
+		Py_INCREF(self->modes[index]);
+		return self->modes[index];
+	}
+
+	/* Get specific group support modes */
+	memset(supported_modes, 0, sizeof(supported_modes));
+
+	Py_BEGIN_ALLOW_THREADS
+	num_modes = vc_tv_hdmi_get_supported_modes_new(
+	                group,
+	                supported_modes,
+	                vcos_countof(supported_modes),
+	                &preferred_group,
+	                &preferred_mode);
+	Py_END_ALLOW_THREADS
+
+	if (num_modes < 0) {
+
+		PyErr_SetString(PyExc_RuntimeError, "Cannot get support modes");
+		return NULL;
+	}
+
+	if ((modes = PyList_New(0)) == NULL) {
+
+		return NULL;
+	}
+
+	/* Create modes list */
+	for (j = 0; j < num_modes; j++) {
+
+		item = Py_BuildValue("{s:I,s:I,s:I,s:s,s:s,s:s,s:N}",
+		                     "mode", supported_modes[j].code,
+		                     "rate", supported_modes[j].frame_rate,
+		                     "clock", supported_modes[j].pixel_freq / 1000000U,
+		                     "group", HDMI_RES_GROUP_NAME(group),
+		                     "scan_mode", supported_modes[j].scan_mode ? "i" : "p",
+		                     "ratio", aspect_ratio_str(supported_modes[j].aspect_ratio),
+		                     "res", PyUnicode_FromFormat("%ux%u", supported_modes[j].width, supported_modes[j].height));
+
+		/* Append to modes */
+		if (item == NULL || PyList_Append(modes, item) != 0) {
+
+			Py_XDECREF(item);
+			Py_DECREF(modes);
+			return NULL;
+		}
+
+		Py_DECREF(item);
+	}
+
+	Py_XDECREF(self->modes[index]);
+	self->modes[index] = modes;
+	self->modes_generation[index] = generation;
+
+	self->preferred_group = preferred_group;
+	self->preferred_mode = preferred_mode;
+	self->preferred_generation = generation;
+
+	Py_INCREF(modes);
+	return modes;
+}
+
+
+PyDoc_STRVAR(TVService_get_modes_doc, "get_modes(group)\n\nGet supported modes for GROUP (CEA, DMT), cached until the next hotplug\n");
 static PyObject *TVService_get_modes(TVServiceObject *self, PyObject *args, PyObject *kwds) {
 
-	uint32_t num_modes, j;
 	char *group_name = NULL;
-	PyObject *item = NULL, *modes = PyList_New(0);
+	Py_ssize_t i;
+	PyObject *table, *modes, *item;
 	HDMI_RES_GROUP_T group = HDMI_RES_GROUP_INVALID;
-	static TV_SUPPORTED_MODE_NEW_T supported_modes[MAX_MODE_ID];
+	TRACE_SCOPE("TVService.get_modes");
 
 	/* Get args */
 	if (!PyArg_ParseTuple(args, "s:get_modes", &group_name)) {
@@ -282,40 +688,35 @@ static PyObject *TVService_get_modes(TVServiceObject *self, PyObject *args, PyOb
 		return NULL;
 	}
 
+	tvservice_lock(self);
+	table = tvservice_mode_table(self, group);
+	pthread_mutex_unlock(&self->lock);
 
-	/* Get specific group support modes */
-	memset(supported_modes, 0, sizeof(supported_modes));
-	num_modes = vc_tv_hdmi_get_supported_modes_new(
-	                group,
-	                supported_modes,
-	                vcos_countof(supported_modes),
-	                &self->preferred_group,
-	                &self->preferred_mode);
+	if (table == NULL) {
 
-	if (num_modes < 0) {
+		return NULL;
+	}
 
-		PyErr_SetString(PyExc_RuntimeError, "Cannot get support modes");
-		goto out;
+	/* Callers get their own list and mode dicts, the cached ones stay intact */
+	if ((modes = PyList_New(PyList_GET_SIZE(table))) == NULL) {
+
+		Py_DECREF(table);
+		return NULL;
 	}
 
-	/* Create modes list */
-	for (j = 0; j < num_modes; j++) {
+	for (i = 0; i < PyList_GET_SIZE(table); i++) {
 
-		item = PyDict_New();
-		PyDict_SetItem(item, PyUnicode_FromString("mode"), PyLong_FromLong(supported_modes[j].code));
-		PyDict_SetItem(item, PyUnicode_FromString("rate"), PyLong_FromLong(supported_modes[j].frame_rate));
-		PyDict_SetItem(item, PyUnicode_FromString("clock"), PyLong_FromLong(supported_modes[j].pixel_freq / 1000000U));
+		if ((item = PyDict_Copy(PyList_GET_ITEM(table, i))) == NULL) {
 
-		PyDict_SetItemString(item, "group", PyUnicode_FromString(group_name));
-		PyDict_SetItemString(item, "scan_mode", PyUnicode_FromString(supported_modes[j].scan_mode ? "i" : "p"));
-		PyDict_SetItemString(item, "ratio", PyUnicode_FromString(aspect_ratio_str(supported_modes[j].aspect_ratio)));
-		PyDict_SetItemString(item, "res", PyUnicode_FromFormat("%ux%u", supported_modes[j].width, supported_modes[j].height));
+			Py_DECREF(modes);
+			Py_DECREF(table);
+			return NULL;
+		}
 
-		/* Append to modes */
-		PyList_Append(modes, item);
+		PyList_SET_ITEM(modes, i, item);
 	}
 
-out:
+	Py_DECREF(table);
 	return modes;
 }
 
@@ -326,13 +727,19 @@ static PyObject *TVService_get_status(TVServiceObject *self, PyObject *args, PyO
 	float frame_rate;
 	TV_DISPLAY_STATE_T tvstate;
 	PyObject *state = PyDict_New();
+	TRACE_SCOPE("TVService.get_status");
+
+	HDMI_PROPERTY_PARAM_T property;
+	property.property = HDMI_PROPERTY_PIXEL_CLOCK_TYPE;
 
+	Py_BEGIN_ALLOW_THREADS
 	ret = vc_tv_get_display_state(&tvstate);
+	Py_END_ALLOW_THREADS
 	CHECK_ERROR(ret, "Failed to get current display state");
 
-	HDMI_PROPERTY_PARAM_T property;
-	property.property = HDMI_PROPERTY_PIXEL_CLOCK_TYPE;
+	Py_BEGIN_ALLOW_THREADS
 	vc_tv_hdmi_get_property(&property);
+	Py_END_ALLOW_THREADS
 	frame_rate = property.param1 == HDMI_PIXEL_CLOCK_TYPE_NTSC ? tvstate.display.hdmi.frame_rate * (1000.0f / 10001.0f) : tvstate.display.hdmi.frame_rate;
 
 	PyDict_SetItem(state, PyUnicode_FromString("rate"), PyLong_FromLong(frame_rate));
@@ -347,79 +754,273 @@ error:
 }
 
 
-PyDoc_STRVAR(TVService_get_preferred_mode_doc, "preferred_mode()\n\nGet HDMI preferred modes for (GROUP, MODE)\n");
+PyDoc_STRVAR(TVService_get_preferred_mode_doc, "preferred_mode()\n\nGet HDMI preferred modes for (GROUP, MODE), cached until the next hotplug\n");
 static PyObject *TVService_get_preferred_mode(TVServiceObject *self, PyObject *args, PyObject *kwds) {
 
-	PyObject *group = PyTuple_New(1);
+	uint32_t mode;
+	PyObject *table;
+	HDMI_RES_GROUP_T group;
+
+	tvservice_lock(self);
+
+	/* Any group query reports the preferred mode, it is only fetched when the cache is stale */
+	if (self->preferred_generation != __atomic_load_n(&self->edid_generation, __ATOMIC_ACQUIRE)) {
+
+		if ((table = tvservice_mode_table(self, HDMI_RES_GROUP_CEA)) == NULL) {
+
+			pthread_mutex_unlock(&self->lock);
+			return NULL;
+		}
+
+		Py_DECREF(table);
+	}
+
+	group = self->preferred_group;
+	mode = self->preferred_mode;
+	pthread_mutex_unlock(&self->lock);
+
+	return Py_BuildValue("sI", HDMI_RES_GROUP_NAME(group), mode);
+}
+
+
+static const char *tvservice_event_name(uint32_t reason) {
+
+	switch (reason) {
+		case VC_HDMI_UNPLUGGED:
+			return TV_EVENT_UNPLUGGED;
+
+		case VC_HDMI_ATTACHED:
+			return TV_EVENT_ATTACHED;
+
+		case VC_HDMI_DVI:
+			return TV_EVENT_DVI;
+
+		case VC_HDMI_HDMI:
+			return TV_EVENT_HDMI;
+
+		case VC_HDMI_CHANGING_MODE:
+			return TV_EVENT_CHANGING_MODE;
+
+		case VC_HDMI_HDCP_AUTH:
+			return TV_EVENT_HDCP_AUTH;
+
+		case VC_HDMI_HDCP_UNAUTH:
+			return TV_EVENT_HDCP_UNAUTH;
+
+		case VC_SDTV_UNPLUGGED:
+			return TV_EVENT_SDTV_UNPLUGGED;
+
+		case VC_SDTV_ATTACHED:
+			return TV_EVENT_SDTV_ATTACHED;
 
-	PyTuple_SetItem(group, 0, Py_BuildValue("s", "CEA"));
-	TVService_get_modes(self, group, NULL);
+		default:
+			return "unknown";
+	}
+}
+
+
+static PyObject *tvservice_event_object(TVServiceObject *self, QueueEvent *event) {
+
+	PyObject *item;
+	ModuleState *state = module_state_by_type(Py_TYPE(self));
+
+	if (state == NULL || (item = PyStructSequence_New(state->tv_event_type)) == NULL) {
+
+		return NULL;
+	}
+
+	PyStructSequence_SET_ITEM(item, 0, PyUnicode_FromString(tvservice_event_name(event->type)));
+
+	/* Mode notifications carry group and mode in their parameters */
+	if (event->type & (VC_HDMI_DVI | VC_HDMI_HDMI | VC_HDMI_CHANGING_MODE)) {
 
-	PyTuple_SetItem(group, 0, Py_BuildValue("s", "DMT"));
-	TVService_get_modes(self, group, NULL);
+		PyStructSequence_SET_ITEM(item, 1, PyUnicode_FromString(HDMI_RES_GROUP_NAME(event->param1)));
+		PyStructSequence_SET_ITEM(item, 2, PyLong_FromUnsignedLong(event->param2));
+	}
+	else {
+
+		Py_INCREF(Py_None);
+		Py_INCREF(Py_None);
+		PyStructSequence_SET_ITEM(item, 1, Py_None);
+		PyStructSequence_SET_ITEM(item, 2, Py_None);
+	}
+
+	PyStructSequence_SET_ITEM(item, 3, PyFloat_FromDouble(event_queue_seconds(event->timestamp)));
+	return item;
+}
 
-	return Py_BuildValue("sI", HDMI_RES_GROUP_NAME(self->preferred_group), self->preferred_mode);
+
+PyDoc_STRVAR(TVService_fileno_doc, "fileno()\n\nReturn an eventfd which becomes readable when HDMI or SDTV events are queued.\n");
+static PyObject *TVService_fileno(TVServiceObject *self) {
+
+	return Py_BuildValue("i", self->events.fd);
 }
 
 
+PyDoc_STRVAR(TVService_read_events_doc, "read_events()\n\nReturn and clear the list of pending TVEvent, never blocks.\n");
+static PyObject *TVService_read_events(TVServiceObject *self) {
+
+	QueueEvent event;
+	PyObject *item, *events = PyList_New(0);
+
+	if (events == NULL) {
+
+		return NULL;
+	}
+
+	event_queue_clear_fd(&self->events);
+
+	while (event_queue_pop(&self->events, &event) == 0) {
+
+		if ((item = tvservice_event_object(self, &event)) == NULL || PyList_Append(events, item) != 0) {
+
+			Py_XDECREF(item);
+			Py_DECREF(events);
+			return NULL;
+		}
+
+		Py_DECREF(item);
+	}
+
+	return events;
+}
+
+
+PyDoc_STRVAR(TVService_events_dropped_doc, "TVService events lost because read_events() was not called in time(read only)\n");
+static PyObject *TVService_get_events_dropped(TVServiceObject *self, void *closure) {
+
+	return PyLong_FromUnsignedLong(__atomic_load_n(&self->events.dropped, __ATOMIC_RELAXED));
+}
+
+
+static PyGetSetDef TVService_getseters[] = {
+
+	{"events_dropped", (getter)TVService_get_events_dropped, (setter)NULL, TVService_events_dropped_doc},
+	{NULL},
+};
+
+
 /* pylibi2c module methods */
 static PyMethodDef TVService_methods[] = {
 
 	{"get_preferred_mode", (PyCFunction)TVService_get_preferred_mode, METH_NOARGS, TVService_get_preferred_mode_doc},
-	{"set_preferred", (PyCFunction)TVService_set_preferred, METH_NOARGS, TVService_set_preferred_doc},
+	{"set_preferred", (PyCFunction)TVService_set_preferred, METH_VARARGS | METH_KEYWORDS, TVService_set_preferred_doc},
 	{"set_explicit", (PyCFunction)TVService_set_explicit,  METH_VARARGS | METH_KEYWORDS, TVService_set_explicit_doc},
+	{"set_preferred_async", (PyCFunction)TVService_set_preferred_async, METH_NOARGS, TVService_set_preferred_async_doc},
+	{"set_explicit_async", (PyCFunction)TVService_set_explicit_async, METH_VARARGS | METH_KEYWORDS, TVService_set_explicit_async_doc},
 	{"power_off", (PyCFunction)TVService_power_off, METH_NOARGS, TVService_power_off_doc},
 	{"get_status", (PyCFunction)TVService_get_status, METH_NOARGS, TVService_get_status_doc},
 	{"get_modes", (PyCFunction)TVService_get_modes, METH_VARARGS, TVService_get_modes_doc},
+	{"fileno", (PyCFunction)TVService_fileno, METH_NOARGS, TVService_fileno_doc},
+	{"read_events", (PyCFunction)TVService_read_events, METH_NOARGS, TVService_read_events_doc},
 	{"__enter__", (PyCFunction)TVService_enter, METH_NOARGS, NULL},
-	{"__exit__", (PyCFunction)TVService_exit, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction)TVService_exit, METH_VARARGS, NULL},
 	{NULL},
 };
 
 
-PyTypeObject TVServiceObjectType = {
-#if PY_MAJOR_VERSION >= 3
-	PyVarObject_HEAD_INIT(NULL, 0)
-#else
-	PyObject_HEAD_INIT(NULL)
-	0,				            /* ob_size */
-#endif
-	TVService_name,	            /* tp_name */
-	sizeof(TVServiceObject),	/* tp_basicsize */
-	0,				            /* tp_itemsize */
-	(destructor)TVService_free,	/* tp_dealloc */
-	0,				            /* tp_print */
-	0,				            /* tp_getattr */
-	0,				            /* tp_setattr */
-	0,				            /* tp_compare */
-	0,				            /* tp_repr */
-	0,				            /* tp_as_number */
-	0,				            /* tp_as_sequence */
-	0,				            /* tp_as_mapping */
-	0,				            /* tp_hash */
-	0,				            /* tp_call */
-	0,				            /* tp_str */
-	0,				            /* tp_getattro */
-	0,				            /* tp_setattro */
-	0,				            /* tp_as_buffer */
-	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /* tp_flags */
-	TVServiceObject_type_doc,	/* tp_doc */
-	0,				            /* tp_traverse */
-	0,				            /* tp_clear */
-	0,				            /* tp_richcompare */
-	0,				            /* tp_weaklistoffset */
-	0,				            /* tp_iter */
-	0,				            /* tp_iternext */
-	TVService_methods,		    /* tp_methods */
-	0,				            /* tp_members */
-	0,				            /* tp_getset */
-	0,				            /* tp_base */
-	0,				            /* tp_dict */
-	0,				            /* tp_descr_get */
-	0,				            /* tp_descr_set */
-	0,				            /* tp_dictoffset */
-	(initproc)TVService_init,	/* tp_init */
-	0,				            /* tp_alloc */
-	TVService_new,		        /* tp_new */
+static PyType_Slot TVService_slots[] = {
+	{Py_tp_doc, (void *)TVServiceObject_type_doc},
+	{Py_tp_dealloc, (void *)TVService_free},
+	{Py_tp_methods, (void *)TVService_methods},
+	{Py_tp_getset, (void *)TVService_getseters},
+	{Py_tp_init, (void *)TVService_init},
+	{Py_tp_new, (void *)TVService_new},
+	{0, NULL},
+};
+
+
+PyType_Spec TVService_spec = {
+	"pylibmmal." TVService_name,
+	sizeof(TVServiceObject),
+	0,
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+	TVService_slots,
 };
 
+
+
+static void TVModeChange_free(TVModeChangeObject *self) {
+
+	PyTypeObject *type = Py_TYPE(self);
+
+	Py_XDECREF(self->tv);
+	type->tp_free((PyObject *)self);
+	MODULE_TYPE_RELEASE(type);
+}
+
+
+PyDoc_STRVAR(TVModeChange_wait_doc,
+             "wait(timeout=None)\n\nBlock with the GIL released until the mode switch settled, return True once settled, False on timeout\n");
+static PyObject *TVModeChange_wait(TVModeChangeObject *self, PyObject *args, PyObject *kwds) {
+
+	double seconds = -1.0;
+	PyObject *timeout = Py_None;
+	static char *kwlist[] = {"timeout", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:wait", kwlist, &timeout)) {
+
+		return NULL;
+	}
+
+	if (timeout != Py_None && (seconds = PyFloat_AsDouble(timeout)) < 0) {
+
+		if (!PyErr_Occurred()) {
+
+			PyErr_SetString(PyExc_ValueError, "timeout must not be negative");
+		}
+
+		return NULL;
+	}
+
+	if (!self->settled) {
+
+		self->settled = tvservice_wait_mode(self->tv, self->seq, self->group, self->mode, seconds);
+	}
+
+	return PyBool_FromLong(self->settled);
+}
+
+
+PyDoc_STRVAR(TVModeChange_done_doc, "TVModeChange mode switch has settled, never blocks(read only)\n");
+static PyObject *TVModeChange_get_done(TVModeChangeObject *self, void *closure) {
+
+	if (!self->settled) {
+
+		self->settled = tvservice_wait_mode(self->tv, self->seq, self->group, self->mode, 0);
+	}
+
+	return PyBool_FromLong(self->settled);
+}
+
+
+static PyMethodDef TVModeChange_methods[] = {
+
+	{"wait", (PyCFunction)TVModeChange_wait, METH_VARARGS | METH_KEYWORDS, TVModeChange_wait_doc},
+	{NULL},
+};
+
+
+static PyGetSetDef TVModeChange_getseters[] = {
+
+	{"done", (getter)TVModeChange_get_done, (setter)NULL, TVModeChange_done_doc},
+	{NULL},
+};
+
+
+static PyType_Slot TVModeChange_slots[] = {
+	{Py_tp_doc, (void *)TVModeChangeObject_type_doc},
+	{Py_tp_dealloc, (void *)TVModeChange_free},
+	{Py_tp_methods, (void *)TVModeChange_methods},
+	{Py_tp_getset, (void *)TVModeChange_getseters},
+	{0, NULL},
+};
+
+
+PyType_Spec TVModeChange_spec = {
+	"pylibmmal." TVModeChange_name,
+	sizeof(TVModeChangeObject),
+	0,
+	Py_TPFLAGS_DEFAULT | MODULE_TPFLAGS_NO_NEW,
+	TVModeChange_slots,
+};
@@ -1,7 +1,13 @@
 #ifndef _TVSERVICE_H_
 
+#include <structseq.h>
+
 #define TVService_name "TVService"
+#define TVEvent_name "TVEvent"
+#define TVModeChange_name "TVModeChange"
 
-PyTypeObject TVServiceObjectType;
+extern PyType_Spec TVService_spec;
+extern PyType_Spec TVModeChange_spec;
+extern PyStructSequence_Desc TVEvent_desc;
 
 #endif
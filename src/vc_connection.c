@@ -0,0 +1,299 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <bcm_host.h>
+#include <interface/vcos/vcos.h>
+#include <interface/vchi/vchi.h>
+#include <interface/vmcs_host/vc_tvservice.h>
+#include "vc_connection.h"
+#include "trace.h"
+
+/*
+ * Process wide VideoCore connection shared by every TVService and MmalGraph.
+ * The VCHI connection and tvservice client are set up by the first user and
+ * stopped with the last one. The firmware client only keeps a couple of
+ * notification callbacks, so a single one is registered and fanned out here.
+ * Dispmanx keeps one vsync callback per process whatever display handle it is
+ * given, it is fanned out the same way while anyone listens.
+ */
+
+typedef struct {
+	VcListener listener;
+	void *data;
+} VcListenerEntry;
+
+typedef struct {
+	VcVsyncListener listener;
+	void *data;
+} VcVsyncEntry;
+
+static struct {
+	uint32_t users;
+	VCHI_INSTANCE_T instance;
+	VCHI_CONNECTION_T *connection;
+	uint32_t listener_count, listener_capacity;
+	VcListenerEntry *listeners;
+} vc = {0};
+
+static struct {
+	DISPMANX_DISPLAY_HANDLE_T display;
+	uint32_t listener_count, listener_capacity;
+	VcVsyncEntry *listeners;
+} vsync = {DISPMANX_NO_HANDLE};
+
+/* vc_lock guards the connection, vc_listener_lock the listeners so the notification thread never waits on a teardown.
+   vsync_lock and vsync_listener_lock split the vsync registration the same way */
+static pthread_mutex_t vc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t vc_listener_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t vsync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t vsync_listener_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t vc_host_once = PTHREAD_ONCE_INIT;
+
+
+static void vc_host_init_once(void) {
+
+	bcm_host_init();
+}
+
+
+/* bcm_host_deinit() does nothing, so the host interface stays up for the process */
+void vc_host_init(void) {
+
+	pthread_once(&vc_host_once, vc_host_init_once);
+}
+
+
+static void vc_notify_cb(void *callback_data, uint32_t reason, uint32_t param1, uint32_t param2) {
+
+	uint32_t i;
+
+	/* Holding the lock keeps a listener alive until remove_listener returns */
+	pthread_mutex_lock(&vc_listener_lock);
+
+	for (i = 0; i < vc.listener_count; i++) {
+
+		vc.listeners[i].listener(vc.listeners[i].data, reason, param1, param2);
+	}
+
+	pthread_mutex_unlock(&vc_listener_lock);
+}
+
+
+/* Borrow the connection, connects on first use, returns -1 when VCHI is not available */
+int vc_connection_acquire(void) {
+
+	int ret = 0;
+
+	pthread_mutex_lock(&vc_lock);
+
+	if (vc.users == 0) {
+
+		vcos_init();
+
+		if (vchi_initialise(&vc.instance) != 0) {
+
+			ret = -1;
+			goto out;
+		}
+
+		if (vchi_connect(NULL, 0, vc.instance) != 0) {
+
+			ret = -1;
+			goto out;
+		}
+
+		vc_vchi_tv_init(vc.instance, &vc.connection, 1);
+		vc_tv_register_callback(vc_notify_cb, NULL);
+	}
+
+	vc.users++;
+
+out:
+	pthread_mutex_unlock(&vc_lock);
+	return ret;
+}
+
+
+/* Give the connection back, the last user disconnects */
+void vc_connection_release(void) {
+
+	pthread_mutex_lock(&vc_lock);
+
+	if (vc.users && --vc.users == 0) {
+
+		vc_tv_unregister_callback_full(vc_notify_cb, NULL);
+		vc_vchi_tv_stop();
+		vchi_disconnect(vc.instance);
+		vc.instance = NULL;
+		vc.connection = NULL;
+	}
+
+	pthread_mutex_unlock(&vc_lock);
+}
+
+
+uint32_t vc_connection_users(void) {
+
+	uint32_t users;
+
+	pthread_mutex_lock(&vc_lock);
+	users = vc.users;
+	pthread_mutex_unlock(&vc_lock);
+	return users;
+}
+
+
+int vc_connection_add_listener(VcListener listener, void *data) {
+
+	int ret = 0;
+	uint32_t capacity;
+	VcListenerEntry *grown;
+
+	pthread_mutex_lock(&vc_listener_lock);
+
+	if (vc.listener_count == vc.listener_capacity) {
+
+		capacity = vc.listener_capacity ? vc.listener_capacity * 2 : 4;
+
+		if ((grown = realloc(vc.listeners, capacity * sizeof(VcListenerEntry))) == NULL) {
+
+			ret = -1;
+			goto out;
+		}
+
+		vc.listeners = grown;
+		vc.listener_capacity = capacity;
+	}
+
+	vc.listeners[vc.listener_count].listener = listener;
+	vc.listeners[vc.listener_count].data = data;
+	vc.listener_count++;
+
+out:
+	pthread_mutex_unlock(&vc_listener_lock);
+	return ret;
+}
+
+
+/* Once this returns the listener is not running and won't be called again */
+void vc_connection_remove_listener(VcListener listener, void *data) {
+
+	uint32_t i;
+
+	pthread_mutex_lock(&vc_listener_lock);
+
+	for (i = 0; i < vc.listener_count; i++) {
+
+		if (vc.listeners[i].listener == listener && vc.listeners[i].data == data) {
+
+			vc.listeners[i] = vc.listeners[--vc.listener_count];
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&vc_listener_lock);
+}
+
+
+static void vc_vsync_cb(DISPMANX_UPDATE_HANDLE_T update, void *arg) {
+
+	uint32_t i;
+
+	pthread_mutex_lock(&vsync_listener_lock);
+
+	for (i = 0; i < vsync.listener_count; i++) {
+
+		vsync.listeners[i].listener(vsync.listeners[i].data);
+	}
+
+	pthread_mutex_unlock(&vsync_listener_lock);
+}
+
+
+/* Last listener gone, nothing may be called after the callback was unregistered. Called with vsync_lock held */
+static void vc_vsync_release(void) {
+
+	if (vsync.listener_count == 0 && vsync.display != DISPMANX_NO_HANDLE) {
+
+		vc_dispmanx_vsync_callback(vsync.display, NULL, NULL);
+		vc_dispmanx_display_close(vsync.display);
+		vsync.display = DISPMANX_NO_HANDLE;
+	}
+}
+
+
+/* Call listener on every vsync, the first listener registers the process wide callback through display_num */
+int vc_vsync_add_listener(uint32_t display_num, VcVsyncListener listener, void *data) {
+
+	int ret = 0;
+	uint32_t capacity;
+	VcVsyncEntry *grown;
+
+	pthread_mutex_lock(&vsync_lock);
+
+	if (vsync.display == DISPMANX_NO_HANDLE) {
+
+		if ((vsync.display = vc_dispmanx_display_open(display_num)) == DISPMANX_NO_HANDLE) {
+
+			ret = -1;
+			goto out;
+		}
+
+		if (vc_dispmanx_vsync_callback(vsync.display, vc_vsync_cb, NULL) != 0) {
+
+			vc_dispmanx_display_close(vsync.display);
+			vsync.display = DISPMANX_NO_HANDLE;
+			ret = -1;
+			goto out;
+		}
+	}
+
+	pthread_mutex_lock(&vsync_listener_lock);
+
+	if (vsync.listener_count == vsync.listener_capacity) {
+
+		capacity = vsync.listener_capacity ? vsync.listener_capacity * 2 : 4;
+
+		if ((grown = realloc(vsync.listeners, capacity * sizeof(VcVsyncEntry))) == NULL) {
+
+			pthread_mutex_unlock(&vsync_listener_lock);
+			vc_vsync_release();
+			ret = -1;
+			goto out;
+		}
+
+		vsync.listeners = grown;
+		vsync.listener_capacity = capacity;
+	}
+
+	vsync.listeners[vsync.listener_count].listener = listener;
+	vsync.listeners[vsync.listener_count].data = data;
+	vsync.listener_count++;
+	pthread_mutex_unlock(&vsync_listener_lock);
+
+out:
+	pthread_mutex_unlock(&vsync_lock);
+	return ret;
+}
+
+
+/* Once this returns the listener is not running and won't be called again */
+void vc_vsync_remove_listener(VcVsyncListener listener, void *data) {
+
+	uint32_t i;
+
+	pthread_mutex_lock(&vsync_lock);
+	pthread_mutex_lock(&vsync_listener_lock);
+
+	for (i = 0; i < vsync.listener_count; i++) {
+
+		if (vsync.listeners[i].listener == listener && vsync.listeners[i].data == data) {
+
+			vsync.listeners[i] = vsync.listeners[--vsync.listener_count];
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&vsync_listener_lock);
+	vc_vsync_release();
+	pthread_mutex_unlock(&vsync_lock);
+}
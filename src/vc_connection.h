@@ -0,0 +1,21 @@
+#ifndef _VC_CONNECTION_H_
+#define _VC_CONNECTION_H_
+
+#include <stdint.h>
+
+/* Receives tvservice notifications, runs on the VCHI notification thread and must not block */
+typedef void (*VcListener)(void *data, uint32_t reason, uint32_t param1, uint32_t param2);
+
+/* Receives vsyncs, runs on the dispmanx callback thread and must not block */
+typedef void (*VcVsyncListener)(void *data);
+
+void vc_host_init(void);
+int vc_connection_acquire(void);
+void vc_connection_release(void);
+uint32_t vc_connection_users(void);
+int vc_connection_add_listener(VcListener listener, void *data);
+void vc_connection_remove_listener(VcListener listener, void *data);
+int vc_vsync_add_listener(uint32_t display_num, VcVsyncListener listener, void *data);
+void vc_vsync_remove_listener(VcVsyncListener listener, void *data);
+
+#endif
@@ -0,0 +1,381 @@
+#!/usr/bin/env python
+"""
+Benchmarks for pylibmmal, prints one JSON document so runs can be diffed between commits.
+
+    PYLIBMMAL_STUB=1 python setup.py build_ext --inplace
+    python tests/benchmark.py -o before.json
+    python tests/benchmark.py -o after.json --compare before.json
+
+Built against tests/stub the simulated latencies are set per case (see tests/stub/stub.h) and
+stub object counts are reported, on a Pi only the timings are meaningful.
+"""
+import os
+import sys
+import json
+import time
+import ctypes
+import select
+import argparse
+import tempfile
+import threading
+import subprocess
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+import pylibmmal
+
+IMAGE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "superwoman.jpg")
+OBJECTS = ("components", "connections", "graphs", "pools", "queues", "buffers")
+
+
+class Stub(object):
+    def __init__(self):
+        self.lib = ctypes.CDLL(pylibmmal.__file__)
+        try:
+            self.lib.stub_set_latency.argtypes = [ctypes.c_char_p, ctypes.c_uint32]
+            self.lib.stub_allocated.argtypes = [ctypes.c_char_p]
+            self.lib.stub_allocated.restype = ctypes.c_long
+            self.lib.stub_alive.argtypes = [ctypes.c_char_p]
+            self.lib.stub_alive.restype = ctypes.c_long
+        except AttributeError:
+            self.lib = None
+
+    @property
+    def active(self):
+        return self.lib is not None
+
+    def set_latencies(self, latencies):
+        for name, us in latencies.items():
+            if self.lib and self.lib.stub_set_latency(name.encode(), us) != 0:
+                raise ValueError("unknown stub latency {}".format(name))
+
+    def counters(self):
+        if not self.lib:
+            return {}
+        return {name: (self.lib.stub_allocated(name.encode()), self.lib.stub_alive(name.encode())) for name in OBJECTS}
+
+
+def timed(func, iterations):
+    samples = []
+    for _ in range(iterations):
+        start = time.perf_counter()
+        func()
+        samples.append(time.perf_counter() - start)
+
+    samples.sort()
+    return {
+        "iterations": iterations,
+        "min_us": round(samples[0] * 1e6, 2),
+        "median_us": round(samples[len(samples) // 2] * 1e6, 2),
+        "p90_us": round(samples[int(len(samples) * 0.9)] * 1e6, 2),
+    }
+
+
+def allocations(stub, func, iterations):
+    """Stub objects allocated per call and still alive after all calls, non zero alive is a leak"""
+    before = stub.counters()
+    for _ in range(iterations):
+        func()
+    after = stub.counters()
+
+    return {name: {"per_call": (after[name][0] - before[name][0]) / float(iterations),
+                   "alive": after[name][1] - before[name][1]} for name in before}
+
+
+def open_close(**kwargs):
+    graph = pylibmmal.MmalGraph(**kwargs)
+    graph.open(IMAGE)
+    graph.close()
+
+
+def open_shown(graph):
+    """Open and wait until the picture reached the renderer"""
+    graph.open(IMAGE)
+    while not any(event.type == pylibmmal.EVENT_EOS for event in graph.read_events()):
+        select.select([graph], [], [], 1.0)
+
+
+def bench_open_close(stub, iterations):
+    graph = pylibmmal.MmalGraph(persistent=True)
+    graph.open(IMAGE)
+    cached = pylibmmal.MmalGraph(persistent=True, cache=64 << 20)
+    open_shown(cached)
+    result = {
+        "open_close": timed(open_close, iterations),
+        "open_close_resize": timed(lambda: open_close(resize=(160, 120)), iterations),
+        "persistent_open": timed(lambda: graph.open(IMAGE), iterations),
+        "persistent_shown": timed(lambda: open_shown(graph), iterations),
+        "cached_shown": timed(lambda: open_shown(cached), iterations),
+    }
+    graph.close()
+    cached.close()
+
+    if stub.active:
+        result["allocations"] = {
+            "open_close": allocations(stub, open_close, iterations),
+            "open_close_resize": allocations(stub, lambda: open_close(resize=(160, 120)), iterations),
+        }
+
+    return result
+
+
+def bench_modes(stub, iterations):
+    def fresh():
+        tv = pylibmmal.TVService()
+        for group in (pylibmmal.CEA, pylibmmal.DMT):
+            tv.get_modes(group)
+
+    tv = pylibmmal.TVService()
+    modes = len(tv.get_modes(pylibmmal.CEA)) + len(tv.get_modes(pylibmmal.DMT))
+
+    def cached():
+        for group in (pylibmmal.CEA, pylibmmal.DMT):
+            tv.get_modes(group)
+
+    result = {"modes": modes, "fresh": timed(fresh, iterations), "cached": timed(cached, iterations * 10)}
+    for case in ("fresh", "cached"):
+        result[case]["modes_per_s"] = round(modes / (result[case]["median_us"] / 1e6), 1) if result[case]["median_us"] else None
+
+    return result
+
+
+def bench_binding(stub, iterations):
+    """Cost of crossing into C for calls which do no MMAL/VCHI work"""
+    graph = pylibmmal.MmalGraph()
+    graph.open(IMAGE)
+    tv = pylibmmal.TVService()
+    tv.get_modes(pylibmmal.CEA)
+
+    result = {
+        "graph_attribute": timed(lambda: graph.is_open, iterations),
+        "graph_stats": timed(graph.stats, iterations),
+        "graph_read_events": timed(graph.read_events, iterations),
+        "tv_read_events": timed(tv.read_events, iterations),
+        "tv_get_modes_cached": timed(lambda: tv.get_modes(pylibmmal.CEA), iterations),
+    }
+
+    graph.close()
+    return result
+
+
+def decode_all(path, prefetch, work_s=0.0):
+    with pylibmmal.MmalDecoder(path, prefetch=prefetch) as decoder:
+        for frame in decoder:
+            frame.release()
+            if work_s:
+                time.sleep(work_s)
+
+        return decoder.frames
+
+
+def bench_decode(stub, iterations):
+    """MmalDecoder frames/s, alone and with Python work per frame which prefetch overlaps with decoding"""
+    fd, video = tempfile.mkstemp(suffix=".h264")
+    with os.fdopen(fd, "wb") as fp:
+        fp.write(os.urandom(25 * 80 * 1024 - 1000))
+
+    result = {}
+    try:
+        for name, prefetch, work_s in (("prefetch_1", 1, 0.0), ("prefetch_4", 4, 0.0),
+                                       ("prefetch_1_work", 1, 0.002), ("prefetch_4_work", 4, 0.002)):
+            frames = decode_all(video, prefetch, work_s)
+            result[name] = timed(lambda: decode_all(video, prefetch, work_s), max(iterations // 10, 3))
+            result[name]["frames"] = frames
+            result[name]["frames_per_s"] = round(frames / (result[name]["median_us"] / 1e6), 1)
+    finally:
+        os.unlink(video)
+
+    return result
+
+
+def lateness(samples):
+    samples.sort()
+    return {
+        "switches": len(samples),
+        "median_us": round(samples[len(samples) // 2] * 1e6, 2),
+        "p90_us": round(samples[int(len(samples) * 0.9)] * 1e6, 2),
+        "max_us": round(samples[-1] * 1e6, 2),
+    }
+
+
+def python_slideshow(graph, count, dwell):
+    """The README loop, prefetch then sleep until the planned switch in Python"""
+    late, planned = [], time.monotonic()
+    for _ in range(count):
+        graph.prefetch(IMAGE)
+        time.sleep(max(planned - time.monotonic(), 0))
+        graph.show()
+        late.append(time.monotonic() - planned)
+        planned += dwell
+    return late
+
+
+def native_slideshow(graph, count, dwell):
+    playlist = pylibmmal.MmalPlaylist(graph, [(IMAGE, dwell)] * count)
+    playlist.wait()
+    return [timing["late"] for timing in playlist.timings]
+
+
+def bench_playlist(stub, iterations):
+    """Switch lateness against the plan while another thread keeps the interpreter busy"""
+    count, dwell, result = max(iterations // 2, 10), 0.02, {}
+    stop = threading.Event()
+
+    def busy():
+        while not stop.is_set():
+            sum(range(10000))
+
+    thread = threading.Thread(target=busy)
+    thread.start()
+    try:
+        for name, slideshow in (("python_loop", python_slideshow), ("playlist", native_slideshow)):
+            graph = pylibmmal.MmalGraph(persistent=True)
+            graph.open(IMAGE)
+            # First switch includes the first decode, it is not scheduling jitter
+            result[name] = lateness(slideshow(graph, count, dwell)[1:])
+            graph.close()
+    finally:
+        stop.set()
+        thread.join()
+
+    return result
+
+
+def bench_trace(stub, iterations):
+    """Open/close and get_modes with the tracer stopped and recording, with zero stub latency the difference is its cost"""
+    def modes():
+        tv = pylibmmal.TVService()
+        tv.get_modes(pylibmmal.CEA)
+
+    path = os.path.join(tempfile.gettempdir(), "pylibmmal_bench_trace.json")
+    result = {"off": {"open_close": timed(open_close, iterations), "get_modes": timed(modes, iterations)}}
+
+    pylibmmal.trace_enable(True)
+    try:
+        pylibmmal.trace_dump(path)
+        result["on"] = {"open_close": timed(open_close, iterations), "get_modes": timed(modes, iterations)}
+        start = time.perf_counter()
+        events = pylibmmal.trace_dump(path)
+        result["dump"] = {"events": events, "events_per_call": round(events / (2.0 * iterations), 1),
+                          "ms": round((time.perf_counter() - start) * 1e3, 2)}
+    finally:
+        pylibmmal.trace_enable(False)
+        os.unlink(path)
+
+    return result
+
+
+def stream_latency(encoding, framed, count, interval):
+    """Seconds from feed() to the renderer input per frame, pts keys the timing samples to the feed times"""
+    fed, latency = {}, []
+    graph = pylibmmal.MmalGraph(timing=lambda samples: latency.extend(sample.timestamp - fed[sample.pts]
+                                                                         for sample in samples if sample.pts in fed),
+                                timing_batch=1)
+    graph.open_stream(encoding, framed=framed)
+    start = b"\xff\xd8" if encoding == "mjpeg" else b"\x00\x00\x00\x01\x41"
+    for i in range(count):
+        fed[i * 40000] = time.monotonic()
+        graph.feed(start + b"\x11" * 20000, pts=i * 40000)
+        time.sleep(interval)
+
+    graph.feed(b"", eos=True)
+    deadline = time.monotonic() + 2
+    while len(latency) < count - 1 and time.monotonic() < deadline:
+        time.sleep(0.01)
+
+    graph.close()
+    return latency
+
+
+def bench_stream(stub, iterations):
+    """Glass-to-glass latency of open_stream() input, a parsed stream holds each frame until the next one starts"""
+    count, interval, result = max(iterations, 10), 0.01, {}
+    for name, encoding, framed in (("framed", "mjpeg", True), ("parsed", "h264", False)):
+        samples = sorted(stream_latency(encoding, framed, count, interval))
+        result[name] = {
+            "frames": len(samples),
+            "median_us": round(samples[len(samples) // 2] * 1e6, 2),
+            "p90_us": round(samples[int(len(samples) * 0.9)] * 1e6, 2),
+        }
+
+    return result
+
+
+# Latency profile per case, None keeps what the stub was started with
+CASES = (
+    ("open_close", bench_open_close, None),
+    ("get_modes", bench_modes, {"query": 300}),
+    ("binding", bench_binding, {name: 0 for name in ("init", "connect", "query", "create", "commit",
+                                                     "enable", "open", "process")}),
+    ("decode", bench_decode, {"process": 2000}),
+    ("playlist", bench_playlist, {"process": 2000}),
+    ("trace", bench_trace, {name: 0 for name in ("init", "connect", "query", "create", "commit",
+                                                 "enable", "open", "process")}),
+    ("stream", bench_stream, {"process": 2000}),
+)
+
+
+def compare(old, new, threshold):
+    """Yield (path, old, new, ratio) of medians slower than threshold, sub microsecond changes are noise"""
+    def walk(a, b, path):
+        for key, value in b.items():
+            if key not in a:
+                continue
+            if isinstance(value, dict):
+                for item in walk(a[key], value, path + [key]):
+                    yield item
+            elif key == "median_us" and a[key]:
+                ratio = value / a[key]
+                if ratio > threshold and value - a[key] > 1.0:
+                    yield "/".join(path), a[key], value, ratio
+
+    return walk(old.get("results", {}), new.get("results", {}), [])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("-n", "--iterations", type=int, default=50)
+    parser.add_argument("-o", "--output", help="write results to this file instead of stdout")
+    parser.add_argument("-c", "--compare", help="previous results, exit 1 if a median got slower than --threshold")
+    parser.add_argument("-t", "--threshold", type=float, default=1.25)
+    parser.add_argument("cases", nargs="*", help="subset of {}".format(", ".join(name for name, _, _ in CASES)))
+    args = parser.parse_args()
+
+    stub = Stub()
+    try:
+        revision = subprocess.check_output(["git", "rev-parse", "--short", "HEAD"], stderr=subprocess.DEVNULL,
+                                           cwd=os.path.dirname(os.path.abspath(__file__))).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        revision = None
+
+    report = {"version": pylibmmal.__version__, "revision": revision,
+              "stub": stub.active, "python": sys.version.split()[0], "results": {}}
+
+    for name, bench, latencies in CASES:
+        if args.cases and name not in args.cases:
+            continue
+
+        if latencies and stub.active:
+            stub.set_latencies(latencies)
+        report["results"][name] = bench(stub, args.iterations)
+
+    text = json.dumps(report, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, "w") as fp:
+            fp.write(text + "\n")
+    else:
+        print(text)
+
+    if args.compare:
+        with open(args.compare) as fp:
+            regressions = list(compare(json.load(fp), report, args.threshold))
+
+        for path, old, new, ratio in regressions:
+            sys.stderr.write("{}: {:.1f}us -> {:.1f}us ({:.2f}x)\n".format(path, old, new, ratio))
+
+        return 1 if regressions else 0
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
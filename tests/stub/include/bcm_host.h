@@ -0,0 +1,11 @@
+/* Stub of <bcm_host.h>, only the subset used by src/, see tests/stub/stub.h */
+#ifndef BCM_HOST_H
+#define BCM_HOST_H
+#include <stdint.h>
+#include "interface/vcos/vcos.h"
+#include "interface/vchi/vchi.h"
+#include "interface/vmcs_host/vc_dispmanx.h"
+#include "interface/vmcs_host/vc_tvservice.h"
+void bcm_host_init(void);
+void bcm_host_deinit(void);
+#endif
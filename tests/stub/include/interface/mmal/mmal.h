@@ -0,0 +1,181 @@
+/* Stub of <interface/mmal/mmal.h>, only the subset used by src/, see tests/stub/stub.h */
+#ifndef MMAL_H
+#define MMAL_H
+#include <stdint.h>
+#include <stddef.h>
+#include "interface/vcos/vcos.h"
+
+typedef int32_t MMAL_BOOL_T;
+#define MMAL_FALSE 0
+#define MMAL_TRUE 1
+typedef enum { MMAL_SUCCESS = 0, MMAL_ENOMEM, MMAL_ENOSPC, MMAL_EINVAL, MMAL_ENOSYS, MMAL_ENOENT, MMAL_ENXIO, MMAL_EIO,
+	MMAL_ESPIPE, MMAL_ECORRUPT, MMAL_ENOTREADY, MMAL_ECONFIG, MMAL_EISCONN, MMAL_ENOTCONN, MMAL_EAGAIN, MMAL_EFAULT } MMAL_STATUS_T;
+typedef struct { int32_t x, y, width, height; } MMAL_RECT_T;
+typedef struct { int32_t num, den; } MMAL_RATIONAL_T;
+#define MMAL_TIME_UNKNOWN (INT64_C(1) << 63)
+#define MMAL_FOURCC(a,b,c,d) ((a) | (b << 8) | (c << 16) | (d << 24))
+typedef uint32_t MMAL_FOURCC_T;
+
+#define MMAL_ENCODING_H264 MMAL_FOURCC('H','2','6','4')
+#define MMAL_ENCODING_MJPEG MMAL_FOURCC('M','J','P','G')
+#define MMAL_ENCODING_JPEG MMAL_FOURCC('J','P','E','G')
+#define MMAL_ENCODING_GIF MMAL_FOURCC('G','I','F',' ')
+#define MMAL_ENCODING_PNG MMAL_FOURCC('P','N','G',' ')
+#define MMAL_ENCODING_BMP MMAL_FOURCC('B','M','P',' ')
+#define MMAL_ENCODING_I420 MMAL_FOURCC('I','4','2','0')
+#define MMAL_ENCODING_RGB24 MMAL_FOURCC('R','G','B','3')
+#define MMAL_ENCODING_BGR24 MMAL_FOURCC('B','G','R','3')
+#define MMAL_ENCODING_RGBA MMAL_FOURCC('R','G','B','A')
+#define MMAL_ENCODING_BGRA MMAL_FOURCC('B','G','R','A')
+#define MMAL_ENCODING_OPAQUE MMAL_FOURCC('O','P','Q','V')
+
+typedef enum { MMAL_ES_TYPE_UNKNOWN, MMAL_ES_TYPE_CONTROL, MMAL_ES_TYPE_AUDIO, MMAL_ES_TYPE_VIDEO, MMAL_ES_TYPE_SUBPICTURE } MMAL_ES_TYPE_T;
+typedef struct { uint32_t width, height; MMAL_RECT_T crop; MMAL_RATIONAL_T frame_rate; MMAL_RATIONAL_T par; MMAL_FOURCC_T color_space; } MMAL_VIDEO_FORMAT_T;
+typedef union { MMAL_VIDEO_FORMAT_T video; } MMAL_ES_SPECIFIC_FORMAT_T;
+typedef struct MMAL_ES_FORMAT_T { MMAL_ES_TYPE_T type; MMAL_FOURCC_T encoding; MMAL_FOURCC_T encoding_variant; MMAL_ES_SPECIFIC_FORMAT_T *es; uint32_t bitrate; uint32_t flags; uint32_t extradata_size; uint8_t *extradata; } MMAL_ES_FORMAT_T;
+#define MMAL_ES_FORMAT_FLAG_FRAMED 0x1
+void mmal_format_copy(MMAL_ES_FORMAT_T *format_dest, MMAL_ES_FORMAT_T *format_src);
+MMAL_STATUS_T mmal_format_full_copy(MMAL_ES_FORMAT_T *format_dest, MMAL_ES_FORMAT_T *format_src);
+
+typedef struct MMAL_BUFFER_HEADER_T {
+	struct MMAL_BUFFER_HEADER_T *next; void *priv; uint32_t cmd; uint8_t *data; uint32_t alloc_size; uint32_t length; uint32_t offset;
+	uint32_t flags; int64_t pts; int64_t dts; void *type; void *user_data;
+} MMAL_BUFFER_HEADER_T;
+#define MMAL_BUFFER_HEADER_FLAG_EOS (1 << 0)
+#define MMAL_BUFFER_HEADER_FLAG_FRAME_START (1 << 1)
+#define MMAL_BUFFER_HEADER_FLAG_FRAME_END (1 << 2)
+#define MMAL_BUFFER_HEADER_FLAG_FRAME (MMAL_BUFFER_HEADER_FLAG_FRAME_START | MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+#define MMAL_BUFFER_HEADER_FLAG_KEYFRAME (1 << 3)
+#define MMAL_BUFFER_HEADER_FLAG_DISCONTINUITY (1 << 4)
+#define MMAL_BUFFER_HEADER_FLAG_CONFIG (1 << 5)
+#define MMAL_BUFFER_HEADER_FLAG_CORRUPTED (1 << 7)
+void mmal_buffer_header_acquire(MMAL_BUFFER_HEADER_T *header);
+void mmal_buffer_header_reset(MMAL_BUFFER_HEADER_T *header);
+void mmal_buffer_header_release(MMAL_BUFFER_HEADER_T *header);
+MMAL_STATUS_T mmal_buffer_header_mem_lock(MMAL_BUFFER_HEADER_T *header);
+void mmal_buffer_header_mem_unlock(MMAL_BUFFER_HEADER_T *header);
+
+typedef struct MMAL_QUEUE_T MMAL_QUEUE_T;
+MMAL_QUEUE_T *mmal_queue_create(void);
+void mmal_queue_put(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer);
+void mmal_queue_put_back(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer);
+MMAL_BUFFER_HEADER_T *mmal_queue_get(MMAL_QUEUE_T *queue);
+MMAL_BUFFER_HEADER_T *mmal_queue_wait(MMAL_QUEUE_T *queue);
+MMAL_BUFFER_HEADER_T *mmal_queue_timedwait(MMAL_QUEUE_T *queue, uint32_t timeout);
+unsigned int mmal_queue_length(MMAL_QUEUE_T *queue);
+void mmal_queue_destroy(MMAL_QUEUE_T *queue);
+
+typedef struct MMAL_POOL_T { MMAL_QUEUE_T *queue; uint32_t headers_num; MMAL_BUFFER_HEADER_T **header; } MMAL_POOL_T;
+typedef MMAL_BOOL_T (*MMAL_POOL_BH_CB_T)(MMAL_POOL_T *pool, MMAL_BUFFER_HEADER_T *buffer, void *userdata);
+MMAL_POOL_T *mmal_pool_create(unsigned int headers, uint32_t payload_size);
+void mmal_pool_destroy(MMAL_POOL_T *pool);
+MMAL_STATUS_T mmal_pool_resize(MMAL_POOL_T *pool, unsigned int headers, uint32_t payload_size);
+void mmal_pool_callback_set(MMAL_POOL_T *pool, MMAL_POOL_BH_CB_T cb, void *userdata);
+
+typedef enum { MMAL_PORT_TYPE_UNKNOWN = 0, MMAL_PORT_TYPE_CONTROL, MMAL_PORT_TYPE_INPUT, MMAL_PORT_TYPE_OUTPUT, MMAL_PORT_TYPE_CLOCK } MMAL_PORT_TYPE_T;
+struct MMAL_COMPONENT_T;
+typedef struct MMAL_PORT_USERDATA_T MMAL_PORT_USERDATA_T;
+typedef struct MMAL_PORT_T {
+	struct MMAL_PORT_PRIVATE_T *priv; const char *name; MMAL_PORT_TYPE_T type; uint16_t index; uint16_t index_all; uint32_t is_enabled;
+	MMAL_ES_FORMAT_T *format; uint32_t buffer_num_min; uint32_t buffer_size_min; uint32_t buffer_alignment_min;
+	uint32_t buffer_num_recommended; uint32_t buffer_size_recommended; uint32_t buffer_num; uint32_t buffer_size;
+	struct MMAL_COMPONENT_T *component; struct MMAL_PORT_USERDATA_T *userdata; uint32_t capabilities;
+} MMAL_PORT_T;
+#define MMAL_PORT_CAPABILITY_PASSTHROUGH 0x01
+#define MMAL_PORT_CAPABILITY_ALLOCATION 0x02
+#define MMAL_PORT_CAPABILITY_SUPPORTS_EVENT_FORMAT_CHANGE 0x04
+typedef void (*MMAL_PORT_BH_CB_T)(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer);
+MMAL_STATUS_T mmal_port_format_commit(MMAL_PORT_T *port);
+MMAL_STATUS_T mmal_port_enable(MMAL_PORT_T *port, MMAL_PORT_BH_CB_T cb);
+MMAL_STATUS_T mmal_port_disable(MMAL_PORT_T *port);
+MMAL_STATUS_T mmal_port_flush(MMAL_PORT_T *port);
+MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer);
+MMAL_STATUS_T mmal_port_connect(MMAL_PORT_T *port, MMAL_PORT_T *other_port);
+MMAL_STATUS_T mmal_port_disconnect(MMAL_PORT_T *port);
+MMAL_POOL_T *mmal_port_pool_create(MMAL_PORT_T *port, unsigned int headers, uint32_t payload_size);
+void mmal_port_pool_destroy(MMAL_PORT_T *port, MMAL_POOL_T *pool);
+
+typedef struct MMAL_COMPONENT_T {
+	struct MMAL_COMPONENT_PRIVATE_T *priv; struct MMAL_COMPONENT_USERDATA_T *userdata; const char *name; uint32_t is_enabled;
+	MMAL_PORT_T *control; uint32_t input_num; MMAL_PORT_T **input; uint32_t output_num; MMAL_PORT_T **output;
+	uint32_t clock_num; MMAL_PORT_T **clock; uint32_t port_num; MMAL_PORT_T **port; uint32_t id;
+} MMAL_COMPONENT_T;
+MMAL_STATUS_T mmal_component_create(const char *name, MMAL_COMPONENT_T **component);
+void mmal_component_acquire(MMAL_COMPONENT_T *component);
+MMAL_STATUS_T mmal_component_release(MMAL_COMPONENT_T *component);
+MMAL_STATUS_T mmal_component_destroy(MMAL_COMPONENT_T *component);
+MMAL_STATUS_T mmal_component_enable(MMAL_COMPONENT_T *component);
+MMAL_STATUS_T mmal_component_disable(MMAL_COMPONENT_T *component);
+
+#define MMAL_EVENT_ERROR MMAL_FOURCC('E','R','R','O')
+#define MMAL_EVENT_EOS MMAL_FOURCC('E','E','O','S')
+#define MMAL_EVENT_FORMAT_CHANGED MMAL_FOURCC('E','F','C','H')
+#define MMAL_EVENT_PARAMETER_CHANGED MMAL_FOURCC('E','P','C','H')
+typedef struct { uint32_t buffer_size_min, buffer_num_min, buffer_size_recommended, buffer_num_recommended; MMAL_ES_FORMAT_T *format; } MMAL_EVENT_FORMAT_CHANGED_T;
+MMAL_EVENT_FORMAT_CHANGED_T *mmal_event_format_changed_get(MMAL_BUFFER_HEADER_T *buffer);
+
+typedef struct MMAL_PARAMETER_HEADER_T { uint32_t id; uint32_t size; } MMAL_PARAMETER_HEADER_T;
+enum {
+	MMAL_PARAMETER_GROUP_COMMON = (0 << 16), MMAL_PARAMETER_GROUP_VIDEO = (2 << 16),
+	MMAL_PARAMETER_UNUSED = MMAL_PARAMETER_GROUP_COMMON, MMAL_PARAMETER_SUPPORTED_ENCODINGS, MMAL_PARAMETER_URI,
+	MMAL_PARAMETER_CHANGE_EVENT_REQUEST, MMAL_PARAMETER_ZERO_COPY, MMAL_PARAMETER_BUFFER_REQUIREMENTS, MMAL_PARAMETER_STATISTICS,
+	MMAL_PARAMETER_CORE_STATISTICS, MMAL_PARAMETER_MEM_USAGE, MMAL_PARAMETER_BUFFER_FLAG_FILTER, MMAL_PARAMETER_SEEK,
+	MMAL_PARAMETER_POWERMON_ENABLE, MMAL_PARAMETER_LOGGING, MMAL_PARAMETER_SYSTEM_TIME, MMAL_PARAMETER_NO_IMAGE_PADDING,
+	MMAL_PARAMETER_LOCKSTEP_ENABLE,
+	MMAL_PARAMETER_DISPLAYREGION = MMAL_PARAMETER_GROUP_VIDEO, MMAL_PARAMETER_SUPPORTED_PROFILES, MMAL_PARAMETER_PROFILE,
+	MMAL_PARAMETER_INTRAPERIOD, MMAL_PARAMETER_RATECONTROL, MMAL_PARAMETER_NALUNITFORMAT, MMAL_PARAMETER_MINIMISE_FRAGMENTATION,
+	MMAL_PARAMETER_MB_ROWS_PER_SLICE, MMAL_PARAMETER_VIDEO_LEVEL_EXTENSION, MMAL_PARAMETER_VIDEO_EEDE_ENABLE,
+	MMAL_PARAMETER_VIDEO_EEDE_LOSSRATE, MMAL_PARAMETER_VIDEO_REQUEST_I_FRAME, MMAL_PARAMETER_VIDEO_INTRA_REFRESH,
+	MMAL_PARAMETER_VIDEO_IMMUTABLE_INPUT, MMAL_PARAMETER_VIDEO_BIT_RATE, MMAL_PARAMETER_VIDEO_FRAME_RATE,
+	MMAL_PARAMETER_VIDEO_ENCODE_MIN_QUANT, MMAL_PARAMETER_VIDEO_ENCODE_MAX_QUANT, MMAL_PARAMETER_VIDEO_ENCODE_RC_MODEL,
+	MMAL_PARAMETER_EXTRA_BUFFERS, MMAL_PARAMETER_VIDEO_ALIGN_HORIZ, MMAL_PARAMETER_VIDEO_ALIGN_VERT,
+	MMAL_PARAMETER_VIDEO_DROPPABLE_PFRAMES, MMAL_PARAMETER_VIDEO_ENCODE_INITIAL_QUANT, MMAL_PARAMETER_VIDEO_ENCODE_QP_P,
+	MMAL_PARAMETER_VIDEO_ENCODE_RC_SLICE_DQUANT, MMAL_PARAMETER_VIDEO_ENCODE_FRAME_LIMIT_BITS, MMAL_PARAMETER_VIDEO_ENCODE_PEAK_RATE,
+	MMAL_PARAMETER_VIDEO_ENCODE_H264_DISABLE_CABAC, MMAL_PARAMETER_VIDEO_ENCODE_H264_LOW_LATENCY,
+	MMAL_PARAMETER_VIDEO_ENCODE_H264_AU_DELIMITERS, MMAL_PARAMETER_VIDEO_ENCODE_H264_DEBLOCK_IDC,
+	MMAL_PARAMETER_VIDEO_ENCODE_H264_MB_INTRA_MODE, MMAL_PARAMETER_VIDEO_ENCODE_HEADER_ON_OPEN,
+	MMAL_PARAMETER_VIDEO_ENCODE_PRECODE_FOR_QP, MMAL_PARAMETER_VIDEO_DRM_INIT_INFO, MMAL_PARAMETER_VIDEO_TIMESTAMP_FIFO,
+	MMAL_PARAMETER_VIDEO_DECODE_ERROR_CONCEALMENT, MMAL_PARAMETER_VIDEO_DRM_PROTECT_BUFFER, MMAL_PARAMETER_VIDEO_DECODE_CONFIG_VD3,
+	MMAL_PARAMETER_VIDEO_ENCODE_H264_VCL_HRD_PARAMETERS, MMAL_PARAMETER_VIDEO_ENCODE_H264_LOW_DELAY_HRD_FLAG,
+	MMAL_PARAMETER_VIDEO_ENCODE_INLINE_HEADER, MMAL_PARAMETER_VIDEO_ENCODE_SEI_ENABLE, MMAL_PARAMETER_VIDEO_ENCODE_INLINE_VECTORS,
+	MMAL_PARAMETER_VIDEO_RENDER_STATS, MMAL_PARAMETER_VIDEO_INTERLACE_TYPE, MMAL_PARAMETER_VIDEO_INTERPOLATE_TIMESTAMPS,
+	MMAL_PARAMETER_VIDEO_ENCODE_SPS_TIMING, MMAL_PARAMETER_VIDEO_MAX_NUM_CALLBACKS, MMAL_PARAMETER_VIDEO_SOURCE_PATTERN,
+	MMAL_PARAMETER_VIDEO_ENCODE_SEPARATE_NAL_BUFS, MMAL_PARAMETER_VIDEO_DROPPABLE_PFRAME_LENGTH, MMAL_PARAMETER_VIDEO_STALL_DETECT,
+	MMAL_PARAMETER_VIDEO_ENCODE_INLINE_VECTORS2, MMAL_PARAMETER_RESIZE_PARAMS,
+	MMAL_PARAMETER_JPEG_Q_FACTOR = (1 << 16) + 50,
+};
+typedef struct { MMAL_PARAMETER_HEADER_T hdr; uint32_t value; } MMAL_PARAMETER_UINT32_T;
+typedef struct { MMAL_PARAMETER_HEADER_T hdr; MMAL_BOOL_T enable; } MMAL_PARAMETER_BOOLEAN_T;
+typedef struct { MMAL_PARAMETER_HEADER_T hdr; uint32_t buffer_count; uint32_t frame_count; uint32_t frames_skipped; uint32_t frames_discarded;
+	uint32_t eos_seen; uint32_t maximum_frame_bytes; int64_t total_bytes; uint32_t corrupt_macroblocks; } MMAL_PARAMETER_STATISTICS_T;
+typedef enum { MMAL_CORE_STATS_RX, MMAL_CORE_STATS_TX, MMAL_CORE_STATS_MAX = 0x7fffffff } MMAL_CORE_STATS_DIR;
+typedef struct { uint32_t buffer_count; uint32_t first_buffer_time; uint32_t last_buffer_time; uint32_t max_delay; } MMAL_CORE_STATISTICS_T;
+typedef struct { MMAL_PARAMETER_HEADER_T hdr; MMAL_CORE_STATS_DIR dir; MMAL_BOOL_T reset; MMAL_CORE_STATISTICS_T stats; } MMAL_PARAMETER_CORE_STATISTICS_T;
+typedef enum { MMAL_DISPLAY_ROT0 = 0, MMAL_DISPLAY_MIRROR_ROT0, MMAL_DISPLAY_MIRROR_ROT180, MMAL_DISPLAY_ROT180,
+	MMAL_DISPLAY_MIRROR_ROT90, MMAL_DISPLAY_ROT270, MMAL_DISPLAY_ROT90, MMAL_DISPLAY_MIRROR_ROT270 } MMAL_DISPLAYTRANSFORM_T;
+typedef enum { MMAL_DISPLAY_MODE_FILL = 0, MMAL_DISPLAY_MODE_LETTERBOX = 1 } MMAL_DISPLAYMODE_T;
+typedef enum {
+	MMAL_DISPLAY_SET_NONE = 0, MMAL_DISPLAY_SET_NUM = 1, MMAL_DISPLAY_SET_FULLSCREEN = 2, MMAL_DISPLAY_SET_TRANSFORM = 4,
+	MMAL_DISPLAY_SET_DEST_RECT = 8, MMAL_DISPLAY_SET_SRC_RECT = 0x10, MMAL_DISPLAY_SET_MODE = 0x20, MMAL_DISPLAY_SET_PIXEL = 0x40,
+	MMAL_DISPLAY_SET_NOASPECT = 0x80, MMAL_DISPLAY_SET_LAYER = 0x100, MMAL_DISPLAY_SET_COPYPROTECT = 0x200, MMAL_DISPLAY_SET_ALPHA = 0x400
+} MMAL_DISPLAYSET_T;
+typedef struct {
+	MMAL_PARAMETER_HEADER_T hdr; uint32_t set; uint32_t display_num; MMAL_BOOL_T fullscreen; MMAL_DISPLAYTRANSFORM_T transform;
+	MMAL_RECT_T dest_rect; MMAL_RECT_T src_rect; MMAL_BOOL_T noaspect; MMAL_DISPLAYMODE_T mode; uint32_t pixel_x; uint32_t pixel_y;
+	int32_t layer; MMAL_BOOL_T copyprotect_required; uint32_t alpha;
+} MMAL_DISPLAYREGION_T;
+typedef enum { MMAL_RESIZE_NONE, MMAL_RESIZE_CROP, MMAL_RESIZE_BOX, MMAL_RESIZE_BYTES } MMAL_RESIZEMODE_T;
+typedef struct { MMAL_PARAMETER_HEADER_T hdr; MMAL_RESIZEMODE_T mode; uint32_t max_width; uint32_t max_height; uint32_t max_bytes;
+	MMAL_BOOL_T preserve_aspect_ratio; MMAL_BOOL_T allow_rotation; } MMAL_PARAMETER_RESIZE_T;
+typedef enum { MMAL_VIDEO_PROFILE_H264_BASELINE = 0x19, MMAL_VIDEO_PROFILE_H264_MAIN, MMAL_VIDEO_PROFILE_H264_HIGH = 0x1C } MMAL_VIDEO_PROFILE_T;
+typedef enum { MMAL_VIDEO_LEVEL_H264_4 = 0x2B } MMAL_VIDEO_LEVEL_T;
+typedef struct { MMAL_VIDEO_PROFILE_T profile; MMAL_VIDEO_LEVEL_T level; } MMAL_PARAMETER_VIDEO_PROFILE_S;
+typedef struct { MMAL_PARAMETER_HEADER_T hdr; MMAL_PARAMETER_VIDEO_PROFILE_S profile[1]; } MMAL_PARAMETER_VIDEO_PROFILE_T;
+
+MMAL_STATUS_T mmal_port_parameter_set(MMAL_PORT_T *port, const MMAL_PARAMETER_HEADER_T *param);
+MMAL_STATUS_T mmal_port_parameter_get(MMAL_PORT_T *port, MMAL_PARAMETER_HEADER_T *param);
+MMAL_STATUS_T mmal_port_parameter_set_boolean(MMAL_PORT_T *port, uint32_t id, MMAL_BOOL_T value);
+MMAL_STATUS_T mmal_port_parameter_get_boolean(MMAL_PORT_T *port, uint32_t id, MMAL_BOOL_T *value);
+MMAL_STATUS_T mmal_port_parameter_set_uint32(MMAL_PORT_T *port, uint32_t id, uint32_t value);
+MMAL_STATUS_T mmal_port_parameter_get_uint32(MMAL_PORT_T *port, uint32_t id, uint32_t *value);
+#endif
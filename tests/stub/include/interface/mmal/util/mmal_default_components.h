@@ -0,0 +1,12 @@
+/* Stub of <interface/mmal/util/mmal_default_components.h>, only the subset used by src/, see tests/stub/stub.h */
+#ifndef MMAL_DEFAULT_COMPONENTS_H
+#define MMAL_DEFAULT_COMPONENTS_H
+#define MMAL_COMPONENT_DEFAULT_VIDEO_DECODER "vc.ril.video_decode"
+#define MMAL_COMPONENT_DEFAULT_VIDEO_ENCODER "vc.ril.video_encode"
+#define MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER "vc.ril.video_render"
+#define MMAL_COMPONENT_DEFAULT_IMAGE_DECODER "vc.ril.image_decode"
+#define MMAL_COMPONENT_DEFAULT_IMAGE_ENCODER "vc.ril.image_encode"
+#define MMAL_COMPONENT_DEFAULT_VIDEO_SPLITTER "vc.ril.video_splitter"
+#define MMAL_COMPONENT_DEFAULT_CONTAINER_READER "container_reader"
+#define MMAL_COMPONENT_DEFAULT_CONTAINER_WRITER "container_writer"
+#endif
@@ -0,0 +1,15 @@
+/* Stub of <interface/mmal/util/mmal_graph.h>, only the subset used by src/, see tests/stub/stub.h */
+#ifndef MMAL_GRAPH_H
+#define MMAL_GRAPH_H
+#include "util/mmal_connection.h"
+typedef struct MMAL_GRAPH_T { void *userdata; } MMAL_GRAPH_T;
+typedef void (*MMAL_GRAPH_EVENT_CB)(MMAL_GRAPH_T *graph, MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer, void *cb_data);
+MMAL_STATUS_T mmal_graph_create(MMAL_GRAPH_T **graph, unsigned int userdata_size);
+MMAL_STATUS_T mmal_graph_add_component(MMAL_GRAPH_T *graph, MMAL_COMPONENT_T *component);
+MMAL_STATUS_T mmal_graph_new_component(MMAL_GRAPH_T *graph, const char *name, MMAL_COMPONENT_T **component);
+MMAL_STATUS_T mmal_graph_add_connection(MMAL_GRAPH_T *graph, MMAL_CONNECTION_T *connection);
+MMAL_STATUS_T mmal_graph_new_connection(MMAL_GRAPH_T *graph, MMAL_PORT_T *out, MMAL_PORT_T *in, uint32_t flags, MMAL_CONNECTION_T **connection);
+MMAL_STATUS_T mmal_graph_enable(MMAL_GRAPH_T *graph, MMAL_GRAPH_EVENT_CB cb, void *cb_data);
+MMAL_STATUS_T mmal_graph_disable(MMAL_GRAPH_T *graph);
+MMAL_STATUS_T mmal_graph_destroy(MMAL_GRAPH_T *graph);
+#endif
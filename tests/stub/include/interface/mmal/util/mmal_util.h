@@ -0,0 +1,9 @@
+/* Stub of <interface/mmal/util/mmal_util.h>, only the subset used by src/, see tests/stub/stub.h */
+#ifndef MMAL_UTIL_H
+#define MMAL_UTIL_H
+#include "mmal.h"
+const char *mmal_status_to_string(MMAL_STATUS_T status);
+uint32_t mmal_encoding_width_to_stride(uint32_t encoding, uint32_t width);
+MMAL_STATUS_T mmal_buffer_header_copy_header(MMAL_BUFFER_HEADER_T *dest, const MMAL_BUFFER_HEADER_T *src);
+MMAL_STATUS_T mmal_util_get_core_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR dir, MMAL_BOOL_T reset, MMAL_CORE_STATISTICS_T *stats);
+#endif
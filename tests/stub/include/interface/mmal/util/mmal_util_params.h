@@ -0,0 +1,7 @@
+/* Stub of <interface/mmal/util/mmal_util_params.h>, only the subset used by src/, see tests/stub/stub.h */
+#ifndef MMAL_UTIL_PARAMS_H
+#define MMAL_UTIL_PARAMS_H
+#include "mmal.h"
+MMAL_STATUS_T mmal_util_port_set_uri(MMAL_PORT_T *port, const char *uri);
+MMAL_STATUS_T mmal_port_parameter_set_uint64(MMAL_PORT_T *port, uint32_t id, uint64_t value);
+#endif
@@ -0,0 +1,10 @@
+/* Stub of <interface/vchi/vchi.h>, only the subset used by src/, see tests/stub/stub.h */
+#ifndef VCHI_H
+#define VCHI_H
+#include <stdint.h>
+typedef struct opaque_vchi_instance_handle_t *VCHI_INSTANCE_T;
+typedef struct vchi_connection_t VCHI_CONNECTION_T;
+int32_t vchi_initialise(VCHI_INSTANCE_T *instance_handle);
+int32_t vchi_connect(VCHI_CONNECTION_T **connections, const uint32_t num_connections, VCHI_INSTANCE_T instance_handle);
+int32_t vchi_disconnect(VCHI_INSTANCE_T instance_handle);
+#endif
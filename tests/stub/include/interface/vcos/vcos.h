@@ -0,0 +1,15 @@
+/* Stub of <interface/vcos/vcos.h>, only the subset used by src/, see tests/stub/stub.h */
+#ifndef VCOS_H
+#define VCOS_H
+#include <stdint.h>
+#include <strings.h>
+typedef int32_t VCOS_STATUS_T;
+#define VCOS_SUCCESS 0
+#define vcos_countof(x) (sizeof((x)) / sizeof((x)[0]))
+#define vcos_strcasecmp strcasecmp
+#define VCOS_ALIGN_UP(p,n) (((p) + (n) - 1) & ~((n) - 1))
+VCOS_STATUS_T vcos_init(void);
+void vcos_deinit(void);
+uint64_t vcos_getmicrosecs64(void);
+void vcos_sleep(uint32_t ms);
+#endif
@@ -0,0 +1,14 @@
+/* Stub of <interface/vmcs_host/vc_dispmanx.h>, only the subset used by src/, see tests/stub/stub.h */
+#ifndef VC_DISPMANX_H
+#define VC_DISPMANX_H
+#include <stdint.h>
+typedef uint32_t DISPMANX_DISPLAY_HANDLE_T;
+typedef uint32_t DISPMANX_UPDATE_HANDLE_T;
+typedef struct { int32_t width; int32_t height; uint32_t transform; uint32_t input_format; uint32_t display_num; } DISPMANX_MODEINFO_T;
+typedef void (*DISPMANX_CALLBACK_FUNC_T)(DISPMANX_UPDATE_HANDLE_T u, void *arg);
+#define DISPMANX_NO_HANDLE 0
+DISPMANX_DISPLAY_HANDLE_T vc_dispmanx_display_open(uint32_t device);
+int vc_dispmanx_display_close(DISPMANX_DISPLAY_HANDLE_T display);
+int vc_dispmanx_display_get_info(DISPMANX_DISPLAY_HANDLE_T display, DISPMANX_MODEINFO_T *pinfo);
+int vc_dispmanx_vsync_callback(DISPMANX_DISPLAY_HANDLE_T display, DISPMANX_CALLBACK_FUNC_T cb_func, void *cb_arg);
+#endif
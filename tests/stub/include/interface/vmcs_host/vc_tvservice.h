@@ -0,0 +1,40 @@
+/* Stub of <interface/vmcs_host/vc_tvservice.h>, only the subset used by src/, see tests/stub/stub.h */
+#ifndef VC_TVSERVICE_H
+#define VC_TVSERVICE_H
+#include <stdint.h>
+#include "interface/vcos/vcos.h"
+#include "interface/vchi/vchi.h"
+typedef enum { HDMI_RES_GROUP_INVALID = 0, HDMI_RES_GROUP_CEA = 1, HDMI_RES_GROUP_DMT = 2, HDMI_RES_GROUP_CEA_3D = 3 } HDMI_RES_GROUP_T;
+#define HDMI_RES_GROUP_NAME(g) (((g) == HDMI_RES_GROUP_INVALID) ? "Invalid" : (((g) == HDMI_RES_GROUP_CEA) ? "CEA" : (((g) == HDMI_RES_GROUP_DMT) ? "DMT" : "Unknown")))
+typedef enum { HDMI_MODE_OFF, HDMI_MODE_DVI, HDMI_MODE_HDMI, HDMI_MODE_3D } HDMI_MODE_T;
+typedef enum { HDMI_ASPECT_UNKNOWN = 0, HDMI_ASPECT_4_3, HDMI_ASPECT_14_9, HDMI_ASPECT_16_9, HDMI_ASPECT_5_4, HDMI_ASPECT_16_10, HDMI_ASPECT_15_9, HDMI_ASPECT_64_27 } HDMI_ASPECT_T;
+typedef enum { HDMI_PROPERTY_PIXEL_ENCODING = 0, HDMI_PROPERTY_PIXEL_CLOCK_TYPE = 1, HDMI_PROPERTY_CONTENT_TYPE = 2, HDMI_PROPERTY_FUZZY_MATCH = 3, HDMI_PROPERTY_3D_STRUCTURE = 4 } HDMI_PROPERTY_T;
+typedef enum { HDMI_PIXEL_CLOCK_TYPE_PAL = 0, HDMI_PIXEL_CLOCK_TYPE_NTSC = 1 } HDMI_PIXEL_CLOCK_TYPE_T;
+typedef enum { HDMI_3D_FORMAT_NONE = 0 } HDMI_3D_FORMAT_T;
+typedef struct { HDMI_PROPERTY_T property; uint32_t param1; uint32_t param2; } HDMI_PROPERTY_PARAM_T;
+typedef struct { uint16_t scan_mode : 1; uint16_t native : 1; uint16_t group : 3; uint16_t code : 7; uint32_t pixel_freq; uint16_t width; uint16_t height; uint16_t frame_rate; uint16_t aspect_ratio; uint32_t struct_3d_mask; } TV_SUPPORTED_MODE_NEW_T;
+typedef struct { uint32_t state; uint32_t width; uint32_t height; uint16_t frame_rate; uint16_t scan_mode; uint32_t group; uint32_t mode; uint16_t pixel_rep; uint16_t aspect_ratio; uint32_t pixel_encoding; uint32_t format_3d; } TV_HDMI_DISPLAY_STATE_T;
+typedef struct { uint32_t state; union { TV_HDMI_DISPLAY_STATE_T hdmi; } display; } TV_DISPLAY_STATE_T;
+typedef enum {
+	VC_HDMI_UNPLUGGED = (1 << 0), VC_HDMI_ATTACHED = (1 << 1), VC_HDMI_DVI = (1 << 2), VC_HDMI_HDMI = (1 << 3),
+	VC_HDMI_HDCP_UNAUTH = (1 << 4), VC_HDMI_HDCP_AUTH = (1 << 5), VC_HDMI_HDCP_KEY_DOWNLOAD = (1 << 6),
+	VC_HDMI_HDCP_SRM_DOWNLOAD = (1 << 7), VC_HDMI_CHANGING_MODE = (1 << 8)
+} VC_HDMI_NOTIFY_T;
+typedef enum {
+	VC_SDTV_UNPLUGGED = 1 << 16, VC_SDTV_ATTACHED = 1 << 17, VC_SDTV_NTSC = 1 << 18, VC_SDTV_PAL = 1 << 19,
+	VC_SDTV_CP_INACTIVE = 1 << 20, VC_SDTV_CP_ACTIVE = 1 << 21
+} VC_SDTV_NOTIFY_T;
+typedef void (*TVSERVICE_CALLBACK_T)(void *callback_data, uint32_t reason, uint32_t param1, uint32_t param2);
+int vc_vchi_tv_init(VCHI_INSTANCE_T initialise_instance, VCHI_CONNECTION_T **connections, uint32_t num_connections);
+void vc_vchi_tv_stop(void);
+void vc_tv_register_callback(TVSERVICE_CALLBACK_T callback, void *callback_data);
+void vc_tv_unregister_callback(TVSERVICE_CALLBACK_T callback);
+void vc_tv_unregister_callback_full(TVSERVICE_CALLBACK_T callback, void *callback_data);
+int vc_tv_get_display_state(TV_DISPLAY_STATE_T *tvstate);
+int vc_tv_hdmi_power_on_preferred(void);
+int vc_tv_hdmi_power_on_explicit_new(HDMI_MODE_T mode, HDMI_RES_GROUP_T group, uint32_t code);
+int vc_tv_power_off(void);
+int vc_tv_hdmi_get_supported_modes_new(HDMI_RES_GROUP_T group, TV_SUPPORTED_MODE_NEW_T *supported_modes, uint32_t max_supported_modes, HDMI_RES_GROUP_T *preferred_group, uint32_t *preferred_mode);
+int vc_tv_hdmi_set_property(const HDMI_PROPERTY_PARAM_T *property);
+int vc_tv_hdmi_get_property(HDMI_PROPERTY_PARAM_T *property);
+#endif
@@ -0,0 +1,58 @@
+#ifndef _STUB_H_
+#define _STUB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Stub of the MMAL, mmal_util, bcm_host, vc_dispmanx and vc_tvservice calls
+ * used by src/, built in place of /opt/vc/lib when PYLIBMMAL_STUB=1 is set:
+ *
+ *	PYLIBMMAL_STUB=1 python setup.py build_ext --inplace
+ *
+ * Components are simulated by one worker thread each, buffers really travel
+ * through pools, queues and connections, decoders emit blank frames (one per
+ * H.264 slice or JPEG start of image on unframed input), encoders emit a valid
+ * magic number and the renderer raises EOS. Simulated latencies
+ * (microseconds) are read once from the environment:
+ *
+ *	PYLIBMMAL_STUB_LATENCY="create=500,process=2000,query=300"
+ */
+
+enum {
+	STUB_INIT,		/* bcm_host_init */
+	STUB_CONNECT,		/* vc_vchi_tv_init */
+	STUB_QUERY,		/* every vc_tv_* request */
+	STUB_MODE,		/* vc_tv_hdmi_power_on_* until the mode change notification */
+	STUB_CREATE,		/* mmal_component_create */
+	STUB_COMMIT,		/* mmal_port_format_commit */
+	STUB_ENABLE,		/* mmal_port_enable */
+	STUB_OPEN,		/* mmal_util_port_set_uri */
+	STUB_PROCESS,		/* every frame a component processes */
+	STUB_VSYNC,		/* vsync period */
+	STUB_LATENCIES
+};
+
+/* Objects the stub allocates, counted so leaks show up in benchmarks */
+enum {
+	STUB_COMPONENTS,
+	STUB_CONNECTIONS,
+	STUB_GRAPHS,
+	STUB_POOLS,
+	STUB_QUEUES,
+	STUB_BUFFERS,
+	STUB_OBJECTS
+};
+
+void stub_delay(int which);
+uint32_t stub_latency(int which);
+void *stub_alloc(int kind, size_t size);
+void stub_free(int kind, void *ptr);
+
+/* Exported for tests/benchmark.py through ctypes, -1 for an unknown name */
+int stub_set_latency(const char *name, uint32_t us);
+long stub_allocated(const char *name);
+long stub_alive(const char *name);
+void stub_reset_counters(void);
+
+#endif
@@ -0,0 +1,657 @@
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <bcm_host.h>
+#include <interface/vcos/vcos.h>
+#include <interface/vchi/vchi.h>
+#include <interface/vmcs_host/vc_dispmanx.h>
+#include <interface/vmcs_host/vc_tvservice.h>
+#include "stub.h"
+
+#define STUB_LATENCY_ENV	"PYLIBMMAL_STUB_LATENCY"
+#define STUB_LCD		4
+#define STUB_LCD_WIDTH		800
+#define STUB_LCD_HEIGHT		480
+#define STUB_DISPLAYS		16
+#define STUB_LISTENERS		8
+
+static const char *stub_latency_names[STUB_LATENCIES] = {
+	"init", "connect", "query", "mode", "create", "commit", "enable", "open", "process", "vsync"
+};
+
+static const char *stub_object_names[STUB_OBJECTS] = {
+	"components", "connections", "graphs", "pools", "queues", "buffers"
+};
+
+/* Rough Pi 3 figures so relative costs (component setup vs per frame work) hold, override to zero for binding overhead */
+static uint32_t stub_latencies[STUB_LATENCIES] = {
+	[STUB_MODE] = 1000,
+	[STUB_CREATE] = 1000,
+	[STUB_OPEN] = 500,
+	[STUB_PROCESS] = 2000,
+	[STUB_VSYNC] = 16667,
+};
+
+static long stub_allocations[STUB_OBJECTS];
+static long stub_frees[STUB_OBJECTS];
+static pthread_once_t stub_once = PTHREAD_ONCE_INIT;
+
+static int stub_find(const char **names, int count, const char *name, size_t len) {
+
+	int i;
+
+	for (i = 0; i < count; i++) {
+
+		if (strlen(names[i]) == len && strncmp(names[i], name, len) == 0) {
+
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/* PYLIBMMAL_STUB_LATENCY="name=us,name=us", unknown names are reported and ignored */
+static void stub_load_latencies(void) {
+
+	int which;
+	char *end;
+	const char *item, *equal;
+	const char *env = getenv(STUB_LATENCY_ENV);
+
+	for (item = env; item && *item; item = strchr(item, ',') ? strchr(item, ',') + 1 : NULL) {
+
+		if (!(equal = strchr(item, '=')) ||
+		    (which = stub_find(stub_latency_names, STUB_LATENCIES, item, equal - item)) < 0) {
+
+			fprintf(stderr, "%s: ignoring '%s'\n", STUB_LATENCY_ENV, item);
+			continue;
+		}
+
+		stub_latencies[which] = strtoul(equal + 1, &end, 10);
+	}
+}
+
+uint32_t stub_latency(int which) {
+
+	pthread_once(&stub_once, stub_load_latencies);
+	return stub_latencies[which];
+}
+
+void stub_delay(int which) {
+
+	uint32_t us = stub_latency(which);
+	struct timespec delay = {us / 1000000, (us % 1000000) * 1000};
+
+	if (us) {
+
+		while (nanosleep(&delay, &delay) && errno == EINTR);
+	}
+}
+
+int stub_set_latency(const char *name, uint32_t us) {
+
+	int which = stub_find(stub_latency_names, STUB_LATENCIES, name, strlen(name));
+
+	if (which < 0) {
+
+		return -1;
+	}
+
+	pthread_once(&stub_once, stub_load_latencies);
+	stub_latencies[which] = us;
+	return 0;
+}
+
+void *stub_alloc(int kind, size_t size) {
+
+	void *ptr = calloc(1, size);
+
+	if (ptr) {
+
+		__sync_fetch_and_add(&stub_allocations[kind], 1);
+	}
+
+	return ptr;
+}
+
+void stub_free(int kind, void *ptr) {
+
+	if (ptr) {
+
+		__sync_fetch_and_add(&stub_frees[kind], 1);
+		free(ptr);
+	}
+}
+
+long stub_allocated(const char *name) {
+
+	int kind = stub_find(stub_object_names, STUB_OBJECTS, name, strlen(name));
+	return kind < 0 ? -1 : __sync_fetch_and_add(&stub_allocations[kind], 0);
+}
+
+long stub_alive(const char *name) {
+
+	int kind = stub_find(stub_object_names, STUB_OBJECTS, name, strlen(name));
+	return kind < 0 ? -1 : __sync_fetch_and_add(&stub_allocations[kind], 0) - __sync_fetch_and_add(&stub_frees[kind], 0);
+}
+
+void stub_reset_counters(void) {
+
+	int i;
+
+	for (i = 0; i < STUB_OBJECTS; i++) {
+
+		__sync_fetch_and_sub(&stub_allocations[i], __sync_fetch_and_add(&stub_frees[i], 0));
+		__sync_fetch_and_and(&stub_frees[i], 0);
+	}
+}
+
+/* vcos */
+VCOS_STATUS_T vcos_init(void) {
+
+	return VCOS_SUCCESS;
+}
+
+void vcos_deinit(void) {
+
+}
+
+uint64_t vcos_getmicrosecs64(void) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void vcos_sleep(uint32_t ms) {
+
+	struct timespec delay = {ms / 1000, (ms % 1000) * 1000000};
+	while (nanosleep(&delay, &delay) && errno == EINTR);
+}
+
+/* bcm_host */
+void bcm_host_init(void) {
+
+	stub_delay(STUB_INIT);
+}
+
+void bcm_host_deinit(void) {
+
+}
+
+/* vchi */
+int32_t vchi_initialise(VCHI_INSTANCE_T *instance_handle) {
+
+	static int instance;
+
+	*instance_handle = (VCHI_INSTANCE_T)&instance;
+	return 0;
+}
+
+int32_t vchi_connect(VCHI_CONNECTION_T **connections, const uint32_t num_connections, VCHI_INSTANCE_T instance_handle) {
+
+	return 0;
+}
+
+int32_t vchi_disconnect(VCHI_INSTANCE_T instance_handle) {
+
+	return 0;
+}
+
+/* tvservice, a 1080p60 HDMI display that supports a few CEA and DMT modes */
+typedef struct {
+	TVSERVICE_CALLBACK_T callback;
+	void *data;
+} TvListener;
+
+typedef struct {
+	uint32_t reason;
+	uint32_t group;
+	uint32_t code;
+} TvNotify;
+
+static const TV_SUPPORTED_MODE_NEW_T tv_cea_modes[] = {
+	{.group = HDMI_RES_GROUP_CEA, .code = 1, .width = 640, .height = 480, .frame_rate = 60, .aspect_ratio = HDMI_ASPECT_4_3, .pixel_freq = 25175000},
+	{.group = HDMI_RES_GROUP_CEA, .code = 4, .width = 1280, .height = 720, .frame_rate = 60, .aspect_ratio = HDMI_ASPECT_16_9, .pixel_freq = 74250000},
+	{.group = HDMI_RES_GROUP_CEA, .code = 16, .width = 1920, .height = 1080, .frame_rate = 60, .aspect_ratio = HDMI_ASPECT_16_9, .pixel_freq = 148500000, .native = 1},
+	{.group = HDMI_RES_GROUP_CEA, .code = 19, .width = 1280, .height = 720, .frame_rate = 50, .aspect_ratio = HDMI_ASPECT_16_9, .pixel_freq = 74250000},
+	{.group = HDMI_RES_GROUP_CEA, .code = 22, .width = 720, .height = 576, .frame_rate = 50, .aspect_ratio = HDMI_ASPECT_16_9, .pixel_freq = 27000000, .scan_mode = 1},
+	{.group = HDMI_RES_GROUP_CEA, .code = 31, .width = 1920, .height = 1080, .frame_rate = 50, .aspect_ratio = HDMI_ASPECT_16_9, .pixel_freq = 148500000},
+};
+
+static const TV_SUPPORTED_MODE_NEW_T tv_dmt_modes[] = {
+	{.group = HDMI_RES_GROUP_DMT, .code = 4, .width = 640, .height = 480, .frame_rate = 60, .aspect_ratio = HDMI_ASPECT_4_3, .pixel_freq = 25175000},
+	{.group = HDMI_RES_GROUP_DMT, .code = 16, .width = 1024, .height = 768, .frame_rate = 60, .aspect_ratio = HDMI_ASPECT_4_3, .pixel_freq = 65000000},
+	{.group = HDMI_RES_GROUP_DMT, .code = 22, .width = 1280, .height = 768, .frame_rate = 60, .aspect_ratio = HDMI_ASPECT_15_9, .pixel_freq = 68250000},
+	{.group = HDMI_RES_GROUP_DMT, .code = 35, .width = 1280, .height = 1024, .frame_rate = 60, .aspect_ratio = HDMI_ASPECT_5_4, .pixel_freq = 108000000},
+	{.group = HDMI_RES_GROUP_DMT, .code = 82, .width = 1920, .height = 1080, .frame_rate = 60, .aspect_ratio = HDMI_ASPECT_16_9, .pixel_freq = 148500000},
+};
+
+static pthread_mutex_t tv_lock = PTHREAD_MUTEX_INITIALIZER;
+static TvListener tv_listeners[STUB_LISTENERS];
+static HDMI_PROPERTY_PARAM_T tv_properties[HDMI_PROPERTY_3D_STRUCTURE + 1];
+static const TV_SUPPORTED_MODE_NEW_T *tv_mode = &tv_cea_modes[2];
+static HDMI_MODE_T tv_drive = HDMI_MODE_HDMI;
+static int tv_powered = 1;
+
+static const TV_SUPPORTED_MODE_NEW_T *tv_group_modes(HDMI_RES_GROUP_T group, size_t *count) {
+
+	switch (group) {
+
+		case HDMI_RES_GROUP_CEA:
+			*count = vcos_countof(tv_cea_modes);
+			return tv_cea_modes;
+
+		case HDMI_RES_GROUP_DMT:
+			*count = vcos_countof(tv_dmt_modes);
+			return tv_dmt_modes;
+
+		default:
+			*count = 0;
+			return NULL;
+	}
+}
+
+/* Deliver a notification from another thread after the mode switch latency, like the firmware does */
+static void *tv_notify_thread(void *arg) {
+
+	int i, count = 0;
+	TvNotify *notify = arg;
+	TvListener listeners[STUB_LISTENERS];
+
+	stub_delay(STUB_MODE);
+
+	pthread_mutex_lock(&tv_lock);
+
+	for (i = 0; i < STUB_LISTENERS; i++) {
+
+		if (tv_listeners[i].callback) {
+
+			listeners[count++] = tv_listeners[i];
+		}
+	}
+
+	pthread_mutex_unlock(&tv_lock);
+
+	for (i = 0; i < count; i++) {
+
+		listeners[i].callback(listeners[i].data, notify->reason, notify->group, notify->code);
+	}
+
+	free(notify);
+	return NULL;
+}
+
+static void tv_notify(uint32_t reason, uint32_t group, uint32_t code) {
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	TvNotify *notify = malloc(sizeof(TvNotify));
+
+	if (!notify) {
+
+		return;
+	}
+
+	notify->reason = reason;
+	notify->group = group;
+	notify->code = code;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	if (pthread_create(&thread, &attr, tv_notify_thread, notify)) {
+
+		free(notify);
+	}
+
+	pthread_attr_destroy(&attr);
+}
+
+int vc_vchi_tv_init(VCHI_INSTANCE_T initialise_instance, VCHI_CONNECTION_T **connections, uint32_t num_connections) {
+
+	stub_delay(STUB_CONNECT);
+	return 0;
+}
+
+void vc_vchi_tv_stop(void) {
+
+}
+
+void vc_tv_register_callback(TVSERVICE_CALLBACK_T callback, void *callback_data) {
+
+	int i;
+
+	pthread_mutex_lock(&tv_lock);
+
+	for (i = 0; i < STUB_LISTENERS; i++) {
+
+		if (!tv_listeners[i].callback) {
+
+			tv_listeners[i].callback = callback;
+			tv_listeners[i].data = callback_data;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&tv_lock);
+}
+
+void vc_tv_unregister_callback_full(TVSERVICE_CALLBACK_T callback, void *callback_data) {
+
+	int i;
+
+	pthread_mutex_lock(&tv_lock);
+
+	for (i = 0; i < STUB_LISTENERS; i++) {
+
+		if (tv_listeners[i].callback == callback && tv_listeners[i].data == callback_data) {
+
+			tv_listeners[i].callback = NULL;
+			tv_listeners[i].data = NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&tv_lock);
+}
+
+void vc_tv_unregister_callback(TVSERVICE_CALLBACK_T callback) {
+
+	int i;
+
+	pthread_mutex_lock(&tv_lock);
+
+	for (i = 0; i < STUB_LISTENERS; i++) {
+
+		if (tv_listeners[i].callback == callback) {
+
+			tv_listeners[i].callback = NULL;
+			tv_listeners[i].data = NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&tv_lock);
+}
+
+int vc_tv_get_display_state(TV_DISPLAY_STATE_T *tvstate) {
+
+	stub_delay(STUB_QUERY);
+	memset(tvstate, 0, sizeof(TV_DISPLAY_STATE_T));
+
+	pthread_mutex_lock(&tv_lock);
+
+	if (!tv_powered) {
+
+		tvstate->state = VC_HDMI_ATTACHED;
+	}
+	else {
+
+		tvstate->state = tv_drive == HDMI_MODE_DVI ? VC_HDMI_DVI : VC_HDMI_HDMI;
+		tvstate->display.hdmi.state = tvstate->state;
+		tvstate->display.hdmi.width = tv_mode->width;
+		tvstate->display.hdmi.height = tv_mode->height;
+		tvstate->display.hdmi.frame_rate = tv_mode->frame_rate;
+		tvstate->display.hdmi.scan_mode = tv_mode->scan_mode;
+		tvstate->display.hdmi.group = tv_mode->group;
+		tvstate->display.hdmi.mode = tv_mode->code;
+		tvstate->display.hdmi.pixel_rep = 1;
+		tvstate->display.hdmi.aspect_ratio = tv_mode->aspect_ratio;
+	}
+
+	pthread_mutex_unlock(&tv_lock);
+	return 0;
+}
+
+int vc_tv_hdmi_power_on_explicit_new(HDMI_MODE_T mode, HDMI_RES_GROUP_T group, uint32_t code) {
+
+	size_t i, count;
+	const TV_SUPPORTED_MODE_NEW_T *modes = tv_group_modes(group, &count);
+
+	stub_delay(STUB_QUERY);
+
+	for (i = 0; i < count; i++) {
+
+		if (modes[i].code == code) {
+
+			pthread_mutex_lock(&tv_lock);
+			tv_mode = &modes[i];
+			tv_drive = mode;
+			tv_powered = 1;
+			pthread_mutex_unlock(&tv_lock);
+
+			tv_notify(mode == HDMI_MODE_DVI ? VC_HDMI_DVI : VC_HDMI_HDMI, group, code);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int vc_tv_hdmi_power_on_preferred(void) {
+
+	return vc_tv_hdmi_power_on_explicit_new(HDMI_MODE_HDMI, HDMI_RES_GROUP_CEA, 16);
+}
+
+int vc_tv_power_off(void) {
+
+	stub_delay(STUB_QUERY);
+
+	pthread_mutex_lock(&tv_lock);
+	tv_powered = 0;
+	pthread_mutex_unlock(&tv_lock);
+	return 0;
+}
+
+int vc_tv_hdmi_get_supported_modes_new(HDMI_RES_GROUP_T group, TV_SUPPORTED_MODE_NEW_T *supported_modes, uint32_t max_supported_modes,
+                                       HDMI_RES_GROUP_T *preferred_group, uint32_t *preferred_mode) {
+
+	size_t count;
+	const TV_SUPPORTED_MODE_NEW_T *modes = tv_group_modes(group, &count);
+
+	stub_delay(STUB_QUERY);
+
+	if (preferred_group) {
+
+		*preferred_group = HDMI_RES_GROUP_CEA;
+	}
+
+	if (preferred_mode) {
+
+		*preferred_mode = 16;
+	}
+
+	if (count > max_supported_modes) {
+
+		count = max_supported_modes;
+	}
+
+	if (supported_modes && count) {
+
+		memcpy(supported_modes, modes, count * sizeof(TV_SUPPORTED_MODE_NEW_T));
+	}
+
+	return count;
+}
+
+int vc_tv_hdmi_set_property(const HDMI_PROPERTY_PARAM_T *property) {
+
+	stub_delay(STUB_QUERY);
+
+	if (property->property > HDMI_PROPERTY_3D_STRUCTURE) {
+
+		return -1;
+	}
+
+	pthread_mutex_lock(&tv_lock);
+	tv_properties[property->property] = *property;
+	pthread_mutex_unlock(&tv_lock);
+	return 0;
+}
+
+int vc_tv_hdmi_get_property(HDMI_PROPERTY_PARAM_T *property) {
+
+	stub_delay(STUB_QUERY);
+
+	if (property->property > HDMI_PROPERTY_3D_STRUCTURE) {
+
+		return -1;
+	}
+
+	pthread_mutex_lock(&tv_lock);
+	property->param1 = tv_properties[property->property].param1;
+	property->param2 = tv_properties[property->property].param2;
+	pthread_mutex_unlock(&tv_lock);
+	return 0;
+}
+
+/* dispmanx, every open returns its own handle. Like the firmware there is a single vsync callback for the process,
+   registering one replaces the previous one and a NULL callback on any handle removes it */
+typedef struct {
+	int used;
+	uint32_t device;
+} StubDisplay;
+
+static struct {
+	int running;
+	pthread_t thread;
+	DISPMANX_CALLBACK_FUNC_T callback;
+	void *arg;
+} vsync;
+
+static pthread_mutex_t display_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t vsync_lock = PTHREAD_MUTEX_INITIALIZER;
+static StubDisplay displays[STUB_DISPLAYS];
+
+static StubDisplay *stub_display(DISPMANX_DISPLAY_HANDLE_T handle) {
+
+	if (handle == DISPMANX_NO_HANDLE || handle > STUB_DISPLAYS || !displays[handle - 1].used) {
+
+		return NULL;
+	}
+
+	return &displays[handle - 1];
+}
+
+static void *stub_vsync_thread(void *arg) {
+
+	uint32_t period = stub_latency(STUB_VSYNC);
+	struct timespec delay = {period / 1000000, (period % 1000000) * 1000};
+
+	while (__sync_fetch_and_add(&vsync.running, 0)) {
+
+		nanosleep(&delay, NULL);
+		vsync.callback(0, vsync.arg);
+	}
+
+	return NULL;
+}
+
+static void stub_vsync_stop(void) {
+
+	if (vsync.running) {
+
+		__sync_fetch_and_and(&vsync.running, 0);
+		pthread_join(vsync.thread, NULL);
+	}
+}
+
+DISPMANX_DISPLAY_HANDLE_T vc_dispmanx_display_open(uint32_t device) {
+
+	int i;
+	DISPMANX_DISPLAY_HANDLE_T handle = DISPMANX_NO_HANDLE;
+
+	pthread_mutex_lock(&display_lock);
+
+	for (i = 0; i < STUB_DISPLAYS; i++) {
+
+		if (!displays[i].used) {
+
+			memset(&displays[i], 0, sizeof(StubDisplay));
+			displays[i].used = 1;
+			displays[i].device = device;
+			handle = i + 1;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&display_lock);
+	return handle;
+}
+
+int vc_dispmanx_display_close(DISPMANX_DISPLAY_HANDLE_T handle) {
+
+	StubDisplay *display = stub_display(handle);
+
+	if (!display) {
+
+		return -1;
+	}
+
+	pthread_mutex_lock(&display_lock);
+	display->used = 0;
+	pthread_mutex_unlock(&display_lock);
+	return 0;
+}
+
+int vc_dispmanx_display_get_info(DISPMANX_DISPLAY_HANDLE_T handle, DISPMANX_MODEINFO_T *pinfo) {
+
+	StubDisplay *display = stub_display(handle);
+
+	if (!display) {
+
+		return -1;
+	}
+
+	memset(pinfo, 0, sizeof(DISPMANX_MODEINFO_T));
+	pinfo->display_num = display->device;
+
+	if (display->device == STUB_LCD) {
+
+		pinfo->width = STUB_LCD_WIDTH;
+		pinfo->height = STUB_LCD_HEIGHT;
+	}
+	else {
+
+		pthread_mutex_lock(&tv_lock);
+		pinfo->width = tv_mode->width;
+		pinfo->height = tv_mode->height;
+		pthread_mutex_unlock(&tv_lock);
+	}
+
+	return 0;
+}
+
+int vc_dispmanx_vsync_callback(DISPMANX_DISPLAY_HANDLE_T handle, DISPMANX_CALLBACK_FUNC_T cb_func, void *cb_arg) {
+
+	StubDisplay *display = stub_display(handle);
+
+	if (!display) {
+
+		return -1;
+	}
+
+	pthread_mutex_lock(&vsync_lock);
+	stub_vsync_stop();
+
+	if (cb_func) {
+
+		vsync.callback = cb_func;
+		vsync.arg = cb_arg;
+		vsync.running = 1;
+
+		if (pthread_create(&vsync.thread, NULL, stub_vsync_thread, NULL)) {
+
+			vsync.running = 0;
+			pthread_mutex_unlock(&vsync_lock);
+			return -1;
+		}
+	}
+
+	pthread_mutex_unlock(&vsync_lock);
+	return 0;
+}
@@ -0,0 +1,1779 @@
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <mmal.h>
+#include <util/mmal_util.h>
+#include <util/mmal_graph.h>
+#include <util/mmal_connection.h>
+#include <util/mmal_util_params.h>
+#include <util/mmal_default_components.h>
+#include "stub.h"
+
+#define STUB_OUTPUTS_MAX	4
+#define STUB_EVENTS		8
+#define STUB_EVENT_SIZE		64
+#define STUB_WAIT_MS		50
+#define STUB_GRAPH_MAX		16
+#define STUB_NAME_SIZE		64
+#define STUB_DEFAULT_WIDTH	1920
+#define STUB_DEFAULT_HEIGHT	1080
+#define STUB_ENCODED_MIN	(16 * 1024)
+#define STUB_ENCODED_SIZE	(80 * 1024)
+
+typedef enum {
+	STUB_READER,
+	STUB_DECODER,
+	STUB_ENCODER,
+	STUB_RENDERER,
+	STUB_SPLITTER,
+	STUB_ISP,
+} StubKind;
+
+static const struct {
+	const char *name;
+	StubKind kind;
+	uint32_t inputs;
+	uint32_t outputs;
+} stub_components[] = {
+	{MMAL_COMPONENT_DEFAULT_CONTAINER_READER, STUB_READER, 0, 1},
+	{MMAL_COMPONENT_DEFAULT_IMAGE_DECODER, STUB_DECODER, 1, 1},
+	{MMAL_COMPONENT_DEFAULT_VIDEO_DECODER, STUB_DECODER, 1, 1},
+	{MMAL_COMPONENT_DEFAULT_IMAGE_ENCODER, STUB_ENCODER, 1, 1},
+	{MMAL_COMPONENT_DEFAULT_VIDEO_ENCODER, STUB_ENCODER, 1, 1},
+	{MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER, STUB_RENDERER, 1, 0},
+	{"vc.null_sink", STUB_RENDERER, 1, 0},
+	{MMAL_COMPONENT_DEFAULT_VIDEO_SPLITTER, STUB_SPLITTER, 1, STUB_OUTPUTS_MAX},
+	{"vc.ril.isp", STUB_ISP, 1, 1},
+	{"vc.ril.resize", STUB_ISP, 1, 1},
+};
+
+/* Lives behind MMAL_BUFFER_HEADER_T.priv */
+typedef struct {
+	int refcount;
+	struct StubPool *pool;
+	uint8_t *payload;
+} StubHeader;
+
+struct MMAL_QUEUE_T {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	MMAL_BUFFER_HEADER_T *head;
+	MMAL_BUFFER_HEADER_T **tail;
+	unsigned int length;
+};
+
+typedef struct StubPool {
+	MMAL_POOL_T pool;
+	MMAL_POOL_BH_CB_T cb;
+	void *userdata;
+} StubPool;
+
+struct MMAL_PORT_PRIVATE_T {
+	char name[STUB_NAME_SIZE];
+	MMAL_PORT_BH_CB_T cb;
+	MMAL_ES_FORMAT_T format;
+	MMAL_ES_SPECIFIC_FORMAT_T es;
+	MMAL_QUEUE_T *supplied;				/* Empty buffers sent to an output port */
+	MMAL_CORE_STATISTICS_T core[2];
+	MMAL_BOOL_T zero_copy;
+	uint32_t frames;
+	int64_t bytes;
+	uint32_t scan;					/* Last bytes of unframed decoder input, for start codes */
+	int picture;					/* A picture started and was not emitted yet */
+	int64_t picture_pts;				/* pts of the buffer it started in */
+};
+
+struct MMAL_COMPONENT_PRIVATE_T {
+	StubKind kind;
+	int refcount;
+	int stop;
+	int busy;
+	int disabling;
+	int start_reader;
+	char *uri;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	MMAL_QUEUE_T *jobs;				/* Filled buffers sent to the input port */
+	MMAL_POOL_T *events;
+	struct StubGraph *graph;
+	MMAL_PORT_T ports[2 + STUB_OUTPUTS_MAX];
+	struct MMAL_PORT_PRIVATE_T port_privs[2 + STUB_OUTPUTS_MAX];
+	MMAL_PORT_T *port_list[2 + STUB_OUTPUTS_MAX];
+};
+
+typedef struct {
+	MMAL_CONNECTION_T connection;
+	int refcount;
+	MMAL_POOL_T *pool;
+	char name[2 * STUB_NAME_SIZE];
+} StubConnection;
+
+typedef struct StubGraph {
+	MMAL_GRAPH_T graph;
+	pthread_mutex_t lock;
+	MMAL_GRAPH_EVENT_CB cb;
+	void *cb_data;
+	unsigned int component_num;
+	unsigned int connection_num;
+	MMAL_COMPONENT_T *components[STUB_GRAPH_MAX];
+	MMAL_CONNECTION_T *connections[STUB_GRAPH_MAX];
+} StubGraph;
+
+static void stub_deadline(struct timespec *deadline, uint32_t timeout_ms) {
+
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_sec += timeout_ms / 1000;
+	deadline->tv_nsec += (timeout_ms % 1000) * 1000000;
+
+	if (deadline->tv_nsec >= 1000000000) {
+
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+/* Formats */
+void mmal_format_copy(MMAL_ES_FORMAT_T *format_dest, MMAL_ES_FORMAT_T *format_src) {
+
+	MMAL_ES_SPECIFIC_FORMAT_T *es = format_dest->es;
+
+	*es = *format_src->es;
+	*format_dest = *format_src;
+	format_dest->es = es;
+	format_dest->extradata = NULL;
+	format_dest->extradata_size = 0;
+}
+
+MMAL_STATUS_T mmal_format_full_copy(MMAL_ES_FORMAT_T *format_dest, MMAL_ES_FORMAT_T *format_src) {
+
+	mmal_format_copy(format_dest, format_src);
+	return MMAL_SUCCESS;
+}
+
+static int stub_is_raw(MMAL_FOURCC_T encoding) {
+
+	return encoding == MMAL_ENCODING_I420 || encoding == MMAL_ENCODING_OPAQUE || encoding == MMAL_ENCODING_RGB24 ||
+	       encoding == MMAL_ENCODING_BGR24 || encoding == MMAL_ENCODING_RGBA || encoding == MMAL_ENCODING_BGRA;
+}
+
+uint32_t mmal_encoding_width_to_stride(uint32_t encoding, uint32_t width) {
+
+	if (encoding == MMAL_ENCODING_RGB24 || encoding == MMAL_ENCODING_BGR24) {
+
+		return width * 3;
+	}
+
+	if (encoding == MMAL_ENCODING_RGBA || encoding == MMAL_ENCODING_BGRA) {
+
+		return width * 4;
+	}
+
+	return width;
+}
+
+static uint32_t stub_frame_size(MMAL_ES_FORMAT_T *format) {
+
+	uint32_t stride = mmal_encoding_width_to_stride(format->encoding, format->es->video.width);
+
+	if (format->encoding == MMAL_ENCODING_OPAQUE) {
+
+		return 128;
+	}
+
+	return format->encoding == MMAL_ENCODING_I420 ? stride * format->es->video.height * 3 / 2 : stride * format->es->video.height;
+}
+
+const char *mmal_status_to_string(MMAL_STATUS_T status) {
+
+	static const char *names[] = {
+		"SUCCESS", "ENOMEM", "ENOSPC", "EINVAL", "ENOSYS", "ENOENT", "ENXIO", "EIO",
+		"ESPIPE", "ECORRUPT", "ENOTREADY", "ECONFIG", "EISCONN", "ENOTCONN", "EAGAIN", "EFAULT"
+	};
+
+	return status < vcos_countof(names) ? names[status] : "UNKNOWN";
+}
+
+/* Buffer headers */
+void mmal_buffer_header_reset(MMAL_BUFFER_HEADER_T *header) {
+
+	header->cmd = 0;
+	header->length = 0;
+	header->offset = 0;
+	header->flags = 0;
+	header->pts = MMAL_TIME_UNKNOWN;
+	header->dts = MMAL_TIME_UNKNOWN;
+}
+
+void mmal_buffer_header_acquire(MMAL_BUFFER_HEADER_T *header) {
+
+	__sync_fetch_and_add(&((StubHeader *)header->priv)->refcount, 1);
+}
+
+/* The last reference hands the header back to its pool, whose callback may take it instead */
+void mmal_buffer_header_release(MMAL_BUFFER_HEADER_T *header) {
+
+	StubHeader *priv = header->priv;
+
+	if (__sync_sub_and_fetch(&priv->refcount, 1) > 0) {
+
+		return;
+	}
+
+	priv->refcount = 1;
+	mmal_buffer_header_reset(header);
+
+	if (priv->pool->cb && !priv->pool->cb(&priv->pool->pool, header, priv->pool->userdata)) {
+
+		return;
+	}
+
+	mmal_queue_put(priv->pool->pool.queue, header);
+}
+
+MMAL_STATUS_T mmal_buffer_header_mem_lock(MMAL_BUFFER_HEADER_T *header) {
+
+	return MMAL_SUCCESS;
+}
+
+void mmal_buffer_header_mem_unlock(MMAL_BUFFER_HEADER_T *header) {
+
+}
+
+MMAL_STATUS_T mmal_buffer_header_copy_header(MMAL_BUFFER_HEADER_T *dest, const MMAL_BUFFER_HEADER_T *src) {
+
+	dest->cmd = src->cmd;
+	dest->offset = src->offset;
+	dest->length = src->length;
+	dest->flags = src->flags;
+	dest->pts = src->pts;
+	dest->dts = src->dts;
+	return MMAL_SUCCESS;
+}
+
+MMAL_EVENT_FORMAT_CHANGED_T *mmal_event_format_changed_get(MMAL_BUFFER_HEADER_T *buffer) {
+
+	return NULL;
+}
+
+/* Queues */
+MMAL_QUEUE_T *mmal_queue_create(void) {
+
+	MMAL_QUEUE_T *queue = stub_alloc(STUB_QUEUES, sizeof(MMAL_QUEUE_T));
+
+	if (queue) {
+
+		pthread_mutex_init(&queue->lock, NULL);
+		pthread_cond_init(&queue->cond, NULL);
+		queue->tail = &queue->head;
+	}
+
+	return queue;
+}
+
+void mmal_queue_destroy(MMAL_QUEUE_T *queue) {
+
+	if (queue) {
+
+		pthread_mutex_destroy(&queue->lock);
+		pthread_cond_destroy(&queue->cond);
+		stub_free(STUB_QUEUES, queue);
+	}
+}
+
+void mmal_queue_put(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer) {
+
+	pthread_mutex_lock(&queue->lock);
+	buffer->next = NULL;
+	*queue->tail = buffer;
+	queue->tail = &buffer->next;
+	queue->length++;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+void mmal_queue_put_back(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer) {
+
+	pthread_mutex_lock(&queue->lock);
+	buffer->next = queue->head;
+	queue->head = buffer;
+
+	if (queue->tail == &queue->head) {
+
+		queue->tail = &buffer->next;
+	}
+
+	queue->length++;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+static MMAL_BUFFER_HEADER_T *stub_queue_pop(MMAL_QUEUE_T *queue) {
+
+	MMAL_BUFFER_HEADER_T *buffer = queue->head;
+
+	if (buffer) {
+
+		if ((queue->head = buffer->next) == NULL) {
+
+			queue->tail = &queue->head;
+		}
+
+		buffer->next = NULL;
+		queue->length--;
+	}
+
+	return buffer;
+}
+
+MMAL_BUFFER_HEADER_T *mmal_queue_get(MMAL_QUEUE_T *queue) {
+
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	pthread_mutex_lock(&queue->lock);
+	buffer = stub_queue_pop(queue);
+	pthread_mutex_unlock(&queue->lock);
+	return buffer;
+}
+
+MMAL_BUFFER_HEADER_T *mmal_queue_wait(MMAL_QUEUE_T *queue) {
+
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	pthread_mutex_lock(&queue->lock);
+
+	while (!queue->head) {
+
+		pthread_cond_wait(&queue->cond, &queue->lock);
+	}
+
+	buffer = stub_queue_pop(queue);
+	pthread_mutex_unlock(&queue->lock);
+	return buffer;
+}
+
+MMAL_BUFFER_HEADER_T *mmal_queue_timedwait(MMAL_QUEUE_T *queue, uint32_t timeout) {
+
+	struct timespec deadline;
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	stub_deadline(&deadline, timeout);
+	pthread_mutex_lock(&queue->lock);
+
+	while (!queue->head) {
+
+		if (pthread_cond_timedwait(&queue->cond, &queue->lock, &deadline) == ETIMEDOUT) {
+
+			break;
+		}
+	}
+
+	buffer = stub_queue_pop(queue);
+	pthread_mutex_unlock(&queue->lock);
+	return buffer;
+}
+
+unsigned int mmal_queue_length(MMAL_QUEUE_T *queue) {
+
+	unsigned int length;
+
+	pthread_mutex_lock(&queue->lock);
+	length = queue->length;
+	pthread_mutex_unlock(&queue->lock);
+	return length;
+}
+
+/* Pools */
+static void stub_pool_free_headers(MMAL_POOL_T *pool) {
+
+	uint32_t i;
+
+	while (mmal_queue_get(pool->queue));
+
+	for (i = 0; i < pool->headers_num; i++) {
+
+		free(((StubHeader *)pool->header[i]->priv)->payload);
+		free(pool->header[i]->priv);
+		stub_free(STUB_BUFFERS, pool->header[i]);
+	}
+
+	free(pool->header);
+	pool->header = NULL;
+	pool->headers_num = 0;
+}
+
+MMAL_STATUS_T mmal_pool_resize(MMAL_POOL_T *pool, unsigned int headers, uint32_t payload_size) {
+
+	unsigned int i;
+	StubHeader *priv;
+
+	stub_pool_free_headers(pool);
+
+	if (headers && (pool->header = calloc(headers, sizeof(MMAL_BUFFER_HEADER_T *))) == NULL) {
+
+		return MMAL_ENOMEM;
+	}
+
+	for (i = 0; i < headers; i++) {
+
+		if ((pool->header[i] = stub_alloc(STUB_BUFFERS, sizeof(MMAL_BUFFER_HEADER_T))) == NULL ||
+		    (priv = calloc(1, sizeof(StubHeader))) == NULL) {
+
+			stub_free(STUB_BUFFERS, pool->header[i]);
+			stub_pool_free_headers(pool);
+			return MMAL_ENOMEM;
+		}
+
+		priv->refcount = 1;
+		priv->pool = (StubPool *)pool;
+		priv->payload = payload_size ? malloc(payload_size) : NULL;
+
+		pool->header[i]->priv = priv;
+		pool->header[i]->data = priv->payload;
+		pool->header[i]->alloc_size = priv->payload ? payload_size : 0;
+		mmal_buffer_header_reset(pool->header[i]);
+		pool->headers_num++;
+		mmal_queue_put(pool->queue, pool->header[i]);
+	}
+
+	return MMAL_SUCCESS;
+}
+
+MMAL_POOL_T *mmal_pool_create(unsigned int headers, uint32_t payload_size) {
+
+	StubPool *pool = stub_alloc(STUB_POOLS, sizeof(StubPool));
+
+	if (!pool) {
+
+		return NULL;
+	}
+
+	if ((pool->pool.queue = mmal_queue_create()) == NULL || mmal_pool_resize(&pool->pool, headers, payload_size) != MMAL_SUCCESS) {
+
+		mmal_pool_destroy(&pool->pool);
+		return NULL;
+	}
+
+	return &pool->pool;
+}
+
+void mmal_pool_destroy(MMAL_POOL_T *pool) {
+
+	if (pool) {
+
+		if (pool->queue) {
+
+			stub_pool_free_headers(pool);
+			mmal_queue_destroy(pool->queue);
+		}
+
+		stub_free(STUB_POOLS, pool);
+	}
+}
+
+void mmal_pool_callback_set(MMAL_POOL_T *pool, MMAL_POOL_BH_CB_T cb, void *userdata) {
+
+	((StubPool *)pool)->cb = cb;
+	((StubPool *)pool)->userdata = userdata;
+}
+
+/* Ports */
+static void stub_port_count(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR dir) {
+
+	uint32_t now = (uint32_t)vcos_getmicrosecs64();
+	MMAL_CORE_STATISTICS_T *stats = &port->priv->core[dir];
+
+	if (stats->buffer_count++ == 0) {
+
+		stats->first_buffer_time = now;
+	}
+	else if (now - stats->last_buffer_time > stats->max_delay) {
+
+		stats->max_delay = now - stats->last_buffer_time;
+	}
+
+	stats->last_buffer_time = now;
+}
+
+/* Hand a buffer back to the owner of an enabled port */
+static void stub_port_return(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	MMAL_PORT_BH_CB_T cb = port->priv->cb;
+
+	if (port->type == MMAL_PORT_TYPE_OUTPUT && buffer->cmd == 0) {
+
+		stub_port_count(port, MMAL_CORE_STATS_TX);
+	}
+
+	if (cb) {
+
+		cb(port, buffer);
+	}
+	else {
+
+		mmal_buffer_header_release(buffer);
+	}
+}
+
+static void stub_port_requirements(MMAL_PORT_T *port) {
+
+	StubKind kind = port->component->priv->kind;
+	uint32_t size = stub_frame_size(port->format);
+
+	port->buffer_num_min = 1;
+	port->buffer_num_recommended = 3;
+
+	if (stub_is_raw(port->format->encoding) && size) {
+
+		port->buffer_size_min = port->buffer_size_recommended = size;
+	}
+	else {
+
+		port->buffer_size_min = STUB_ENCODED_MIN;
+		port->buffer_size_recommended = kind == STUB_ENCODER ? STUB_ENCODED_MIN : STUB_ENCODED_SIZE;
+	}
+
+	if (port->buffer_num < port->buffer_num_min) {
+
+		port->buffer_num = port->buffer_num_recommended;
+	}
+
+	if (port->buffer_size < port->buffer_size_min) {
+
+		port->buffer_size = port->buffer_size_recommended;
+	}
+}
+
+/* Decoders start out with 1080p I420 output until they see a stream, other components copy their input */
+MMAL_STATUS_T mmal_port_format_commit(MMAL_PORT_T *port) {
+
+	uint32_t i;
+	MMAL_COMPONENT_T *component = port->component;
+
+	stub_delay(STUB_COMMIT);
+
+	if (port->type == MMAL_PORT_TYPE_OUTPUT && component->priv->kind == STUB_ENCODER && stub_is_raw(port->format->encoding)) {
+
+		return MMAL_EINVAL;
+	}
+
+	if (port->type == MMAL_PORT_TYPE_INPUT && component->priv->kind != STUB_RENDERER) {
+
+		for (i = 0; i < component->output_num; i++) {
+
+			MMAL_PORT_T *output = component->output[i];
+
+			if (component->priv->kind == STUB_DECODER) {
+
+				if (output->format->encoding == 0 || output->format->es->video.width == 0) {
+
+					output->format->type = MMAL_ES_TYPE_VIDEO;
+					output->format->encoding = MMAL_ENCODING_I420;
+					output->format->es->video.width = VCOS_ALIGN_UP(port->format->es->video.width ? : STUB_DEFAULT_WIDTH, 32);
+					output->format->es->video.height = VCOS_ALIGN_UP(port->format->es->video.height ? : STUB_DEFAULT_HEIGHT, 16);
+					output->format->es->video.crop.width = port->format->es->video.width ? : STUB_DEFAULT_WIDTH;
+					output->format->es->video.crop.height = port->format->es->video.height ? : STUB_DEFAULT_HEIGHT;
+				}
+			}
+			else if (component->priv->kind == STUB_ENCODER) {
+
+				output->format->es->video = port->format->es->video;
+			}
+			else if (output->format->encoding == 0 || component->priv->kind == STUB_SPLITTER) {
+
+				mmal_format_copy(output->format, port->format);
+			}
+
+			stub_port_requirements(output);
+		}
+	}
+
+	stub_port_requirements(port);
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_enable(MMAL_PORT_T *port, MMAL_PORT_BH_CB_T cb) {
+
+	struct MMAL_COMPONENT_PRIVATE_T *priv = port->component->priv;
+
+	if (port->is_enabled) {
+
+		return MMAL_EISCONN;
+	}
+
+	stub_delay(STUB_ENABLE);
+
+	pthread_mutex_lock(&priv->lock);
+	port->priv->cb = cb;
+	port->priv->scan = 0xffffffff;
+	port->priv->picture = 0;
+	port->is_enabled = 1;
+
+	if (priv->kind == STUB_READER && port->type == MMAL_PORT_TYPE_OUTPUT && priv->uri) {
+
+		priv->start_reader = 1;
+		pthread_cond_broadcast(&priv->wake);
+	}
+
+	pthread_mutex_unlock(&priv->lock);
+	return MMAL_SUCCESS;
+}
+
+/* Wait for the worker to finish the buffer it is on, then hand back everything the port holds */
+MMAL_STATUS_T mmal_port_disable(MMAL_PORT_T *port) {
+
+	MMAL_BUFFER_HEADER_T *buffer;
+	struct MMAL_COMPONENT_PRIVATE_T *priv = port->component->priv;
+
+	if (!port->is_enabled) {
+
+		return MMAL_EINVAL;
+	}
+
+	pthread_mutex_lock(&priv->lock);
+	port->is_enabled = 0;
+	priv->disabling++;
+	pthread_cond_broadcast(&priv->wake);
+
+	while (priv->busy && !pthread_equal(priv->thread, pthread_self())) {
+
+		pthread_cond_wait(&priv->idle, &priv->lock);
+	}
+
+	priv->disabling--;
+
+	if (port->type == MMAL_PORT_TYPE_OUTPUT) {
+
+		priv->start_reader = 0;
+	}
+
+	pthread_mutex_unlock(&priv->lock);
+
+	if (port->type == MMAL_PORT_TYPE_INPUT) {
+
+		while ((buffer = mmal_queue_get(priv->jobs)) != NULL) {
+
+			stub_port_return(port, buffer);
+		}
+	}
+	else if (port->priv->supplied) {
+
+		while ((buffer = mmal_queue_get(port->priv->supplied)) != NULL) {
+
+			stub_port_return(port, buffer);
+		}
+	}
+
+	port->priv->cb = NULL;
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_flush(MMAL_PORT_T *port) {
+
+	MMAL_BUFFER_HEADER_T *buffer;
+	MMAL_QUEUE_T *queue = port->type == MMAL_PORT_TYPE_INPUT ? port->component->priv->jobs : port->priv->supplied;
+
+	while (queue && (buffer = mmal_queue_get(queue)) != NULL) {
+
+		stub_port_return(port, buffer);
+	}
+
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	struct MMAL_COMPONENT_PRIVATE_T *priv = port->component->priv;
+
+	if (!port->is_enabled) {
+
+		return MMAL_EINVAL;
+	}
+
+	if (port->type == MMAL_PORT_TYPE_INPUT) {
+
+		stub_port_count(port, MMAL_CORE_STATS_RX);
+		mmal_queue_put(priv->jobs, buffer);
+	}
+	else if (port->type == MMAL_PORT_TYPE_OUTPUT) {
+
+		mmal_queue_put(port->priv->supplied, buffer);
+	}
+	else {
+
+		return MMAL_EINVAL;
+	}
+
+	pthread_mutex_lock(&priv->lock);
+	pthread_cond_broadcast(&priv->wake);
+	pthread_mutex_unlock(&priv->lock);
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_connect(MMAL_PORT_T *port, MMAL_PORT_T *other_port) {
+
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_disconnect(MMAL_PORT_T *port) {
+
+	return MMAL_SUCCESS;
+}
+
+MMAL_POOL_T *mmal_port_pool_create(MMAL_PORT_T *port, unsigned int headers, uint32_t payload_size) {
+
+	return mmal_pool_create(headers, payload_size);
+}
+
+void mmal_port_pool_destroy(MMAL_PORT_T *port, MMAL_POOL_T *pool) {
+
+	mmal_pool_destroy(pool);
+}
+
+MMAL_STATUS_T mmal_port_parameter_set(MMAL_PORT_T *port, const MMAL_PARAMETER_HEADER_T *param) {
+
+	switch (param->id) {
+
+		case MMAL_PARAMETER_ZERO_COPY:
+			port->priv->zero_copy = ((const MMAL_PARAMETER_BOOLEAN_T *)param)->enable;
+			return MMAL_SUCCESS;
+
+		case MMAL_PARAMETER_DISPLAYREGION:
+			return port->component->priv->kind == STUB_RENDERER ? MMAL_SUCCESS : MMAL_ENOSYS;
+
+		default:
+			return MMAL_SUCCESS;
+	}
+}
+
+MMAL_STATUS_T mmal_port_parameter_get(MMAL_PORT_T *port, MMAL_PARAMETER_HEADER_T *param) {
+
+	MMAL_PARAMETER_CORE_STATISTICS_T *core;
+	MMAL_PARAMETER_STATISTICS_T *stats;
+
+	switch (param->id) {
+
+		case MMAL_PARAMETER_ZERO_COPY:
+			((MMAL_PARAMETER_BOOLEAN_T *)param)->enable = port->priv->zero_copy;
+			return MMAL_SUCCESS;
+
+		case MMAL_PARAMETER_CORE_STATISTICS:
+			core = (MMAL_PARAMETER_CORE_STATISTICS_T *)param;
+			return mmal_util_get_core_port_stats(port, core->dir, core->reset, &core->stats);
+
+		case MMAL_PARAMETER_STATISTICS:
+			if (port->type != MMAL_PORT_TYPE_INPUT) {
+
+				return MMAL_ENOSYS;
+			}
+
+			stats = (MMAL_PARAMETER_STATISTICS_T *)param;
+			stats->buffer_count = port->priv->core[MMAL_CORE_STATS_RX].buffer_count;
+			stats->frame_count = port->priv->frames;
+			stats->total_bytes = port->priv->bytes;
+			return MMAL_SUCCESS;
+
+		default:
+			return MMAL_ENOSYS;
+	}
+}
+
+MMAL_STATUS_T mmal_port_parameter_set_boolean(MMAL_PORT_T *port, uint32_t id, MMAL_BOOL_T value) {
+
+	MMAL_PARAMETER_BOOLEAN_T param = {{id, sizeof(param)}, value};
+	return mmal_port_parameter_set(port, &param.hdr);
+}
+
+MMAL_STATUS_T mmal_port_parameter_get_boolean(MMAL_PORT_T *port, uint32_t id, MMAL_BOOL_T *value) {
+
+	MMAL_STATUS_T status;
+	MMAL_PARAMETER_BOOLEAN_T param = {{id, sizeof(param)}, 0};
+
+	if ((status = mmal_port_parameter_get(port, &param.hdr)) == MMAL_SUCCESS) {
+
+		*value = param.enable;
+	}
+
+	return status;
+}
+
+MMAL_STATUS_T mmal_port_parameter_set_uint32(MMAL_PORT_T *port, uint32_t id, uint32_t value) {
+
+	MMAL_PARAMETER_UINT32_T param = {{id, sizeof(param)}, value};
+	return mmal_port_parameter_set(port, &param.hdr);
+}
+
+MMAL_STATUS_T mmal_port_parameter_get_uint32(MMAL_PORT_T *port, uint32_t id, uint32_t *value) {
+
+	MMAL_STATUS_T status;
+	MMAL_PARAMETER_UINT32_T param = {{id, sizeof(param)}, 0};
+
+	if ((status = mmal_port_parameter_get(port, &param.hdr)) == MMAL_SUCCESS) {
+
+		*value = param.value;
+	}
+
+	return status;
+}
+
+MMAL_STATUS_T mmal_port_parameter_set_uint64(MMAL_PORT_T *port, uint32_t id, uint64_t value) {
+
+	MMAL_PARAMETER_HEADER_T param = {id, sizeof(param)};
+	return mmal_port_parameter_set(port, &param);
+}
+
+MMAL_STATUS_T mmal_util_get_core_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR dir, MMAL_BOOL_T reset, MMAL_CORE_STATISTICS_T *stats) {
+
+	if (dir != MMAL_CORE_STATS_RX && dir != MMAL_CORE_STATS_TX) {
+
+		return MMAL_EINVAL;
+	}
+
+	*stats = port->priv->core[dir];
+
+	if (reset) {
+
+		memset(&port->priv->core[dir], 0, sizeof(MMAL_CORE_STATISTICS_T));
+	}
+
+	return MMAL_SUCCESS;
+}
+
+/* Only files are supported, the encoding is sniffed from the magic number */
+MMAL_STATUS_T mmal_util_port_set_uri(MMAL_PORT_T *port, const char *uri) {
+
+	FILE *fp;
+	size_t size;
+	uint8_t magic[8] = {0};
+	MMAL_FOURCC_T encoding = MMAL_ENCODING_H264;
+	MMAL_COMPONENT_T *component = port->component;
+	MMAL_PORT_T *output = component->output_num ? component->output[0] : NULL;
+
+	stub_delay(STUB_OPEN);
+
+	if (component->priv->kind != STUB_READER || !output) {
+
+		return MMAL_ENOSYS;
+	}
+
+	if ((fp = fopen(uri, "rb")) == NULL) {
+
+		return MMAL_ENOENT;
+	}
+
+	size = fread(magic, 1, sizeof(magic), fp);
+	fclose(fp);
+
+	if (size >= 2 && magic[0] == 0xff && magic[1] == 0xd8) {
+
+		encoding = MMAL_ENCODING_JPEG;
+	}
+	else if (size >= 4 && memcmp(magic, "\x89PNG", 4) == 0) {
+
+		encoding = MMAL_ENCODING_PNG;
+	}
+	else if (size >= 3 && memcmp(magic, "GIF", 3) == 0) {
+
+		encoding = MMAL_ENCODING_GIF;
+	}
+	else if (size >= 2 && memcmp(magic, "BM", 2) == 0) {
+
+		encoding = MMAL_ENCODING_BMP;
+	}
+
+	pthread_mutex_lock(&component->priv->lock);
+	free(component->priv->uri);
+	component->priv->uri = strdup(uri);
+	pthread_mutex_unlock(&component->priv->lock);
+
+	memset(output->format->es, 0, sizeof(MMAL_ES_SPECIFIC_FORMAT_T));
+	output->format->type = MMAL_ES_TYPE_VIDEO;
+	output->format->encoding = encoding;
+	output->format->flags = MMAL_ES_FORMAT_FLAG_FRAMED;
+	stub_port_requirements(output);
+	return MMAL_SUCCESS;
+}
+
+/* Components */
+static void stub_post_event(MMAL_COMPONENT_T *component, uint32_t cmd) {
+
+	StubGraph *graph;
+	MMAL_GRAPH_EVENT_CB cb = NULL;
+	void *cb_data = NULL;
+	MMAL_BUFFER_HEADER_T *event = mmal_queue_get(component->priv->events->queue);
+
+	if (!event) {
+
+		return;
+	}
+
+	event->cmd = cmd;
+
+	if ((graph = component->priv->graph) != NULL) {
+
+		pthread_mutex_lock(&graph->lock);
+		cb = graph->cb;
+		cb_data = graph->cb_data;
+		pthread_mutex_unlock(&graph->lock);
+	}
+
+	if (cb) {
+
+		cb(&graph->graph, component->control, event, cb_data);
+	}
+	else if (component->control->is_enabled) {
+
+		stub_port_return(component->control, event);
+	}
+	else {
+
+		mmal_buffer_header_release(event);
+	}
+}
+
+/* Fill the next empty buffer of an output port, gives up once the port or component goes away */
+static int stub_emit(MMAL_COMPONENT_T *component, MMAL_PORT_T *port, const void *data, uint32_t length, uint32_t flags, int64_t pts) {
+
+	struct timespec deadline;
+	MMAL_BUFFER_HEADER_T *buffer;
+	struct MMAL_COMPONENT_PRIVATE_T *priv = component->priv;
+
+	while ((buffer = mmal_queue_get(port->priv->supplied)) == NULL) {
+
+		pthread_mutex_lock(&priv->lock);
+
+		if (!port->is_enabled || priv->stop || priv->disabling) {
+
+			pthread_mutex_unlock(&priv->lock);
+			return -1;
+		}
+
+		stub_deadline(&deadline, STUB_WAIT_MS);
+		pthread_cond_timedwait(&priv->wake, &priv->lock, &deadline);
+		pthread_mutex_unlock(&priv->lock);
+	}
+
+	buffer->length = length < buffer->alloc_size ? length : buffer->alloc_size;
+	buffer->offset = 0;
+	buffer->flags = flags;
+	buffer->pts = pts;
+
+	if (data && buffer->data) {
+
+		memcpy(buffer->data, data, buffer->length);
+	}
+
+	stub_port_return(port, buffer);
+	return 0;
+}
+
+/* An image is one frame split over several buffers, anything else is read as video with one frame per buffer at 25 fps */
+static void stub_read(MMAL_COMPONENT_T *component, const char *uri) {
+
+	FILE *fp;
+	size_t size;
+	int video = -1;
+	int64_t pts = 0;
+	uint8_t chunk[STUB_ENCODED_SIZE];
+	MMAL_PORT_T *output = component->output[0];
+	uint32_t flags = MMAL_BUFFER_HEADER_FLAG_FRAME_START;
+
+	if ((fp = fopen(uri, "rb")) == NULL) {
+
+		stub_post_event(component, MMAL_EVENT_ERROR);
+		return;
+	}
+
+	do {
+
+		size = fread(chunk, 1, output->buffer_size < sizeof(chunk) ? output->buffer_size : sizeof(chunk), fp);
+
+		if (video < 0) {
+
+			video = !(size >= 3 && memcmp(chunk, "\xff\xd8\xff", 3) == 0) && !(size >= 8 && memcmp(chunk, "\x89PNG", 4) == 0) &&
+			        !(size >= 6 && memcmp(chunk, "GIF8", 4) == 0) && !(size >= 2 && memcmp(chunk, "BM", 2) == 0);
+		}
+
+		if (video) {
+
+			flags = MMAL_BUFFER_HEADER_FLAG_FRAME_START | MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+		}
+
+		if (feof(fp)) {
+
+			flags |= MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_EOS;
+		}
+
+		if (feof(fp)) {
+
+			stub_delay(STUB_PROCESS);
+		}
+
+		if (stub_emit(component, output, chunk, size, flags, video ? pts : 0) != 0) {
+
+			break;
+		}
+
+		flags = 0;
+		pts += 40000;
+	} while (!feof(fp));
+
+	fclose(fp);
+}
+
+/* Encoded output starts with the magic number of its encoding so callers can sniff it */
+static void stub_encode(MMAL_COMPONENT_T *component, MMAL_BUFFER_HEADER_T *input) {
+
+	uint8_t data[STUB_ENCODED_MIN];
+	MMAL_PORT_T *output = component->output[0];
+	uint32_t length = input->length / 10 > 64 ? input->length / 10 : 64;
+
+	memset(data, 0, sizeof(data));
+
+	switch (output->format->encoding) {
+
+		case MMAL_ENCODING_JPEG:
+			memcpy(data, "\xff\xd8\xff\xe0", 4);
+			break;
+
+		case MMAL_ENCODING_PNG:
+			memcpy(data, "\x89PNG\r\n\x1a\n", 8);
+			break;
+
+		case MMAL_ENCODING_BMP:
+			memcpy(data, "BM", 2);
+			break;
+
+		case MMAL_ENCODING_GIF:
+			memcpy(data, "GIF89a", 6);
+			break;
+
+		default:
+			memcpy(data, "\x00\x00\x00\x01", 4);
+			break;
+	}
+
+	stub_emit(component, output, data, length < sizeof(data) ? length : sizeof(data), input->flags, input->pts);
+}
+
+/* Count pictures started in unframed H.264 (slice NAL units) or MJPEG (SOI markers) decoder input */
+static uint32_t stub_scan_pictures(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *input) {
+
+	uint32_t i, nal, pictures = 0;
+	const uint8_t *data = input->data + input->offset;
+	struct MMAL_PORT_PRIVATE_T *priv = port->priv;
+
+	for (i = 0; i < input->length; i++) {
+
+		priv->scan = (priv->scan << 8) | data[i];
+
+		if (port->format->encoding == MMAL_ENCODING_MJPEG) {
+
+			pictures += (priv->scan & 0xffff) == 0xffd8;
+		}
+		else if ((priv->scan & 0xffffff00) == 0x00000100) {
+
+			nal = priv->scan & 0x1f;
+			pictures += nal == 1 || nal == 5;
+		}
+	}
+
+	return pictures;
+}
+
+/* A decoder parsing an elementary stream emits a picture once the next one starts, or at the end of the stream */
+static void stub_decode_stream(MMAL_COMPONENT_T *component, MMAL_BUFFER_HEADER_T *input) {
+
+	uint32_t pictures;
+	MMAL_PORT_T *port = component->input[0];
+	MMAL_PORT_T *output = component->output[0];
+	int eos = (input->flags & MMAL_BUFFER_HEADER_FLAG_EOS) != 0;
+
+	for (pictures = stub_scan_pictures(port, input); pictures; pictures--) {
+
+		if (port->priv->picture) {
+
+			stub_delay(STUB_PROCESS);
+			port->priv->frames++;
+			stub_emit(component, output, NULL, output->buffer_size, MMAL_BUFFER_HEADER_FLAG_FRAME_END, port->priv->picture_pts);
+		}
+
+		port->priv->picture = 1;
+		port->priv->picture_pts = input->pts;
+	}
+
+	if (eos) {
+
+		if (port->priv->picture) {
+
+			stub_delay(STUB_PROCESS);
+			port->priv->frames++;
+		}
+
+		stub_emit(component, output, NULL, port->priv->picture ? output->buffer_size : 0,
+		          MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_EOS, port->priv->picture ? port->priv->picture_pts : input->pts);
+		port->priv->picture = 0;
+		port->priv->scan = 0xffffffff;
+	}
+}
+
+static int stub_unframed(MMAL_PORT_T *port) {
+
+	return !(port->format->flags & MMAL_ES_FORMAT_FLAG_FRAMED) &&
+	       (port->format->encoding == MMAL_ENCODING_H264 || port->format->encoding == MMAL_ENCODING_MJPEG);
+}
+
+static void stub_process(MMAL_COMPONENT_T *component, MMAL_BUFFER_HEADER_T *input) {
+
+	uint32_t i;
+	MMAL_PORT_T *port = component->input[0];
+	int frame_end = (input->flags & (MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_EOS)) != 0;
+
+	if (component->priv->kind == STUB_DECODER && stub_unframed(port)) {
+
+		port->priv->bytes += input->length;
+		stub_decode_stream(component, input);
+		stub_port_return(port, input);
+		return;
+	}
+
+	/* Hardware cost is per frame, not per chunk of encoded input */
+	if (frame_end) {
+
+		stub_delay(STUB_PROCESS);
+	}
+
+	port->priv->bytes += input->length;
+	port->priv->frames += frame_end;
+
+	switch (component->priv->kind) {
+
+		case STUB_DECODER:
+		case STUB_ISP:
+			if (frame_end || component->priv->kind == STUB_ISP) {
+
+				stub_emit(component, component->output[0], NULL, component->output[0]->buffer_size, input->flags | MMAL_BUFFER_HEADER_FLAG_FRAME_END,
+				          input->pts);
+			}
+
+			break;
+
+		case STUB_SPLITTER:
+			for (i = 0; i < component->output_num; i++) {
+
+				if (component->output[i]->is_enabled) {
+
+					stub_emit(component, component->output[i], NULL, component->output[i]->buffer_size, input->flags, input->pts);
+				}
+			}
+
+			break;
+
+		case STUB_ENCODER:
+			if (frame_end) {
+
+				stub_encode(component, input);
+			}
+
+			break;
+
+		case STUB_RENDERER:
+			if (input->flags & MMAL_BUFFER_HEADER_FLAG_EOS) {
+
+				stub_post_event(component, MMAL_EVENT_EOS);
+			}
+
+			break;
+
+		default:
+			break;
+	}
+
+	stub_port_return(port, input);
+}
+
+static void *stub_component_thread(void *arg) {
+
+	char *uri;
+	MMAL_BUFFER_HEADER_T *buffer;
+	MMAL_COMPONENT_T *component = arg;
+	struct MMAL_COMPONENT_PRIVATE_T *priv = component->priv;
+
+	pthread_mutex_lock(&priv->lock);
+
+	while (!priv->stop) {
+
+		if (priv->start_reader && component->is_enabled) {
+
+			priv->start_reader = 0;
+			uri = strdup(priv->uri);
+			priv->busy = 1;
+			pthread_mutex_unlock(&priv->lock);
+
+			if (uri) {
+
+				stub_read(component, uri);
+				free(uri);
+			}
+		}
+		else if (component->input_num && component->is_enabled && component->input[0]->is_enabled &&
+		         (buffer = mmal_queue_get(priv->jobs)) != NULL) {
+
+			priv->busy = 1;
+			pthread_mutex_unlock(&priv->lock);
+			stub_process(component, buffer);
+		}
+		else {
+
+			pthread_cond_wait(&priv->wake, &priv->lock);
+			continue;
+		}
+
+		pthread_mutex_lock(&priv->lock);
+		priv->busy = 0;
+		pthread_cond_broadcast(&priv->idle);
+	}
+
+	pthread_mutex_unlock(&priv->lock);
+	return NULL;
+}
+
+static void stub_init_port(MMAL_COMPONENT_T *component, int slot, MMAL_PORT_TYPE_T type, uint16_t index, const char *role) {
+
+	struct MMAL_COMPONENT_PRIVATE_T *priv = component->priv;
+	MMAL_PORT_T *port = &priv->ports[slot];
+
+	port->priv = &priv->port_privs[slot];
+	port->priv->format.es = &port->priv->es;
+	snprintf(port->priv->name, sizeof(port->priv->name), "%s:%s:%u", component->name, role, index);
+
+	port->name = port->priv->name;
+	port->type = type;
+	port->index = index;
+	port->index_all = slot;
+	port->format = &port->priv->format;
+	port->component = component;
+	port->buffer_num_min = 1;
+	port->buffer_num_recommended = 3;
+	port->buffer_num = 3;
+
+	priv->port_list[slot] = port;
+}
+
+static void stub_component_free(MMAL_COMPONENT_T *component) {
+
+	uint32_t i;
+	struct MMAL_COMPONENT_PRIVATE_T *priv = component->priv;
+
+	for (i = 0; i < component->port_num; i++) {
+
+		mmal_queue_destroy(priv->ports[i].priv->supplied);
+	}
+
+	mmal_queue_destroy(priv->jobs);
+	mmal_pool_destroy(priv->events);
+	pthread_mutex_destroy(&priv->lock);
+	pthread_cond_destroy(&priv->wake);
+	pthread_cond_destroy(&priv->idle);
+	free(priv->uri);
+	free(priv);
+	free((char *)component->name);
+	stub_free(STUB_COMPONENTS, component);
+}
+
+MMAL_STATUS_T mmal_component_create(const char *name, MMAL_COMPONENT_T **component) {
+
+	size_t i;
+	uint32_t j;
+	int slot = 0;
+	MMAL_COMPONENT_T *self;
+	struct MMAL_COMPONENT_PRIVATE_T *priv;
+
+	stub_delay(STUB_CREATE);
+
+	for (i = 0; i < vcos_countof(stub_components) && strcmp(stub_components[i].name, name); i++);
+
+	if (i == vcos_countof(stub_components)) {
+
+		return MMAL_ENOENT;
+	}
+
+	if ((self = stub_alloc(STUB_COMPONENTS, sizeof(MMAL_COMPONENT_T))) == NULL) {
+
+		return MMAL_ENOMEM;
+	}
+
+	if ((self->priv = priv = calloc(1, sizeof(struct MMAL_COMPONENT_PRIVATE_T))) == NULL || (self->name = strdup(name)) == NULL) {
+
+		free(priv);
+		stub_free(STUB_COMPONENTS, self);
+		return MMAL_ENOMEM;
+	}
+
+	priv->kind = stub_components[i].kind;
+	priv->refcount = 1;
+	pthread_mutex_init(&priv->lock, NULL);
+	pthread_cond_init(&priv->wake, NULL);
+	pthread_cond_init(&priv->idle, NULL);
+
+	stub_init_port(self, slot++, MMAL_PORT_TYPE_CONTROL, 0, "ctr");
+	self->control = priv->port_list[0];
+	self->input = &priv->port_list[slot];
+	self->input_num = stub_components[i].inputs;
+
+	for (j = 0; j < self->input_num; j++) {
+
+		stub_init_port(self, slot++, MMAL_PORT_TYPE_INPUT, j, "in");
+	}
+
+	self->output = &priv->port_list[slot];
+	self->output_num = stub_components[i].outputs;
+
+	for (j = 0; j < self->output_num; j++) {
+
+		stub_init_port(self, slot++, MMAL_PORT_TYPE_OUTPUT, j, "out");
+	}
+
+	self->port = priv->port_list;
+	self->port_num = slot;
+	self->is_enabled = 1;
+
+	for (j = 0; j < self->output_num; j++) {
+
+		if ((self->output[j]->priv->supplied = mmal_queue_create()) == NULL) {
+
+			goto error;
+		}
+	}
+
+	if ((priv->jobs = mmal_queue_create()) == NULL || (priv->events = mmal_pool_create(STUB_EVENTS, STUB_EVENT_SIZE)) == NULL) {
+
+		goto error;
+	}
+
+	if (pthread_create(&priv->thread, NULL, stub_component_thread, self) != 0) {
+
+		goto error;
+	}
+
+	*component = self;
+	return MMAL_SUCCESS;
+
+error:
+	stub_component_free(self);
+	return MMAL_ENOMEM;
+}
+
+void mmal_component_acquire(MMAL_COMPONENT_T *component) {
+
+	__sync_fetch_and_add(&component->priv->refcount, 1);
+}
+
+MMAL_STATUS_T mmal_component_release(MMAL_COMPONENT_T *component) {
+
+	uint32_t i;
+	struct MMAL_COMPONENT_PRIVATE_T *priv = component->priv;
+
+	if (__sync_sub_and_fetch(&priv->refcount, 1) > 0) {
+
+		return MMAL_SUCCESS;
+	}
+
+	for (i = 0; i < component->port_num; i++) {
+
+		if (component->port[i]->is_enabled) {
+
+			mmal_port_disable(component->port[i]);
+		}
+	}
+
+	pthread_mutex_lock(&priv->lock);
+	priv->stop = 1;
+	pthread_cond_broadcast(&priv->wake);
+	pthread_mutex_unlock(&priv->lock);
+
+	pthread_join(priv->thread, NULL);
+	stub_component_free(component);
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_component_destroy(MMAL_COMPONENT_T *component) {
+
+	return mmal_component_release(component);
+}
+
+MMAL_STATUS_T mmal_component_enable(MMAL_COMPONENT_T *component) {
+
+	pthread_mutex_lock(&component->priv->lock);
+	component->is_enabled = 1;
+	pthread_cond_broadcast(&component->priv->wake);
+	pthread_mutex_unlock(&component->priv->lock);
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_component_disable(MMAL_COMPONENT_T *component) {
+
+	pthread_mutex_lock(&component->priv->lock);
+	component->is_enabled = 0;
+	pthread_mutex_unlock(&component->priv->lock);
+	return MMAL_SUCCESS;
+}
+
+/* Connections. Without a client callback buffers are forwarded directly, which is what tunnelling
+   and the graph worker both amount to. With one they are queued and the client forwards them */
+static void stub_connection_out_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	MMAL_CONNECTION_T *connection = (MMAL_CONNECTION_T *)port->userdata;
+
+	if (!connection->is_enabled) {
+
+		mmal_buffer_header_release(buffer);
+	}
+	else if (connection->callback) {
+
+		mmal_queue_put(connection->queue, buffer);
+		connection->callback(connection);
+	}
+	else if (mmal_port_send_buffer(connection->in, buffer) != MMAL_SUCCESS) {
+
+		mmal_buffer_header_release(buffer);
+	}
+}
+
+static void stub_connection_in_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+
+	mmal_buffer_header_release(buffer);
+}
+
+static MMAL_BOOL_T stub_connection_release_cb(MMAL_POOL_T *pool, MMAL_BUFFER_HEADER_T *buffer, void *userdata) {
+
+	MMAL_CONNECTION_T *connection = userdata;
+
+	if (!connection->is_enabled) {
+
+		return MMAL_TRUE;
+	}
+
+	if (connection->callback) {
+
+		mmal_queue_put(pool->queue, buffer);
+		connection->callback(connection);
+		return MMAL_FALSE;
+	}
+
+	return mmal_port_send_buffer(connection->out, buffer) == MMAL_SUCCESS ? MMAL_FALSE : MMAL_TRUE;
+}
+
+MMAL_STATUS_T mmal_connection_create(MMAL_CONNECTION_T **connection, MMAL_PORT_T *out, MMAL_PORT_T *in, uint32_t flags) {
+
+	MMAL_STATUS_T status;
+	StubConnection *self;
+
+	if (out->type != MMAL_PORT_TYPE_OUTPUT || in->type != MMAL_PORT_TYPE_INPUT) {
+
+		return MMAL_EINVAL;
+	}
+
+	if ((self = stub_alloc(STUB_CONNECTIONS, sizeof(StubConnection))) == NULL) {
+
+		return MMAL_ENOMEM;
+	}
+
+	if ((self->connection.queue = mmal_queue_create()) == NULL || (self->pool = mmal_pool_create(0, 0)) == NULL) {
+
+		mmal_queue_destroy(self->connection.queue);
+		stub_free(STUB_CONNECTIONS, self);
+		return MMAL_ENOMEM;
+	}
+
+	snprintf(self->name, sizeof(self->name), "%s %s", out->name, in->name);
+	self->refcount = 1;
+	self->connection.name = self->name;
+	self->connection.out = out;
+	self->connection.in = in;
+	self->connection.flags = flags;
+	self->connection.pool = flags & MMAL_CONNECTION_FLAG_TUNNELLING ? NULL : self->pool;
+	self->connection.time_setup = vcos_getmicrosecs64();
+	mmal_pool_callback_set(self->pool, stub_connection_release_cb, self);
+
+	out->userdata = (struct MMAL_PORT_USERDATA_T *)self;
+	in->userdata = (struct MMAL_PORT_USERDATA_T *)self;
+
+	if (!(flags & MMAL_CONNECTION_FLAG_KEEP_PORT_FORMATS)) {
+
+		mmal_format_full_copy(in->format, out->format);
+
+		if ((status = mmal_port_format_commit(in)) != MMAL_SUCCESS) {
+
+			mmal_connection_destroy(&self->connection);
+			return status;
+		}
+	}
+
+	*connection = &self->connection;
+	return MMAL_SUCCESS;
+}
+
+void mmal_connection_acquire(MMAL_CONNECTION_T *connection) {
+
+	__sync_fetch_and_add(&((StubConnection *)connection)->refcount, 1);
+}
+
+MMAL_STATUS_T mmal_connection_release(MMAL_CONNECTION_T *connection) {
+
+	StubConnection *self = (StubConnection *)connection;
+
+	if (__sync_sub_and_fetch(&self->refcount, 1) > 0) {
+
+		return MMAL_SUCCESS;
+	}
+
+	if (connection->is_enabled) {
+
+		mmal_connection_disable(connection);
+	}
+
+	mmal_pool_destroy(self->pool);
+	mmal_queue_destroy(connection->queue);
+	stub_free(STUB_CONNECTIONS, self);
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_connection_destroy(MMAL_CONNECTION_T *connection) {
+
+	return mmal_connection_release(connection);
+}
+
+MMAL_STATUS_T mmal_connection_enable(MMAL_CONNECTION_T *connection) {
+
+	MMAL_STATUS_T status;
+	MMAL_BUFFER_HEADER_T *buffer;
+	StubConnection *self = (StubConnection *)connection;
+	MMAL_PORT_T *out = connection->out, *in = connection->in;
+	uint32_t num = out->buffer_num > in->buffer_num ? out->buffer_num : in->buffer_num;
+	uint32_t size = out->buffer_size > in->buffer_size ? out->buffer_size : in->buffer_size;
+
+	if (connection->is_enabled) {
+
+		return MMAL_SUCCESS;
+	}
+
+	out->buffer_num = in->buffer_num = num;
+	out->buffer_size = in->buffer_size = size;
+
+	if ((status = mmal_pool_resize(self->pool, num, size)) != MMAL_SUCCESS ||
+	    (status = mmal_port_enable(in, stub_connection_in_cb)) != MMAL_SUCCESS) {
+
+		return status;
+	}
+
+	if ((status = mmal_port_enable(out, stub_connection_out_cb)) != MMAL_SUCCESS) {
+
+		mmal_port_disable(in);
+		return status;
+	}
+
+	connection->time_enable = vcos_getmicrosecs64();
+	connection->is_enabled = 1;
+
+	/* A client with a callback feeds the output itself */
+	while (!connection->callback && (buffer = mmal_queue_get(self->pool->queue)) != NULL) {
+
+		mmal_port_send_buffer(out, buffer);
+	}
+
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_connection_disable(MMAL_CONNECTION_T *connection) {
+
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	if (!connection->is_enabled) {
+
+		return MMAL_SUCCESS;
+	}
+
+	connection->is_enabled = 0;
+	connection->time_disable = vcos_getmicrosecs64();
+	mmal_port_disable(connection->out);
+	mmal_port_disable(connection->in);
+
+	while ((buffer = mmal_queue_get(connection->queue)) != NULL) {
+
+		mmal_buffer_header_release(buffer);
+	}
+
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_connection_event_format_changed(MMAL_CONNECTION_T *connection, MMAL_BUFFER_HEADER_T *buffer) {
+
+	return MMAL_SUCCESS;
+}
+
+/* Graph */
+MMAL_STATUS_T mmal_graph_create(MMAL_GRAPH_T **graph, unsigned int userdata_size) {
+
+	StubGraph *self = stub_alloc(STUB_GRAPHS, sizeof(StubGraph));
+
+	if (!self) {
+
+		return MMAL_ENOMEM;
+	}
+
+	if (userdata_size && (self->graph.userdata = calloc(1, userdata_size)) == NULL) {
+
+		stub_free(STUB_GRAPHS, self);
+		return MMAL_ENOMEM;
+	}
+
+	pthread_mutex_init(&self->lock, NULL);
+	*graph = &self->graph;
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_graph_add_component(MMAL_GRAPH_T *graph, MMAL_COMPONENT_T *component) {
+
+	StubGraph *self = (StubGraph *)graph;
+
+	if (self->component_num == STUB_GRAPH_MAX) {
+
+		return MMAL_ENOSPC;
+	}
+
+	mmal_component_acquire(component);
+	component->priv->graph = self;
+	self->components[self->component_num++] = component;
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_graph_new_component(MMAL_GRAPH_T *graph, const char *name, MMAL_COMPONENT_T **component) {
+
+	MMAL_STATUS_T status;
+	MMAL_COMPONENT_T *created;
+
+	if ((status = mmal_component_create(name, &created)) != MMAL_SUCCESS) {
+
+		return status;
+	}
+
+	if ((status = mmal_graph_add_component(graph, created)) != MMAL_SUCCESS) {
+
+		mmal_component_release(created);
+		return status;
+	}
+
+	*component = created;
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_graph_add_connection(MMAL_GRAPH_T *graph, MMAL_CONNECTION_T *connection) {
+
+	StubGraph *self = (StubGraph *)graph;
+
+	if (self->connection_num == STUB_GRAPH_MAX) {
+
+		return MMAL_ENOSPC;
+	}
+
+	mmal_connection_acquire(connection);
+	self->connections[self->connection_num++] = connection;
+	return MMAL_SUCCESS;
+}
+
+/* The graph keeps the only reference to connections it creates */
+MMAL_STATUS_T mmal_graph_new_connection(MMAL_GRAPH_T *graph, MMAL_PORT_T *out, MMAL_PORT_T *in, uint32_t flags, MMAL_CONNECTION_T **connection) {
+
+	MMAL_STATUS_T status;
+	MMAL_CONNECTION_T *created;
+
+	if ((status = mmal_connection_create(&created, out, in, flags)) != MMAL_SUCCESS) {
+
+		return status;
+	}
+
+	status = mmal_graph_add_connection(graph, created);
+	mmal_connection_release(created);
+
+	if (status == MMAL_SUCCESS && connection) {
+
+		*connection = created;
+	}
+
+	return status;
+}
+
+MMAL_STATUS_T mmal_graph_enable(MMAL_GRAPH_T *graph, MMAL_GRAPH_EVENT_CB cb, void *cb_data) {
+
+	unsigned int i;
+	MMAL_STATUS_T status;
+	StubGraph *self = (StubGraph *)graph;
+
+	pthread_mutex_lock(&self->lock);
+	self->cb = cb;
+	self->cb_data = cb_data;
+	pthread_mutex_unlock(&self->lock);
+
+	/* Downstream first so nothing is produced before its consumer is ready */
+	for (i = self->connection_num; i > 0; i--) {
+
+		if ((status = mmal_connection_enable(self->connections[i - 1])) != MMAL_SUCCESS) {
+
+			mmal_graph_disable(graph);
+			return status;
+		}
+	}
+
+	for (i = 0; i < self->component_num; i++) {
+
+		mmal_component_enable(self->components[i]);
+	}
+
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_graph_disable(MMAL_GRAPH_T *graph) {
+
+	unsigned int i;
+	StubGraph *self = (StubGraph *)graph;
+
+	for (i = 0; i < self->connection_num; i++) {
+
+		mmal_connection_disable(self->connections[i]);
+	}
+
+	pthread_mutex_lock(&self->lock);
+	self->cb = NULL;
+	self->cb_data = NULL;
+	pthread_mutex_unlock(&self->lock);
+	return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_graph_destroy(MMAL_GRAPH_T *graph) {
+
+	unsigned int i;
+	StubGraph *self = (StubGraph *)graph;
+
+	mmal_graph_disable(graph);
+
+	for (i = 0; i < self->connection_num; i++) {
+
+		mmal_connection_release(self->connections[i]);
+	}
+
+	for (i = 0; i < self->component_num; i++) {
+
+		self->components[i]->priv->graph = NULL;
+		mmal_component_release(self->components[i]);
+	}
+
+	pthread_mutex_destroy(&self->lock);
+	free(self->graph.userdata);
+	stub_free(STUB_GRAPHS, self);
+	return MMAL_SUCCESS;
+}
@@ -0,0 +1,91 @@
+import os
+import time
+import shutil
+import tempfile
+import unittest
+from pylibmmal import MmalBatch, MmalGraph
+
+
+class PyMmalBatchTest(unittest.TestCase):
+    def setUp(self):
+        self.image = os.path.join(os.path.dirname(__file__), "superwoman.jpg")
+        self.tmp = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.tmp)
+
+    def test_init(self):
+        with self.assertRaises(TypeError):
+            MmalBatch([self.image])
+
+        with self.assertRaises(ValueError):
+            MmalBatch([self.image], (0, 120))
+
+        with self.assertRaises(ValueError):
+            MmalBatch([self.image], (160, 120), format="webp")
+
+        with self.assertRaises(ValueError):
+            MmalBatch([self.image], (160, 120), lanes=0)
+
+        with self.assertRaises(ValueError):
+            MmalBatch([self.image], (160, 120), outputs=[])
+
+        with self.assertRaises(TypeError):
+            MmalBatch([None], (160, 120))
+
+        self.assertEqual(list(MmalBatch([], (160, 120))), [])
+
+    def test_bytes(self):
+        batch = MmalBatch([self.image] * 4, (160, 120), quality=80)
+        thumbnails = list(batch)
+        self.assertEqual(len(thumbnails), 4)
+        self.assertEqual(batch.done, 4)
+
+        for data in thumbnails:
+            self.assertEqual(data[:3], b"\xff\xd8\xff")
+
+        self.assertGreater(batch.fps, 0.0)
+
+    def test_outputs(self):
+        outputs = [os.path.join(self.tmp, "{}.png".format(i)) for i in range(3)]
+        results = list(MmalBatch([self.image] * 3, (64, 64), format="png", outputs=outputs))
+        self.assertEqual(results, outputs)
+
+        for path in outputs:
+            with open(path, "rb") as fp:
+                self.assertEqual(fp.read(8), b"\x89PNG\r\n\x1a\n")
+
+    def test_errors(self):
+        missing = os.path.join(self.tmp, "missing.jpg")
+        batch = MmalBatch([self.image, missing, self.image], (160, 120))
+
+        # A bad input fails on its own, the others still come out in order
+        self.assertTrue(next(batch).startswith(b"\xff\xd8"))
+        with self.assertRaises(IOError):
+            next(batch)
+        self.assertTrue(next(batch).startswith(b"\xff\xd8"))
+
+        with self.assertRaises(StopIteration):
+            next(batch)
+
+    def test_throughput(self):
+        paths = [self.image] * 16
+
+        start = time.time()
+        for _ in paths:
+            graph = MmalGraph(resize=(160, 120))
+            graph.open(self.image)
+            graph.close()
+        sequential = time.time() - start
+
+        start = time.time()
+        with MmalBatch(paths, (160, 120), lanes=3) as batch:
+            self.assertEqual(len(list(batch)), len(paths))
+        batched = time.time() - start
+
+        print("sequential {:.1f} img/s, batched {:.1f} img/s".format(len(paths) / sequential, len(paths) / batched))
+        self.assertLess(batched, sequential)
+
+
+if __name__ == '__main__':
+    unittest.main()
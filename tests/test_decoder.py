@@ -0,0 +1,112 @@
+import os
+import time
+import ctypes
+import tempfile
+import unittest
+import pylibmmal
+from pylibmmal import MmalDecoder, MmalFrame
+
+# The stub backend reads anything which is not an image as a video, one frame per reader buffer
+STUB = hasattr(ctypes.CDLL(pylibmmal.__file__), "stub_set_latency")
+
+
+class PyMmalDecoderTest(unittest.TestCase):
+    def setUp(self):
+        self.image = os.path.join(os.path.dirname(__file__), "superwoman.jpg")
+
+        fd, self.video = tempfile.mkstemp(suffix=".h264")
+        with os.fdopen(fd, "wb") as fp:
+            fp.write(os.urandom(12 * 80 * 1024 + 1000))
+
+    def tearDown(self):
+        os.unlink(self.video)
+
+    def test_init(self):
+        with self.assertRaises(TypeError):
+            MmalDecoder()
+
+        with self.assertRaises(ValueError):
+            MmalDecoder(self.image, prefetch=0)
+
+        with self.assertRaises(ValueError):
+            MmalDecoder(self.image, format="YUYV")
+
+        with self.assertRaises(IOError):
+            MmalDecoder("/tmp/no_such_file.h264")
+
+        with MmalDecoder(self.image, prefetch=2) as decoder:
+            self.assertEqual(decoder.prefetch, 2)
+            self.assertEqual(decoder.frames, 0)
+            self.assertEqual(decoder.fps, 0.0)
+
+    def test_image(self):
+        decoder = MmalDecoder(self.image, format="RGB24")
+        frames = list(decoder)
+
+        self.assertEqual(len(frames), 1)
+        self.assertIsInstance(frames[0], MmalFrame)
+        self.assertEqual(frames[0].shape[2], 3)
+        self.assertTrue(decoder.eos)
+        frames[0].release()
+
+        # Exhausted iterator keeps raising StopIteration
+        self.assertEqual(list(decoder), [])
+
+    def test_close(self):
+        decoder = MmalDecoder(self.image)
+        decoder.close()
+
+        with self.assertRaises(RuntimeError):
+            next(decoder)
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_video(self):
+        pts = []
+        with MmalDecoder(self.video, prefetch=3) as decoder:
+            for frame in decoder:
+                with frame:
+                    pts.append(frame.pts)
+
+            self.assertEqual(decoder.frames, len(pts))
+
+        self.assertEqual(len(pts), 13)
+        self.assertEqual(pts, sorted(pts))
+        self.assertEqual(len(set(pts)), len(pts))
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_backpressure(self):
+        with MmalDecoder(self.video, prefetch=4) as decoder:
+            # Decoder runs ahead until the queue is full, then waits instead of dropping frames
+            time.sleep(0.5)
+            self.assertEqual(decoder.queued, 4)
+            self.assertFalse(decoder.eos)
+
+            pts = []
+            for frame in decoder:
+                pts.append(frame.pts)
+                frame.release()
+                time.sleep(0.01)
+
+        self.assertEqual(len(pts), 13)
+        self.assertEqual(pts, [i * 40000 for i in range(13)])
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_held_frames(self):
+        # Frames kept by Python also keep their decoder buffer, the decoder stalls and times out
+        with MmalDecoder(self.video, prefetch=2, timeout=0.3) as decoder:
+            held = []
+            with self.assertRaises(RuntimeError):
+                for frame in decoder:
+                    held.append(frame)
+
+            self.assertGreaterEqual(len(held), 2)
+
+            # Giving buffers back lets it continue
+            for frame in held:
+                frame.release()
+
+            self.assertIsInstance(next(decoder), MmalFrame)
+
+
+if __name__ == '__main__':
+    unittest.main()
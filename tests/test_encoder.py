@@ -0,0 +1,108 @@
+import os
+import time
+import ctypes
+import tempfile
+import threading
+import unittest
+import pylibmmal
+from pylibmmal import MmalEncoder
+
+STUB = hasattr(ctypes.CDLL(pylibmmal.__file__), "stub_set_latency")
+
+
+class PyMmalEncoderTest(unittest.TestCase):
+    def test_init(self):
+        with self.assertRaises(TypeError):
+            MmalEncoder()
+
+        with self.assertRaises(ValueError):
+            MmalEncoder(0, 480)
+
+        with self.assertRaises(ValueError):
+            MmalEncoder(640, 480, encoding="webp")
+
+        with self.assertRaises(ValueError):
+            MmalEncoder(640, 480, format="YUYV")
+
+        encoder = MmalEncoder(640, 480)
+        self.assertEqual(encoder.stride, 640 * 3)
+        self.assertEqual(encoder.frame_size, 640 * 480 * 3)
+        self.assertEqual(encoder.frames, 0)
+        self.assertEqual(encoder.fps, 0.0)
+
+    def test_encode_jpeg(self):
+        encoder = MmalEncoder(640, 480, quality=90)
+
+        with self.assertRaises(ValueError):
+            encoder.encode(bytes(100))
+
+        data = encoder.encode(bytearray(encoder.frame_size))
+        self.assertTrue(data.startswith(b"\xff\xd8"))
+        self.assertEqual(encoder.frames, 1)
+        self.assertEqual(encoder.bytes, len(data))
+
+    def test_encode_unpadded(self):
+        # 100 x 50 needs padding to 128 x 64, the frame is copied once
+        encoder = MmalEncoder(100, 50, format="RGBA")
+        self.assertEqual(encoder.frame_size, 128 * 4 * 64)
+
+        data = encoder.encode(memoryview(bytearray(100 * 50 * 4)))
+        self.assertTrue(data.startswith(b"\xff\xd8"))
+
+    def test_encode_path(self):
+        encoder = MmalEncoder(320, 240, encoding="png")
+        path = os.path.join(tempfile.mkdtemp(), "frame.png")
+
+        size = encoder.encode(bytes(encoder.frame_size), path=path)
+        self.assertEqual(os.path.getsize(path), size)
+
+    def test_encode_h264(self):
+        with MmalEncoder(640, 480, encoding="h264", format="I420", bitrate=1000000) as encoder:
+            frame = bytearray(encoder.frame_size)
+            stream = b"".join(encoder.encode(frame) for _ in range(30))
+            stream += encoder.flush()
+
+            self.assertEqual(encoder.frames, 30)
+            self.assertGreater(len(stream), 0)
+            self.assertGreater(encoder.fps, 0)
+
+        with self.assertRaises(RuntimeError):
+            encoder.encode(frame)
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_close_while_encoding(self):
+        lib = ctypes.CDLL(pylibmmal.__file__)
+        # STUB_PROCESS in tests/stub/stub.h, slow enough for a second encode() to wait for the lock
+        process = lib.stub_latency(8)
+        lib.stub_set_latency(b"process", 100000)
+
+        def encode(encoder, frame, results):
+            try:
+                results.append(len(encoder.encode(frame)))
+            except RuntimeError as error:
+                results.append(str(error))
+
+        try:
+            for _ in range(5):
+                results = []
+                encoder = MmalEncoder(320, 240)
+                frame = bytes(encoder.frame_size)
+                threads = [threading.Thread(target=encode, args=(encoder, frame, results)) for _ in range(2)]
+                threads.insert(1, threading.Thread(target=encoder.close))
+
+                # close() queues for the lock first, the second encode() gets it after the teardown
+                for thread in threads:
+                    thread.start()
+                    time.sleep(0.03)
+
+                for thread in threads:
+                    thread.join()
+
+                self.assertEqual(len(results), 2)
+                self.assertTrue(all(isinstance(result, int) or result == "encoder is closed" for result in results))
+        finally:
+            lib.stub_set_latency(b"process", process)
+
+
+if __name__ == "__main__":
+    unittest.main()
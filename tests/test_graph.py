@@ -1,7 +1,19 @@
+import gc
 import os
+import sys
 import time
+import ctypes
+import shutil
+import select
+import tempfile
+import weakref
+import warnings
 import unittest
-from pylibmmal import MmalGraph, LCD, HDMI
+import threading
+import pylibmmal
+from pylibmmal import MmalGraph, MmalGraphEvent, MmalFrame, LCD, HDMI, EVENT_EOS
+
+STUB = hasattr(ctypes.CDLL(pylibmmal.__file__), "stub_set_latency")
 
 
 class PyMmalGraphTest(unittest.TestCase):
@@ -47,6 +59,8 @@ class PyMmalGraphTest(unittest.TestCase):
         graph.open(self.image)
         self.assertEqual(graph.is_open, True)
         self.assertEqual(graph.uri, self.image)
+        # Only the caller owns the returned str
+        self.assertEqual(sys.getrefcount(graph.uri), sys.getrefcount(str(len(self.image) * 12345)))
         graph.close()
         self.assertEqual(graph.uri, "")
         self.assertEqual(graph.is_open, False)
@@ -67,6 +81,519 @@ class PyMmalGraphTest(unittest.TestCase):
         self.assertEqual(graph.uri,self.image)
         self.assertEqual(graph.display_num, HDMI)
 
+    def test_persistent(self):
+        graph = MmalGraph(persistent=True)
+        self.assertEqual(graph.persistent, True)
+        self.assertEqual(MmalGraph().persistent, False)
+
+        graph.open(self.image)
+        rebuild = graph.open_time
+        graph.open(self.image)
+        switch = graph.open_time
+        self.assertEqual(graph.is_open, True)
+        self.assertEqual(graph.uri, self.image)
+        print("Graph rebuild: {0:.3f}s, uri switch: {1:.3f}s".format(rebuild, switch))
+
+        with self.assertRaises(IOError):
+            graph.open("")
+
+        self.assertEqual(graph.is_open, False)
+        graph.close()
+
+    def test_open_async(self):
+        done = threading.Event()
+        result = []
+
+        def callback(graph, error):
+            result.append((graph, error))
+            done.set()
+
+        with self.assertRaises(TypeError):
+            MmalGraph().open_async(self.image, callback=1)
+
+        graph = MmalGraph()
+        self.assertEqual(graph.open_async(self.image, callback), None)
+        self.assertTrue(done.wait(5))
+        self.assertEqual(result[0], (graph, None))
+        self.assertEqual(graph.is_open, True)
+
+        done.clear()
+        graph.open_async("", callback=callback)
+        self.assertTrue(done.wait(5))
+        self.assertIsInstance(result[1][1], IOError)
+        self.assertEqual(graph.is_open, False)
+
+    def test_events(self):
+        graph = MmalGraph()
+        self.assertEqual(graph.read_events(), [])
+        self.assertGreaterEqual(graph.fileno(), 0)
+
+        graph.open(self.image)
+        readable, _, _ = select.select([graph], [], [], 5)
+        self.assertEqual(readable, [graph])
+
+        events = graph.read_events()
+        self.assertIsInstance(events[0], MmalGraphEvent)
+        self.assertIn(EVENT_EOS, [event.type for event in events])
+        self.assertEqual(graph.read_events(), [])
+
+    def test_wait_eos(self):
+        try:
+            import asyncio
+        except ImportError:
+            return
+
+        graph = MmalGraph()
+
+        # No running loop to bind the future to
+        with self.assertRaises(RuntimeError):
+            graph.wait_eos()
+
+        async def play():
+            graph.open(self.image)
+            return await asyncio.wait_for(graph.wait_eos(), 5)
+
+        loop = asyncio.new_event_loop()
+        event = loop.run_until_complete(play())
+        self.assertEqual(event.type, EVENT_EOS)
+        loop.close()
+
+        # A waiter which never completes ties the loop and the graph in a cycle
+        async def abandon():
+            MmalGraph().wait_eos()
+
+        loop = asyncio.new_event_loop()
+        loop.run_until_complete(abandon())
+        loop_ref = weakref.ref(loop)
+        del loop
+
+        with warnings.catch_warnings():
+            warnings.simplefilter("ignore", ResourceWarning)
+            gc.collect()
+
+        self.assertIsNone(loop_ref())
+
+    def test_prefetch(self):
+        graph = MmalGraph()
+        with self.assertRaises(RuntimeError):
+            graph.show()
+
+        with self.assertRaises(IOError):
+            graph.prefetch("")
+
+        graph.open(self.image)
+        graph.prefetch(self.image)
+        self.assertEqual(graph.prefetched, self.image)
+        self.assertEqual(graph.show(timeout=5), True)
+        self.assertEqual(graph.prefetched, "")
+        self.assertEqual(graph.uri, self.image)
+        self.assertEqual(graph.is_open, True)
+        graph.close()
+
+        # Persistent graph keeps the previous pipeline for the next prefetch
+        graph = MmalGraph(persistent=True)
+        graph.open(self.image)
+        for _ in range(3):
+            graph.prefetch(self.image)
+            self.assertEqual(graph.show(timeout=5), True)
+            self.assertEqual(graph.prefetched, self.image)
+
+        # Cross-fade runs on the animator, the old picture stays below until the next prefetch
+        with self.assertRaises(ValueError):
+            graph.show(fade=-1)
+
+        graph.prefetch(self.image)
+        self.assertEqual(graph.show(timeout=5, fade=0.2), True)
+        self.assertTrue(graph.animating)
+        time.sleep(0.4)
+        self.assertFalse(graph.animating)
+
+    def test_open_bytes(self):
+        with open(self.image, "rb") as fp:
+            data = fp.read()
+
+        graph = MmalGraph(persistent=True)
+        with self.assertRaises(TypeError):
+            graph.open_bytes(1)
+
+        with self.assertRaises(ValueError):
+            graph.open_bytes(b"not an image")
+
+        graph.open_bytes(data)
+        self.assertEqual(graph.is_open, True)
+        self.assertEqual(graph.uri, "")
+
+        graph.open_bytes(memoryview(data))
+        graph.open_bytes(bytearray(data))
+        self.assertEqual(graph.is_open, True)
+
+        graph.open(self.image)
+        self.assertEqual(graph.uri, self.image)
+        graph.close()
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_open_bytes_in_flight(self):
+        lib = ctypes.CDLL(pylibmmal.__file__)
+        # STUB_PROCESS in tests/stub/stub.h, the decoder holds the last input buffer that long
+        process = lib.stub_latency(8)
+        lib.stub_set_latency(b"process", 50000)
+
+        try:
+            with open(self.image, "rb") as fp:
+                data = bytearray(fp.read())
+
+            graph = MmalGraph()
+            graph.open_bytes(data)
+
+            # Aligned data is decoded in place, no input buffer may still point into it
+            link = graph.stats()["links"]["memory->decoder"]
+            self.assertEqual(link["pool_free"], link["pool_size"])
+            data[:] = bytes(len(data))
+            del data
+            graph.close()
+        finally:
+            lib.stub_set_latency(b"process", process)
+
+    def test_tap(self):
+        with self.assertRaises(ValueError):
+            MmalGraph(tap="YUYV")
+
+        with self.assertRaises(RuntimeError):
+            MmalGraph().get_frame()
+
+        graph = MmalGraph(tap="RGBA")
+        self.assertEqual(graph.get_frame(timeout=0.1), None)
+        graph.open(self.image)
+
+        frame = graph.get_frame(timeout=5)
+        self.assertIsInstance(frame, MmalFrame)
+        self.assertEqual(frame.shape[2], 4)
+        self.assertEqual(frame.strides[1:], (4, 1))
+
+        view = memoryview(frame)
+        self.assertEqual(view.shape, frame.shape)
+        self.assertEqual(view.readonly, True)
+
+        # Only the picture is exported, not the rows padding it to the decoder's alignment
+        self.assertEqual(view.nbytes, frame.height * frame.width * 4)
+        self.assertEqual(len(view.tobytes()), view.nbytes)
+        self.assertEqual(len(bytes(frame)), view.nbytes)
+
+        with self.assertRaises(BufferError):
+            frame.release()
+
+        view.release()
+        frame.release()
+        self.assertEqual(frame.released, True)
+
+        with self.assertRaises(BufferError):
+            memoryview(frame)
+
+        try:
+            import numpy
+        except ImportError:
+            return
+
+        graph.open(self.image)
+        with graph.get_frame(timeout=5) as frame:
+            array = numpy.asarray(frame)
+            self.assertEqual(array.shape, (frame.height, frame.width, 4))
+            del array
+
+    def test_collect(self):
+        class Player(object):
+            def __init__(self):
+                self.graph = MmalGraph(timing=self.on_timing)
+
+            def on_timing(self, samples):
+                pass
+
+        # The bound timing callback makes a cycle through the owner, only the cycle collector can free it
+        player = Player()
+        player.graph.open(self.image)
+        player.graph.close()
+        owner = weakref.ref(player)
+        del player
+        gc.collect()
+        self.assertIsNone(owner())
+
+    def test_stats(self):
+        graph = MmalGraph()
+        stats = graph.stats()
+        self.assertEqual(stats["ports"], {})
+        self.assertIsNone(stats["phases"]["first_frame"])
+
+        graph.open(self.image)
+        time.sleep(0.5)
+        stats = graph.stats()
+
+        phases = stats["phases"]
+        for phase in ("create", "open", "connect", "enable"):
+            self.assertGreaterEqual(phases[phase], 0.0)
+
+        self.assertGreater(phases["first_frame"], 0.0)
+        self.assertGreater(stats["ports"]["renderer.input"]["buffers"], 0)
+        self.assertIn("reader->decoder", stats["links"])
+        self.assertIn("decoder->renderer", stats["links"])
+
+        link = stats["links"]["decoder->renderer"]
+        self.assertLessEqual(link["pool_free"], link["pool_size"])
+
+    def test_links(self):
+        with self.assertRaises(KeyError):
+            MmalGraph(links={"encoder": {}})
+
+        with self.assertRaises(KeyError):
+            MmalGraph(links={"decoder": {"buffers": 2}})
+
+        with self.assertRaises(ValueError):
+            MmalGraph(links={"decoder": {"buffer_num": -1}})
+
+        with self.assertRaises(TypeError):
+            MmalGraph(links=[])
+
+        graph = MmalGraph(links={"reader": {"buffer_num": 8, "buffer_size": 256 * 1024, "zero_copy": True},
+                                 "decoder": {"buffer_num": 2, "zero_copy": True}})
+        graph.open(self.image)
+        time.sleep(0.5)
+
+        # Effective values, never below what the ports require
+        links = graph.stats()["links"]
+        self.assertGreaterEqual(links["reader->decoder"]["buffer_num"], 8)
+        self.assertGreaterEqual(links["reader->decoder"]["buffer_size"], 256 * 1024)
+        self.assertEqual(links["reader->decoder"]["zero_copy"], True)
+        self.assertEqual(links["decoder->renderer"]["zero_copy"], True)
+        self.assertEqual(links["decoder->renderer"]["tunnelled"], False)
+        graph.close()
+
+        graph = MmalGraph(links={"decoder": {"tunnelling": True}})
+        graph.open(self.image)
+        time.sleep(0.5)
+        link = graph.stats()["links"]["decoder->renderer"]
+        self.assertEqual(link["tunnelled"], True)
+        self.assertEqual(link["pool_size"], 0)
+        self.assertGreater(link["buffer_num"], 0)
+        graph.close()
+
+        # A tapped link is forwarded by the host and stays non-tunnelled
+        graph = MmalGraph(tap=True, links={"decoder": {"tunnelling": True}})
+        graph.open(self.image)
+        self.assertEqual(graph.stats()["links"]["decoder->renderer"]["tunnelled"], False)
+        graph.close()
+
+    def test_displays(self):
+        with self.assertRaises(ValueError):
+            MmalGraph(display=[])
+
+        with self.assertRaises(ValueError):
+            MmalGraph(display=[HDMI] * 5)
+
+        with self.assertRaises(KeyError):
+            MmalGraph(display={"fullscreen": True})
+
+        with self.assertRaises(TypeError):
+            MmalGraph(display={"display": HDMI, "dest_rect": (0, 0)})
+
+        graph = MmalGraph(display=HDMI)
+        self.assertEqual(graph.displays, (HDMI,))
+
+        # One decoder, a splitter and a renderer per display
+        graph = MmalGraph(display=[LCD, {"display": HDMI, "fullscreen": False, "dest_rect": (0, 0, 640, 480)}])
+        self.assertEqual(graph.displays, (LCD, HDMI))
+        self.assertEqual(graph.display_num, LCD)
+
+        graph.open(self.image)
+        time.sleep(0.5)
+        stats = graph.stats()
+        self.assertEqual(stats["ports"]["decoder.output"]["buffers"] > 0, True)
+        self.assertIn("decoder->splitter", stats["links"])
+        self.assertGreater(stats["ports"]["renderer.input"]["buffers"], 0)
+        self.assertGreater(stats["ports"]["renderer1.input"]["buffers"], 0)
+        graph.close()
+
+    def test_regions(self):
+        graph = MmalGraph(display=[HDMI, LCD])
+
+        with self.assertRaises(IndexError):
+            graph.set_region(2, alpha=128)
+
+        with self.assertRaises(ValueError):
+            graph.set_region(alpha=256)
+
+        with self.assertRaises(TypeError):
+            graph.set_region(display=HDMI)
+
+        with self.assertRaises(TypeError):
+            MmalGraph(display={"display": HDMI, "alpha": 128})
+
+        with self.assertRaises(ValueError):
+            graph.animate(0.5)
+
+        with self.assertRaises(RuntimeError):
+            graph.animate(0.5, alpha=0)
+
+        graph.open(self.image)
+
+        # Live updates keep the decoded picture, only the renderer regions change
+        start = time.time()
+        graph.set_region(0, dest_rect=(0, 0, 640, 480))
+        graph.set_regions([{"output": 1, "transform": 2}, {"alpha": 128, "layer": 3}])
+        self.assertLess(time.time() - start, 0.1)
+        self.assertEqual(graph.uri, self.image)
+
+        # A bad entry rejects the whole batch
+        with self.assertRaises(ValueError):
+            graph.set_regions([{"alpha": 0}, {"transform": 8}])
+
+        # Fade in over ~30 vsyncs on a native thread
+        graph.animate(0.5, alpha=255, dest_rect=(0, 0, 1280, 720))
+        self.assertEqual(graph.animating, True)
+        time.sleep(1.0)
+        self.assertEqual(graph.animating, False)
+
+        graph.animate(0.5, output=1, alpha=0, wait=True)
+        self.assertEqual(graph.animating, False)
+
+        # Waits past 2147 ms, the longest a 32-bit nanosecond timeout can hold
+        start = time.monotonic()
+        graph.animate(1.2, alpha=200, wait=True)
+        self.assertGreaterEqual(time.monotonic() - start, 1.1)
+        self.assertEqual(graph.animating, False)
+
+        # set_region() and close() stop a running animation
+        graph.animate(5.0, alpha=255)
+        graph.set_region(alpha=64)
+        self.assertEqual(graph.animating, False)
+
+        graph.animate(5.0, alpha=255)
+        graph.close()
+        self.assertEqual(graph.animating, False)
+
+    def test_resize(self):
+        with self.assertRaises(TypeError):
+            MmalGraph(resize="1080p")
+
+        with self.assertRaises(ValueError):
+            MmalGraph(resize=(0, 720))
+
+        graph = MmalGraph()
+        graph.open(self.image)
+        time.sleep(0.5)
+        direct = graph.stats()
+        self.assertIsNone(direct["resize"])
+        graph.close()
+
+        # Scaled to fit 320x240 before the renderer, never upscaled
+        graph = MmalGraph(resize=(320, 240))
+        graph.open(self.image)
+        time.sleep(0.5)
+        stats = graph.stats()
+        resize = stats["resize"]
+        self.assertIn("decoder->resizer", stats["links"])
+        self.assertIn("resizer->renderer", stats["links"])
+        self.assertLessEqual(resize["target"][0], 320)
+        self.assertLessEqual(resize["target"][1], 240)
+        self.assertLessEqual(resize["target"][0], resize["source"][0])
+        self.assertGreater(resize["bytes_saved"], 0)
+        self.assertGreater(stats["ports"]["renderer.input"]["buffers"], 0)
+        print("resize saved {} bytes, first frame {:.3f}s -> {:.3f}s".format(
+            resize["bytes_saved"], direct["phases"]["first_frame"], stats["phases"]["first_frame"]))
+        graph.close()
+
+        # Target taken from the current display mode
+        graph = MmalGraph(resize=True)
+        graph.open(self.image)
+        time.sleep(0.5)
+        self.assertIsNotNone(graph.stats()["resize"])
+        graph.close()
+
+    def wait_eos(self, graph, timeout=5):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            select.select([graph], [], [], 0.1)
+            if any(event.type == EVENT_EOS for event in graph.read_events()):
+                return True
+        return False
+
+    def test_cache(self):
+        with self.assertRaises(ValueError):
+            MmalGraph(cache=-1)
+
+        with self.assertRaises(ValueError):
+            MmalGraph(tap=True, cache=1 << 20)
+
+        # A rejected reinit leaves the graph as it was
+        class Broken(object):
+            def __bool__(self):
+                raise ZeroDivisionError
+
+        graph = MmalGraph()
+        with self.assertRaises(ValueError):
+            graph.__init__(tap="RGBA", cache=1 << 20)
+
+        with self.assertRaises(ZeroDivisionError):
+            graph.__init__(tap=Broken())
+
+        with self.assertRaises(RuntimeError):
+            graph.get_frame()
+
+        self.assertIsNone(MmalGraph().stats()["cache"])
+
+        folder = tempfile.mkdtemp()
+        self.addCleanup(shutil.rmtree, folder)
+        paths = [os.path.join(folder, "{}.jpg".format(i)) for i in range(3)]
+        for path in paths:
+            shutil.copy(self.image, path)
+
+        graph = MmalGraph(cache=64 << 20)
+        for path in paths * 3:
+            graph.open(path)
+            self.assertTrue(self.wait_eos(graph))
+            self.assertEqual(graph.uri, path)
+
+        stats = graph.stats()
+        self.assertEqual(stats["cache"]["misses"], 3)
+        self.assertEqual(stats["cache"]["hits"], 6)
+        self.assertEqual(stats["cache"]["entries"], 3)
+        self.assertGreater(stats["cache"]["bytes"], 0)
+
+        # Hits go straight to the renderer
+        self.assertIn("cache->renderer", stats["links"])
+        self.assertNotIn("decoder.input", stats["ports"])
+        self.assertGreater(stats["ports"]["renderer.input"]["buffers"], 0)
+
+        # A changed file is decoded again
+        os.utime(paths[0], (time.time() + 10, time.time() + 10))
+        graph.open(paths[0])
+        self.assertTrue(self.wait_eos(graph))
+        self.assertEqual(graph.stats()["cache"]["misses"], 4)
+
+        # Picture size budget keeps only the most recent picture
+        size = stats["cache"]["bytes"] // 3
+        graph = MmalGraph(cache=size + size // 2)
+        for path in paths * 2:
+            graph.open(path)
+            self.assertTrue(self.wait_eos(graph))
+
+        stats = graph.stats()["cache"]
+        self.assertEqual(stats["hits"], 0)
+        self.assertEqual(stats["entries"], 1)
+        self.assertGreaterEqual(stats["evictions"], 4)
+        graph.close()
+
+    def test_cache_persistent(self):
+        graph = MmalGraph(persistent=True, display=[LCD, HDMI], cache=64 << 20)
+        for _ in range(3):
+            graph.open(self.image)
+            self.assertTrue(self.wait_eos(graph))
+            graph.prefetch(self.image)
+            self.assertEqual(graph.show(timeout=5), True)
+
+        stats = graph.stats()["cache"]
+        self.assertEqual(stats["misses"], 1)
+        self.assertEqual(stats["hits"], 5)
+        graph.close()
+
 
 if __name__ == '__main__':
     unittest.main()
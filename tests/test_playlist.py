@@ -0,0 +1,133 @@
+import os
+import time
+import unittest
+from pylibmmal import MmalGraph, MmalPlaylist
+
+
+class PyMmalPlaylistTest(unittest.TestCase):
+    def setUp(self):
+        self.image = os.path.join(os.path.dirname(__file__), "superwoman.jpg")
+
+    def test_init(self):
+        graph = MmalGraph()
+
+        with self.assertRaises(TypeError):
+            MmalPlaylist(graph)
+
+        with self.assertRaises(TypeError):
+            MmalPlaylist(None, [(self.image, 1.0)])
+
+        with self.assertRaises(ValueError):
+            MmalPlaylist(graph, [])
+
+        with self.assertRaises(TypeError):
+            MmalPlaylist(graph, [self.image])
+
+        with self.assertRaises(ValueError):
+            MmalPlaylist(graph, [(self.image, 0)])
+
+        with self.assertRaises(ValueError):
+            MmalPlaylist(graph, [(self.image, 1.0, 2.0)])
+
+        with MmalPlaylist(graph, [(self.image, 10.0)]) as playlist:
+            self.assertTrue(playlist.running)
+            self.assertFalse(playlist.loop)
+            self.assertFalse(playlist.wait(timeout=0.1))
+
+        self.assertFalse(playlist.running)
+        graph.close()
+
+    def test_schedule(self):
+        graph = MmalGraph()
+        items = [(self.image, 0.2), (self.image, 0.3), (self.image, 0.2)]
+
+        start = time.monotonic()
+        playlist = MmalPlaylist(graph, items)
+        self.assertTrue(playlist.wait(timeout=5))
+        elapsed = time.monotonic() - start
+
+        self.assertFalse(playlist.running)
+        self.assertEqual(playlist.index, 2)
+        self.assertGreaterEqual(elapsed, 0.7)
+
+        timings = playlist.timings
+        self.assertEqual([timing["index"] for timing in timings], [0, 1, 2])
+
+        # Switch times are planned from the first one, not from the previous actual switch
+        for timing, offset in zip(timings, (0.0, 0.2, 0.5)):
+            self.assertEqual(timing["uri"], self.image)
+            self.assertIsNone(timing["error"])
+            self.assertTrue(timing["ready"])
+            self.assertAlmostEqual(timing["planned"] - timings[0]["planned"], offset, places=3)
+            self.assertGreaterEqual(timing["late"], 0.0)
+            self.assertAlmostEqual(timing["actual"] - timing["planned"], timing["late"], places=6)
+
+        for timing, (_, duration) in zip(timings, items):
+            self.assertAlmostEqual(timing["dwell"], duration, delta=0.1)
+
+        self.assertTrue(graph.is_open)
+        graph.close()
+
+    def test_skip(self):
+        graph = MmalGraph(persistent=True)
+        playlist = MmalPlaylist(graph, [(self.image, 0.1), ("/tmp/no_such_file.jpg", 0.1), (self.image, 0.1)])
+        self.assertTrue(playlist.wait(timeout=5))
+
+        timings = playlist.timings
+        self.assertEqual(len(timings), 3)
+        self.assertIsNotNone(timings[1]["error"])
+        self.assertIsNone(timings[1]["actual"])
+        self.assertIsNone(timings[1]["dwell"])
+
+        # The first picture stays on screen through the slot of the skipped item
+        self.assertAlmostEqual(timings[0]["dwell"], 0.2, delta=0.1)
+        graph.close()
+
+    def test_loop(self):
+        graph = MmalGraph(persistent=True)
+
+        with MmalPlaylist(graph, [(self.image, 0.05), (self.image, 0.05, 0.02)], loop=True) as playlist:
+            time.sleep(0.5)
+            self.assertTrue(playlist.loop)
+            self.assertTrue(playlist.running)
+            self.assertFalse(playlist.wait(timeout=0))
+
+        timings = playlist.timings
+        self.assertGreater(len(timings), 4)
+        self.assertEqual([timing["index"] for timing in timings[:4]], [0, 1, 0, 1])
+        graph.close()
+
+    def test_graph_closed(self):
+        graph = MmalGraph(persistent=True)
+        playlist = MmalPlaylist(graph, [(self.image, 0.05)], loop=True)
+        time.sleep(0.3)
+
+        # The schedule stops instead of reopening the graph behind close()
+        graph.close()
+        self.assertTrue(playlist.wait(timeout=2))
+        self.assertEqual(playlist.timings[-1]["error"], "graph is closed")
+        self.assertFalse(graph.is_open)
+
+        # A new schedule opens it again
+        playlist = MmalPlaylist(graph, [(self.image, 0.1)])
+        self.assertTrue(playlist.wait(timeout=5))
+        self.assertIsNone(playlist.timings[-1]["error"])
+        self.assertTrue(graph.is_open)
+        graph.close()
+
+    def test_busy_interpreter(self):
+        graph = MmalGraph()
+        playlist = MmalPlaylist(graph, [(self.image, 0.1)] * 5)
+
+        # Switches don't wait for the GIL
+        deadline = time.monotonic() + 0.6
+        while time.monotonic() < deadline:
+            sum(range(1000))
+
+        self.assertTrue(playlist.wait(timeout=5))
+        self.assertTrue(all(timing["late"] < 0.05 for timing in playlist.timings))
+        graph.close()
+
+
+if __name__ == '__main__':
+    unittest.main()
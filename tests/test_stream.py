@@ -0,0 +1,200 @@
+import os
+import time
+import ctypes
+import select
+import threading
+import unittest
+import pylibmmal
+from pylibmmal import MmalGraph, EVENT_EOS
+
+# The stub decoder emits one picture per H.264 slice or JPEG start of image found in unframed input
+STUB = hasattr(ctypes.CDLL(pylibmmal.__file__), "stub_set_latency")
+
+
+def h264_stream(pictures, size=3000):
+    # SPS and PPS, then one IDR slice followed by non IDR slices
+    stream = b"\x00\x00\x00\x01\x67\x42\x00\x1f" + b"\x00\x00\x00\x01\x68\xce\x3c\x80"
+    for i in range(pictures):
+        stream += (b"\x00\x00\x00\x01\x65" if i == 0 else b"\x00\x00\x00\x01\x41") + b"\x11" * size
+    return stream
+
+
+class PyMmalStreamTest(unittest.TestCase):
+    def wait_eos(self, graph, timeout=5):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            select.select([graph], [], [], 0.1)
+            if any(event.type == EVENT_EOS for event in graph.read_events()):
+                return True
+        return False
+
+    def test_init(self):
+        graph = MmalGraph()
+
+        with self.assertRaises(ValueError):
+            graph.feed(b"\x00\x00\x00\x01")
+
+        with self.assertRaises(ValueError):
+            graph.open_stream("vp8")
+
+        with self.assertRaises(TypeError):
+            graph.open_stream("h264", fd="stream")
+
+        with self.assertRaises(ValueError):
+            graph.open_stream("mjpeg", fd=0, framed=True)
+
+        self.assertIsNone(graph.stats()["stream"])
+
+        graph.open_stream("h264")
+        self.assertEqual(graph.feed(b""), 0)
+        stream = graph.stats()["stream"]
+        self.assertEqual(stream["bytes"], 0)
+        self.assertIsNone(stream["fd"])
+        self.assertFalse(stream["eos"])
+        self.assertIsNone(stream["error"])
+
+        graph.close()
+        with self.assertRaises(ValueError):
+            graph.feed(b"\x00\x00\x00\x01")
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_feed(self):
+        data = h264_stream(10)
+        graph = MmalGraph(timing=True)
+        graph.open_stream("h264")
+
+        # Chunks split start codes, the decoder finds the boundaries itself
+        for offset in range(0, len(data), 1000):
+            self.assertEqual(graph.feed(memoryview(data)[offset:offset + 1000]), len(data[offset:offset + 1000]))
+
+        self.assertEqual(graph.feed(b"", eos=True), 0)
+        self.assertTrue(self.wait_eos(graph))
+
+        with self.assertRaises(ValueError):
+            graph.feed(data)
+
+        stats = graph.stats()
+        self.assertEqual(stats["timing"]["frames"], 10)
+        self.assertEqual(stats["stream"]["bytes"], len(data))
+        self.assertTrue(stats["stream"]["eos"])
+        self.assertIn("stream->decoder", stats["links"])
+        graph.close()
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_framed(self):
+        samples = []
+        graph = MmalGraph(timing=samples.extend, timing_batch=5)
+        graph.open_stream("mjpeg", framed=True)
+
+        for i in range(5):
+            self.assertEqual(graph.feed(b"\xff\xd8" + b"\x11" * 5000 + b"\xff\xd9", pts=i * 40000, eos=i == 4), 5004)
+
+        self.assertTrue(self.wait_eos(graph))
+
+        deadline = time.monotonic() + 3
+        while len(samples) < 5 and time.monotonic() < deadline:
+            time.sleep(0.05)
+
+        self.assertEqual([sample.pts for sample in samples], [i * 40000 for i in range(5)])
+        graph.close()
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_vsync_shared(self):
+        graph = MmalGraph(timing=True)
+        graph.open_stream("mjpeg", framed=True)
+        frame = b"\xff\xd8" + b"\x11" * 5000 + b"\xff\xd9"
+        graph.feed(frame, pts=0)
+
+        # Dispmanx has one vsync callback per process, an animation must not take it from timing
+        graph.animate(0.1, alpha=128, wait=True)
+
+        for i in range(1, 6):
+            time.sleep(0.05)
+            graph.feed(frame, pts=i * 50000, eos=i == 5)
+
+        self.assertTrue(self.wait_eos(graph))
+        timing = graph.stats()["timing"]
+        self.assertEqual(timing["frames"], 6)
+        self.assertEqual(timing["dropped"], 0)
+        self.assertEqual(timing["vsync"]["histogram"][0], 0)
+        graph.close()
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_fd(self):
+        data = h264_stream(8)
+        graph = MmalGraph(timing=True)
+        open_fds = len(os.listdir("/proc/self/fd"))
+        read_fd, write_fd = os.pipe()
+
+        def writer():
+            for offset in range(0, len(data), 777):
+                os.write(write_fd, data[offset:offset + 777])
+            os.close(write_fd)
+
+        try:
+            graph.open_stream("h264", fd=read_fd)
+        finally:
+            # The reader thread works on its own copy
+            os.close(read_fd)
+
+        thread = threading.Thread(target=writer)
+        thread.start()
+
+        with self.assertRaises(ValueError):
+            graph.feed(data)
+
+        self.assertTrue(self.wait_eos(graph))
+        thread.join()
+
+        stats = graph.stats()
+        self.assertEqual(stats["timing"]["frames"], 8)
+        self.assertEqual(stats["stream"]["bytes"], len(data))
+        self.assertEqual(stats["stream"]["fd"], read_fd)
+        self.assertTrue(stats["stream"]["eos"])
+        graph.close()
+        self.assertEqual(len(os.listdir("/proc/self/fd")), open_fds)
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_backpressure(self):
+        lib = ctypes.CDLL(pylibmmal.__file__)
+        # STUB_PROCESS in tests/stub/stub.h, restored for the tests which rely on its default
+        process = lib.stub_latency(8)
+        lib.stub_set_latency(b"process", 50000)
+        graph = MmalGraph(links={"reader": {"buffer_num": 2, "buffer_size": 4096}})
+
+        try:
+            graph.open_stream("h264")
+            self.assertEqual(graph.stats()["links"]["stream->decoder"]["buffer_num"], 2)
+
+            # Only what fits in free input buffers is queued without waiting
+            data = h264_stream(16)
+            fed = graph.feed(data, timeout=0)
+            self.assertGreater(fed, 0)
+            self.assertLess(fed, len(data))
+
+            # A writer stuck on a full decoder does not hold up close()
+            errors = []
+
+            def writer():
+                try:
+                    graph.feed(data[fed:])
+                except RuntimeError as error:
+                    errors.append(error)
+
+            thread = threading.Thread(target=writer)
+            thread.start()
+            time.sleep(0.1)
+            self.assertGreater(graph.stats()["stream"]["stalls"], 0)
+
+            start = time.monotonic()
+            graph.close()
+            thread.join(timeout=2)
+            self.assertFalse(thread.is_alive())
+            self.assertLess(time.monotonic() - start, 1.0)
+            self.assertEqual(len(errors), 1)
+        finally:
+            lib.stub_set_latency(b"process", process)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,123 @@
+import os
+import sys
+import unittest
+import threading
+import pylibmmal
+from pylibmmal import MmalGraph, MmalBatch, TVService
+
+try:
+    import _xxsubinterpreters as interpreters
+except ImportError:
+    interpreters = None
+
+
+def run_threads(target, count=8, *args):
+    errors = []
+
+    def worker(index):
+        try:
+            target(index, *args)
+        except Exception as error:
+            errors.append(error)
+
+    threads = [threading.Thread(target=worker, args=(i,)) for i in range(count)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    return errors
+
+
+class ThreadStressTest(unittest.TestCase):
+    def setUp(self):
+        self.image = os.path.join(os.path.dirname(__file__), "superwoman.jpg")
+
+    def test_shared_tvservice(self):
+        tv = TVService()
+        expected = {group: tv.get_modes(group) for group in (pylibmmal.CEA, pylibmmal.DMT)}
+        preferred = tv.get_preferred_mode()
+
+        def query(index):
+            for _ in range(200):
+                group = (pylibmmal.CEA, pylibmmal.DMT)[index % 2]
+                self.assertEqual(tv.get_modes(group), expected[group])
+                self.assertEqual(tv.get_preferred_mode(), preferred)
+                tv.read_events()
+
+        self.assertEqual(run_threads(query), [])
+
+    def test_tvservice_per_thread(self):
+        def query(index):
+            for _ in range(20):
+                with TVService() as tv:
+                    self.assertGreater(len(tv.get_modes(pylibmmal.CEA)), 0)
+                    tv.get_status()
+
+        self.assertEqual(run_threads(query), [])
+        self.assertEqual(pylibmmal.connection_users(), 0)
+
+    def test_shared_graph(self):
+        graph = MmalGraph(persistent=True)
+
+        def drive(index):
+            for _ in range(20):
+                graph.open(self.image)
+                graph.stats()
+                graph.read_events()
+
+        self.assertEqual(run_threads(drive), [])
+        self.assertTrue(graph.is_open)
+        graph.close()
+
+    def test_graph_per_thread(self):
+        def drive(index):
+            for _ in range(10):
+                with MmalGraph(display=(pylibmmal.HDMI, pylibmmal.LCD)[index % 2]) as graph:
+                    graph.open(self.image)
+
+        self.assertEqual(run_threads(drive), [])
+
+    def test_shared_batch(self):
+        results = []
+        paths = [self.image] * 32
+
+        with MmalBatch(paths, (160, 120), lanes=3) as batch:
+            def consume(index):
+                for jpeg in batch:
+                    results.append(jpeg)
+
+            self.assertEqual(run_threads(consume, 4), [])
+
+        # Every image is handed out exactly once
+        self.assertEqual(len(results), len(paths))
+
+    @unittest.skipIf(interpreters is None, "no subinterpreter support")
+    def test_subinterpreter(self):
+        script = "\n".join((
+            "import sys",
+            "sys.path[:0] = {!r}".format(sys.path),
+            "import pylibmmal",
+            "assert pylibmmal.MmalGraph is not None",
+            "graph = pylibmmal.MmalGraph()",
+            "graph.open({!r})".format(self.image),
+            "import threading",
+            "done = threading.Event()",
+            "graph.open_async({!r}, callback=lambda graph, error: done.set())".format(self.image),
+            "assert done.wait(5)",
+            "graph.close()",
+            "assert len(pylibmmal.TVService().get_modes(pylibmmal.CEA))",
+        ))
+
+        interp = interpreters.create()
+        try:
+            interpreters.run_string(interp, script)
+        finally:
+            interpreters.destroy(interp)
+
+        # Each interpreter has its own types
+        self.assertIsNotNone(MmalGraph())
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,100 @@
+import os
+import time
+import ctypes
+import select
+import tempfile
+import unittest
+import pylibmmal
+from pylibmmal import MmalGraph, MmalGraphTiming, EVENT_EOS
+
+# The stub backend reads anything which is not an image as a video, one frame per reader buffer
+STUB = hasattr(ctypes.CDLL(pylibmmal.__file__), "stub_set_latency")
+
+
+class PyMmalTimingTest(unittest.TestCase):
+    def setUp(self):
+        self.image = os.path.join(os.path.dirname(__file__), "superwoman.jpg")
+
+        fd, self.video = tempfile.mkstemp(suffix=".h264")
+        with os.fdopen(fd, "wb") as fp:
+            fp.write(os.urandom(12 * 80 * 1024 + 1000))
+
+    def tearDown(self):
+        os.unlink(self.video)
+
+    def wait_eos(self, graph, timeout=5):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            select.select([graph], [], [], 0.1)
+            if any(event.type == EVENT_EOS for event in graph.read_events()):
+                return True
+        return False
+
+    def test_init(self):
+        with self.assertRaises(ValueError):
+            MmalGraph(timing_batch=0)
+
+        with self.assertRaises(ValueError):
+            MmalGraph(timing_batch=1 << 20)
+
+        self.assertIsNone(MmalGraph().stats()["timing"])
+
+        graph = MmalGraph(timing=True)
+        graph.open(self.image)
+        self.assertTrue(self.wait_eos(graph))
+
+        timing = graph.stats()["timing"]
+        self.assertEqual(timing["frames"], 1)
+        self.assertEqual(timing["dropped"], 0)
+        self.assertEqual(len(timing["interval"]["histogram"]), 12)
+        self.assertEqual(len(timing["lateness"]["histogram"]), 12)
+        graph.close()
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_stats(self):
+        graph = MmalGraph(timing=True)
+        graph.open(self.video)
+        self.assertTrue(self.wait_eos(graph))
+
+        # The vsync period needs a few refreshes, the stub decodes the whole clip within two
+        time.sleep(0.1)
+        timing = graph.stats()["timing"]
+        self.assertEqual(timing["frames"], 13)
+        self.assertEqual(timing["missing"], 0)
+        # (upper edge in ms, count) buckets, the last one is open ended
+        self.assertEqual(sum(count for _, count in timing["interval"]["histogram"]), 12)
+        self.assertEqual(sum(count for _, count in timing["lateness"]["histogram"]), 13)
+        self.assertIsNone(timing["interval"]["histogram"][-1][0])
+        self.assertGreaterEqual(timing["interval"]["jitter"], 0.0)
+
+        # Frames decoded faster than the refresh rate are replaced before they reach a vsync
+        self.assertIsNotNone(timing["vsync"])
+        self.assertAlmostEqual(timing["vsync"]["period"], 1 / 60.0, delta=0.005)
+        self.assertEqual(len(timing["vsync"]["histogram"]), 5)
+        self.assertGreater(timing["dropped"], 0)
+        graph.close()
+
+    @unittest.skipUnless(STUB, "needs the stub backend")
+    def test_callback(self):
+        samples = []
+        graph = MmalGraph(timing=samples.extend, timing_batch=4)
+        graph.open(self.video)
+        self.assertTrue(self.wait_eos(graph))
+
+        # Full batches are delivered right away, the rest once its oldest sample is a second old
+        deadline = time.monotonic() + 3
+        while len(samples) < 13 and time.monotonic() < deadline:
+            time.sleep(0.05)
+
+        self.assertEqual(len(samples), 13)
+        self.assertTrue(all(isinstance(sample, MmalGraphTiming) for sample in samples))
+        self.assertEqual([sample.pts for sample in samples], [i * 40000 for i in range(13)])
+        self.assertEqual(samples[0].interval, 0.0)
+        self.assertTrue(all(sample.interval > 0 for sample in samples[1:]))
+        self.assertTrue(all(sample.timestamp <= time.monotonic() for sample in samples))
+        self.assertEqual(graph.stats()["timing"]["lost"], 0)
+        graph.close()
+
+
+if __name__ == '__main__':
+    unittest.main()
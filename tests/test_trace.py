@@ -0,0 +1,100 @@
+import os
+import json
+import tempfile
+import unittest
+import threading
+import pylibmmal
+from pylibmmal import MmalGraph, TVService, CEA
+
+
+class PyMmalTraceTest(unittest.TestCase):
+    def setUp(self):
+        self.image = os.path.join(os.path.dirname(__file__), "superwoman.jpg")
+
+        fd, self.path = tempfile.mkstemp(suffix=".json")
+        os.close(fd)
+
+        # Drop whatever earlier tests left in the buffers
+        pylibmmal.trace_enable(False)
+        pylibmmal.trace_dump(self.path)
+
+    def tearDown(self):
+        pylibmmal.trace_enable(False)
+        os.unlink(self.path)
+
+    def dump(self, **kwargs):
+        count = pylibmmal.trace_dump(self.path, **kwargs)
+        with open(self.path) as fp:
+            trace = json.load(fp)
+
+        events = [event for event in trace["traceEvents"] if event["ph"] == "X"]
+        self.assertEqual(len(events), count)
+        self.assertEqual(trace["otherData"]["lost"], 0)
+        return events
+
+    def test_args(self):
+        with self.assertRaises(TypeError):
+            pylibmmal.trace_dump()
+
+        with self.assertRaises(IOError):
+            pylibmmal.trace_dump("/no_such_dir/trace.json")
+
+        self.assertFalse(pylibmmal.trace_enable())
+        self.assertTrue(pylibmmal.trace_enable(False))
+        self.assertFalse(pylibmmal.trace_enable(enabled=False))
+
+    def test_stopped(self):
+        graph = MmalGraph()
+        graph.open(self.image)
+        graph.close()
+        self.assertEqual(self.dump(), [])
+
+    def test_calls(self):
+        pylibmmal.trace_enable()
+        graph = MmalGraph()
+        graph.open(self.image)
+        graph.close()
+        TVService().get_modes(CEA)
+        pylibmmal.trace_enable(False)
+
+        events = self.dump(clear=False)
+        names = [event["name"] for event in events]
+        for name in ("MmalGraph.open", "MmalGraph.close", "TVService.get_modes", "mmal_graph_create",
+                     "mmal_graph_new_component", "vc_tv_hdmi_get_supported_modes_new"):
+            self.assertIn(name, names)
+
+        for event in events:
+            self.assertGreaterEqual(event["dur"], 0)
+            self.assertEqual(event["pid"], os.getpid())
+            self.assertIn(event["cat"], ("api", "mmal", "vchi"))
+
+        # MMAL calls of open() nest inside its span on the same thread
+        span = next(event for event in events if event["name"] == "MmalGraph.open")
+        create = next(event for event in events if event["name"] == "mmal_graph_create")
+        self.assertEqual(create["tid"], span["tid"])
+        self.assertGreaterEqual(create["ts"], span["ts"])
+        self.assertLessEqual(create["ts"] + create["dur"], span["ts"] + span["dur"])
+
+        # clear=False keeps the events for the next dump
+        self.assertEqual(len(self.dump()), len(events))
+        self.assertEqual(self.dump(), [])
+
+    def test_threads(self):
+        def modes():
+            TVService().get_modes(CEA)
+
+        pylibmmal.trace_enable()
+        workers = [threading.Thread(target=modes) for _ in range(4)]
+        for worker in workers:
+            worker.start()
+        for worker in workers:
+            worker.join()
+        pylibmmal.trace_enable(False)
+
+        spans = [event for event in self.dump() if event["name"] == "TVService.get_modes"]
+        self.assertEqual(len(spans), 4)
+        self.assertEqual(len(set(span["tid"] for span in spans)), 4)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -1,4 +1,5 @@
 import time
+import select
 import unittest
 import pylibmmal
 
@@ -26,9 +27,75 @@ class TVServiceTest(unittest.TestCase):
             for mode in self.tv.get_modes(group):
                 print(mode)
 
+    def test_modes_cache(self):
+        preferred = self.tv.get_preferred_mode()
+        modes = self.tv.get_modes(pylibmmal.CEA)
+
+        # Repeat queries are served from the cache until the next hotplug
+        start = time.time()
+        for _ in range(100):
+            self.assertEqual(self.tv.get_preferred_mode(), preferred)
+            self.assertEqual(self.tv.get_modes(pylibmmal.CEA), modes)
+        self.assertLess(time.time() - start, 0.1)
+
+        # Returned list and mode dicts are copies
+        self.tv.get_modes(pylibmmal.CEA).append(None)
+        self.assertEqual(self.tv.get_modes(pylibmmal.CEA), modes)
+
+        expected = [dict(mode) for mode in modes]
+        changed = self.tv.get_modes(pylibmmal.CEA)
+        changed[0]["mode"] = 0
+        del changed[-1]["res"]
+        self.assertEqual(self.tv.get_modes(pylibmmal.CEA), expected)
+
+    def test_events(self):
+        self.assertEqual(self.tv.read_events(), [])
+        self.tv.power_off()
+        self.tv.set_preferred()
+
+        # Power on reports the new mode without polling get_status()
+        readable, _, _ = select.select([self.tv], [], [], 5.0)
+        self.assertEqual(readable, [self.tv])
+
+        events = self.tv.read_events()
+        self.assertTrue(all(isinstance(event, pylibmmal.TVEvent) for event in events))
+        types = set(event.type for event in events)
+        self.assertTrue(types & set((pylibmmal.TV_EVENT_HDMI, pylibmmal.TV_EVENT_DVI)))
+
+        for event in events:
+            self.assertLessEqual(event.timestamp, time.monotonic())
+            if event.type in (pylibmmal.TV_EVENT_HDMI, pylibmmal.TV_EVENT_DVI):
+                self.assertIn(event.group, (pylibmmal.CEA, pylibmmal.DMT))
+
+        self.assertEqual(self.tv.events_dropped, 0)
+
+    def test_shared_connection(self):
+        users = pylibmmal.connection_users()
+        self.assertGreaterEqual(users, 1)
+
+        # Extra instances borrow the open connection instead of connecting again
+        start = time.time()
+        services = [pylibmmal.TVService() for _ in range(50)]
+        elapsed = time.time() - start
+        print("TVService construction: {:.1f}us".format(elapsed / len(services) * 1e6))
+
+        self.assertEqual(pylibmmal.connection_users(), users + 50)
+        self.assertEqual(services[0].get_modes(pylibmmal.CEA), self.tv.get_modes(pylibmmal.CEA))
+
+        # Freeing one instance must not stop the tvservice under the others
+        del services[1:]
+        self.assertEqual(pylibmmal.connection_users(), users + 1)
+        self.assertIsNotNone(self.tv.get_status())
+
+        with services.pop() as tv:
+            pass
+        self.assertEqual(pylibmmal.connection_users(), users)
+
     def test_cea_mode(self):
-        self.tv.set_explicit(group=pylibmmal.CEA, mode=22)
-        time.sleep(3)
+        self.assertEqual(self.tv.set_explicit(group=pylibmmal.CEA, mode=22, timeout=5.0), True)
+
+        with self.assertRaises(ValueError):
+            self.tv.set_explicit(pylibmmal.CEA, 22, timeout=-1)
 
     def test_dmt_mode(self):
         with self.assertRaises(ValueError):
@@ -41,8 +108,18 @@ class TVServiceTest(unittest.TestCase):
         time.sleep(3)
 
     def test_preferred(self):
-        self.tv.set_preferred()
-        time.sleep(3)
+        start = time.time()
+        self.assertEqual(self.tv.set_preferred(timeout=5.0), True)
+        self.assertLess(time.time() - start, 5.0)
+
+    def test_mode_async(self):
+        change = self.tv.set_explicit_async(pylibmmal.DMT, 22)
+        self.assertIsInstance(change, pylibmmal.TVModeChange)
+        self.assertEqual(change.wait(5.0), True)
+        self.assertEqual(change.done, True)
+
+        change = self.tv.set_preferred_async()
+        self.assertEqual(change.wait(timeout=5.0), True)
 
     def test_power_off(self):
         self.tv.power_off()